@@ -48,4 +48,6 @@ static const UA_DataType PointType = {
                                          identifier used on the wire (the
                                          namespaceindex is from .typeId) */
         Point_members
+        UA_BINARYENCODING(NULL)          /* .binaryEncoding, interpreted from
+                                             the members */
 };
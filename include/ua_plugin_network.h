@@ -75,7 +75,8 @@ struct UA_Connection {
     void (*releaseSendBuffer)(UA_Connection *connection, UA_ByteString *buf);
 
     /* Sends a message over the connection. The message buffer is always freed,
-     * even if sending fails.
+     * even if sending fails. The network layer may queue the message (or the
+     * remainder) if it cannot be sent without blocking.
      *
      * @param connection The connection
      * @param buf The message buffer
@@ -106,6 +107,12 @@ struct UA_Connection {
     /* To be called only from within the server (and not the network layer).
      * Frees up the connection's memory. */
     void (*free)(UA_Connection *connection);
+
+    /* Returns the number of bytes that the network layer has queued for
+     * sending because the socket was not writable. The server holds back
+     * publish responses while this exceeds config.maxSendQueueSize. May be
+     * called from worker threads. NULL if the network layer does not queue. */
+    size_t (*getSendQueueSize)(UA_Connection *connection);
 };
 
 /* Cleans up half-received messages, and so on. Called from connection->free. */
@@ -132,8 +139,10 @@ UA_Connection_deleteMembers(UA_Connection *connection);
 
 /* Process a binary message (TCP packet). The message can contain partial
  * chunks. (TCP is a streaming protocol and packets may be split/merge during
- * transport.) After processing, the message is freed with
- * connection->releaseRecvBuffer. */
+ * transport.) The server does not retain the message after the call returns.
+ * So the network layer can release or reuse the buffer right away. With
+ * multithreading, the message is copied and processed in a worker thread. The
+ * messages of a connection are processed in the order they were received. */
 void UA_EXPORT
 UA_Server_processBinaryMessage(UA_Server *server, UA_Connection *connection,
                                UA_ByteString *message);
@@ -114,6 +114,22 @@ UA_Node_deleteReferences(UA_Node *node);
 void UA_EXPORT
 UA_Node_deleteMembers(UA_Node *node);
 
+#ifdef UA_ENABLE_NODESTRING_INTERNING
+/* The strings in the browse name, display name and description of all nodes
+ * (including the locales) are interned in a reference-counted pool. Nodes with
+ * identical strings, e.g. instances of the same ObjectType, share a single
+ * copy. */
+typedef struct {
+    size_t strings;       /* Distinct strings in the pool */
+    size_t references;    /* Node attributes pointing into the pool */
+    size_t bytesUsed;     /* Memory of the pool including its overhead */
+    size_t bytesUnshared; /* Memory for a separate copy per reference */
+} UA_NodeStringPoolStatistics;
+
+void UA_EXPORT
+UA_NodeStringPool_getStatistics(UA_NodeStringPoolStatistics *stats);
+#endif
+
 /**
  * VariableNode
  * ------------
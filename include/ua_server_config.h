@@ -55,6 +55,11 @@ struct UA_ServerConfig {
     /* Networking */
     size_t networkLayersSize;
     UA_ServerNetworkLayer *networkLayers;
+    UA_UInt32 maxReceiveQueueSize; /* Received bytes that wait for a worker per
+                                    * connection. The connection is closed if
+                                    * the client sends more. Only if
+                                    * multithreading is enabled. 0 -> unlimited
+                                    * size */
 
     /* Available endpoints */
     size_t endpointsSize;
@@ -80,6 +85,9 @@ struct UA_ServerConfig {
     UA_UInt32Range keepAliveCountLimits;
     UA_UInt32 maxNotificationsPerPublish;
     UA_UInt32 maxRetransmissionQueueSize; /* 0 -> unlimited size */
+    UA_UInt32 maxSendQueueSize; /* Publish responses are held back while more
+                                 * bytes wait in the send queue of the
+                                 * connection. 0 -> unlimited size */
 
     /* Limits for MonitoredItems */
     UA_DurationRange samplingIntervalLimits;
@@ -733,6 +733,9 @@ typedef struct UA_DiagnosticInfo {
  * - ``void T_delete(T *ptr)``: Delete the content of the data type and the
  *   memory for the data type itself.
  *
+ * In addition, ``UA_order`` and ``UA_equal`` compare two variables of the same
+ * data type by their content.
+ *
  * Specializations, such as ``UA_Int32_new()`` are derived from the generic
  * type operations as static inline functions.
  */
@@ -756,6 +759,19 @@ typedef struct {
     UA_Boolean isArray       : 1; /* The member is an array */
 } UA_DataTypeMember;
 
+#ifdef UA_ENABLE_COMPILED_ENCODING
+/* Type-specific binary encoding functions generated by
+ * tools/generate_datatypes.py (option --compiled-encoding). They replace the
+ * interpretation of the member descriptions and operate on the internal state
+ * of UA_encodeBinary, UA_decodeBinary and UA_calcSizeBinary. So they cannot be
+ * called directly. */
+typedef struct {
+    UA_StatusCode (*encodeBinary)(const void *src, const UA_DataType *type);
+    UA_StatusCode (*decodeBinary)(void *dst, const UA_DataType *type);
+    size_t (*calcSizeBinary)(const void *src, const UA_DataType *type);
+} UA_DataTypeBinaryEncoding;
+#endif
+
 struct UA_DataType {
 #ifdef UA_ENABLE_TYPENAMES
     const char *typeName;
@@ -773,6 +789,10 @@ struct UA_DataType {
     UA_UInt16  binaryEncodingId; /* NodeId of datatype when encoded as binary */
     //UA_UInt16  xmlEncodingId;  /* NodeId of datatype when encoded as XML */
     UA_DataTypeMember *members;
+#ifdef UA_ENABLE_COMPILED_ENCODING
+    const UA_DataTypeBinaryEncoding *binaryEncoding; /* NULL if the members are
+                                                        interpreted */
+#endif
 };
 
 /**
@@ -828,6 +848,36 @@ void UA_EXPORT UA_deleteMembers(void *p, const UA_DataType *type);
  * @param type The datatype description of the variable */
 void UA_EXPORT UA_delete(void *p, const UA_DataType *type);
 
+/* Result of the comparison of two variables */
+typedef enum {
+    UA_ORDER_LESS = -1,
+    UA_ORDER_EQ = 0,
+    UA_ORDER_MORE = 1
+} UA_Order;
+
+/* Compares two variables of the same type and returns their (total) order. The
+ * content is compared member by member. Floating point values are compared
+ * numerically. NaN values are equal among themselves and smaller than all
+ * other values. The order of variants and decoded ExtensionObjects with
+ * different data types is arbitrary but stable.
+ *
+ * @param p1 The memory location of the first variable
+ * @param p2 The memory location of the second variable
+ * @param type The datatype description of the variables
+ * @return Returns the order of p1 relative to p2 */
+UA_Order UA_EXPORT
+UA_order(const void *p1, const void *p2, const UA_DataType *type);
+
+/* Tests two variables of the same type for equality
+ *
+ * @param p1 The memory location of the first variable
+ * @param p2 The memory location of the second variable
+ * @param type The datatype description of the variables */
+static UA_INLINE UA_Boolean
+UA_equal(const void *p1, const void *p2, const UA_DataType *type) {
+    return (UA_order(p1, p2, type) == UA_ORDER_EQ);
+}
+
 /**
  * .. _array-handling:
  *
@@ -6,6 +6,7 @@
 #include "ua_network_tcp.h"
 #include "ua_accesscontrol_default.h"
 #include "ua_nodestore_default.h"
+#include "ua_nodestore_concurrent.h"
 #include "ua_types_generated.h"
 #include "ua_securitypolicy_none.h"
 #include "ua_types.h"
@@ -177,6 +178,7 @@ UA_ServerConfig_new_minimal(UA_UInt16 portNumber,
     conf->keepAliveCountLimits = UA_UINT32RANGE(1, 100);
     conf->maxNotificationsPerPublish = 1000;
     conf->maxRetransmissionQueueSize = 0; /* unlimited */
+    conf->maxSendQueueSize = 1024 * 1024; /* 1MB */
 
     /* Limits for MonitoredItems */
     conf->samplingIntervalLimits = UA_DURATIONRANGE(50.0, 24.0 * 3600.0 * 1000.0);
@@ -188,7 +190,12 @@ UA_ServerConfig_new_minimal(UA_UInt16 portNumber,
 
     /* --> Finish setting the default static config <-- */
 
+#ifdef UA_ENABLE_MULTITHREADING
+    /* Lookups from the worker threads don't serialize on a lock */
+    UA_StatusCode retval = UA_Nodestore_concurrent_new(&conf->nodestore);
+#else
     UA_StatusCode retval = UA_Nodestore_default_new(&conf->nodestore);
+#endif
     if(retval != UA_STATUSCODE_GOOD) {
         UA_ServerConfig_delete(conf);
         return NULL;
@@ -201,9 +208,15 @@ UA_ServerConfig_new_minimal(UA_UInt16 portNumber,
         UA_ServerConfig_delete(conf);
         return NULL;
     }
+#ifdef UA_ENABLE_NETWORK_EPOLL
+    conf->networkLayers[0] =
+        UA_ServerNetworkLayerEpoll(UA_ConnectionConfig_default, portNumber);
+#else
     conf->networkLayers[0] =
         UA_ServerNetworkLayerTCP(UA_ConnectionConfig_default, portNumber);
+#endif
     conf->networkLayersSize = 1;
+    conf->maxReceiveQueueSize = 16 * UA_ConnectionConfig_default.recvBufferSize;
 
     /* Allocate the endpoint */
     conf->endpointsSize = 1;
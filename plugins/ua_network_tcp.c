@@ -19,6 +19,10 @@
 #include <string.h> // memset
 #include <errno.h>
 
+#ifdef UA_ENABLE_MULTITHREADING
+#include <pthread.h>
+#endif
+
 #ifdef _WIN32
 # include <winsock2.h>
 # include <ws2tcpip.h>
@@ -38,6 +42,7 @@
 # include <arpa/inet.h>
 # include <netinet/in.h>
 # include <sys/select.h>
+# include <sys/uio.h>
 # include <sys/ioctl.h>
 # include <fcntl.h>
 # include <unistd.h> // read, write, close
@@ -110,15 +115,16 @@ connection_releaserecvbuffer(UA_Connection *connection,
     UA_ByteString_deleteMembers(buf);
 }
 
+/* Send the full buffer. This may require several calls to send. The buffer is
+ * not freed. */
 static UA_StatusCode
-connection_write(UA_Connection *connection, UA_ByteString *buf) {
+socket_write(UA_Connection *connection, const UA_ByteString *buf) {
     /* Prevent OS signals when sending to a closed socket */
     int flags = 0;
 #ifdef MSG_NOSIGNAL
     flags |= MSG_NOSIGNAL;
 #endif
 
-    /* Send the full buffer. This may require several calls to send */
     size_t nWritten = 0;
     do {
         ssize_t n = 0;
@@ -129,27 +135,56 @@ connection_write(UA_Connection *connection, UA_ByteString *buf) {
                      WIN32_INT bytes_to_send, flags);
             if(n < 0 && errno__ != INTERRUPTED && errno__ != AGAIN) {
                 connection->close(connection);
-                UA_ByteString_deleteMembers(buf);
                 return UA_STATUSCODE_BADCONNECTIONCLOSED;
             }
         } while(n < 0);
         nWritten += (size_t)n;
     } while(nWritten < buf->length);
-
-    /* Free the buffer */
-    UA_ByteString_deleteMembers(buf);
     return UA_STATUSCODE_GOOD;
 }
 
+/* Send as much of the buffer as the socket accepts without blocking. The
+ * number of sent bytes is returned in sent. */
 static UA_StatusCode
-connection_recv(UA_Connection *connection, UA_ByteString *response,
-                UA_UInt32 timeout) {
-    response->data = (UA_Byte*)
-        UA_malloc(connection->localConf.recvBufferSize);
-    if(!response->data) {
-        response->length = 0;
-        return UA_STATUSCODE_BADOUTOFMEMORY; /* not enough memory retry */
+socket_trywrite(UA_Connection *connection, const UA_ByteString *buf,
+                size_t *sent) {
+    int flags = 0;
+#ifdef MSG_NOSIGNAL
+    flags |= MSG_NOSIGNAL;
+#endif
+
+    *sent = 0;
+    while(*sent < buf->length) {
+        size_t bytes_to_send = buf->length - *sent;
+        ssize_t n = send((SOCKET)connection->sockfd,
+                         (const char*)buf->data + *sent,
+                         WIN32_INT bytes_to_send, flags);
+        if(n < 0) {
+            if(errno__ == INTERRUPTED)
+                continue;
+            if(errno__ == AGAIN || errno__ == WOULDBLOCK)
+                break;
+            connection->close(connection);
+            return UA_STATUSCODE_BADCONNECTIONCLOSED;
+        }
+        *sent += (size_t)n;
     }
+    return UA_STATUSCODE_GOOD;
+}
+
+static UA_StatusCode
+connection_write(UA_Connection *connection, UA_ByteString *buf) {
+    UA_StatusCode retval = socket_write(connection, buf);
+    UA_ByteString_deleteMembers(buf);
+    return retval;
+}
+
+/* Receive into the buffer response->data with a capacity of at least
+ * localConf.recvBufferSize. The buffer is not freed. */
+static UA_StatusCode
+socket_recv(UA_Connection *connection, UA_ByteString *response,
+            UA_UInt32 timeout) {
+    response->length = 0;
 
     /* Listen on the socket for the given timeout until a message arrives */
     if(timeout > 0) {
@@ -172,14 +207,11 @@ connection_recv(UA_Connection *connection, UA_ByteString *response,
                        connection->localConf.recvBufferSize, 0);
 
     /* The remote side closed the connection */
-    if(ret == 0) {
-        UA_ByteString_deleteMembers(response);
+    if(ret == 0)
         return UA_STATUSCODE_BADCONNECTIONCLOSED;
-    }
 
     /* Error case */
     if(ret < 0) {
-        UA_ByteString_deleteMembers(response);
         if(errno__ == INTERRUPTED || (timeout > 0) ?
            false : (errno__ == EAGAIN || errno__ == WOULDBLOCK))
             return UA_STATUSCODE_GOOD; /* statuscode_good but no data -> retry */
@@ -192,6 +224,21 @@ connection_recv(UA_Connection *connection, UA_ByteString *response,
     return UA_STATUSCODE_GOOD;
 }
 
+static UA_StatusCode
+connection_recv(UA_Connection *connection, UA_ByteString *response,
+                UA_UInt32 timeout) {
+    response->data = (UA_Byte*)
+        UA_malloc(connection->localConf.recvBufferSize);
+    if(!response->data) {
+        response->length = 0;
+        return UA_STATUSCODE_BADOUTOFMEMORY; /* not enough memory retry */
+    }
+    UA_StatusCode retval = socket_recv(connection, response, timeout);
+    if(retval != UA_STATUSCODE_GOOD || response->length == 0)
+        UA_ByteString_deleteMembers(response);
+    return retval;
+}
+
 static UA_StatusCode
 socket_set_nonblocking(SOCKET sockfd) {
 #ifdef _WIN32
@@ -226,9 +273,42 @@ socket_set_blocking(SOCKET sockfd) {
 
 #define MAXBACKLOG 100
 
+/* Number of unused send buffers that are kept for reuse */
+#define UA_SENDBUFFER_POOLSIZE 16
+
+/* Maximum number of queued buffers that are sent with a single syscall */
+#define UA_SENDQUEUE_IOVMAX 64
+
+/* Coalesced messages are flushed early when this many bytes are queued */
+#define UA_SENDQUEUE_COALESCEMAX 65536
+
+/* A buffer that could not be sent (completely) without blocking */
+typedef struct SendQueueEntry {
+    SIMPLEQ_ENTRY(SendQueueEntry) next;
+    UA_ByteString buf;
+    size_t sent;
+} SendQueueEntry;
+
 typedef struct ConnectionEntry {
-    UA_Connection connection;
+    UA_Connection connection; /* must be the first member */
     LIST_ENTRY(ConnectionEntry) pointers;
+
+    /* Sending never blocks the server. What the socket does not accept is
+     * queued and sent when the socket becomes writable again. Responses can be
+     * sent from worker threads. The members are protected by the mutex. */
+    SIMPLEQ_HEAD(, SendQueueEntry) sendQueue;
+    size_t sendQueueSize; /* Queued bytes that are not yet sent */
+    UA_Boolean flushing;  /* A failed send closes the connection, which
+                           * flushes again. Don't re-enter the flush. */
+#ifdef UA_ENABLE_MULTITHREADING
+    pthread_mutex_t sendQueueMutex;
+#endif
+
+    /* The receive buffer is reused for every recv on the connection. Received
+     * messages are processed (or copied by the server) before the next recv.
+     * Incomplete chunks are buffered in the connection. Capacity of
+     * conf.recvBufferSize. */
+    UA_Byte *recvBuffer;
 } ConnectionEntry;
 
 typedef struct {
@@ -237,23 +317,345 @@ typedef struct {
     UA_Int32 serverSockets[FD_SETSIZE];
     UA_UInt16 serverSocketsSize;
     LIST_HEAD(, ConnectionEntry) connections;
+
+    /* Send buffers are reused instead of allocating a fresh buffer for every
+     * message. All buffers in the pool have at least the capacity of
+     * conf.sendBufferSize. Responses can be sent from worker threads. */
+    UA_Byte *sendBufferPool[UA_SENDBUFFER_POOLSIZE];
+    size_t sendBufferPoolSize;
+#ifdef UA_ENABLE_MULTITHREADING
+    pthread_mutex_t sendBufferPoolMutex;
+#endif
+
+    /* While the listen loop processes received messages, sent messages are
+     * only queued. They are flushed together at the end of the iteration.
+     * This merges the chunks of a message and the responses to several
+     * requests into a few syscalls. With multithreading, the messages are
+     * processed and sent asynchronously in the workers and are not
+     * coalesced. */
+    UA_Boolean coalesce;
 } ServerNetworkLayerTCP;
 
+static UA_StatusCode
+ServerNetworkLayerTCP_getSendBuffer(UA_Connection *connection,
+                                    size_t length, UA_ByteString *buf) {
+    if(length > connection->remoteConf.recvBufferSize)
+        return UA_STATUSCODE_BADCOMMUNICATIONERROR;
+
+    /* Large buffers are not pooled */
+    ServerNetworkLayerTCP *layer = (ServerNetworkLayerTCP*)connection->handle;
+    size_t capacity = length;
+    if(length <= layer->conf.sendBufferSize) {
+        buf->data = NULL;
+#ifdef UA_ENABLE_MULTITHREADING
+        pthread_mutex_lock(&layer->sendBufferPoolMutex);
+#endif
+        if(layer->sendBufferPoolSize > 0) {
+            layer->sendBufferPoolSize--;
+            buf->data = layer->sendBufferPool[layer->sendBufferPoolSize];
+        }
+#ifdef UA_ENABLE_MULTITHREADING
+        pthread_mutex_unlock(&layer->sendBufferPoolMutex);
+#endif
+        if(buf->data) {
+            buf->length = length;
+            return UA_STATUSCODE_GOOD;
+        }
+        capacity = layer->conf.sendBufferSize;
+    }
+
+    buf->data = (UA_Byte*)UA_malloc(capacity);
+    if(!buf->data) {
+        buf->length = 0;
+        return UA_STATUSCODE_BADOUTOFMEMORY;
+    }
+    buf->length = length;
+    return UA_STATUSCODE_GOOD;
+}
+
+/* Every buffer from getSendBuffer has at least the capacity of
+ * conf.sendBufferSize. So every buffer can be returned to the pool. */
+static void
+ServerNetworkLayerTCP_releaseSendBuffer(UA_Connection *connection,
+                                        UA_ByteString *buf) {
+    ServerNetworkLayerTCP *layer = (ServerNetworkLayerTCP*)connection->handle;
+    if(buf->data) {
+#ifdef UA_ENABLE_MULTITHREADING
+        pthread_mutex_lock(&layer->sendBufferPoolMutex);
+#endif
+        if(layer->sendBufferPoolSize < UA_SENDBUFFER_POOLSIZE) {
+            layer->sendBufferPool[layer->sendBufferPoolSize] = buf->data;
+            layer->sendBufferPoolSize++;
+            buf->data = NULL;
+        }
+#ifdef UA_ENABLE_MULTITHREADING
+        pthread_mutex_unlock(&layer->sendBufferPoolMutex);
+#endif
+        UA_free(buf->data);
+    }
+    buf->data = NULL;
+    buf->length = 0;
+}
+
+static void
+ServerNetworkLayerTCP_flush(ConnectionEntry *e);
+
+static UA_StatusCode
+ServerNetworkLayerTCP_write(UA_Connection *connection, UA_ByteString *buf) {
+    ServerNetworkLayerTCP *layer = (ServerNetworkLayerTCP*)connection->handle;
+    ConnectionEntry *e = (ConnectionEntry*)connection;
+    SendQueueEntry *entry;
+    UA_StatusCode retval = UA_STATUSCODE_GOOD;
+    UA_Boolean flush = false;
+    size_t sent = 0;
+#ifdef UA_ENABLE_MULTITHREADING
+    pthread_mutex_lock(&e->sendQueueMutex);
+#endif
+
+    /* Send right away if nothing is queued before and the message is not
+     * coalesced with the following messages */
+    if(!layer->coalesce && SIMPLEQ_EMPTY(&e->sendQueue)) {
+        retval = socket_trywrite(connection, buf, &sent);
+        if(retval != UA_STATUSCODE_GOOD || sent == buf->length)
+            goto release;
+    }
+
+    /* Queue the remainder. Block if the entry cannot be allocated. */
+    entry = (SendQueueEntry*)UA_malloc(sizeof(SendQueueEntry));
+    if(!entry) {
+        UA_ByteString rest = {buf->length - sent, &buf->data[sent]};
+        retval = socket_write(connection, &rest);
+        goto release;
+    }
+    entry->buf = *buf;
+    entry->sent = sent;
+    SIMPLEQ_INSERT_TAIL(&e->sendQueue, entry, next);
+    e->sendQueueSize += buf->length - sent;
+    buf->data = NULL;
+    buf->length = 0;
+
+    /* Don't let coalesced messages pile up */
+    flush = (layer->coalesce && e->sendQueueSize >= UA_SENDQUEUE_COALESCEMAX);
+
+ release:
+#ifdef UA_ENABLE_MULTITHREADING
+    pthread_mutex_unlock(&e->sendQueueMutex);
+#endif
+    if(buf->data)
+        ServerNetworkLayerTCP_releaseSendBuffer(connection, buf);
+    if(flush)
+        ServerNetworkLayerTCP_flush(e);
+    return retval;
+}
+
+#ifndef _WIN32
+
+/* Send queued buffers until the socket would block. Several buffers are sent
+ * with a single vectored syscall. */
+static void
+ServerNetworkLayerTCP_flush(ConnectionEntry *e) {
+    UA_Connection *connection = &e->connection;
+    int flags = 0;
+#ifdef MSG_NOSIGNAL
+    flags |= MSG_NOSIGNAL;
+#endif
+#ifdef UA_ENABLE_MULTITHREADING
+    pthread_mutex_lock(&e->sendQueueMutex);
+#endif
+    if(e->flushing) {
+#ifdef UA_ENABLE_MULTITHREADING
+        pthread_mutex_unlock(&e->sendQueueMutex);
+#endif
+        return;
+    }
+    e->flushing = true;
+    while(!SIMPLEQ_EMPTY(&e->sendQueue)) {
+        /* Gather the queued buffers */
+        struct iovec iov[UA_SENDQUEUE_IOVMAX];
+        size_t iovcnt = 0;
+        size_t total = 0;
+        SendQueueEntry *entry;
+        SIMPLEQ_FOREACH(entry, &e->sendQueue, next) {
+            if(iovcnt == UA_SENDQUEUE_IOVMAX)
+                break;
+            iov[iovcnt].iov_base = &entry->buf.data[entry->sent];
+            iov[iovcnt].iov_len = entry->buf.length - entry->sent;
+            total += iov[iovcnt].iov_len;
+            iovcnt++;
+        }
+
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(struct msghdr));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iovcnt;
+        ssize_t n = sendmsg((SOCKET)connection->sockfd, &msg, flags);
+        if(n < 0) {
+            if(errno__ == INTERRUPTED)
+                continue;
+            if(errno__ != AGAIN && errno__ != WOULDBLOCK)
+                connection->close(connection);
+            break;
+        }
+
+        /* Release the buffers that were sent completely */
+        size_t sent = (size_t)n;
+        e->sendQueueSize -= sent;
+        while(sent > 0) {
+            entry = SIMPLEQ_FIRST(&e->sendQueue);
+            size_t rest = entry->buf.length - entry->sent;
+            if(sent < rest) {
+                entry->sent += sent;
+                break;
+            }
+            sent -= rest;
+            SIMPLEQ_REMOVE_HEAD(&e->sendQueue, next);
+            ServerNetworkLayerTCP_releaseSendBuffer(connection, &entry->buf);
+            UA_free(entry);
+        }
+
+        /* The socket does not accept more right now */
+        if((size_t)n < total)
+            break;
+    }
+    e->flushing = false;
+#ifdef UA_ENABLE_MULTITHREADING
+    pthread_mutex_unlock(&e->sendQueueMutex);
+#endif
+}
+
+#else
+
+/* Send queued buffers until the socket would block */
+static void
+ServerNetworkLayerTCP_flush(ConnectionEntry *e) {
+    UA_Connection *connection = &e->connection;
+#ifdef UA_ENABLE_MULTITHREADING
+    pthread_mutex_lock(&e->sendQueueMutex);
+#endif
+    SendQueueEntry *entry;
+    if(e->flushing) {
+#ifdef UA_ENABLE_MULTITHREADING
+        pthread_mutex_unlock(&e->sendQueueMutex);
+#endif
+        return;
+    }
+    e->flushing = true;
+    while((entry = SIMPLEQ_FIRST(&e->sendQueue))) {
+        UA_ByteString rest = {entry->buf.length - entry->sent,
+                              &entry->buf.data[entry->sent]};
+        size_t sent = 0;
+        UA_StatusCode retval = socket_trywrite(connection, &rest, &sent);
+        entry->sent += sent;
+        e->sendQueueSize -= sent;
+        if(retval != UA_STATUSCODE_GOOD || entry->sent < entry->buf.length)
+            break;
+        SIMPLEQ_REMOVE_HEAD(&e->sendQueue, next);
+        ServerNetworkLayerTCP_releaseSendBuffer(connection, &entry->buf);
+        UA_free(entry);
+    }
+    e->flushing = false;
+#ifdef UA_ENABLE_MULTITHREADING
+    pthread_mutex_unlock(&e->sendQueueMutex);
+#endif
+}
+
+#endif /* _WIN32 */
+
+static size_t
+ServerNetworkLayerTCP_getSendQueueSize(UA_Connection *connection) {
+    ConnectionEntry *e = (ConnectionEntry*)connection;
+#ifdef UA_ENABLE_MULTITHREADING
+    pthread_mutex_lock(&e->sendQueueMutex);
+#endif
+    size_t size = e->sendQueueSize;
+#ifdef UA_ENABLE_MULTITHREADING
+    pthread_mutex_unlock(&e->sendQueueMutex);
+#endif
+    return size;
+}
+
+static UA_Boolean
+ServerNetworkLayerTCP_hasQueued(ConnectionEntry *e) {
+#ifdef UA_ENABLE_MULTITHREADING
+    pthread_mutex_lock(&e->sendQueueMutex);
+#endif
+    UA_Boolean queued = !SIMPLEQ_EMPTY(&e->sendQueue);
+#ifdef UA_ENABLE_MULTITHREADING
+    pthread_mutex_unlock(&e->sendQueueMutex);
+#endif
+    return queued;
+}
+
+/* Drops the unsent buffers */
+static void
+ServerNetworkLayerTCP_deleteSendQueue(ConnectionEntry *e) {
+    SendQueueEntry *entry;
+    while((entry = SIMPLEQ_FIRST(&e->sendQueue))) {
+        SIMPLEQ_REMOVE_HEAD(&e->sendQueue, next);
+        ServerNetworkLayerTCP_releaseSendBuffer(&e->connection, &entry->buf);
+        UA_free(entry);
+    }
+    e->sendQueueSize = 0;
+#ifdef UA_ENABLE_MULTITHREADING
+    pthread_mutex_destroy(&e->sendQueueMutex);
+#endif
+}
+
+/* The socket is closed only when the connection is freed. With multithreading,
+ * this is a delayed callback after the workers have let go of the connection.
+ * Otherwise a worker could send on the socket id after it was reused for a new
+ * connection. */
 static void
 ServerNetworkLayerTCP_freeConnection(UA_Connection *connection) {
+    ConnectionEntry *e = (ConnectionEntry*)connection;
+    CLOSESOCKET(connection->sockfd);
+    ServerNetworkLayerTCP_deleteSendQueue(e);
     UA_Connection_deleteMembers(connection);
+    UA_free(e->recvBuffer);
     UA_free(connection);
 }
 
-/* This performs only 'shutdown'. 'close' is called when the shutdown
- * socket is returned from select. */
+/* Receive into the persistent buffer of the connection. The buffer is
+ * allocated with the first recv and released with the connection. */
+static UA_StatusCode
+ServerNetworkLayerTCP_recv(ServerNetworkLayerTCP *layer, ConnectionEntry *e,
+                           UA_ByteString *buf) {
+    if(!e->recvBuffer) {
+        e->recvBuffer = (UA_Byte*)UA_malloc(layer->conf.recvBufferSize);
+        if(!e->recvBuffer)
+            return UA_STATUSCODE_BADOUTOFMEMORY;
+    }
+    buf->data = e->recvBuffer;
+    return socket_recv(&e->connection, buf, 0);
+}
+
+/* The persistent buffer is not freed */
+static void
+ServerNetworkLayerTCP_releaseRecvBuffer(UA_Connection *connection,
+                                        UA_ByteString *buf) {
+    buf->data = NULL;
+    buf->length = 0;
+}
+
+/* This performs only 'shutdown'. 'close' is called when the connection is
+ * freed after the shutdown socket was returned from select. Coalesced messages (e.g. an error message
+ * before closing) are sent out first. */
 static void
 ServerNetworkLayerTCP_close(UA_Connection *connection) {
-    shutdown((SOCKET)connection->sockfd, 2);
+    UA_Boolean wasClosed = (connection->state == UA_CONNECTION_CLOSED);
     connection->state = UA_CONNECTION_CLOSED;
+#ifndef UA_ENABLE_MULTITHREADING
+    if(!wasClosed)
+        ServerNetworkLayerTCP_flush((ConnectionEntry*)connection);
+#else
+    (void)wasClosed;
+#endif
+    shutdown((SOCKET)connection->sockfd, 2);
 }
 
-static UA_StatusCode
+/* Returns the new connection entry or NULL if the connection could not be
+ * set up. The socket is not closed in that case. */
+static ConnectionEntry *
 ServerNetworkLayerTCP_add(ServerNetworkLayerTCP *layer, UA_Int32 newsockfd,
                           struct sockaddr_storage *remote) {
     /* Set nonblocking */
@@ -266,7 +668,7 @@ ServerNetworkLayerTCP_add(ServerNetworkLayerTCP *layer, UA_Int32 newsockfd,
         UA_LOG_ERROR(UA_Log_Stdout, UA_LOGCATEGORY_NETWORK,
                      "Cannot set socket option TCP_NODELAY. Error: %s",
                      strerror(errno));
-        return UA_STATUSCODE_BADUNEXPECTEDERROR;
+        return NULL;
     }
 
     /* Get the peer name for logging */
@@ -289,7 +691,7 @@ ServerNetworkLayerTCP_add(ServerNetworkLayerTCP *layer, UA_Int32 newsockfd,
     /* Allocate and initialize the connection */
     ConnectionEntry *e = (ConnectionEntry*)UA_malloc(sizeof(ConnectionEntry));
     if(!e)
-        return UA_STATUSCODE_BADOUTOFMEMORY;
+        return NULL;
 
     UA_Connection *c = &e->connection;
     memset(c, 0, sizeof(UA_Connection));
@@ -297,17 +699,25 @@ ServerNetworkLayerTCP_add(ServerNetworkLayerTCP *layer, UA_Int32 newsockfd,
     c->handle = layer;
     c->localConf = layer->conf;
     c->remoteConf = layer->conf;
-    c->send = connection_write;
+    c->send = ServerNetworkLayerTCP_write;
     c->close = ServerNetworkLayerTCP_close;
     c->free = ServerNetworkLayerTCP_freeConnection;
-    c->getSendBuffer = connection_getsendbuffer;
-    c->releaseSendBuffer = connection_releasesendbuffer;
-    c->releaseRecvBuffer = connection_releaserecvbuffer;
+    c->getSendBuffer = ServerNetworkLayerTCP_getSendBuffer;
+    c->releaseSendBuffer = ServerNetworkLayerTCP_releaseSendBuffer;
+    c->releaseRecvBuffer = ServerNetworkLayerTCP_releaseRecvBuffer;
+    c->getSendQueueSize = ServerNetworkLayerTCP_getSendQueueSize;
     c->state = UA_CONNECTION_OPENING;
+    SIMPLEQ_INIT(&e->sendQueue);
+    e->sendQueueSize = 0;
+    e->flushing = false;
+#ifdef UA_ENABLE_MULTITHREADING
+    pthread_mutex_init(&e->sendQueueMutex, NULL);
+#endif
+    e->recvBuffer = NULL;
 
     /* Add to the linked list */
     LIST_INSERT_HEAD(&layer->connections, e, pointers);
-    return UA_STATUSCODE_GOOD;
+    return e;
 }
 
 static void
@@ -386,8 +796,8 @@ ServerNetworkLayerTCP_start(UA_ServerNetworkLayer *nl) {
     /* Get the discovery url from the hostname */
     UA_String du = UA_STRING_NULL;
     char hostname[256];
+    char discoveryUrl[256];
     if(gethostname(hostname, 255) == 0) {
-        char discoveryUrl[256];
 #ifndef _MSC_VER
         du.length = (size_t)snprintf(discoveryUrl, 255, "opc.tcp://%s:%d",
                                      hostname, layer->port);
@@ -430,6 +840,42 @@ ServerNetworkLayerTCP_start(UA_ServerNetworkLayer *nl) {
     return UA_STATUSCODE_GOOD;
 }
 
+static void
+ServerNetworkLayerTCP_beginCoalesce(ServerNetworkLayerTCP *layer) {
+#ifndef UA_ENABLE_MULTITHREADING
+    layer->coalesce = true;
+#endif
+}
+
+/* Flush the messages that were sent since beginCoalesce */
+static void
+ServerNetworkLayerTCP_endCoalesce(ServerNetworkLayerTCP *layer) {
+    if(!layer->coalesce)
+        return;
+    layer->coalesce = false;
+    ConnectionEntry *e;
+    LIST_FOREACH(e, &layer->connections, pointers) {
+        if(ServerNetworkLayerTCP_hasQueued(e))
+            ServerNetworkLayerTCP_flush(e);
+    }
+}
+
+/* Connections with queued buffers wait until they are writable */
+static UA_Int32
+setWriteFDSet(ServerNetworkLayerTCP *layer, fd_set *fdset) {
+    FD_ZERO(fdset);
+    UA_Int32 highestfd = 0;
+    ConnectionEntry *e;
+    LIST_FOREACH(e, &layer->connections, pointers) {
+        if(!ServerNetworkLayerTCP_hasQueued(e))
+            continue;
+        UA_fd_set(e->connection.sockfd, fdset);
+        if(e->connection.sockfd > highestfd)
+            highestfd = e->connection.sockfd;
+    }
+    return highestfd;
+}
+
 /* After every select, reset the sockets to listen on */
 static UA_Int32
 setFDSet(ServerNetworkLayerTCP *layer, fd_set *fdset) {
@@ -458,11 +904,14 @@ ServerNetworkLayerTCP_listen(UA_ServerNetworkLayer *nl, UA_Server *server,
     ServerNetworkLayerTCP *layer = (ServerNetworkLayerTCP *)nl->handle;
 
     /* Listen on open sockets (including the server) */
-    fd_set fdset, errset;
+    fd_set fdset, errset, writeset;
     UA_Int32 highestfd = setFDSet(layer, &fdset);
     setFDSet(layer, &errset);
+    UA_Int32 highestwritefd = setWriteFDSet(layer, &writeset);
+    if(highestwritefd > highestfd)
+        highestfd = highestwritefd;
     struct timeval tmptv = {0, timeout * 1000};
-    if (select(highestfd+1, &fdset, NULL, &errset, &tmptv) < 0) {
+    if (select(highestfd+1, &fdset, &writeset, &errset, &tmptv) < 0) {
         UA_LOG_WARNING(UA_Log_Stdout, UA_LOGCATEGORY_NETWORK,
                        "Socket select failed with %s", strerror(errno));
     }
@@ -487,12 +936,18 @@ ServerNetworkLayerTCP_listen(UA_ServerNetworkLayer *nl, UA_Server *server,
                     "Connection %i | New TCP connection on server socket %i",
                     (int)newsockfd, layer->serverSockets[i]);
 
-        ServerNetworkLayerTCP_add(layer, (UA_Int32)newsockfd, &remote);
+        if(!ServerNetworkLayerTCP_add(layer, (UA_Int32)newsockfd, &remote))
+            CLOSESOCKET(newsockfd);
     }
 
     /* Read from established sockets */
+    ServerNetworkLayerTCP_beginCoalesce(layer);
     ConnectionEntry *e, *e_tmp;
     LIST_FOREACH_SAFE(e, &layer->connections, pointers, e_tmp) {
+        /* Continue sending the queued buffers */
+        if(UA_fd_isset(e->connection.sockfd, &writeset))
+            ServerNetworkLayerTCP_flush(e);
+
         if(!UA_fd_isset(e->connection.sockfd, &errset) &&
            !UA_fd_isset(e->connection.sockfd, &fdset))
           continue;
@@ -502,12 +957,13 @@ ServerNetworkLayerTCP_listen(UA_ServerNetworkLayer *nl, UA_Server *server,
                     e->connection.sockfd);
 
         UA_ByteString buf = UA_BYTESTRING_NULL;
-        UA_StatusCode retval = connection_recv(&e->connection, &buf, 0);
+        UA_StatusCode retval = ServerNetworkLayerTCP_recv(layer, e, &buf);
 
         if(retval == UA_STATUSCODE_GOOD) {
             /* Process packets */
-            UA_Server_processBinaryMessage(server, &e->connection, &buf);
-            connection_releaserecvbuffer(&e->connection, &buf);
+            if(buf.length > 0)
+                UA_Server_processBinaryMessage(server, &e->connection, &buf);
+            ServerNetworkLayerTCP_releaseRecvBuffer(&e->connection, &buf);
         } else if(retval == UA_STATUSCODE_BADCONNECTIONCLOSED) {
             /* The socket is shutdown but not closed */
             if(e->connection.state != UA_CONNECTION_CLOSED) {
@@ -520,10 +976,10 @@ ServerNetworkLayerTCP_listen(UA_ServerNetworkLayer *nl, UA_Server *server,
                             e->connection.sockfd);
             }
             LIST_REMOVE(e, pointers);
-            CLOSESOCKET(e->connection.sockfd);
             UA_Server_removeConnection(server, &e->connection);
         }
     }
+    ServerNetworkLayerTCP_endCoalesce(layer);
     return UA_STATUSCODE_GOOD;
 }
 
@@ -567,9 +1023,19 @@ ServerNetworkLayerTCP_deleteMembers(UA_ServerNetworkLayer *nl) {
         LIST_REMOVE(e, pointers);
         ServerNetworkLayerTCP_close(&e->connection);
         CLOSESOCKET(e->connection.sockfd);
+        ServerNetworkLayerTCP_deleteSendQueue(e);
+        UA_Connection_deleteMembers(&e->connection);
+        UA_free(e->recvBuffer);
         UA_free(e);
     }
 
+    /* Free the pooled send buffers */
+    for(size_t i = 0; i < layer->sendBufferPoolSize; i++)
+        UA_free(layer->sendBufferPool[i]);
+#ifdef UA_ENABLE_MULTITHREADING
+    pthread_mutex_destroy(&layer->sendBufferPoolMutex);
+#endif
+
     /* Free the layer */
     UA_free(layer);
 }
@@ -585,6 +1051,9 @@ UA_ServerNetworkLayerTCP(UA_ConnectionConfig conf, UA_UInt16 port) {
 
     layer->conf = conf;
     layer->port = port;
+#ifdef UA_ENABLE_MULTITHREADING
+    pthread_mutex_init(&layer->sendBufferPoolMutex, NULL);
+#endif
 
     nl.handle = layer;
     nl.start = ServerNetworkLayerTCP_start;
@@ -594,6 +1063,240 @@ UA_ServerNetworkLayerTCP(UA_ConnectionConfig conf, UA_UInt16 port) {
     return nl;
 }
 
+#ifdef UA_ENABLE_NETWORK_EPOLL
+
+/*****************************/
+/* Server NetworkLayer Epoll */
+/*****************************/
+
+/* The epoll layer reuses the socket handling of the TCP layer. But sockets are
+ * registered only once with epoll when they are opened. Connections are
+ * edge-triggered. So a socket has to be read until it is drained whenever it
+ * is reported. */
+
+#include <sys/epoll.h>
+
+#define UA_EPOLL_MAXEVENTS 64
+
+typedef struct {
+    ServerNetworkLayerTCP tcp; /* must be the first member */
+    int epollfd;
+} ServerNetworkLayerEpoll;
+
+static UA_StatusCode
+ServerNetworkLayerEpoll_start(UA_ServerNetworkLayer *nl) {
+    ServerNetworkLayerEpoll *layer = (ServerNetworkLayerEpoll *)nl->handle;
+    if(layer->epollfd >= 0)
+        close(layer->epollfd);
+    layer->epollfd = epoll_create1(EPOLL_CLOEXEC);
+    if(layer->epollfd < 0) {
+        UA_LOG_ERROR(UA_Log_Stdout, UA_LOGCATEGORY_NETWORK,
+                     "Could not create the epoll instance. Error: %s",
+                     strerror(errno));
+        return UA_STATUSCODE_BADINTERNALERROR;
+    }
+
+    UA_StatusCode retval = ServerNetworkLayerTCP_start(nl);
+    if(retval != UA_STATUSCODE_GOOD)
+        return retval;
+
+    /* Server sockets are level-triggered and registered without a pointer */
+    for(UA_UInt16 i = 0; i < layer->tcp.serverSocketsSize; i++) {
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(struct epoll_event));
+        ev.events = EPOLLIN;
+        ev.data.ptr = NULL;
+        if(epoll_ctl(layer->epollfd, EPOLL_CTL_ADD,
+                     layer->tcp.serverSockets[i], &ev) < 0)
+            UA_LOG_WARNING(UA_Log_Stdout, UA_LOGCATEGORY_NETWORK,
+                           "Could not add server socket %i to epoll",
+                           layer->tcp.serverSockets[i]);
+    }
+    return UA_STATUSCODE_GOOD;
+}
+
+static void
+ServerNetworkLayerEpoll_accept(ServerNetworkLayerEpoll *layer) {
+    for(UA_UInt16 i = 0; i < layer->tcp.serverSocketsSize; i++) {
+        /* Accept until the backlog of the server socket is empty */
+        while(true) {
+            struct sockaddr_storage remote;
+            socklen_t remote_size = sizeof(remote);
+            SOCKET newsockfd = accept((SOCKET)layer->tcp.serverSockets[i],
+                                      (struct sockaddr*)&remote, &remote_size);
+            if(newsockfd < 0)
+                break;
+
+            UA_LOG_TRACE(UA_Log_Stdout, UA_LOGCATEGORY_NETWORK,
+                         "Connection %i | New TCP connection on server socket %i",
+                         (int)newsockfd, layer->tcp.serverSockets[i]);
+
+            ConnectionEntry *e =
+                ServerNetworkLayerTCP_add(&layer->tcp, (UA_Int32)newsockfd, &remote);
+            if(!e) {
+                CLOSESOCKET(newsockfd);
+                continue;
+            }
+
+            /* Register the connection once. Data that arrived before the
+             * registration is reported right away. */
+            struct epoll_event ev;
+            memset(&ev, 0, sizeof(struct epoll_event));
+            ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+            ev.data.ptr = e;
+            if(epoll_ctl(layer->epollfd, EPOLL_CTL_ADD, newsockfd, &ev) < 0) {
+                UA_LOG_WARNING(UA_Log_Stdout, UA_LOGCATEGORY_NETWORK,
+                               "Connection %i | Could not add the socket to epoll",
+                               (int)newsockfd);
+                LIST_REMOVE(e, pointers);
+                CLOSESOCKET(newsockfd);
+                ServerNetworkLayerTCP_deleteSendQueue(e);
+                UA_free(e);
+            }
+        }
+    }
+}
+
+static void
+ServerNetworkLayerEpoll_remove(ServerNetworkLayerEpoll *layer, UA_Server *server,
+                               ConnectionEntry *e) {
+    /* The socket is shutdown but not closed */
+    if(e->connection.state != UA_CONNECTION_CLOSED) {
+        UA_LOG_INFO(UA_Log_Stdout, UA_LOGCATEGORY_NETWORK,
+                    "Connection %i | Closed by the client",
+                    e->connection.sockfd);
+    } else {
+        UA_LOG_INFO(UA_Log_Stdout, UA_LOGCATEGORY_NETWORK,
+                    "Connection %i | Closed by the server",
+                    e->connection.sockfd);
+    }
+    epoll_ctl(layer->epollfd, EPOLL_CTL_DEL, e->connection.sockfd, NULL);
+    LIST_REMOVE(e, pointers);
+    UA_Server_removeConnection(server, &e->connection);
+}
+
+static void
+ServerNetworkLayerEpoll_read(ServerNetworkLayerEpoll *layer, UA_Server *server,
+                             ConnectionEntry *e, uint32_t events) {
+    UA_LOG_TRACE(UA_Log_Stdout, UA_LOGCATEGORY_NETWORK,
+                 "Connection %i | Activity on the socket",
+                 e->connection.sockfd);
+
+    /* Read until the socket is drained. A short read means that no more data
+     * was pending. Data arriving afterwards triggers a new event. But if the
+     * remote side hung up, no further event follows. Then read on until the
+     * end of the stream is seen. */
+    UA_Boolean hangup = (events & (EPOLLRDHUP | EPOLLERR | EPOLLHUP)) != 0;
+    while(true) {
+        UA_ByteString buf = UA_BYTESTRING_NULL;
+        UA_StatusCode retval = ServerNetworkLayerTCP_recv(&layer->tcp, e, &buf);
+        if(retval == UA_STATUSCODE_BADCONNECTIONCLOSED) {
+            ServerNetworkLayerEpoll_remove(layer, server, e);
+            return;
+        }
+        if(retval != UA_STATUSCODE_GOOD || buf.length == 0)
+            return;
+
+        size_t received = buf.length;
+        UA_Server_processBinaryMessage(server, &e->connection, &buf);
+        ServerNetworkLayerTCP_releaseRecvBuffer(&e->connection, &buf);
+        if(received < e->connection.localConf.recvBufferSize && !hangup)
+            return;
+    }
+}
+
+static UA_StatusCode
+ServerNetworkLayerEpoll_listen(UA_ServerNetworkLayer *nl, UA_Server *server,
+                               UA_UInt16 timeout) {
+    ServerNetworkLayerEpoll *layer = (ServerNetworkLayerEpoll *)nl->handle;
+
+    struct epoll_event events[UA_EPOLL_MAXEVENTS];
+    int n = epoll_wait(layer->epollfd, events, UA_EPOLL_MAXEVENTS, timeout);
+    if(n < 0) {
+        if(errno != EINTR)
+            UA_LOG_WARNING(UA_Log_Stdout, UA_LOGCATEGORY_NETWORK,
+                           "Socket epoll_wait failed with %s", strerror(errno));
+        return UA_STATUSCODE_GOOD;
+    }
+
+    /* Every fd is reported at most once. And connections are only removed when
+     * their own event is processed. So the entries in the event list remain
+     * valid. */
+    ServerNetworkLayerTCP_beginCoalesce(&layer->tcp);
+    for(int i = 0; i < n; i++) {
+        if(!events[i].data.ptr) {
+            ServerNetworkLayerEpoll_accept(layer);
+            continue;
+        }
+        ConnectionEntry *e = (ConnectionEntry*)events[i].data.ptr;
+        /* The socket became writable. Continue sending the queued buffers. */
+        if(events[i].events & EPOLLOUT)
+            ServerNetworkLayerTCP_flush(e);
+        if(events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLERR | EPOLLHUP))
+            ServerNetworkLayerEpoll_read(layer, server, e, events[i].events);
+    }
+    ServerNetworkLayerTCP_endCoalesce(&layer->tcp);
+    return UA_STATUSCODE_GOOD;
+}
+
+static void
+ServerNetworkLayerEpoll_stop(UA_ServerNetworkLayer *nl, UA_Server *server) {
+    ServerNetworkLayerEpoll *layer = (ServerNetworkLayerEpoll *)nl->handle;
+    UA_LOG_INFO(UA_Log_Stdout, UA_LOGCATEGORY_NETWORK,
+                "Shutting down the epoll network layer");
+
+    /* Close the server sockets. Closing removes them from epoll. */
+    for(UA_UInt16 i = 0; i < layer->tcp.serverSocketsSize; i++) {
+        shutdown((SOCKET)layer->tcp.serverSockets[i], 2);
+        CLOSESOCKET(layer->tcp.serverSockets[i]);
+    }
+    layer->tcp.serverSocketsSize = 0;
+
+    /* Close and remove the open connections directly. A single epoll_wait
+     * reports only a limited number of events. */
+    ConnectionEntry *e, *e_tmp;
+    LIST_FOREACH_SAFE(e, &layer->tcp.connections, pointers, e_tmp) {
+        ServerNetworkLayerTCP_close(&e->connection);
+        ServerNetworkLayerEpoll_remove(layer, server, e);
+    }
+}
+
+/* run only when the server is stopped */
+static void
+ServerNetworkLayerEpoll_deleteMembers(UA_ServerNetworkLayer *nl) {
+    ServerNetworkLayerEpoll *layer = (ServerNetworkLayerEpoll *)nl->handle;
+    if(layer->epollfd >= 0)
+        close(layer->epollfd);
+    /* Frees the layer */
+    ServerNetworkLayerTCP_deleteMembers(nl);
+}
+
+UA_ServerNetworkLayer
+UA_ServerNetworkLayerEpoll(UA_ConnectionConfig conf, UA_UInt16 port) {
+    UA_ServerNetworkLayer nl;
+    memset(&nl, 0, sizeof(UA_ServerNetworkLayer));
+    ServerNetworkLayerEpoll *layer = (ServerNetworkLayerEpoll*)
+        UA_calloc(1,sizeof(ServerNetworkLayerEpoll));
+    if(!layer)
+        return nl;
+
+    layer->tcp.conf = conf;
+    layer->tcp.port = port;
+#ifdef UA_ENABLE_MULTITHREADING
+    pthread_mutex_init(&layer->tcp.sendBufferPoolMutex, NULL);
+#endif
+    layer->epollfd = -1;
+
+    nl.handle = layer;
+    nl.start = ServerNetworkLayerEpoll_start;
+    nl.listen = ServerNetworkLayerEpoll_listen;
+    nl.stop = ServerNetworkLayerEpoll_stop;
+    nl.deleteMembers = ServerNetworkLayerEpoll_deleteMembers;
+    return nl;
+}
+
+#endif /* UA_ENABLE_NETWORK_EPOLL */
+
 /***************************/
 /* Client NetworkLayer TCP */
 /***************************/
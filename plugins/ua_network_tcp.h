@@ -14,6 +14,14 @@ extern "C" {
 UA_ServerNetworkLayer UA_EXPORT
 UA_ServerNetworkLayerTCP(UA_ConnectionConfig conf, UA_UInt16 port);
 
+#ifdef UA_ENABLE_NETWORK_EPOLL
+/* TCP server network layer based on epoll. Sockets are registered once
+ * (edge-triggered) when they are opened. So the cost of a listen call depends
+ * on the number of active sockets and not on the number of open connections. */
+UA_ServerNetworkLayer UA_EXPORT
+UA_ServerNetworkLayerEpoll(UA_ConnectionConfig conf, UA_UInt16 port);
+#endif
+
 UA_Connection UA_EXPORT
 UA_ClientConnectionTCP(UA_ConnectionConfig conf, const char *endpointUrl, const UA_UInt32 timeout);
 
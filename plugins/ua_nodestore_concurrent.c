@@ -0,0 +1,558 @@
+/* This work is licensed under a Creative Commons CCZero 1.0 Universal License.
+ * See http://creativecommons.org/publicdomain/zero/1.0/ for more information. */
+
+#include "ua_nodestore_concurrent.h"
+
+/* container_of */
+#ifndef container_of
+#define container_of(ptr, type, member) \
+    (type *)((uintptr_t)ptr - offsetof(type,member))
+#endif
+
+/* The concurrent Nodestore is a hash-map from NodeIds to Nodes (open
+ * addressing with double hashing, same as the default Nodestore). But readers
+ * never take a lock and never write to shared memory:
+ *
+ * - getNode/iterate open an RCU read-side section. releaseNode closes it.
+ * - Writers are serialized with a mutex. They publish new slot contents (and
+ *   resized tables) with a single atomic pointer store.
+ * - Replaced and removed nodes (and old tables) are retired. They are freed
+ *   only after all readers that could still see them have left their read-side
+ *   section (grace period).
+ *
+ * Hence, nodes in the map are immutable. Edits are done on a copy that
+ * atomically replaces the original (copy-on-write). */
+
+#ifdef UA_ENABLE_MULTITHREADING
+
+#include <pthread.h>
+#include <urcu-bp.h> /* bullet-proof flavor, readers need not register */
+
+#define BEGIN_RCU_READ(NODEMAP) rcu_read_lock()
+#define END_RCU_READ(NODEMAP) rcu_read_unlock()
+#define BEGIN_RCU_WRITE(NODEMAP) pthread_mutex_lock(&(NODEMAP)->writeMutex)
+#define END_RCU_WRITE(NODEMAP) pthread_mutex_unlock(&(NODEMAP)->writeMutex)
+
+#else
+
+/* Without multithreading, the only readers are on the current call stack. The
+ * retired memory is freed when the last open read-side section is left. */
+struct rcu_head {
+    struct rcu_head *next;
+    void (*func)(struct rcu_head *head);
+};
+
+#define rcu_dereference(p) (p)
+#define rcu_assign_pointer(p, v) ((p) = (v))
+#define BEGIN_RCU_READ(NODEMAP) (++(NODEMAP)->readers)
+#define END_RCU_READ(NODEMAP) endRcuRead(NODEMAP)
+#define BEGIN_RCU_WRITE(NODEMAP)
+#define END_RCU_WRITE(NODEMAP)
+
+#endif
+
+typedef struct UA_RcuNodeEntry {
+    struct rcu_head rcuHead; /* for the deferred reclamation */
+    struct UA_RcuNodeEntry *orig; /* the version this is a copy from (or NULL) */
+    UA_Node node;
+} UA_RcuNodeEntry;
+
+#define UA_RCUNODEMAP_MINSIZE 64
+#define UA_RCUNODEMAP_TOMBSTONE ((UA_RcuNodeEntry*)0x01)
+
+typedef struct {
+    struct rcu_head rcuHead; /* for the deferred reclamation */
+    UA_RcuNodeEntry **entries;
+    UA_UInt32 size;
+    UA_UInt32 count; /* Live entries */
+    UA_UInt32 tombstones;
+} UA_RcuNodeTable;
+
+typedef struct {
+    UA_RcuNodeTable *table; /* Swapped out when the table is resized */
+#ifdef UA_ENABLE_MULTITHREADING
+    pthread_mutex_t writeMutex; /* Serialize the writers */
+#else
+    size_t readers; /* Currently open read-side sections */
+    struct rcu_head *retired; /* Freed when readers == 0 */
+#endif
+} UA_RcuNodeMap;
+
+/*************************/
+/* Deferred Reclamation  */
+/*************************/
+
+#ifndef UA_ENABLE_MULTITHREADING
+static void
+endRcuRead(UA_RcuNodeMap *ns) {
+    UA_assert(ns->readers > 0);
+    if(--ns->readers > 0)
+        return;
+    while(ns->retired) {
+        struct rcu_head *head = ns->retired;
+        ns->retired = head->next;
+        head->func(head);
+    }
+}
+#endif
+
+static void
+retireRcu(UA_RcuNodeMap *ns, struct rcu_head *head,
+          void (*func)(struct rcu_head *head)) {
+#ifdef UA_ENABLE_MULTITHREADING
+    call_rcu(head, func);
+#else
+    head->func = func;
+    head->next = ns->retired;
+    ns->retired = head;
+    if(ns->readers == 0) {
+        ++ns->readers;
+        endRcuRead(ns);
+    }
+#endif
+}
+
+/*********************/
+/* HashMap Utilities */
+/*********************/
+
+/* The size of the hash-map is always a prime number. They are chosen to be
+ * close to the next power of 2. So the size ca. doubles with each prime. */
+static UA_UInt32 const rcuPrimes[] = {
+    7,         13,         31,         61,         127,         251,
+    509,       1021,       2039,       4093,       8191,        16381,
+    32749,     65521,      131071,     262139,     524287,      1048573,
+    2097143,   4194301,    8388593,    16777213,   33554393,    67108859,
+    134217689, 268435399,  536870909,  1073741789, 2147483647,  4294967291
+};
+
+static UA_UInt32
+rcuHigherPrime(UA_UInt32 n) {
+    UA_UInt16 low  = 0;
+    UA_UInt16 high = (UA_UInt16)(sizeof(rcuPrimes) / sizeof(UA_UInt32));
+    while(low != high) {
+        UA_UInt16 mid = (UA_UInt16)(low + ((high - low) / 2));
+        if(n > rcuPrimes[mid])
+            low = (UA_UInt16)(mid + 1);
+        else
+            high = mid;
+    }
+    return rcuPrimes[low];
+}
+
+static UA_RcuNodeTable *
+newRcuTable(UA_UInt32 minSize) {
+    if(minSize < UA_RCUNODEMAP_MINSIZE)
+        minSize = UA_RCUNODEMAP_MINSIZE;
+    UA_RcuNodeTable *table = (UA_RcuNodeTable*)UA_calloc(1, sizeof(UA_RcuNodeTable));
+    if(!table)
+        return NULL;
+    table->size = rcuHigherPrime(minSize);
+    table->entries = (UA_RcuNodeEntry**)
+        UA_calloc(table->size, sizeof(UA_RcuNodeEntry*));
+    if(!table->entries) {
+        UA_free(table);
+        return NULL;
+    }
+    return table;
+}
+
+static void
+freeRcuTable(struct rcu_head *head) {
+    UA_RcuNodeTable *table = container_of(head, UA_RcuNodeTable, rcuHead);
+    UA_free(table->entries);
+    UA_free(table);
+}
+
+static UA_RcuNodeEntry *
+newRcuEntry(UA_NodeClass nodeClass) {
+    size_t size = sizeof(UA_RcuNodeEntry) - sizeof(UA_Node);
+    switch(nodeClass) {
+    case UA_NODECLASS_OBJECT:
+        size += sizeof(UA_ObjectNode);
+        break;
+    case UA_NODECLASS_VARIABLE:
+        size += sizeof(UA_VariableNode);
+        break;
+    case UA_NODECLASS_METHOD:
+        size += sizeof(UA_MethodNode);
+        break;
+    case UA_NODECLASS_OBJECTTYPE:
+        size += sizeof(UA_ObjectTypeNode);
+        break;
+    case UA_NODECLASS_VARIABLETYPE:
+        size += sizeof(UA_VariableTypeNode);
+        break;
+    case UA_NODECLASS_REFERENCETYPE:
+        size += sizeof(UA_ReferenceTypeNode);
+        break;
+    case UA_NODECLASS_DATATYPE:
+        size += sizeof(UA_DataTypeNode);
+        break;
+    case UA_NODECLASS_VIEW:
+        size += sizeof(UA_ViewNode);
+        break;
+    default:
+        return NULL;
+    }
+    UA_RcuNodeEntry *entry = (UA_RcuNodeEntry*)UA_calloc(1, size);
+    if(!entry)
+        return NULL;
+    entry->node.nodeClass = nodeClass;
+    return entry;
+}
+
+static void
+deleteRcuEntry(UA_RcuNodeEntry *entry) {
+    UA_Node_deleteMembers(&entry->node);
+    UA_free(entry);
+}
+
+static void
+freeRcuEntry(struct rcu_head *head) {
+    deleteRcuEntry(container_of(head, UA_RcuNodeEntry, rcuHead));
+}
+
+/* Lookup for the readers. The probing is bounded by the table size, so that a
+ * concurrent writer can never trap a reader in an endless loop. */
+static UA_RcuNodeEntry *
+lookupRcuEntry(UA_RcuNodeTable *table, const UA_NodeId *nodeid) {
+    UA_UInt32 h = UA_NodeId_hash(nodeid);
+    UA_UInt32 size = table->size;
+    UA_UInt32 idx = h % size;
+    UA_UInt32 hash2 = 1 + (h % (size - 2));
+    for(UA_UInt32 i = 0; i < size; ++i) {
+        UA_RcuNodeEntry *e = rcu_dereference(table->entries[idx]);
+        if(!e)
+            return NULL;
+        if(e != UA_RCUNODEMAP_TOMBSTONE &&
+           UA_NodeId_equal(&e->node.nodeId, nodeid))
+            return e;
+        idx += hash2;
+        if(idx >= size)
+            idx -= size;
+    }
+    return NULL;
+}
+
+/* Returns the slot of the entry with the NodeId. Writers only. */
+static UA_RcuNodeEntry **
+findOccupiedRcuSlot(UA_RcuNodeTable *table, const UA_NodeId *nodeid) {
+    UA_UInt32 h = UA_NodeId_hash(nodeid);
+    UA_UInt32 size = table->size;
+    UA_UInt32 idx = h % size;
+    UA_UInt32 hash2 = 1 + (h % (size - 2));
+    for(UA_UInt32 i = 0; i < size; ++i) {
+        UA_RcuNodeEntry *e = table->entries[idx];
+        if(!e)
+            return NULL;
+        if(e != UA_RCUNODEMAP_TOMBSTONE &&
+           UA_NodeId_equal(&e->node.nodeId, nodeid))
+            return &table->entries[idx];
+        idx += hash2;
+        if(idx >= size)
+            idx -= size;
+    }
+    return NULL;
+}
+
+/* Returns a free slot (empty or tombstone) or NULL if the NodeId exists. The
+ * probing continues past tombstones to ensure the NodeId is unique. Writers
+ * only. */
+static UA_RcuNodeEntry **
+findFreeRcuSlot(UA_RcuNodeTable *table, const UA_NodeId *nodeid) {
+    UA_UInt32 h = UA_NodeId_hash(nodeid);
+    UA_UInt32 size = table->size;
+    UA_UInt32 idx = h % size;
+    UA_UInt32 hash2 = 1 + (h % (size - 2));
+    UA_RcuNodeEntry **tombstone = NULL;
+    for(UA_UInt32 i = 0; i < size; ++i) {
+        UA_RcuNodeEntry *e = table->entries[idx];
+        if(!e)
+            return tombstone ? tombstone : &table->entries[idx];
+        if(e == UA_RCUNODEMAP_TOMBSTONE) {
+            if(!tombstone)
+                tombstone = &table->entries[idx];
+        } else if(UA_NodeId_equal(&e->node.nodeId, nodeid)) {
+            return NULL;
+        }
+        idx += hash2;
+        if(idx >= size)
+            idx -= size;
+    }
+    return tombstone;
+}
+
+/* Rehash into a new table with ca. 50% occupancy. The new table is published
+ * atomically. The old table is retired, readers might still probe it. */
+static UA_StatusCode
+resizeRcuTable(UA_RcuNodeMap *ns) {
+    UA_RcuNodeTable *otable = ns->table;
+    UA_RcuNodeTable *ntable = newRcuTable(otable->count * 2);
+    if(!ntable)
+        return UA_STATUSCODE_BADOUTOFMEMORY;
+
+    for(UA_UInt32 i = 0; i < otable->size; ++i) {
+        UA_RcuNodeEntry *e = otable->entries[i];
+        if(e <= UA_RCUNODEMAP_TOMBSTONE)
+            continue;
+        UA_RcuNodeEntry **slot = findFreeRcuSlot(ntable, &e->node.nodeId);
+        UA_assert(slot);
+        *slot = e;
+    }
+    ntable->count = otable->count;
+
+    rcu_assign_pointer(ns->table, ntable);
+    retireRcu(ns, &otable->rcuHead, freeRcuTable);
+    return UA_STATUSCODE_GOOD;
+}
+
+/***********************/
+/* Interface functions */
+/***********************/
+
+static UA_Node *
+UA_RcuNodeMap_newNode(void *context, UA_NodeClass nodeClass) {
+    UA_RcuNodeEntry *entry = newRcuEntry(nodeClass);
+    if(!entry)
+        return NULL;
+    return &entry->node;
+}
+
+/* Nodes that are not (yet) in the map were never visible to readers */
+static void
+UA_RcuNodeMap_deleteNode(void *context, UA_Node *node) {
+    UA_RcuNodeEntry *entry = container_of(node, UA_RcuNodeEntry, node);
+    UA_assert(&entry->node == node);
+    deleteRcuEntry(entry);
+}
+
+/* The read-side section remains open until the node is released */
+static const UA_Node *
+UA_RcuNodeMap_getNode(void *context, const UA_NodeId *nodeid) {
+    UA_RcuNodeMap *ns = (UA_RcuNodeMap*)context;
+    BEGIN_RCU_READ(ns);
+    UA_RcuNodeEntry *entry = lookupRcuEntry(rcu_dereference(ns->table), nodeid);
+    if(!entry) {
+        END_RCU_READ(ns);
+        return NULL;
+    }
+    return (const UA_Node*)&entry->node;
+}
+
+static void
+UA_RcuNodeMap_releaseNode(void *context, const UA_Node *node) {
+    if(!node)
+        return;
+#ifndef UA_ENABLE_MULTITHREADING
+    UA_RcuNodeMap *ns = (UA_RcuNodeMap*)context;
+#endif
+    END_RCU_READ(ns);
+}
+
+static UA_StatusCode
+UA_RcuNodeMap_getNodeCopy(void *context, const UA_NodeId *nodeid,
+                          UA_Node **outNode) {
+    UA_RcuNodeMap *ns = (UA_RcuNodeMap*)context;
+    BEGIN_RCU_READ(ns);
+    UA_RcuNodeEntry *entry = lookupRcuEntry(rcu_dereference(ns->table), nodeid);
+    if(!entry) {
+        END_RCU_READ(ns);
+        return UA_STATUSCODE_BADNODEIDUNKNOWN;
+    }
+    UA_RcuNodeEntry *newItem = newRcuEntry(entry->node.nodeClass);
+    if(!newItem) {
+        END_RCU_READ(ns);
+        return UA_STATUSCODE_BADOUTOFMEMORY;
+    }
+    UA_StatusCode retval = UA_Node_copy(&entry->node, &newItem->node);
+    if(retval == UA_STATUSCODE_GOOD) {
+        newItem->orig = entry; /* store the pointer to the original */
+        *outNode = &newItem->node;
+    } else {
+        deleteRcuEntry(newItem);
+    }
+    END_RCU_READ(ns);
+    return retval;
+}
+
+static UA_StatusCode
+UA_RcuNodeMap_insertNode(void *context, UA_Node *node,
+                         UA_NodeId *addedNodeId) {
+    UA_RcuNodeMap *ns = (UA_RcuNodeMap*)context;
+    UA_RcuNodeEntry *entry = container_of(node, UA_RcuNodeEntry, node);
+    BEGIN_RCU_WRITE(ns);
+
+    /* Grow (or clean up the tombstones) before the table gets too full */
+    UA_RcuNodeTable *table = ns->table;
+    if((table->count + table->tombstones + 1) * 4 > table->size * 3) {
+        if(resizeRcuTable(ns) != UA_STATUSCODE_GOOD) {
+            END_RCU_WRITE(ns);
+            deleteRcuEntry(entry);
+            return UA_STATUSCODE_BADOUTOFMEMORY;
+        }
+        table = ns->table;
+    }
+
+    UA_RcuNodeEntry **slot;
+    if(node->nodeId.identifierType == UA_NODEIDTYPE_NUMERIC &&
+       node->nodeId.identifier.numeric == 0) {
+        /* Create a random nodeid. Start at least with 50,000 to make sure we
+         * don't conflict with nodes from the spec. */
+        UA_UInt32 identifier = 50000 + table->count + 1;
+        UA_UInt32 increase = 1 + ((table->count + 1) % (table->size - 2));
+        while(true) {
+            node->nodeId.identifier.numeric = identifier;
+            slot = findFreeRcuSlot(table, &node->nodeId);
+            if(slot)
+                break;
+            identifier += increase;
+        }
+    } else {
+        slot = findFreeRcuSlot(table, &node->nodeId);
+        if(!slot) {
+            END_RCU_WRITE(ns);
+            deleteRcuEntry(entry);
+            return UA_STATUSCODE_BADNODEIDEXISTS;
+        }
+    }
+
+    /* Copy the NodeId before the node is published. Afterwards, the node is
+     * owned by the map and can be retired any time by a different writer. */
+    if(addedNodeId) {
+        UA_StatusCode retval = UA_NodeId_copy(&node->nodeId, addedNodeId);
+        if(retval != UA_STATUSCODE_GOOD) {
+            END_RCU_WRITE(ns);
+            deleteRcuEntry(entry);
+            return retval;
+        }
+    }
+
+    if(*slot == UA_RCUNODEMAP_TOMBSTONE)
+        --table->tombstones;
+    ++table->count;
+    entry->orig = NULL;
+    rcu_assign_pointer(*slot, entry);
+    END_RCU_WRITE(ns);
+    return UA_STATUSCODE_GOOD;
+}
+
+static UA_StatusCode
+UA_RcuNodeMap_replaceNode(void *context, UA_Node *node) {
+    UA_RcuNodeMap *ns = (UA_RcuNodeMap*)context;
+    UA_RcuNodeEntry *entry = container_of(node, UA_RcuNodeEntry, node);
+    BEGIN_RCU_WRITE(ns);
+    UA_RcuNodeEntry **slot = findOccupiedRcuSlot(ns->table, &node->nodeId);
+    if(!slot) {
+        END_RCU_WRITE(ns);
+        deleteRcuEntry(entry);
+        return UA_STATUSCODE_BADNODEIDUNKNOWN;
+    }
+    if(*slot != entry->orig) {
+        /* The node was updated since the copy was made */
+        END_RCU_WRITE(ns);
+        deleteRcuEntry(entry);
+        return UA_STATUSCODE_BADINTERNALERROR;
+    }
+    UA_RcuNodeEntry *old = *slot;
+    entry->orig = NULL;
+    rcu_assign_pointer(*slot, entry);
+    retireRcu(ns, &old->rcuHead, freeRcuEntry);
+    END_RCU_WRITE(ns);
+    return UA_STATUSCODE_GOOD;
+}
+
+static UA_StatusCode
+UA_RcuNodeMap_removeNode(void *context, const UA_NodeId *nodeid) {
+    UA_RcuNodeMap *ns = (UA_RcuNodeMap*)context;
+    BEGIN_RCU_WRITE(ns);
+    UA_RcuNodeTable *table = ns->table;
+    UA_RcuNodeEntry **slot = findOccupiedRcuSlot(table, nodeid);
+    if(!slot) {
+        END_RCU_WRITE(ns);
+        return UA_STATUSCODE_BADNODEIDUNKNOWN;
+    }
+    UA_RcuNodeEntry *old = *slot;
+    rcu_assign_pointer(*slot, UA_RCUNODEMAP_TOMBSTONE);
+    --table->count;
+    ++table->tombstones;
+    retireRcu(ns, &old->rcuHead, freeRcuEntry);
+
+    /* Downsize the hashmap if it is very empty. Can fail. Just continue with
+     * the bigger hashmap. */
+    if(table->count * 8 < table->size && table->size > UA_RCUNODEMAP_MINSIZE)
+        resizeRcuTable(ns);
+    END_RCU_WRITE(ns);
+    return UA_STATUSCODE_GOOD;
+}
+
+/* The visitor sees a consistent snapshot of the table. Nodes that are replaced
+ * or removed concurrently (also by the visitor) remain valid until the
+ * iteration is done. */
+static void
+UA_RcuNodeMap_iterate(void *context, void *visitorContext,
+                      UA_NodestoreVisitor visitor) {
+    UA_RcuNodeMap *ns = (UA_RcuNodeMap*)context;
+    BEGIN_RCU_READ(ns);
+    UA_RcuNodeTable *table = rcu_dereference(ns->table);
+    for(UA_UInt32 i = 0; i < table->size; ++i) {
+        UA_RcuNodeEntry *entry = rcu_dereference(table->entries[i]);
+        if(entry > UA_RCUNODEMAP_TOMBSTONE)
+            visitor(visitorContext, &entry->node);
+    }
+    END_RCU_READ(ns);
+}
+
+static void
+UA_RcuNodeMap_delete(void *context) {
+    UA_RcuNodeMap *ns = (UA_RcuNodeMap*)context;
+#ifdef UA_ENABLE_MULTITHREADING
+    /* Wait until all retired nodes are freed */
+    rcu_barrier();
+    pthread_mutex_destroy(&ns->writeMutex);
+#else
+    /* On debugging builds, check that all nodes were released */
+    UA_assert(ns->readers == 0);
+    ++ns->readers;
+    endRcuRead(ns);
+#endif
+    UA_RcuNodeTable *table = ns->table;
+    for(UA_UInt32 i = 0; i < table->size; ++i) {
+        if(table->entries[i] > UA_RCUNODEMAP_TOMBSTONE)
+            deleteRcuEntry(table->entries[i]);
+    }
+    freeRcuTable(&table->rcuHead);
+    UA_free(ns);
+}
+
+UA_StatusCode
+UA_Nodestore_concurrent_new(UA_Nodestore *ns) {
+    /* Allocate and initialize the nodemap */
+    UA_RcuNodeMap *nodemap = (UA_RcuNodeMap*)UA_calloc(1, sizeof(UA_RcuNodeMap));
+    if(!nodemap)
+        return UA_STATUSCODE_BADOUTOFMEMORY;
+    nodemap->table = newRcuTable(UA_RCUNODEMAP_MINSIZE);
+    if(!nodemap->table) {
+        UA_free(nodemap);
+        return UA_STATUSCODE_BADOUTOFMEMORY;
+    }
+#ifdef UA_ENABLE_MULTITHREADING
+    pthread_mutex_init(&nodemap->writeMutex, NULL);
+#endif
+
+    /* Populate the nodestore */
+    ns->context = nodemap;
+    ns->deleteNodestore = UA_RcuNodeMap_delete;
+    ns->inPlaceEditAllowed = false; /* Concurrent readers see every write */
+    ns->newNode = UA_RcuNodeMap_newNode;
+    ns->deleteNode = UA_RcuNodeMap_deleteNode;
+    ns->getNode = UA_RcuNodeMap_getNode;
+    ns->releaseNode = UA_RcuNodeMap_releaseNode;
+    ns->getNodeCopy = UA_RcuNodeMap_getNodeCopy;
+    ns->insertNode = UA_RcuNodeMap_insertNode;
+    ns->replaceNode = UA_RcuNodeMap_replaceNode;
+    ns->removeNode = UA_RcuNodeMap_removeNode;
+    ns->iterate = UA_RcuNodeMap_iterate;
+
+    return UA_STATUSCODE_GOOD;
+}
@@ -0,0 +1,25 @@
+/* This work is licensed under a Creative Commons CCZero 1.0 Universal License.
+ * See http://creativecommons.org/publicdomain/zero/1.0/ for more information. */
+
+#ifndef UA_NODESTORE_CONCURRENT_H_
+#define UA_NODESTORE_CONCURRENT_H_
+
+#include "ua_plugin_nodestore.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Initializes a nodestore with wait-free lookups. Readers never take a lock.
+ * Nodes are edited with copy/replace only (no in-place edits) and the memory of
+ * replaced or removed nodes is reclaimed after a grace period (RCU). With
+ * UA_ENABLE_MULTITHREADING, liburcu (bullet-proof flavor) is used. Otherwise,
+ * retired nodes are freed as soon as no node is checked out anymore. */
+UA_StatusCode UA_EXPORT
+UA_Nodestore_concurrent_new(UA_Nodestore *ns);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif /* UA_NODESTORE_CONCURRENT_H_ */
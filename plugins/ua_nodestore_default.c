@@ -2,6 +2,7 @@
  * See http://creativecommons.org/publicdomain/zero/1.0/ for more information. */
 
 #include "ua_nodestore_default.h"
+#include "queue.h"
 
 /* container_of */
 #define container_of(ptr, type, member) \
@@ -16,28 +17,96 @@
 #define END_CRITSECT(NODEMAP)
 #endif
 
-/* The default Nodestore is simply a hash-map from NodeIds to Nodes. To find an
- * entry, iterate over candidate positions according to the NodeId hash.
+/* The default Nodestore maps NodeIds to Nodes. Numeric NodeIds are mostly
+ * allocated contiguously in every namespace. They are stored directly indexed
+ * in pages of a dense array per namespace. All other NodeIds (and very large
+ * numeric identifiers) are stored in a hash-map with Robin Hood linear
+ * probing. Every slot caches the hash of its NodeId. The entries of a cluster
+ * are ordered by their home position (hash & mask). To find an entry, probe
+ * linearly from the home position:
  *
- * - Tombstone or non-matching NodeId: continue searching
- * - Matching NodeId: Return the entry
- * - NULL: Abort the search */
+ * - Non-matching NodeId: continue searching
+ * - Matching hash and NodeId: Return the entry
+ * - NULL or an entry closer to its home position than the probe: Abort the
+ *   search */
+
+struct UA_NodeMapSlab;
 
 typedef struct UA_NodeMapEntry {
-    struct UA_NodeMapEntry *orig; /* the version this is a copy from (or NULL) */
+    struct UA_NodeMapEntry *orig; /* the version this is a copy from (or NULL).
+                                   * Links the free entries of a slab and the
+                                   * retired entries. */
     UA_UInt16 refCount; /* How many consumers have a reference to the node? */
     UA_Boolean deleted; /* Node was marked as deleted and can be deleted when refCount == 0 */
+    struct UA_NodeMapSlab *slab; /* The slab the entry was allocated from */
     UA_Node node;
 } UA_NodeMapEntry;
 
+/* Entries are allocated from slabs of UA_NODEMAP_SLABENTRIES entries. There is
+ * one pool of slabs for every node class, so all entries in a slab have the
+ * same size. Slabs with free entries are kept in a list. A slab without used
+ * entries is released once the pool has another slab worth of free entries. */
+#define UA_NODEMAP_SLABENTRIES 32
+#define UA_NODEMAP_ALIGN 16
+#define UA_NODEMAP_NODECLASSES 8
+
+struct UA_NodeMapPool;
+
+typedef struct UA_NodeMapSlab {
+    LIST_ENTRY(UA_NodeMapSlab) allPointers;
+    LIST_ENTRY(UA_NodeMapSlab) freePointers; /* Only if there are free entries */
+    struct UA_NodeMapPool *pool;
+    UA_NodeMapEntry *freeEntries;
+    UA_UInt32 used;
+} UA_NodeMapSlab;
+
+typedef struct UA_NodeMapPool {
+    LIST_HEAD(, UA_NodeMapSlab) slabs;
+    LIST_HEAD(, UA_NodeMapSlab) freeSlabs;
+    size_t entrySize; /* Rounded up to UA_NODEMAP_ALIGN */
+    UA_UInt32 freeCount;
+} UA_NodeMapPool;
+
+/* The size of the hash-map is a power of two. It grows above 75% load and
+ * shrinks below 12.5% load. */
 #define UA_NODEMAP_MINSIZE 64
-#define UA_NODEMAP_TOMBSTONE ((UA_NodeMapEntry*)0x01)
 
 typedef struct {
-    UA_NodeMapEntry **entries;
+    UA_NodeMapEntry *entry; /* NULL if the slot is empty */
+    UA_UInt32 hash;         /* Cached UA_NodeId_hash of the entry */
+} UA_NodeMapSlot;
+
+/* Numeric identifiers below the limit are stored in the dense pages. The page
+ * directory of a namespace grows up to UA_NODEMAP_DENSELIMIT >>
+ * UA_NODEMAP_PAGEBITS pointers. */
+#define UA_NODEMAP_PAGEBITS 8
+#define UA_NODEMAP_PAGESIZE (1u << UA_NODEMAP_PAGEBITS)
+#define UA_NODEMAP_DENSELIMIT (1u << 22)
+
+typedef struct {
+    UA_NodeMapEntry ***pages; /* Pages are allocated on demand */
+    UA_UInt32 pagesSize;
+} UA_NodeMapDense;
+
+typedef struct {
+    /* Hash-map */
+    UA_NodeMapSlot *slots;
     UA_UInt32 size;
     UA_UInt32 count;
-    UA_UInt32 sizePrimeIndex;
+
+    /* Dense pages per namespace index */
+    UA_NodeMapDense *dense;
+    UA_UInt16 denseSize;
+    UA_UInt32 denseCount;
+
+    /* While iterations are running, the hash-map is not shrunk and deleted
+     * entries are retired instead of released. The retired entries are
+     * linked with their orig pointer. */
+    UA_UInt32 iterating;
+    UA_NodeMapEntry *retired;
+
+    /* Slab pools by node class */
+    UA_NodeMapPool pools[UA_NODEMAP_NODECLASSES];
 #ifdef UA_ENABLE_MULTITHREADING
     pthread_mutex_t mutex; /* Protect access */
 #endif
@@ -47,126 +116,211 @@ typedef struct {
 /* HashMap Utilities */
 /*********************/
 
-/* The size of the hash-map is always a prime number. They are chosen to be
- * close to the next power of 2. So the size ca. doubles with each prime. */
-static UA_UInt32 const primes[] = {
-    7,         13,         31,         61,         127,         251,
-    509,       1021,       2039,       4093,       8191,        16381,
-    32749,     65521,      131071,     262139,     524287,      1048573,
-    2097143,   4194301,    8388593,    16777213,   33554393,    67108859,
-    134217689, 268435399,  536870909,  1073741789, 2147483647,  4294967291
-};
-
-static UA_UInt32 mod(UA_UInt32 h, UA_UInt32 size) { return h % size; }
-static UA_UInt32 mod2(UA_UInt32 h, UA_UInt32 size) { return 1 + (h % (size - 2)); }
-
-static UA_UInt16
-higher_prime_index(UA_UInt32 n) {
-    UA_UInt16 low  = 0;
-    UA_UInt16 high = (UA_UInt16)(sizeof(primes) / sizeof(UA_UInt32));
-    while(low != high) {
-        UA_UInt16 mid = (UA_UInt16)(low + ((high - low) / 2));
-        if(n > primes[mid])
-            low = (UA_UInt16)(mid + 1);
-        else
-            high = mid;
-    }
-    return low;
-}
-
-/* returns an empty slot or null if the nodeid exists */
-static UA_NodeMapEntry **
-findFreeSlot(const UA_NodeMap *ns, const UA_NodeId *nodeid) {
-    UA_UInt32 h = UA_NodeId_hash(nodeid);
-    UA_UInt32 size = ns->size;
-    UA_UInt32 idx = mod(h, size);
-    UA_UInt32 hash2 = mod2(h, size);
+/* Distance of the slot at idx from the home position of its hash */
+static UA_UInt32
+probeDistance(const UA_NodeMap *ns, UA_UInt32 hash, UA_UInt32 idx) {
+    return (idx - hash) & (ns->size - 1);
+}
 
-    while(true) {
-        UA_NodeMapEntry *e = ns->entries[idx];
-        if(e > UA_NODEMAP_TOMBSTONE &&
-           UA_NodeId_equal(&e->node.nodeId, nodeid))
-            return NULL;
-        if(ns->entries[idx] <= UA_NODEMAP_TOMBSTONE)
-            return &ns->entries[idx];
-        idx += hash2;
-        if(idx >= size)
-            idx -= size;
+/* Returns the index of the matching slot or ns->size if not found */
+static UA_UInt32
+findHashed(const UA_NodeMap *ns, const UA_NodeId *nodeid, UA_UInt32 hash) {
+    UA_UInt32 mask = ns->size - 1;
+    UA_UInt32 idx = hash & mask;
+    for(UA_UInt32 dist = 0; ; ++dist) {
+        const UA_NodeMapSlot *slot = &ns->slots[idx];
+        if(!slot->entry || probeDistance(ns, slot->hash, idx) < dist)
+            return ns->size;
+        if(slot->hash == hash && UA_NodeId_equal(&slot->entry->node.nodeId, nodeid))
+            return idx;
+        idx = (idx + 1) & mask;
+    }
+}
+
+/* Opens an empty slot at the Robin Hood position of the hash. The entries
+ * behind it in the cluster are shifted up by one. The NodeId must not be
+ * contained and the map must have a free slot. */
+static UA_NodeMapSlot *
+openSlot(UA_NodeMap *ns, UA_UInt32 hash) {
+    UA_UInt32 mask = ns->size - 1;
+    UA_UInt32 idx = hash & mask;
+    UA_UInt32 dist = 0;
+    while(ns->slots[idx].entry &&
+          probeDistance(ns, ns->slots[idx].hash, idx) >= dist) {
+        idx = (idx + 1) & mask;
+        ++dist;
+    }
+
+    /* Shift the rest of the cluster */
+    UA_NodeMapSlot moved = ns->slots[idx];
+    UA_UInt32 i = idx;
+    while(moved.entry) {
+        i = (i + 1) & mask;
+        UA_NodeMapSlot tmp = ns->slots[i];
+        ns->slots[i] = moved;
+        moved = tmp;
     }
 
-    /* NOTREACHED */
-    return NULL;
+    ns->slots[idx].entry = NULL;
+    ns->slots[idx].hash = hash;
+    return &ns->slots[idx];
 }
 
-/* The occupancy of the table after the call will be about 50% */
+/* Backward-shift deletion. Entries following the removed slot are moved one
+ * position closer to their home until the cluster ends. */
+static void
+closeSlot(UA_NodeMap *ns, UA_UInt32 idx) {
+    UA_UInt32 mask = ns->size - 1;
+    UA_UInt32 next = (idx + 1) & mask;
+    while(ns->slots[next].entry &&
+          probeDistance(ns, ns->slots[next].hash, next) > 0) {
+        ns->slots[idx] = ns->slots[next];
+        idx = next;
+        next = (next + 1) & mask;
+    }
+    ns->slots[idx].entry = NULL;
+}
+
+/* Reinsert all entries with their cached hash into a table of the new size */
 static UA_StatusCode
-expand(UA_NodeMap *ns) {
+resize(UA_NodeMap *ns, UA_UInt32 nsize) {
+    UA_NodeMapSlot *nslots = (UA_NodeMapSlot*)
+        UA_calloc(nsize, sizeof(UA_NodeMapSlot));
+    if(!nslots)
+        return UA_STATUSCODE_BADOUTOFMEMORY;
+    UA_NodeMapSlot *oslots = ns->slots;
     UA_UInt32 osize = ns->size;
-    UA_UInt32 count = ns->count;
-    /* Resize only when table after removal of unused elements is either too
-       full or too empty */
-    if(count * 2 < osize && (count * 8 > osize || osize <= UA_NODEMAP_MINSIZE))
-        return UA_STATUSCODE_GOOD;
+    ns->slots = nslots;
+    ns->size = nsize;
+    for(UA_UInt32 i = 0; i < osize; ++i) {
+        if(oslots[i].entry)
+            openSlot(ns, oslots[i].hash)->entry = oslots[i].entry;
+    }
+    UA_free(oslots);
+    return UA_STATUSCODE_GOOD;
+}
 
-    UA_NodeMapEntry **oentries = ns->entries;
-    UA_UInt32 nindex = higher_prime_index(count * 2);
-    UA_UInt32 nsize = primes[nindex];
-    UA_NodeMapEntry **nentries = (UA_NodeMapEntry **)UA_calloc(nsize, sizeof(UA_NodeMapEntry*));
-    if(!nentries)
+/* Double the size if the table is more than 75% full after the insertion */
+static UA_StatusCode
+growIfNeeded(UA_NodeMap *ns) {
+    if((ns->count + 1) * 4 <= ns->size * 3)
+        return UA_STATUSCODE_GOOD;
+    if(ns->size >= (1u << 31))
         return UA_STATUSCODE_BADOUTOFMEMORY;
+    return resize(ns, ns->size * 2);
+}
 
-    ns->entries = nentries;
-    ns->size = nsize;
-    ns->sizePrimeIndex = nindex;
+/* Halve the size until the table is ca. 50% full again. Can fail, then just
+ * continue with the bigger hashmap. Shrinking is deferred until the last
+ * iteration has finished. */
+static void
+shrinkIfNeeded(UA_NodeMap *ns) {
+    if(ns->iterating > 0)
+        return;
+    if(ns->size <= UA_NODEMAP_MINSIZE || ns->count * 8 >= ns->size)
+        return;
+    UA_UInt32 nsize = ns->size;
+    while(nsize > UA_NODEMAP_MINSIZE && ns->count * 4 < nsize)
+        nsize /= 2;
+    resize(ns, nsize);
+}
+
+/**************/
+/* Slab Pools */
+/**************/
+
+#define UA_NODEMAP_ROUNDUP(SIZE) \
+    (((SIZE) + UA_NODEMAP_ALIGN - 1) & ~(size_t)(UA_NODEMAP_ALIGN - 1))
 
-    /* recompute the position of every entry and insert the pointer */
-    for(size_t i = 0, j = 0; i < osize && j < count; ++i) {
-        if(oentries[i] <= UA_NODEMAP_TOMBSTONE)
-            continue;
-        UA_NodeMapEntry **e = findFreeSlot(ns, &oentries[i]->node.nodeId);
-        UA_assert(e);
-        *e = oentries[i];
-        ++j;
+/* Returns the pool for the node class or NULL */
+static UA_NodeMapPool *
+getPool(UA_NodeMap *ns, UA_NodeClass nodeClass) {
+    size_t i = 0;
+    switch(nodeClass) {
+    case UA_NODECLASS_OBJECT: i = 0; break;
+    case UA_NODECLASS_VARIABLE: i = 1; break;
+    case UA_NODECLASS_METHOD: i = 2; break;
+    case UA_NODECLASS_OBJECTTYPE: i = 3; break;
+    case UA_NODECLASS_VARIABLETYPE: i = 4; break;
+    case UA_NODECLASS_REFERENCETYPE: i = 5; break;
+    case UA_NODECLASS_DATATYPE: i = 6; break;
+    case UA_NODECLASS_VIEW: i = 7; break;
+    default: return NULL;
     }
+    return &ns->pools[i];
+}
 
-    UA_free(oentries);
-    return UA_STATUSCODE_GOOD;
+static void
+initPools(UA_NodeMap *ns) {
+    const size_t sizes[UA_NODEMAP_NODECLASSES] = {
+        sizeof(UA_ObjectNode), sizeof(UA_VariableNode), sizeof(UA_MethodNode),
+        sizeof(UA_ObjectTypeNode), sizeof(UA_VariableTypeNode),
+        sizeof(UA_ReferenceTypeNode), sizeof(UA_DataTypeNode), sizeof(UA_ViewNode)};
+    for(size_t i = 0; i < UA_NODEMAP_NODECLASSES; ++i) {
+        UA_NodeMapPool *pool = &ns->pools[i];
+        LIST_INIT(&pool->slabs);
+        LIST_INIT(&pool->freeSlabs);
+        pool->entrySize = UA_NODEMAP_ROUNDUP(sizeof(UA_NodeMapEntry) -
+                                             sizeof(UA_Node) + sizes[i]);
+        pool->freeCount = 0;
+    }
 }
 
-static UA_NodeMapEntry *
-newEntry(UA_NodeClass nodeClass) {
-    size_t size = sizeof(UA_NodeMapEntry) - sizeof(UA_Node);
-    switch(nodeClass) {
-    case UA_NODECLASS_OBJECT:
-        size += sizeof(UA_ObjectNode);
-        break;
-    case UA_NODECLASS_VARIABLE:
-        size += sizeof(UA_VariableNode);
-        break;
-    case UA_NODECLASS_METHOD:
-        size += sizeof(UA_MethodNode);
-        break;
-    case UA_NODECLASS_OBJECTTYPE:
-        size += sizeof(UA_ObjectTypeNode);
-        break;
-    case UA_NODECLASS_VARIABLETYPE:
-        size += sizeof(UA_VariableTypeNode);
-        break;
-    case UA_NODECLASS_REFERENCETYPE:
-        size += sizeof(UA_ReferenceTypeNode);
-        break;
-    case UA_NODECLASS_DATATYPE:
-        size += sizeof(UA_DataTypeNode);
-        break;
-    case UA_NODECLASS_VIEW:
-        size += sizeof(UA_ViewNode);
-        break;
-    default:
+/* The entries of the slab are not cleaned up */
+static void
+deletePools(UA_NodeMap *ns) {
+    for(size_t i = 0; i < UA_NODEMAP_NODECLASSES; ++i) {
+        UA_NodeMapSlab *slab, *slab_tmp;
+        LIST_FOREACH_SAFE(slab, &ns->pools[i].slabs, allPointers, slab_tmp) {
+            LIST_REMOVE(slab, allPointers);
+            UA_free(slab);
+        }
+    }
+}
+
+static UA_NodeMapSlab *
+newSlab(UA_NodeMapPool *pool) {
+    size_t headerSize = UA_NODEMAP_ROUNDUP(sizeof(UA_NodeMapSlab));
+    UA_NodeMapSlab *slab = (UA_NodeMapSlab*)
+        UA_malloc(headerSize + (pool->entrySize * UA_NODEMAP_SLABENTRIES));
+    if(!slab)
         return NULL;
+    slab->pool = pool;
+    slab->used = 0;
+    slab->freeEntries = NULL;
+    uintptr_t first = (uintptr_t)slab + headerSize;
+    for(size_t i = UA_NODEMAP_SLABENTRIES; i > 0; --i) {
+        UA_NodeMapEntry *entry = (UA_NodeMapEntry*)(first + ((i - 1) * pool->entrySize));
+        entry->orig = slab->freeEntries;
+        slab->freeEntries = entry;
     }
-    UA_NodeMapEntry *entry = (UA_NodeMapEntry*)UA_calloc(1, size);
-    if(!entry)
+    LIST_INSERT_HEAD(&pool->slabs, slab, allPointers);
+    LIST_INSERT_HEAD(&pool->freeSlabs, slab, freePointers);
+    pool->freeCount += UA_NODEMAP_SLABENTRIES;
+    return slab;
+}
+
+static UA_NodeMapEntry *
+newEntry(UA_NodeMap *ns, UA_NodeClass nodeClass) {
+    UA_NodeMapPool *pool = getPool(ns, nodeClass);
+    if(!pool)
         return NULL;
+    UA_NodeMapSlab *slab = LIST_FIRST(&pool->freeSlabs);
+    if(!slab) {
+        slab = newSlab(pool);
+        if(!slab)
+            return NULL;
+    }
+
+    UA_NodeMapEntry *entry = slab->freeEntries;
+    slab->freeEntries = entry->orig;
+    if(!slab->freeEntries)
+        LIST_REMOVE(slab, freePointers);
+    ++slab->used;
+    --pool->freeCount;
+
+    memset(entry, 0, pool->entrySize);
+    entry->slab = slab;
     entry->node.nodeClass = nodeClass;
     return entry;
 }
@@ -174,48 +328,162 @@ newEntry(UA_NodeClass nodeClass) {
 static void
 deleteEntry(UA_NodeMapEntry *entry) {
     UA_Node_deleteMembers(&entry->node);
-    UA_free(entry);
+    UA_NodeMapSlab *slab = entry->slab;
+    UA_NodeMapPool *pool = slab->pool;
+    if(!slab->freeEntries)
+        LIST_INSERT_HEAD(&pool->freeSlabs, slab, freePointers);
+    entry->orig = slab->freeEntries;
+    slab->freeEntries = entry;
+    --slab->used;
+    ++pool->freeCount;
+
+    /* Release the slab if enough free entries remain */
+    if(slab->used > 0 || pool->freeCount < 2 * UA_NODEMAP_SLABENTRIES)
+        return;
+    LIST_REMOVE(slab, freePointers);
+    LIST_REMOVE(slab, allPointers);
+    pool->freeCount -= UA_NODEMAP_SLABENTRIES;
+    UA_free(slab);
 }
 
 static void
-cleanupEntry(UA_NodeMapEntry *entry) {
-    if(entry->deleted && entry->refCount == 0)
-        deleteEntry(entry);
+cleanupEntry(UA_NodeMap *ns, UA_NodeMapEntry *entry) {
+    if(!entry->deleted || entry->refCount > 0)
+        return;
+    if(ns->iterating > 0) {
+        entry->orig = ns->retired;
+        ns->retired = entry;
+        return;
+    }
+    deleteEntry(entry);
 }
 
-static UA_StatusCode
-clearSlot(UA_NodeMap *ns, UA_NodeMapEntry **slot) {
-    (*slot)->deleted = true;
-    cleanupEntry(*slot);
-    *slot = UA_NODEMAP_TOMBSTONE;
-    --ns->count;
-    /* Downsize the hashmap if it is very empty */
-    if(ns->count * 8 < ns->size && ns->size > 32)
-        expand(ns); /* Can fail. Just continue with the bigger hashmap. */
-    return UA_STATUSCODE_GOOD;
+static void
+deleteRetired(UA_NodeMap *ns) {
+    while(ns->retired) {
+        UA_NodeMapEntry *entry = ns->retired;
+        ns->retired = entry->orig;
+        deleteEntry(entry);
+    }
 }
 
 static UA_NodeMapEntry **
 findOccupiedSlot(const UA_NodeMap *ns, const UA_NodeId *nodeid) {
-    UA_UInt32 h = UA_NodeId_hash(nodeid);
-    UA_UInt32 size = ns->size;
-    UA_UInt32 idx = mod(h, size);
-    UA_UInt32 hash2 = mod2(h, size);
+    UA_UInt32 idx = findHashed(ns, nodeid, UA_NodeId_hash(nodeid));
+    if(idx == ns->size)
+        return NULL;
+    return &ns->slots[idx].entry;
+}
 
-    while(true) {
-        UA_NodeMapEntry *e = ns->entries[idx];
-        if(!e)
+/*********************/
+/* Dense Numeric Ids */
+/*********************/
+
+static UA_Boolean
+isDense(const UA_NodeId *nodeid) {
+    return (nodeid->identifierType == UA_NODEIDTYPE_NUMERIC &&
+            nodeid->identifier.numeric < UA_NODEMAP_DENSELIMIT);
+}
+
+/* Returns the slot in the dense pages. Returns NULL if the page does not exist
+ * and is not created. */
+static UA_NodeMapEntry **
+denseSlot(UA_NodeMap *ns, const UA_NodeId *nodeid, UA_Boolean create) {
+    UA_UInt32 id = nodeid->identifier.numeric;
+    UA_UInt32 pageIndex = id >> UA_NODEMAP_PAGEBITS;
+
+    /* Grow the namespaces */
+    if(nodeid->namespaceIndex >= ns->denseSize) {
+        if(!create)
+            return NULL;
+        UA_UInt16 size = (UA_UInt16)(nodeid->namespaceIndex + 1);
+        UA_NodeMapDense *dense = (UA_NodeMapDense*)
+            UA_realloc(ns->dense, sizeof(UA_NodeMapDense) * size);
+        if(!dense)
+            return NULL;
+        memset(&dense[ns->denseSize], 0,
+               sizeof(UA_NodeMapDense) * (size_t)(size - ns->denseSize));
+        ns->dense = dense;
+        ns->denseSize = size;
+    }
+    UA_NodeMapDense *dense = &ns->dense[nodeid->namespaceIndex];
+
+    /* Grow the page directory to the next power of two */
+    if(pageIndex >= dense->pagesSize) {
+        if(!create)
             return NULL;
-        if(e > UA_NODEMAP_TOMBSTONE &&
-           UA_NodeId_equal(&e->node.nodeId, nodeid))
-            return &ns->entries[idx];
-        idx += hash2;
-        if(idx >= size)
-            idx -= size;
+        UA_UInt32 size = dense->pagesSize > 0 ? dense->pagesSize : 8;
+        while(size <= pageIndex)
+            size *= 2;
+        UA_NodeMapEntry ***pages = (UA_NodeMapEntry***)
+            UA_realloc(dense->pages, sizeof(UA_NodeMapEntry**) * size);
+        if(!pages)
+            return NULL;
+        memset(&pages[dense->pagesSize], 0,
+               sizeof(UA_NodeMapEntry**) * (size - dense->pagesSize));
+        dense->pages = pages;
+        dense->pagesSize = size;
     }
 
-    /* NOTREACHED */
-    return NULL;
+    /* Allocate the page */
+    UA_NodeMapEntry **page = dense->pages[pageIndex];
+    if(!page) {
+        if(!create)
+            return NULL;
+        page = (UA_NodeMapEntry**)UA_calloc(UA_NODEMAP_PAGESIZE, sizeof(UA_NodeMapEntry*));
+        if(!page)
+            return NULL;
+        dense->pages[pageIndex] = page;
+    }
+    return &page[id & (UA_NODEMAP_PAGESIZE - 1)];
+}
+
+/* Returns the slot of an existing node or NULL */
+static UA_NodeMapEntry **
+findNode(UA_NodeMap *ns, const UA_NodeId *nodeid) {
+    if(!isDense(nodeid))
+        return findOccupiedSlot(ns, nodeid);
+    UA_NodeMapEntry **slot = denseSlot(ns, nodeid, false);
+    if(!slot || !*slot)
+        return NULL;
+    return slot;
+}
+
+/* Returns an empty slot for the NodeId */
+static UA_StatusCode
+findEmpty(UA_NodeMap *ns, const UA_NodeId *nodeid, UA_NodeMapEntry ***outSlot) {
+    if(isDense(nodeid)) {
+        UA_NodeMapEntry **slot = denseSlot(ns, nodeid, true);
+        if(!slot)
+            return UA_STATUSCODE_BADOUTOFMEMORY;
+        if(*slot)
+            return UA_STATUSCODE_BADNODEIDEXISTS;
+        *outSlot = slot;
+        return UA_STATUSCODE_GOOD;
+    }
+
+    UA_UInt32 hash = UA_NodeId_hash(nodeid);
+    if(findHashed(ns, nodeid, hash) != ns->size)
+        return UA_STATUSCODE_BADNODEIDEXISTS;
+    if(growIfNeeded(ns) != UA_STATUSCODE_GOOD)
+        return UA_STATUSCODE_BADOUTOFMEMORY;
+    *outSlot = &openSlot(ns, hash)->entry;
+    return UA_STATUSCODE_GOOD;
+}
+
+static void
+removeNode(UA_NodeMap *ns, const UA_NodeId *nodeid, UA_NodeMapEntry **slot) {
+    (*slot)->deleted = true;
+    cleanupEntry(ns, *slot);
+    *slot = NULL;
+    if(isDense(nodeid)) {
+        --ns->denseCount;
+        return;
+    }
+    UA_NodeMapSlot *hslot = container_of(slot, UA_NodeMapSlot, entry);
+    closeSlot(ns, (UA_UInt32)(hslot - ns->slots));
+    --ns->count;
+    shrinkIfNeeded(ns);
 }
 
 /***********************/
@@ -224,7 +492,10 @@ findOccupiedSlot(const UA_NodeMap *ns, const UA_NodeId *nodeid) {
 
 static UA_Node *
 UA_NodeMap_newNode(void *context, UA_NodeClass nodeClass) {
-    UA_NodeMapEntry *entry = newEntry(nodeClass);
+    UA_NodeMap *ns = (UA_NodeMap*)context;
+    BEGIN_CRITSECT(ns);
+    UA_NodeMapEntry *entry = newEntry(ns, nodeClass);
+    END_CRITSECT(ns);
     if(!entry)
         return NULL;
     return &entry->node;
@@ -246,7 +517,7 @@ static const UA_Node *
 UA_NodeMap_getNode(void *context, const UA_NodeId *nodeid) {
     UA_NodeMap *ns = (UA_NodeMap*)context;
     BEGIN_CRITSECT(ns);
-    UA_NodeMapEntry **entry = findOccupiedSlot(ns, nodeid);
+    UA_NodeMapEntry **entry = findNode(ns, nodeid);
     if(!entry) {
         END_CRITSECT(ns);
         return NULL;
@@ -258,15 +529,13 @@ UA_NodeMap_getNode(void *context, const UA_NodeId *nodeid) {
 
 static void
 UA_NodeMap_releaseNode(void *context, const UA_Node *node) {
-#ifdef UA_ENABLE_MULTITHREADING
     UA_NodeMap *ns = (UA_NodeMap*)context;
-#endif
     BEGIN_CRITSECT(ns);
     UA_NodeMapEntry *entry = container_of(node, UA_NodeMapEntry, node);
     UA_assert(&entry->node == node);
     UA_assert(entry->refCount > 0);
     --entry->refCount;
-    cleanupEntry(entry);
+    cleanupEntry(ns, entry);
     END_CRITSECT(ns);
 }
 
@@ -275,13 +544,13 @@ UA_NodeMap_getNodeCopy(void *context, const UA_NodeId *nodeid,
                        UA_Node **outNode) {
     UA_NodeMap *ns = (UA_NodeMap*)context;
     BEGIN_CRITSECT(ns);
-    UA_NodeMapEntry **slot = findOccupiedSlot(ns, nodeid);
+    UA_NodeMapEntry **slot = findNode(ns, nodeid);
     if(!slot) {
         END_CRITSECT(ns);
         return UA_STATUSCODE_BADNODEIDUNKNOWN;
     }
     UA_NodeMapEntry *entry = *slot;
-    UA_NodeMapEntry *newItem = newEntry(entry->node.nodeClass);
+    UA_NodeMapEntry *newItem = newEntry(ns, entry->node.nodeClass);
     if(!newItem) {
         END_CRITSECT(ns);
         return UA_STATUSCODE_BADOUTOFMEMORY;
@@ -301,10 +570,10 @@ static UA_StatusCode
 UA_NodeMap_removeNode(void *context, const UA_NodeId *nodeid) {
     UA_NodeMap *ns = (UA_NodeMap*)context;
     BEGIN_CRITSECT(ns);
-    UA_NodeMapEntry **slot = findOccupiedSlot(ns, nodeid);
+    UA_NodeMapEntry **slot = findNode(ns, nodeid);
     UA_StatusCode retval = UA_STATUSCODE_GOOD;
     if(slot)
-        retval = clearSlot(ns, slot);
+        removeNode(ns, nodeid, slot);
     else
         retval = UA_STATUSCODE_BADNODEIDUNKNOWN;
     END_CRITSECT(ns);
@@ -316,53 +585,45 @@ UA_NodeMap_insertNode(void *context, UA_Node *node,
                       UA_NodeId *addedNodeId) {
     UA_NodeMap *ns = (UA_NodeMap*)context;
     BEGIN_CRITSECT(ns);
-    if(ns->size * 3 <= ns->count * 4) {
-        if(expand(ns) != UA_STATUSCODE_GOOD) {
-            END_CRITSECT(ns);
-            return UA_STATUSCODE_BADINTERNALERROR;
-        }
-    }
-
-    UA_NodeId tempNodeid;
-    tempNodeid = node->nodeId;
-    tempNodeid.namespaceIndex = 0;
-    UA_NodeMapEntry **slot;
-    if(tempNodeid.identifierType == UA_NODEIDTYPE_NUMERIC &&
-       tempNodeid.identifier.numeric == 0) {
+    UA_NodeMapEntry **slot = NULL;
+    UA_StatusCode retval;
+    if(node->nodeId.identifierType == UA_NODEIDTYPE_NUMERIC &&
+       node->nodeId.identifier.numeric == 0) {
         /* create a random nodeid */
 		/* start at least with 50,000 to make sure we don not conflict with nodes from the spec */
 		/* E.g. adding a nodeset will create children while there are still other nodes which need to be created */
 		/* Thus the node id's may collide */
-        UA_UInt32 identifier = 50000 + ns->count+1; // start value
-        UA_UInt32 size = ns->size;
-        UA_UInt32 increase = mod2(ns->count+1, size);
+        UA_UInt32 identifier = 50000 + ns->count + ns->denseCount + 1; // start value
         while(true) {
             node->nodeId.identifier.numeric = identifier;
-            slot = findFreeSlot(ns, &node->nodeId);
-            if(slot)
+            retval = findEmpty(ns, &node->nodeId, &slot);
+            if(retval != UA_STATUSCODE_BADNODEIDEXISTS)
                 break;
-            identifier += increase;
-            if(identifier >= size)
-                identifier -= size;
+            ++identifier;
+            if(identifier == 0)
+                identifier = 50000;
         }
     } else {
-        slot = findFreeSlot(ns, &node->nodeId);
-        if(!slot) {
-            deleteEntry(container_of(node, UA_NodeMapEntry, node));
-            END_CRITSECT(ns);
-            return UA_STATUSCODE_BADNODEIDEXISTS;
-        }
+        retval = findEmpty(ns, &node->nodeId, &slot);
+    }
+
+    if(retval != UA_STATUSCODE_GOOD) {
+        deleteEntry(container_of(node, UA_NodeMapEntry, node));
+        END_CRITSECT(ns);
+        return retval;
     }
 
     *slot = container_of(node, UA_NodeMapEntry, node);
-    ++ns->count;
+    if(isDense(&node->nodeId))
+        ++ns->denseCount;
+    else
+        ++ns->count;
     UA_assert(&(*slot)->node == node);
 
-    UA_StatusCode retval = UA_STATUSCODE_GOOD;
     if(addedNodeId) {
         retval = UA_NodeId_copy(&node->nodeId, addedNodeId);
         if(retval != UA_STATUSCODE_GOOD)
-            clearSlot(ns, slot);
+            removeNode(ns, &node->nodeId, slot);
     }
 
     END_CRITSECT(ns);
@@ -373,7 +634,7 @@ static UA_StatusCode
 UA_NodeMap_replaceNode(void *context, UA_Node *node) {
     UA_NodeMap *ns = (UA_NodeMap*)context;
     BEGIN_CRITSECT(ns);
-    UA_NodeMapEntry **slot = findOccupiedSlot(ns, &node->nodeId);
+    UA_NodeMapEntry **slot = findNode(ns, &node->nodeId);
     if(!slot) {
         END_CRITSECT(ns);
         return UA_STATUSCODE_BADNODEIDUNKNOWN;
@@ -386,28 +647,97 @@ UA_NodeMap_replaceNode(void *context, UA_Node *node) {
         return UA_STATUSCODE_BADINTERNALERROR;
     }
     (*slot)->deleted = true;
-    cleanupEntry(*slot);
+    cleanupEntry(ns, *slot);
     *slot = newEntryContainer;
     END_CRITSECT(ns);
     return UA_STATUSCODE_GOOD;
 }
 
+static void
+visitEntry(UA_NodeMap *ns, UA_NodeMapEntry *entry, void *visitorContext,
+           UA_NodestoreVisitor visitor) {
+    entry->refCount++;
+    END_CRITSECT(ns);
+    visitor(visitorContext, &entry->node);
+    BEGIN_CRITSECT(ns);
+    entry->refCount--;
+    cleanupEntry(ns, entry);
+}
+
+/* Visit the entries of the hash-map in place. Used only if the snapshot cannot
+ * be allocated. If the visited entry was removed from the hash-map, the
+ * following entry was shifted into its slot. Entries can still be missed if
+ * the visitor removes or inserts other nodes. */
+static void
+iterateHashedInPlace(UA_NodeMap *ns, void *visitorContext,
+                     UA_NodestoreVisitor visitor) {
+    for(UA_UInt32 i = 0; i < ns->size;) {
+        UA_NodeMapEntry *entry = ns->slots[i].entry;
+        if(entry) {
+            visitEntry(ns, entry, visitorContext, visitor);
+            if(i < ns->size && ns->slots[i].entry != entry)
+                continue;
+        }
+        ++i;
+    }
+}
+
+/* Removing entries from the hash-map shifts the clusters and insertions can
+ * resize the table. So the entries of the hash-map are taken from a snapshot.
+ * Every entry is looked up again before it is visited. This skips removed
+ * nodes and visits the current version of replaced nodes. The entries of the
+ * snapshot are not released before the iteration has finished. Nodes inserted
+ * into the hash-map during the iteration are not visited. */
+static void
+iterateHashed(UA_NodeMap *ns, void *visitorContext,
+              UA_NodestoreVisitor visitor) {
+    if(ns->count == 0)
+        return;
+    UA_NodeMapEntry **snapshot = (UA_NodeMapEntry**)
+        UA_malloc(sizeof(UA_NodeMapEntry*) * ns->count);
+    if(!snapshot) {
+        iterateHashedInPlace(ns, visitorContext, visitor);
+        return;
+    }
+
+    UA_UInt32 snapshotSize = 0;
+    for(UA_UInt32 i = 0; i < ns->size; ++i) {
+        if(ns->slots[i].entry)
+            snapshot[snapshotSize++] = ns->slots[i].entry;
+    }
+
+    for(UA_UInt32 i = 0; i < snapshotSize; ++i) {
+        UA_NodeMapEntry **slot = findOccupiedSlot(ns, &snapshot[i]->node.nodeId);
+        if(slot)
+            visitEntry(ns, *slot, visitorContext, visitor);
+    }
+    UA_free(snapshot);
+}
+
+/* The dense pages are only appended to. Their position is looked up again
+ * after every visit. */
 static void
 UA_NodeMap_iterate(void *context, void *visitorContext,
                    UA_NodestoreVisitor visitor) {
     UA_NodeMap *ns = (UA_NodeMap*)context;
     BEGIN_CRITSECT(ns);
-    for(UA_UInt32 i = 0; i < ns->size; ++i) {
-        if(ns->entries[i] > UA_NODEMAP_TOMBSTONE) {
-            END_CRITSECT(ns);
-            UA_NodeMapEntry *entry = ns->entries[i];
-            entry->refCount++;
-            visitor(visitorContext, &entry->node);
-            entry->refCount--;
-            cleanupEntry(entry);
-            BEGIN_CRITSECT(ns);
+    ++ns->iterating;
+    for(UA_UInt16 n = 0; n < ns->denseSize; ++n) {
+        for(UA_UInt32 p = 0; p < ns->dense[n].pagesSize; ++p) {
+            for(UA_UInt32 i = 0; i < UA_NODEMAP_PAGESIZE; ++i) {
+                UA_NodeMapEntry **page = ns->dense[n].pages[p];
+                if(!page)
+                    break;
+                if(page[i])
+                    visitEntry(ns, page[i], visitorContext, visitor);
+            }
         }
     }
+    iterateHashed(ns, visitorContext, visitor);
+    if(--ns->iterating == 0) {
+        deleteRetired(ns);
+        shrinkIfNeeded(ns);
+    }
     END_CRITSECT(ns);
 }
 
@@ -418,16 +748,34 @@ UA_NodeMap_delete(void *context) {
     pthread_mutex_destroy(&ns->mutex);
 #endif
     UA_UInt32 size = ns->size;
-    UA_NodeMapEntry **entries = ns->entries;
+    UA_NodeMapSlot *slots = ns->slots;
     for(UA_UInt32 i = 0; i < size; ++i) {
-        if(entries[i] > UA_NODEMAP_TOMBSTONE) {
+        if(slots[i].entry) {
             /* On debugging builds, check that all nodes were release */
-            UA_assert(entries[i]->refCount == 0);
+            UA_assert(slots[i].entry->refCount == 0);
             /* Delete the node */
-            deleteEntry(entries[i]);
+            deleteEntry(slots[i].entry);
+        }
+    }
+    UA_free(ns->slots);
+    for(UA_UInt16 n = 0; n < ns->denseSize; ++n) {
+        UA_NodeMapDense *dense = &ns->dense[n];
+        for(UA_UInt32 p = 0; p < dense->pagesSize; ++p) {
+            UA_NodeMapEntry **page = dense->pages[p];
+            if(!page)
+                continue;
+            for(UA_UInt32 i = 0; i < UA_NODEMAP_PAGESIZE; ++i) {
+                if(page[i]) {
+                    UA_assert(page[i]->refCount == 0);
+                    deleteEntry(page[i]);
+                }
+            }
+            UA_free(page);
         }
+        UA_free(dense->pages);
     }
-    UA_free(ns->entries);
+    UA_free(ns->dense);
+    deletePools(ns);
     UA_free(ns);
 }
 
@@ -437,12 +785,17 @@ UA_Nodestore_default_new(UA_Nodestore *ns) {
     UA_NodeMap *nodemap = (UA_NodeMap*)UA_malloc(sizeof(UA_NodeMap));
     if(!nodemap)
         return UA_STATUSCODE_BADOUTOFMEMORY;
-    nodemap->sizePrimeIndex = higher_prime_index(UA_NODEMAP_MINSIZE);
-    nodemap->size = primes[nodemap->sizePrimeIndex];
+    nodemap->size = UA_NODEMAP_MINSIZE;
     nodemap->count = 0;
-    nodemap->entries = (UA_NodeMapEntry**)
-        UA_calloc(nodemap->size, sizeof(UA_NodeMapEntry*));
-    if(!nodemap->entries) {
+    nodemap->dense = NULL;
+    nodemap->denseSize = 0;
+    nodemap->denseCount = 0;
+    nodemap->iterating = 0;
+    nodemap->retired = NULL;
+    initPools(nodemap);
+    nodemap->slots = (UA_NodeMapSlot*)
+        UA_calloc(nodemap->size, sizeof(UA_NodeMapSlot));
+    if(!nodemap->slots) {
         UA_free(nodemap);
         return UA_STATUSCODE_BADOUTOFMEMORY;
     }
@@ -21,6 +21,7 @@ UA_Client_init(UA_Client* client, UA_ClientConfig config) {
     UA_SecurityPolicy_None(&client->securityPolicy, UA_BYTESTRING_NULL, config.logger);
     client->channel.securityPolicy = &client->securityPolicy;
     client->channel.securityMode = UA_MESSAGESECURITYMODE_NONE;
+    UA_LOCK_INIT(client->channel.sendMutex);
     client->config = config;
 }
 
@@ -38,6 +39,7 @@ UA_Client_deleteMembers(UA_Client* client) {
     UA_Client_disconnect(client);
     client->securityPolicy.deleteMembers(&client->securityPolicy);
     UA_SecureChannel_deleteMembersCleanup(&client->channel);
+    UA_LOCK_DESTROY(client->channel.sendMutex);
     UA_Connection_deleteMembers(&client->connection);
     if(client->endpointUrl.data)
         UA_String_deleteMembers(&client->endpointUrl);
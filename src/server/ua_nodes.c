@@ -8,12 +8,213 @@
 /* There is no UA_Node_new() method here. Creating nodes is part of the
  * NodeStore layer */
 
+#ifdef UA_ENABLE_NODESTRING_INTERNING
+
+/********************/
+/* Interned Strings */
+/********************/
+
+/* The pool is a hash-map with chaining. It is shared by all servers and
+ * nodestores in the process. The bucket array is freed when the last string is
+ * released. */
+
+typedef struct UA_NodeStringEntry {
+    struct UA_NodeStringEntry *next;
+    UA_UInt32 hash;
+    UA_UInt32 refCount;
+    size_t length;
+    UA_Byte data[];
+} UA_NodeStringEntry;
+
+#define UA_NODESTRINGPOOL_MINSIZE 256
+
+static struct {
+    UA_NodeStringEntry **buckets;
+    size_t size; /* Always a power of two */
+    size_t count;
+    size_t references;
+    size_t bytes; /* Length of all strings in the pool */
+    size_t bytesUnshared;
+    UA_LOCK_TYPE(mutex)
+} stringPool = {
+    NULL, 0, 0, 0, 0, 0
+#ifdef UA_ENABLE_MULTITHREADING
+    , PTHREAD_MUTEX_INITIALIZER
+#endif
+};
+
+/* FNV-1a */
+static UA_UInt32
+stringHash(const UA_String *s) {
+    UA_UInt32 h = 2166136261u;
+    for(size_t i = 0; i < s->length; ++i) {
+        h ^= s->data[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static UA_NodeStringEntry **
+findStringEntry(const UA_String *s, UA_UInt32 hash) {
+    UA_NodeStringEntry **e = &stringPool.buckets[hash & (stringPool.size - 1)];
+    for(; *e; e = &(*e)->next) {
+        if((*e)->hash == hash && (*e)->length == s->length &&
+           memcmp((*e)->data, s->data, s->length) == 0)
+            return e;
+    }
+    return e;
+}
+
+static void
+resizeStringPool(size_t nsize) {
+    UA_NodeStringEntry **nbuckets = (UA_NodeStringEntry**)
+        UA_calloc(nsize, sizeof(UA_NodeStringEntry*));
+    if(!nbuckets)
+        return; /* Continue with longer chains */
+    for(size_t i = 0; i < stringPool.size; ++i) {
+        UA_NodeStringEntry *e = stringPool.buckets[i];
+        while(e) {
+            UA_NodeStringEntry *next = e->next;
+            e->next = nbuckets[e->hash & (nsize - 1)];
+            nbuckets[e->hash & (nsize - 1)] = e;
+            e = next;
+        }
+    }
+    UA_free(stringPool.buckets);
+    stringPool.buckets = nbuckets;
+    stringPool.size = nsize;
+}
+
+static UA_StatusCode
+internString(const UA_String *src, UA_String *dst) {
+    if(src->length == 0)
+        return UA_String_copy(src, dst);
+
+    UA_LOCK(stringPool.mutex);
+    if(!stringPool.buckets) {
+        resizeStringPool(UA_NODESTRINGPOOL_MINSIZE);
+        if(!stringPool.buckets) {
+            UA_UNLOCK(stringPool.mutex);
+            UA_String_init(dst);
+            return UA_STATUSCODE_BADOUTOFMEMORY;
+        }
+    }
+
+    UA_UInt32 hash = stringHash(src);
+    UA_NodeStringEntry **slot = findStringEntry(src, hash);
+    UA_NodeStringEntry *e = *slot;
+    if(!e) {
+        e = (UA_NodeStringEntry*)UA_malloc(sizeof(UA_NodeStringEntry) + src->length);
+        if(!e) {
+            UA_UNLOCK(stringPool.mutex);
+            UA_String_init(dst);
+            return UA_STATUSCODE_BADOUTOFMEMORY;
+        }
+        e->next = NULL;
+        e->hash = hash;
+        e->refCount = 0;
+        e->length = src->length;
+        memcpy(e->data, src->data, src->length);
+        *slot = e;
+        ++stringPool.count;
+        stringPool.bytes += src->length;
+        if(stringPool.count > stringPool.size)
+            resizeStringPool(stringPool.size * 2);
+    }
+    ++e->refCount;
+    ++stringPool.references;
+    stringPool.bytesUnshared += src->length;
+    UA_UNLOCK(stringPool.mutex);
+
+    dst->length = e->length;
+    dst->data = e->data;
+    return UA_STATUSCODE_GOOD;
+}
+
+static void
+releaseString(UA_String *s) {
+    if(s->length == 0) {
+        UA_String_deleteMembers(s);
+        return;
+    }
+
+    UA_LOCK(stringPool.mutex);
+    UA_NodeStringEntry **slot = NULL;
+    if(stringPool.buckets)
+        slot = findStringEntry(s, stringHash(s));
+    if(!slot || !*slot || (*slot)->data != s->data) {
+        /* Not interned */
+        UA_UNLOCK(stringPool.mutex);
+        UA_String_deleteMembers(s);
+        return;
+    }
+
+    UA_NodeStringEntry *e = *slot;
+    --stringPool.references;
+    stringPool.bytesUnshared -= e->length;
+    if(--e->refCount == 0) {
+        *slot = e->next;
+        --stringPool.count;
+        stringPool.bytes -= e->length;
+        UA_free(e);
+        if(stringPool.count == 0) {
+            UA_free(stringPool.buckets);
+            stringPool.buckets = NULL;
+            stringPool.size = 0;
+        }
+    }
+    UA_UNLOCK(stringPool.mutex);
+    UA_String_init(s);
+}
+
+UA_StatusCode
+UA_Node_copyQualifiedName(const UA_QualifiedName *src, UA_QualifiedName *dst) {
+    dst->namespaceIndex = src->namespaceIndex;
+    return internString(&src->name, &dst->name);
+}
+
+void
+UA_Node_deleteQualifiedName(UA_QualifiedName *qn) {
+    releaseString(&qn->name);
+}
+
+UA_StatusCode
+UA_Node_copyLocalizedText(const UA_LocalizedText *src, UA_LocalizedText *dst) {
+    UA_StatusCode retval = internString(&src->locale, &dst->locale);
+    if(retval != UA_STATUSCODE_GOOD)
+        return retval;
+    retval = internString(&src->text, &dst->text);
+    if(retval != UA_STATUSCODE_GOOD)
+        releaseString(&dst->locale);
+    return retval;
+}
+
+void
+UA_Node_deleteLocalizedText(UA_LocalizedText *lt) {
+    releaseString(&lt->locale);
+    releaseString(&lt->text);
+}
+
+void
+UA_NodeStringPool_getStatistics(UA_NodeStringPoolStatistics *stats) {
+    UA_LOCK(stringPool.mutex);
+    stats->strings = stringPool.count;
+    stats->references = stringPool.references;
+    stats->bytesUsed = stringPool.bytes +
+        (stringPool.count * sizeof(UA_NodeStringEntry)) +
+        (stringPool.size * sizeof(UA_NodeStringEntry*));
+    stats->bytesUnshared = stringPool.bytesUnshared;
+    UA_UNLOCK(stringPool.mutex);
+}
+
+#endif /* UA_ENABLE_NODESTRING_INTERNING */
+
 void UA_Node_deleteMembers(UA_Node *node) {
     /* Delete standard content */
     UA_NodeId_deleteMembers(&node->nodeId);
-    UA_QualifiedName_deleteMembers(&node->browseName);
-    UA_LocalizedText_deleteMembers(&node->displayName);
-    UA_LocalizedText_deleteMembers(&node->description);
+    UA_Node_deleteQualifiedName(&node->browseName);
+    UA_Node_deleteLocalizedText(&node->displayName);
+    UA_Node_deleteLocalizedText(&node->description);
 
     /* Delete references */
     UA_Node_deleteReferences(node);
@@ -142,9 +343,9 @@ UA_Node_copy(const UA_Node *src, UA_Node *dst) {
     /* Copy standard content */
     UA_StatusCode retval = UA_NodeId_copy(&src->nodeId, &dst->nodeId);
     dst->nodeClass = src->nodeClass;
-    retval |= UA_QualifiedName_copy(&src->browseName, &dst->browseName);
-    retval |= UA_LocalizedText_copy(&src->displayName, &dst->displayName);
-    retval |= UA_LocalizedText_copy(&src->description, &dst->description);
+    retval |= UA_Node_copyQualifiedName(&src->browseName, &dst->browseName);
+    retval |= UA_Node_copyLocalizedText(&src->displayName, &dst->displayName);
+    retval |= UA_Node_copyLocalizedText(&src->description, &dst->description);
     dst->writeMask = src->writeMask;
     dst->context = src->context;
     if(retval != UA_STATUSCODE_GOOD) {
@@ -227,9 +428,9 @@ static UA_StatusCode
 copyStandardAttributes(UA_Node *node, const UA_NodeAttributes *attr) {
     /* retval  = UA_NodeId_copy(&item->requestedNewNodeId.nodeId, &node->nodeId); */
     /* retval |= UA_QualifiedName_copy(&item->browseName, &node->browseName); */
-    UA_StatusCode retval = UA_LocalizedText_copy(&attr->displayName,
-                                                 &node->displayName);
-    retval |= UA_LocalizedText_copy(&attr->description, &node->description);
+    UA_StatusCode retval = UA_Node_copyLocalizedText(&attr->displayName,
+                                                     &node->displayName);
+    retval |= UA_Node_copyLocalizedText(&attr->description, &node->description);
     node->writeMask = attr->writeMask;
     return retval;
 }
@@ -9,15 +9,20 @@
 
 #define STARTCHANNELID 1
 #define STARTTOKENID 1
+#define CHANNELHASH_MINSIZE 16
 
 UA_StatusCode
 UA_SecureChannelManager_init(UA_SecureChannelManager* cm, UA_Server* server) {
     LIST_INIT(&cm->channels);
+    cm->channelHash = NULL;
+    cm->channelHashSize = 0;
+    cm->channelHashCount = 0;
     // TODO: use an ID that is likely to be unique after a restart
     cm->lastChannelId = STARTCHANNELID;
     cm->lastTokenId = STARTTOKENID;
     cm->currentChannelCount = 0;
     cm->server = server;
+    UA_LOCK_INIT(cm->mutex);
     return UA_STATUSCODE_GOOD;
 }
 
@@ -26,14 +31,63 @@ void UA_SecureChannelManager_deleteMembers(UA_SecureChannelManager* cm) {
     LIST_FOREACH_SAFE(entry, &cm->channels, pointers, temp) {
         LIST_REMOVE(entry, pointers);
         UA_SecureChannel_deleteMembersCleanup(&entry->channel);
+        UA_LOCK_DESTROY(entry->channel.sendMutex);
         UA_free(entry);
     }
+    UA_free(cm->channelHash);
+    cm->channelHash = NULL;
+    cm->channelHashSize = 0;
+    cm->channelHashCount = 0;
+    UA_LOCK_DESTROY(cm->mutex);
+}
+
+/* The channelIds are handed out sequentially. So the lower bits are
+ * distributed evenly. */
+static struct channel_hash_bucket *
+channelBucket(UA_SecureChannelManager *cm, UA_UInt32 channelId) {
+    return &cm->channelHash[channelId & (cm->channelHashSize - 1)];
+}
+
+/* Add an opened channel to the hash buckets. Rehash all channels if the
+ * buckets need to grow. The new channel already has its channelId but is
+ * inserted only once after the rehash. */
+static UA_StatusCode
+addChannelHash(UA_SecureChannelManager *cm, channel_list_entry *entry) {
+    if(cm->channelHashCount >= cm->channelHashSize) {
+        size_t size = cm->channelHashSize > 0 ?
+            cm->channelHashSize * 2 : CHANNELHASH_MINSIZE;
+        struct channel_hash_bucket *channelHash = (struct channel_hash_bucket*)
+            UA_calloc(size, sizeof(struct channel_hash_bucket));
+        if(!channelHash) {
+            if(cm->channelHashSize == 0)
+                return UA_STATUSCODE_BADOUTOFMEMORY;
+        } else {
+            UA_free(cm->channelHash);
+            cm->channelHash = channelHash;
+            cm->channelHashSize = size;
+            channel_list_entry *e;
+            LIST_FOREACH(e, &cm->channels, pointers) {
+                if(e != entry && e->channel.securityToken.channelId != 0)
+                    LIST_INSERT_HEAD(channelBucket(cm, e->channel.securityToken.channelId),
+                                     e, hashPointers);
+            }
+        }
+    }
+    LIST_INSERT_HEAD(channelBucket(cm, entry->channel.securityToken.channelId),
+                     entry, hashPointers);
+    cm->channelHashCount++;
+    return UA_STATUSCODE_GOOD;
 }
 
 static void
 removeSecureChannelCallback(UA_Server *server, void *entry) {
     channel_list_entry *centry = (channel_list_entry*)entry;
+    /* Detaching the sessions is synchronized with ActivateSession and the
+     * publish callbacks */
+    UA_LOCK(server->serviceMutex);
     UA_SecureChannel_deleteMembersCleanup(&centry->channel);
+    UA_UNLOCK(server->serviceMutex);
+    UA_LOCK_DESTROY(centry->channel.sendMutex);
     UA_free(entry);
 }
 
@@ -51,6 +105,10 @@ removeSecureChannel(UA_SecureChannelManager *cm, channel_list_entry *entry) {
 
     /* Detach the channel and make the capacity available */
     LIST_REMOVE(entry, pointers);
+    if(entry->channel.securityToken.channelId != 0) {
+        LIST_REMOVE(entry, hashPointers);
+        cm->channelHashCount--;
+    }
     UA_atomic_add(&cm->currentChannelCount, (UA_UInt32)-1);
     return UA_STATUSCODE_GOOD;
 }
@@ -58,6 +116,7 @@ removeSecureChannel(UA_SecureChannelManager *cm, channel_list_entry *entry) {
 /* remove channels that were not renewed or who have no connection attached */
 void
 UA_SecureChannelManager_cleanupTimedOut(UA_SecureChannelManager *cm, UA_DateTime nowMonotonic) {
+    UA_LOCK(cm->mutex);
     channel_list_entry *entry, *temp;
     LIST_FOREACH_SAFE(entry, &cm->channels, pointers, temp) {
         UA_DateTime timeout = entry->channel.securityToken.createdAt +
@@ -71,6 +130,7 @@ UA_SecureChannelManager_cleanupTimedOut(UA_SecureChannelManager *cm, UA_DateTime
             UA_SecureChannel_revolveTokens(&entry->channel);
         }
     }
+    UA_UNLOCK(cm->mutex);
 }
 
 /* remove the first channel that has no session attached */
@@ -100,34 +160,44 @@ UA_SecureChannelManager_create(UA_SecureChannelManager *const cm, UA_Connection
     /* Check if there exists a free SC, otherwise try to purge one SC without a
      * session the purge has been introduced to pass CTT, it is not clear what
      * strategy is expected here */
+    UA_LOCK(cm->mutex);
     if(cm->currentChannelCount >= cm->server->config.maxSecureChannels &&
-       !purgeFirstChannelWithoutSession(cm))
+       !purgeFirstChannelWithoutSession(cm)) {
+        UA_UNLOCK(cm->mutex);
         return UA_STATUSCODE_BADOUTOFMEMORY;
+    }
+    UA_atomic_add(&cm->currentChannelCount, 1);
+    UA_UNLOCK(cm->mutex);
 
     UA_LOG_INFO(cm->server->config.logger, UA_LOGCATEGORY_SECURECHANNEL,
                 "Creating a new SecureChannel");
 
     channel_list_entry* entry = (channel_list_entry*)UA_malloc(sizeof(channel_list_entry));
-    if(!entry)
+    if(!entry) {
+        UA_atomic_add(&cm->currentChannelCount, (UA_UInt32)-1);
         return UA_STATUSCODE_BADOUTOFMEMORY;
+    }
 
     /* Create the channel context and parse the sender (remote) certificate used for the
      * secureChannel. */
     UA_StatusCode retval = UA_SecureChannel_init(&entry->channel, securityPolicy,
                                                  &asymHeader->senderCertificate);
     if(retval != UA_STATUSCODE_GOOD) {
+        UA_LOCK_DESTROY(entry->channel.sendMutex);
         UA_free(entry);
+        UA_atomic_add(&cm->currentChannelCount, (UA_UInt32)-1);
         return retval;
     }
 
     /* Channel state is fresh (0) */
     entry->channel.securityToken.channelId = 0;
-    entry->channel.securityToken.tokenId = cm->lastTokenId++;
     entry->channel.securityToken.createdAt = UA_DateTime_now();
     entry->channel.securityToken.revisedLifetime = cm->server->config.maxSecurityTokenLifetime;
 
+    UA_LOCK(cm->mutex);
+    entry->channel.securityToken.tokenId = cm->lastTokenId++;
     LIST_INSERT_HEAD(&cm->channels, entry, pointers);
-    UA_atomic_add(&cm->currentChannelCount, 1);
+    UA_UNLOCK(cm->mutex);
     UA_Connection_attachSecureChannel(connection, &entry->channel);
     return UA_STATUSCODE_GOOD;
 }
@@ -147,7 +217,15 @@ UA_SecureChannelManager_open(UA_SecureChannelManager* cm, UA_SecureChannel *chan
         return UA_STATUSCODE_BADSECURITYMODEREJECTED;
     }
 
+    /* The channel is the first member of the list entry */
+    UA_LOCK(cm->mutex);
     channel->securityToken.channelId = cm->lastChannelId++;
+    UA_StatusCode retval = addChannelHash(cm, (channel_list_entry*)channel);
+    UA_UNLOCK(cm->mutex);
+    if(retval != UA_STATUSCODE_GOOD) {
+        channel->securityToken.channelId = 0;
+        return retval;
+    }
     channel->securityToken.createdAt = UA_DateTime_now();
     channel->securityToken.revisedLifetime =
         (request->requestedLifetime > cm->server->config.maxSecurityTokenLifetime) ?
@@ -188,7 +266,9 @@ UA_SecureChannelManager_renew(UA_SecureChannelManager* cm, UA_SecureChannel *cha
     /* If no security token is already issued */
     if(channel->nextSecurityToken.tokenId == 0) {
         channel->nextSecurityToken.channelId = channel->securityToken.channelId;
+        UA_LOCK(cm->mutex);
         channel->nextSecurityToken.tokenId = cm->lastTokenId++;
+        UA_UNLOCK(cm->mutex);
         channel->nextSecurityToken.createdAt = UA_DateTime_now();
         channel->nextSecurityToken.revisedLifetime =
             (request->requestedLifetime > cm->server->config.maxSecurityTokenLifetime) ?
@@ -218,24 +298,33 @@ UA_SecureChannelManager_renew(UA_SecureChannelManager* cm, UA_SecureChannel *cha
     return UA_STATUSCODE_GOOD;
 }
 
-UA_SecureChannel*
-UA_SecureChannelManager_get(UA_SecureChannelManager* cm, UA_UInt32 channelId) {
+static UA_SecureChannel *
+getSecureChannel(UA_SecureChannelManager* cm, UA_UInt32 channelId) {
+    if(cm->channelHashSize == 0)
+        return NULL;
     channel_list_entry* entry;
-    LIST_FOREACH(entry, &cm->channels, pointers) {
+    LIST_FOREACH(entry, channelBucket(cm, channelId), hashPointers) {
         if(entry->channel.securityToken.channelId == channelId)
             return &entry->channel;
     }
     return NULL;
 }
 
+UA_SecureChannel*
+UA_SecureChannelManager_get(UA_SecureChannelManager* cm, UA_UInt32 channelId) {
+    UA_LOCK(cm->mutex);
+    UA_SecureChannel *channel = getSecureChannel(cm, channelId);
+    UA_UNLOCK(cm->mutex);
+    return channel;
+}
+
 UA_StatusCode
 UA_SecureChannelManager_close(UA_SecureChannelManager* cm, UA_UInt32 channelId) {
-    channel_list_entry* entry;
-    LIST_FOREACH(entry, &cm->channels, pointers) {
-        if(entry->channel.securityToken.channelId == channelId)
-            break;
-    }
-    if(!entry)
-        return UA_STATUSCODE_BADINTERNALERROR;
-    return removeSecureChannel(cm, entry);
+    UA_StatusCode retval = UA_STATUSCODE_BADINTERNALERROR;
+    UA_LOCK(cm->mutex);
+    UA_SecureChannel *channel = getSecureChannel(cm, channelId);
+    if(channel)
+        retval = removeSecureChannel(cm, (channel_list_entry*)channel);
+    UA_UNLOCK(cm->mutex);
+    return retval;
 }
@@ -17,14 +17,27 @@ extern "C" {
 typedef struct channel_list_entry {
     UA_SecureChannel channel;
     LIST_ENTRY(channel_list_entry) pointers;
+    LIST_ENTRY(channel_list_entry) hashPointers; /* bucket in channelHash */
 } channel_list_entry;
 
+LIST_HEAD(channel_hash_bucket, channel_list_entry);
+
 typedef struct UA_SecureChannelManager {
     LIST_HEAD(channel_list, channel_list_entry) channels; // doubly-linked list of channels
+
+    /* Hash buckets over the opened channels by channelId. The number of
+     * buckets is a power of two and grows with the channels. */
+    struct channel_hash_bucket *channelHash;
+    size_t channelHashSize;
+    size_t channelHashCount;
+
     UA_UInt32 currentChannelCount;
     UA_UInt32 lastChannelId;
     UA_UInt32 lastTokenId;
     UA_Server *server;
+
+    /* Channels are created, opened and looked up from the worker threads */
+    UA_LOCK_TYPE(mutex)
 } UA_SecureChannelManager;
 
 UA_StatusCode
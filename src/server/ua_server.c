@@ -87,7 +87,18 @@ void UA_Server_delete(UA_Server *server) {
     /* Delete all internal data */
     UA_SecureChannelManager_deleteMembers(&server->secureChannelManager);
     UA_SessionManager_deleteMembers(&server->sessionManager);
+#ifdef UA_ENABLE_SUBSCRIPTIONS
+    UA_Server_deleteSamplingGroups(server);
+#endif
+#ifdef UA_ENABLE_MULTITHREADING
+    UA_Server_deleteConnectionQueues(server);
+#endif
     UA_Array_delete(server->namespaces, server->namespacesSize, &UA_TYPES[UA_TYPES_STRING]);
+    UA_DataTypeIndex_deleteMembers(&server->customTypesIndex);
+    UA_SubtypeIndex_deleteMembers(&server->subtypeIndex);
+#if defined(UA_ENABLE_REQUEST_ARENA) && !defined(UA_ENABLE_MULTITHREADING)
+    UA_Arena_deleteMembers(&server->requestArena);
+#endif
 
 #ifdef UA_ENABLE_DISCOVERY
     registeredServer_list_entry *rs, *rs_tmp;
@@ -126,17 +137,13 @@ void UA_Server_delete(UA_Server *server) {
     }
 # endif
 
-#endif
-
-#ifdef UA_ENABLE_MULTITHREADING
-    pthread_cond_destroy(&server->dispatchQueue_condition);
-    pthread_mutex_destroy(&server->dispatchQueue_mutex);
 #endif
 
     /* Delete the timed work */
     UA_Timer_deleteMembers(&server->timer);
 
     /* Delete the server itself */
+    UA_LOCK_DESTROY(server->serviceMutex);
     UA_free(server);
 }
 
@@ -147,7 +154,9 @@ UA_Server_cleanup(UA_Server *server, void *_) {
     UA_SessionManager_cleanupTimedOut(&server->sessionManager, nowMonotonic);
     UA_SecureChannelManager_cleanupTimedOut(&server->secureChannelManager, nowMonotonic);
 #ifdef UA_ENABLE_DISCOVERY
+    UA_LOCK(server->serviceMutex);
     UA_Discovery_cleanupTimedOut(server, nowMonotonic);
+    UA_UNLOCK(server->serviceMutex);
 #endif
 }
 
@@ -181,14 +190,11 @@ UA_Server_new(const UA_ServerConfig *config) {
     UA_Timer_init(&server->timer);
 
     /* Initialized the linked list for delayed callbacks */
-#ifndef UA_ENABLE_MULTITHREADING
     SLIST_INIT(&server->delayedCallbacks);
-#endif
-
-    /* Initialized the dispatch queue for worker threads */
 #ifdef UA_ENABLE_MULTITHREADING
-    cds_wfcq_init(&server->dispatchQueue_head, &server->dispatchQueue_tail);
+    SLIST_INIT(&server->delayedCallbacksWaiting);
 #endif
+    UA_LOCK_INIT(server->serviceMutex);
 
     /* Create Namespaces 0 and 1 */
     server->namespaces = (UA_String *)UA_Array_new(2, &UA_TYPES[UA_TYPES_STRING]);
@@ -196,6 +202,17 @@ UA_Server_new(const UA_ServerConfig *config) {
     UA_String_copy(&server->config.applicationDescription.applicationUri, &server->namespaces[1]);
     server->namespacesSize = 2;
 
+    /* Index the custom datatypes for the lookup during decoding. Without the
+     * index, decoding falls back to a linear search. */
+    if(UA_DataTypeIndex_init(&server->customTypesIndex, server->config.customDataTypesSize,
+                             server->config.customDataTypes) != UA_STATUSCODE_GOOD)
+        UA_LOG_WARNING(config->logger, UA_LOGCATEGORY_SERVER,
+                       "Could not index the custom datatypes");
+#if defined(UA_ENABLE_REQUEST_ARENA) && !defined(UA_ENABLE_MULTITHREADING)
+    UA_Arena_init(&server->requestArena, UA_REQUEST_ARENA_CHUNKSIZE);
+#endif
+    UA_SubtypeIndex_init(&server->subtypeIndex);
+
     /* Initialized SecureChannel and Session managers */
     UA_SecureChannelManager_init(&server->secureChannelManager, server);
     UA_SessionManager_init(&server->sessionManager, server);
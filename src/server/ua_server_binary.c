@@ -50,10 +50,67 @@ sendServiceFault(UA_SecureChannel *channel, const UA_ByteString *msg,
     return retval;
 }
 
+/* The results of the read service are encoded into the message as they are
+ * read. Large responses are sent in chunks without being held in memory. */
+static UA_StatusCode
+sendReadResponse(UA_Server *server, UA_Session *session, UA_SecureChannel *channel,
+                 UA_UInt32 requestId, const UA_ReadRequest *request) {
+    UA_MessageContext mc;
+    UA_StatusCode retval = UA_MessageContext_begin(&mc, channel, requestId,
+                                                   UA_MESSAGETYPE_MSG);
+    if(retval == UA_STATUSCODE_GOOD) {
+        UA_NodeId typeId =
+            UA_NODEID_NUMERIC(0, UA_TYPES[UA_TYPES_READRESPONSE].binaryEncodingId);
+        retval = UA_MessageContext_encode(&mc, &typeId, &UA_TYPES[UA_TYPES_NODEID]);
+        if(retval == UA_STATUSCODE_GOOD) {
+            UA_ResponseHeader responseHeader;
+            UA_ResponseHeader_init(&responseHeader);
+            responseHeader.requestHandle = request->requestHeader.requestHandle;
+            responseHeader.timestamp = UA_DateTime_now();
+            retval = Service_Read_stream(server, session, &mc, request, &responseHeader);
+        }
+
+        /* Finishing aborts the message if the final chunk cannot be sent */
+        if(retval == UA_STATUSCODE_GOOD)
+            retval = UA_MessageContext_finish(&mc);
+        else
+            UA_MessageContext_abort(&mc, retval);
+        if(retval == UA_STATUSCODE_GOOD)
+            return UA_STATUSCODE_GOOD;
+    }
+
+    /* Streaming failed, e.g. because the response exceeds the limits of the
+     * client. The chunks that were already sent have been aborted. Answer the
+     * request with the error instead. */
+    UA_LOG_INFO_CHANNEL(server->config.logger, channel,
+                        "Could not stream the ReadResponse with StatusCode %s",
+                        UA_StatusCode_name(retval));
+    UA_ReadResponse response;
+    UA_ReadResponse_init(&response);
+    response.responseHeader.requestHandle = request->requestHeader.requestHandle;
+    response.responseHeader.timestamp = UA_DateTime_now();
+    response.responseHeader.serviceResult = retval;
+    UA_StatusCode faultRetval =
+        UA_SecureChannel_sendSymmetricMessage(channel, requestId, UA_MESSAGETYPE_MSG,
+                                              &response, &UA_TYPES[UA_TYPES_READRESPONSE]);
+
+    /* The client cannot be answered. Close the connection instead of leaving
+     * the request open. */
+    UA_Connection *connection = channel->connection;
+    if(faultRetval != UA_STATUSCODE_GOOD && connection) {
+        UA_LOG_WARNING_CHANNEL(server->config.logger, channel,
+                               "Could not answer the ReadRequest with %s, "
+                               "closing the connection",
+                               UA_StatusCode_name(retval));
+        connection->close(connection);
+    }
+    return faultRetval;
+}
+
 static void
 getServicePointers(UA_UInt32 requestTypeId, const UA_DataType **requestType,
                    const UA_DataType **responseType, UA_Service *service,
-                   UA_Boolean *requiresSession) {
+                   UA_Boolean *requiresSession, UA_Boolean *exclusive) {
     switch(requestTypeId) {
     case UA_NS0ID_GETENDPOINTSREQUEST_ENCODING_DEFAULTBINARY:
         *service = (UA_Service)Service_GetEndpoints;
@@ -66,6 +123,7 @@ getServicePointers(UA_UInt32 requestTypeId, const UA_DataType **requestType,
         *requestType = &UA_TYPES[UA_TYPES_FINDSERVERSREQUEST];
         *responseType = &UA_TYPES[UA_TYPES_FINDSERVERSRESPONSE];
         *requiresSession = false;
+        *exclusive = true;
         break;
 #ifdef UA_ENABLE_DISCOVERY
 # ifdef UA_ENABLE_DISCOVERY_MULTICAST
@@ -74,6 +132,7 @@ getServicePointers(UA_UInt32 requestTypeId, const UA_DataType **requestType,
         *requestType = &UA_TYPES[UA_TYPES_FINDSERVERSONNETWORKREQUEST];
         *responseType = &UA_TYPES[UA_TYPES_FINDSERVERSONNETWORKRESPONSE];
         *requiresSession = false;
+        *exclusive = true;
         break;
 # endif
     case UA_NS0ID_REGISTERSERVERREQUEST_ENCODING_DEFAULTBINARY:
@@ -81,12 +140,14 @@ getServicePointers(UA_UInt32 requestTypeId, const UA_DataType **requestType,
         *requestType = &UA_TYPES[UA_TYPES_REGISTERSERVERREQUEST];
         *responseType = &UA_TYPES[UA_TYPES_REGISTERSERVERRESPONSE];
         *requiresSession = false;
+        *exclusive = true;
         break;
     case UA_NS0ID_REGISTERSERVER2REQUEST_ENCODING_DEFAULTBINARY:
         *service = (UA_Service)Service_RegisterServer2;
         *requestType = &UA_TYPES[UA_TYPES_REGISTERSERVER2REQUEST];
         *responseType = &UA_TYPES[UA_TYPES_REGISTERSERVER2RESPONSE];
         *requiresSession = false;
+        *exclusive = true;
         break;
 #endif
     case UA_NS0ID_CREATESESSIONREQUEST_ENCODING_DEFAULTBINARY:
@@ -104,6 +165,7 @@ getServicePointers(UA_UInt32 requestTypeId, const UA_DataType **requestType,
         *service = (UA_Service)Service_CloseSession;
         *requestType = &UA_TYPES[UA_TYPES_CLOSESESSIONREQUEST];
         *responseType = &UA_TYPES[UA_TYPES_CLOSESESSIONRESPONSE];
+        *exclusive = true;
         break;
     case UA_NS0ID_READREQUEST_ENCODING_DEFAULTBINARY:
         *service = (UA_Service)Service_Read;
@@ -146,50 +208,60 @@ getServicePointers(UA_UInt32 requestTypeId, const UA_DataType **requestType,
         *service = (UA_Service)Service_CreateSubscription;
         *requestType = &UA_TYPES[UA_TYPES_CREATESUBSCRIPTIONREQUEST];
         *responseType = &UA_TYPES[UA_TYPES_CREATESUBSCRIPTIONRESPONSE];
+        *exclusive = true;
         break;
     case UA_NS0ID_PUBLISHREQUEST_ENCODING_DEFAULTBINARY:
         *requestType = &UA_TYPES[UA_TYPES_PUBLISHREQUEST];
         *responseType = &UA_TYPES[UA_TYPES_PUBLISHRESPONSE];
+        *exclusive = true;
         break;
     case UA_NS0ID_REPUBLISHREQUEST_ENCODING_DEFAULTBINARY:
         *service = (UA_Service)Service_Republish;
         *requestType = &UA_TYPES[UA_TYPES_REPUBLISHREQUEST];
         *responseType = &UA_TYPES[UA_TYPES_REPUBLISHRESPONSE];
+        *exclusive = true;
         break;
     case UA_NS0ID_MODIFYSUBSCRIPTIONREQUEST_ENCODING_DEFAULTBINARY:
         *service = (UA_Service)Service_ModifySubscription;
         *requestType = &UA_TYPES[UA_TYPES_MODIFYSUBSCRIPTIONREQUEST];
         *responseType = &UA_TYPES[UA_TYPES_MODIFYSUBSCRIPTIONRESPONSE];
+        *exclusive = true;
         break;
     case UA_NS0ID_SETPUBLISHINGMODEREQUEST_ENCODING_DEFAULTBINARY:
         *service = (UA_Service)Service_SetPublishingMode;
         *requestType = &UA_TYPES[UA_TYPES_SETPUBLISHINGMODEREQUEST];
         *responseType = &UA_TYPES[UA_TYPES_SETPUBLISHINGMODERESPONSE];
+        *exclusive = true;
         break;
     case UA_NS0ID_DELETESUBSCRIPTIONSREQUEST_ENCODING_DEFAULTBINARY:
         *service = (UA_Service)Service_DeleteSubscriptions;
         *requestType = &UA_TYPES[UA_TYPES_DELETESUBSCRIPTIONSREQUEST];
         *responseType = &UA_TYPES[UA_TYPES_DELETESUBSCRIPTIONSRESPONSE];
+        *exclusive = true;
         break;
     case UA_NS0ID_CREATEMONITOREDITEMSREQUEST_ENCODING_DEFAULTBINARY:
         *service = (UA_Service)Service_CreateMonitoredItems;
         *requestType = &UA_TYPES[UA_TYPES_CREATEMONITOREDITEMSREQUEST];
         *responseType = &UA_TYPES[UA_TYPES_CREATEMONITOREDITEMSRESPONSE];
+        *exclusive = true;
         break;
     case UA_NS0ID_DELETEMONITOREDITEMSREQUEST_ENCODING_DEFAULTBINARY:
         *service = (UA_Service)Service_DeleteMonitoredItems;
         *requestType = &UA_TYPES[UA_TYPES_DELETEMONITOREDITEMSREQUEST];
         *responseType = &UA_TYPES[UA_TYPES_DELETEMONITOREDITEMSRESPONSE];
+        *exclusive = true;
         break;
     case UA_NS0ID_MODIFYMONITOREDITEMSREQUEST_ENCODING_DEFAULTBINARY:
         *service = (UA_Service)Service_ModifyMonitoredItems;
         *requestType = &UA_TYPES[UA_TYPES_MODIFYMONITOREDITEMSREQUEST];
         *responseType = &UA_TYPES[UA_TYPES_MODIFYMONITOREDITEMSRESPONSE];
+        *exclusive = true;
         break;
     case UA_NS0ID_SETMONITORINGMODEREQUEST_ENCODING_DEFAULTBINARY:
         *service = (UA_Service)Service_SetMonitoringMode;
         *requestType = &UA_TYPES[UA_TYPES_SETMONITORINGMODEREQUEST];
         *responseType = &UA_TYPES[UA_TYPES_SETMONITORINGMODERESPONSE];
+        *exclusive = true;
         break;
 #endif
 
@@ -343,6 +415,37 @@ processOPN(UA_Server *server, UA_SecureChannel *channel,
     return retval;
 }
 
+/* Decode the request into the arena of the current thread (if enabled). The
+ * custom datatypes are looked up in the index if it is up to date with the
+ * configuration. Otherwise fall back to a heap-allocated request. */
+static UA_StatusCode
+decodeRequest(UA_Server *server, const UA_ByteString *msg, size_t *offset,
+              void *request, const UA_DataType *requestType, UA_Arena **arena) {
+    if(server->customTypesIndex.types != server->config.customDataTypes ||
+       server->customTypesIndex.typesSize != server->config.customDataTypesSize)
+        return UA_decodeBinary(msg, offset, request, requestType,
+                               server->config.customDataTypesSize,
+                               server->config.customDataTypes);
+#ifdef UA_ENABLE_REQUEST_ARENA
+    *arena = UA_Server_getRequestArena(server);
+    if(*arena)
+        return UA_decodeBinaryArena(msg, offset, request, requestType,
+                                    &server->customTypesIndex, *arena);
+#endif
+    return UA_decodeBinaryIndexed(msg, offset, request, requestType,
+                                  &server->customTypesIndex);
+}
+
+/* The arena is reset instead of freeing the request member by member. The
+ * services copy what they keep beyond the request. */
+static void
+deleteRequest(UA_Arena *arena, void *request, const UA_DataType *requestType) {
+    if(arena)
+        UA_Arena_reset(arena);
+    else
+        UA_deleteMembers(request, requestType);
+}
+
 static UA_StatusCode
 processMSG(UA_Server *server, UA_SecureChannel *channel,
            UA_UInt32 requestId, const UA_ByteString *msg) {
@@ -365,8 +468,9 @@ processMSG(UA_Server *server, UA_SecureChannel *channel,
     const UA_DataType *requestType = NULL;
     const UA_DataType *responseType = NULL;
     UA_Boolean sessionRequired = true;
+    UA_Boolean exclusive = false;
     getServicePointers(requestTypeId.identifier.numeric, &requestType,
-                       &responseType, &service, &sessionRequired);
+                       &responseType, &service, &sessionRequired, &exclusive);
     if(!requestType) {
         if(requestTypeId.identifier.numeric == 787) {
             UA_LOG_INFO_CHANNEL(server->config.logger, channel,
@@ -385,12 +489,12 @@ processMSG(UA_Server *server, UA_SecureChannel *channel,
     /* Decode the request */
     void *request = UA_alloca(requestType->memSize);
     UA_RequestHeader *requestHeader = (UA_RequestHeader*)request;
-    retval = UA_decodeBinary(msg, &offset, request, requestType,
-                             server->config.customDataTypesSize,
-                             server->config.customDataTypes);
+    UA_Arena *arena = NULL;
+    retval = decodeRequest(server, msg, &offset, request, requestType, &arena);
     if(retval != UA_STATUSCODE_GOOD) {
         UA_LOG_DEBUG_CHANNEL(server->config.logger, channel,
                              "Could not decode the request");
+        deleteRequest(arena, request, requestType);
         return sendServiceFault(channel, msg, requestPos, responseType, requestId, retval);
     }
 
@@ -401,9 +505,11 @@ processMSG(UA_Server *server, UA_SecureChannel *channel,
 
     /* CreateSession doesn't need a session */
     if(requestType == &UA_TYPES[UA_TYPES_CREATESESSIONREQUEST]) {
+        UA_LOCK(server->serviceMutex);
         Service_CreateSession(server, channel,
             (const UA_CreateSessionRequest *)request,
                               (UA_CreateSessionResponse *)response);
+        UA_UNLOCK(server->serviceMutex);
         #ifdef FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION
 		// store the authentication token and session ID so we can help fuzzing by setting
         // these values in the next request automatically
@@ -419,9 +525,13 @@ processMSG(UA_Server *server, UA_SecureChannel *channel,
         UA_NodeId_copy(&unsafe_fuzz_authenticationToken, &requestHeader->authenticationToken);
     #endif
 
-    /* Find the matching session */
+    /* Find the matching session. With multithreading, sessions are detached
+     * from the channel in other threads. So only the locked lookup in the
+     * SessionManager is used. */
+#ifndef UA_ENABLE_MULTITHREADING
     session = UA_SecureChannel_getSession(channel, &requestHeader->authenticationToken);
     if(!session)
+#endif
         session = UA_SessionManager_getSessionByToken(&server->sessionManager,
                                                       &requestHeader->authenticationToken);
 
@@ -430,13 +540,15 @@ processMSG(UA_Server *server, UA_SecureChannel *channel,
             UA_LOG_DEBUG_CHANNEL(server->config.logger, channel,
                                  "Trying to activate a session that is " \
                                  "not known in the server");
-            UA_deleteMembers(request, requestType);
+            deleteRequest(arena, request, requestType);
             return sendServiceFault(channel, msg, requestPos, responseType,
                                     requestId, UA_STATUSCODE_BADSESSIONIDINVALID);
         }
+        UA_LOCK(server->serviceMutex);
         Service_ActivateSession(server, channel, session,
             (const UA_ActivateSessionRequest*)request,
                                 (UA_ActivateSessionResponse*)response);
+        UA_UNLOCK(server->serviceMutex);
         goto send_response;
     }
 
@@ -447,7 +559,7 @@ processMSG(UA_Server *server, UA_SecureChannel *channel,
             UA_LOG_INFO_CHANNEL(server->config.logger, channel,
                                 "Service request %i without a valid session",
                                 requestType->binaryEncodingId);
-            UA_deleteMembers(request, requestType);
+            deleteRequest(arena, request, requestType);
             return sendServiceFault(channel, msg, requestPos, responseType,
                                     requestId, UA_STATUSCODE_BADSESSIONIDINVALID);
         }
@@ -464,7 +576,7 @@ processMSG(UA_Server *server, UA_SecureChannel *channel,
                             requestType->binaryEncodingId);
         UA_SessionManager_removeSession(&server->sessionManager,
                                         &session->authenticationToken);
-        UA_deleteMembers(request, requestType);
+        deleteRequest(arena, request, requestType);
         return sendServiceFault(channel, msg, requestPos, responseType,
                                 requestId, UA_STATUSCODE_BADSESSIONNOTACTIVATED);
     }
@@ -473,7 +585,7 @@ processMSG(UA_Server *server, UA_SecureChannel *channel,
     if(session->channel != channel) {
         UA_LOG_DEBUG_CHANNEL(server->config.logger, channel,
                              "Client tries to use an obsolete securechannel");
-        UA_deleteMembers(request, requestType);
+        deleteRequest(arena, request, requestType);
         return sendServiceFault(channel, msg, requestPos, responseType,
                                 requestId, UA_STATUSCODE_BADSECURECHANNELIDINVALID);
     }
@@ -484,16 +596,34 @@ processMSG(UA_Server *server, UA_SecureChannel *channel,
 #ifdef UA_ENABLE_SUBSCRIPTIONS
     /* The publish request is not answered immediately */
     if(requestType == &UA_TYPES[UA_TYPES_PUBLISHREQUEST]) {
+        UA_LOCK(server->serviceMutex);
         Service_Publish(server, session,
             (const UA_PublishRequest*)request, requestId);
-        UA_deleteMembers(request, requestType);
+        UA_UNLOCK(server->serviceMutex);
+        deleteRequest(arena, request, requestType);
         return UA_STATUSCODE_GOOD;
     }
 #endif
 
+    /* The read response is streamed directly into the message */
+    if(requestType == &UA_TYPES[UA_TYPES_READREQUEST]) {
+        retval = sendReadResponse(server, session, channel, requestId,
+                                  (const UA_ReadRequest*)request);
+        goto check_sent;
+    }
+
     /* Call the service */
     UA_assert(service); /* For all services besides publish, the service pointer is non-NULL*/
-    service(server, session, request, response);
+    if(exclusive) {
+        /* Services that modify state outside the nodestore are serialized with
+         * the subscription and cleanup callbacks. Other services run in
+         * parallel on the nodestore. */
+        UA_LOCK(server->serviceMutex);
+        service(server, session, request, response);
+        UA_UNLOCK(server->serviceMutex);
+    } else {
+        service(server, session, request, response);
+    }
 
 send_response:
     /* Send the response */
@@ -502,13 +632,14 @@ send_response:
     retval = UA_SecureChannel_sendSymmetricMessage(channel, requestId, UA_MESSAGETYPE_MSG,
                                                    response, responseType);
 
+check_sent:
     if(retval != UA_STATUSCODE_GOOD)
         UA_LOG_INFO_CHANNEL(server->config.logger, channel,
                             "Could not send the message over the SecureChannel "
                             "with StatusCode %s", UA_StatusCode_name(retval));
 
     /* Clean up */
-    UA_deleteMembers(request, requestType);
+    deleteRequest(arena, request, requestType);
     UA_deleteMembers(response, responseType);
 
     return retval;
@@ -623,11 +754,15 @@ processCompleteChunkWithoutChannel(UA_Server *server, UA_Connection *connection,
         if(retval != UA_STATUSCODE_GOOD)
             break;
 
-        retval = UA_SecureChannel_processChunk(connection->channel, message,
+        /* The connection may have been removed meanwhile */
+        UA_SecureChannel *channel = connection->channel;
+        if(!channel) {
+            retval = UA_STATUSCODE_BADCONNECTIONCLOSED;
+            break;
+        }
+        retval = UA_SecureChannel_processChunk(channel, message,
                                                processSecureChannelMessage,
                                                server);
-        if(retval != UA_STATUSCODE_GOOD)
-            break;
         break;
     }
     default:
@@ -645,14 +780,16 @@ processCompleteChunk(void *const application,
                      UA_Connection *const connection,
                      UA_ByteString *const chunk) {
     UA_Server *const server = (UA_Server*)application;
-    if(!connection->channel)
+    UA_SecureChannel *channel = connection->channel;
+    if(!channel)
         return processCompleteChunkWithoutChannel(server, connection, chunk);
-    return UA_SecureChannel_processChunk(connection->channel, chunk,
+    return UA_SecureChannel_processChunk(channel, chunk,
                                          processSecureChannelMessage,
                                          server);
 }
 
-static void
+/* Returns an error if the connection was closed */
+static UA_StatusCode
 processBinaryMessage(UA_Server *server, UA_Connection *connection,
                      UA_ByteString *message) {
     UA_LOG_TRACE(server->config.logger, UA_LOGCATEGORY_NETWORK,
@@ -674,6 +811,7 @@ processBinaryMessage(UA_Server *server, UA_Connection *connection,
         UA_Connection_sendError(connection, &error);
         connection->close(connection);
     }
+    return retval;
 }
 
 #ifndef UA_ENABLE_MULTITHREADING
@@ -686,33 +824,269 @@ UA_Server_processBinaryMessage(UA_Server *server, UA_Connection *connection,
 
 #else
 
-typedef struct {
+/* Received messages are copied into a queue of the connection. A single
+ * worker at a time drains the queue. So the messages of a connection are
+ * processed in order while different connections are processed in parallel.
+ * The queues are found by the connection pointer in a hash map that is only
+ * accessed from the main loop. The workers get the queue itself. */
+
+#define UA_CONNECTIONQUEUES_MINSIZE 16
+
+/* Messages processed per worker callback. Then the worker is dispatched again
+ * for the remaining messages. So a busy connection does not hold on to a
+ * worker (and its dispatch epoch) indefinitely. */
+#define UA_CONNECTIONQUEUE_MAXBATCH 16
+
+typedef struct UA_QueuedMessage {
+    SIMPLEQ_ENTRY(UA_QueuedMessage) next;
+    size_t length;
+    /* The message data follows the struct */
+} UA_QueuedMessage;
+
+typedef struct UA_ConnectionQueue {
+    LIST_ENTRY(UA_ConnectionQueue) listEntry;
     UA_Connection *connection;
-    UA_ByteString message;
-} ConnectionMessage;
+    UA_LOCK_TYPE(mutex)
+    SIMPLEQ_HEAD(, UA_QueuedMessage) messages;
+    size_t queuedBytes;
+    UA_Boolean scheduled; /* A worker drains the queue */
+    UA_Boolean closed;    /* Messages are no longer queued or processed */
+} UA_ConnectionQueue;
+
+LIST_HEAD(UA_ConnectionQueueBucket, UA_ConnectionQueue);
+
+/* The lower bits of the pointer are the same due to the alignment */
+static struct UA_ConnectionQueueBucket *
+connectionQueueBucket(UA_Server *server, const UA_Connection *connection) {
+    size_t hash = (size_t)((uintptr_t)connection >> 4);
+    return &server->connectionQueues[hash & (server->connectionQueuesSize - 1)];
+}
+
+static UA_StatusCode
+resizeConnectionQueues(UA_Server *server, size_t size) {
+    struct UA_ConnectionQueueBucket *buckets = (struct UA_ConnectionQueueBucket*)
+        UA_malloc(size * sizeof(struct UA_ConnectionQueueBucket));
+    if(!buckets)
+        return UA_STATUSCODE_BADOUTOFMEMORY;
+    for(size_t i = 0; i < size; i++)
+        LIST_INIT(&buckets[i]);
+
+    /* Rehash */
+    struct UA_ConnectionQueueBucket *old = server->connectionQueues;
+    size_t oldSize = server->connectionQueuesSize;
+    server->connectionQueues = buckets;
+    server->connectionQueuesSize = size;
+    for(size_t i = 0; i < oldSize; i++) {
+        UA_ConnectionQueue *queue;
+        while((queue = LIST_FIRST(&old[i]))) {
+            LIST_REMOVE(queue, listEntry);
+            LIST_INSERT_HEAD(connectionQueueBucket(server, queue->connection),
+                             queue, listEntry);
+        }
+    }
+    UA_free(old);
+    return UA_STATUSCODE_GOOD;
+}
 
+static UA_ConnectionQueue *
+findConnectionQueue(UA_Server *server, const UA_Connection *connection) {
+    if(server->connectionQueuesSize == 0)
+        return NULL;
+    UA_ConnectionQueue *queue;
+    LIST_FOREACH(queue, connectionQueueBucket(server, connection), listEntry) {
+        if(queue->connection == connection)
+            return queue;
+    }
+    return NULL;
+}
+
+static UA_ConnectionQueue *
+UA_ConnectionQueue_new(UA_Server *server, UA_Connection *connection) {
+    /* Grow the hash buckets. Lookups still work with longer chains if the
+     * buckets cannot be grown. */
+    if(server->connectionQueuesCount >= server->connectionQueuesSize) {
+        size_t size = server->connectionQueuesSize * 2;
+        if(size == 0)
+            size = UA_CONNECTIONQUEUES_MINSIZE;
+        if(resizeConnectionQueues(server, size) != UA_STATUSCODE_GOOD &&
+           server->connectionQueuesSize == 0)
+            return NULL;
+    }
+
+    UA_ConnectionQueue *queue = (UA_ConnectionQueue*)
+        UA_malloc(sizeof(UA_ConnectionQueue));
+    if(!queue)
+        return NULL;
+    queue->connection = connection;
+    UA_LOCK_INIT(queue->mutex);
+    SIMPLEQ_INIT(&queue->messages);
+    queue->queuedBytes = 0;
+    queue->scheduled = false;
+    queue->closed = false;
+    LIST_INSERT_HEAD(connectionQueueBucket(server, connection), queue, listEntry);
+    server->connectionQueuesCount++;
+    return queue;
+}
+
+static void
+deleteQueuedMessages(UA_ConnectionQueue *queue) {
+    UA_QueuedMessage *qm;
+    while((qm = SIMPLEQ_FIRST(&queue->messages))) {
+        SIMPLEQ_REMOVE_HEAD(&queue->messages, next);
+        UA_free(qm);
+    }
+    queue->queuedBytes = 0;
+}
+
+static void
+UA_ConnectionQueue_delete(UA_ConnectionQueue *queue) {
+    deleteQueuedMessages(queue);
+    UA_LOCK_DESTROY(queue->mutex);
+    UA_free(queue);
+}
+
+/* Drop the queued messages. No more messages are queued or processed. A
+ * message that is currently processed is finished by the worker. */
+static void
+closeConnectionQueue(UA_ConnectionQueue *queue) {
+    UA_LOCK(queue->mutex);
+    queue->closed = true;
+    deleteQueuedMessages(queue);
+    UA_UNLOCK(queue->mutex);
+}
+
+/* Returns the queue if a worker needs to be scheduled to drain it. The queue
+ * is closed if the client sends more than config.maxReceiveQueueSize bytes
+ * that are not yet processed. */
+static UA_StatusCode
+enqueueMessage(UA_Server *server, UA_Connection *connection,
+               const UA_ByteString *message, UA_ConnectionQueue **schedule) {
+    *schedule = NULL;
+    UA_ConnectionQueue *queue = findConnectionQueue(server, connection);
+    if(!queue) {
+        queue = UA_ConnectionQueue_new(server, connection);
+        if(!queue)
+            return UA_STATUSCODE_BADOUTOFMEMORY;
+    }
+
+    UA_QueuedMessage *qm = (UA_QueuedMessage*)
+        UA_malloc(sizeof(UA_QueuedMessage) + message->length);
+    if(!qm) {
+        closeConnectionQueue(queue);
+        return UA_STATUSCODE_BADOUTOFMEMORY;
+    }
+    qm->length = message->length;
+    memcpy(&qm[1], message->data, message->length);
+
+    UA_LOCK(queue->mutex);
+    if(queue->closed) {
+        UA_UNLOCK(queue->mutex);
+        UA_free(qm);
+        return UA_STATUSCODE_GOOD;
+    }
+    UA_UInt32 maxSize = server->config.maxReceiveQueueSize;
+    if(maxSize > 0 && queue->queuedBytes + message->length > maxSize) {
+        queue->closed = true;
+        deleteQueuedMessages(queue);
+        UA_UNLOCK(queue->mutex);
+        UA_free(qm);
+        return UA_STATUSCODE_BADTCPNOTENOUGHRESOURCES;
+    }
+    queue->queuedBytes += message->length;
+    SIMPLEQ_INSERT_TAIL(&queue->messages, qm, next);
+    if(!queue->scheduled)
+        *schedule = queue;
+    queue->scheduled = true;
+    UA_UNLOCK(queue->mutex);
+    return UA_STATUSCODE_GOOD;
+}
+
+/* Take the next message from the queue. Returns false if the queue is empty
+ * or closed. The worker is then no longer scheduled for the connection. The
+ * message is freed with UA_free(message->data) after processing. */
+static UA_Boolean
+dequeueMessage(UA_ConnectionQueue *queue, UA_ByteString *message) {
+    UA_LOCK(queue->mutex);
+    UA_QueuedMessage *qm = NULL;
+    if(!queue->closed)
+        qm = SIMPLEQ_FIRST(&queue->messages);
+    if(qm) {
+        SIMPLEQ_REMOVE_HEAD(&queue->messages, next);
+        queue->queuedBytes -= qm->length;
+    } else {
+        queue->scheduled = false;
+    }
+    UA_UNLOCK(queue->mutex);
+    if(!qm)
+        return false;
+
+    /* Move the data to the front of the allocation */
+    message->length = qm->length;
+    message->data = (UA_Byte*)qm;
+    memmove(message->data, &qm[1], qm->length);
+    return true;
+}
+
+/* Returns true if the queue has more messages and the worker remains
+ * scheduled. Otherwise the worker is no longer scheduled for the
+ * connection. */
+static UA_Boolean
+rescheduleQueue(UA_ConnectionQueue *queue) {
+    UA_LOCK(queue->mutex);
+    UA_Boolean more = (!queue->closed && !SIMPLEQ_EMPTY(&queue->messages));
+    if(!more)
+        queue->scheduled = false;
+    UA_UNLOCK(queue->mutex);
+    return more;
+}
+
+/* Process the messages queued for the connection. Only one worker at a time is
+ * scheduled per connection. After a batch of messages, the worker is
+ * dispatched again. The queue and the connection are freed with a delayed
+ * callback after the worker has finished. */
 static void
-workerProcessBinaryMessage(UA_Server *server, ConnectionMessage *cm) {
-    processBinaryMessage(server, cm->connection, &cm->message);
-    UA_free(cm);
+workerProcessConnection(UA_Server *server, UA_ConnectionQueue *queue) {
+    UA_ByteString message;
+    for(size_t i = 0; i < UA_CONNECTIONQUEUE_MAXBATCH; i++) {
+        if(!dequeueMessage(queue, &message))
+            return;
+        UA_StatusCode retval = processBinaryMessage(server, queue->connection, &message);
+        UA_free(message.data);
+        /* The connection was closed. Don't process the remaining messages. */
+        if(retval != UA_STATUSCODE_GOOD)
+            closeConnectionQueue(queue);
+    }
+    if(rescheduleQueue(queue))
+        UA_Server_workerCallback(server, (UA_ServerCallback)workerProcessConnection,
+                                 queue);
 }
 
 void
 UA_Server_processBinaryMessage(UA_Server *server, UA_Connection *connection,
                                UA_ByteString *message) {
-    /* Allocate the memory for the callback data */
-    ConnectionMessage *cm = (ConnectionMessage*)UA_malloc(sizeof(ConnectionMessage));
-
-    /* If malloc failed, execute immediately */
-    if(!cm) {
+    /* Process in the current thread if the workers are not running */
+    if(!server->workers) {
         processBinaryMessage(server, connection, message);
         return;
     }
 
+    /* Copy the message into the queue of the connection. The network layer
+     * reuses the buffer. */
+    UA_ConnectionQueue *schedule = NULL;
+    UA_StatusCode retval = enqueueMessage(server, connection, message, &schedule);
+    if(retval != UA_STATUSCODE_GOOD) {
+        UA_LOG_WARNING(server->config.logger, UA_LOGCATEGORY_NETWORK,
+                       "Connection %i | Could not queue the message with "
+                       "error %s, closing the connection", connection->sockfd,
+                       UA_StatusCode_name(retval));
+        connection->close(connection);
+        return;
+    }
+
     /* Dispatch to the workers */
-    cm->connection = connection;
-    cm->message = *message;
-    UA_Server_workerCallback(server, (UA_ServerCallback)workerProcessBinaryMessage, cm);
+    if(schedule)
+        UA_Server_workerCallback(server, (UA_ServerCallback)workerProcessConnection,
+                                 schedule);
 }
 
 static void
@@ -720,14 +1094,61 @@ deleteConnectionTrampoline(UA_Server *server, void *data) {
     UA_Connection *connection = (UA_Connection*)data;
     connection->free(connection);
 }
+
+/* A worker can dispatch itself again for the next batch of messages. It is
+ * then counted in a later epoch than the removal of the connection. The closed
+ * queue makes the worker return right away. The queue is freed once no worker
+ * is scheduled. */
+static void
+deleteConnectionQueueTrampoline(UA_Server *server, void *data) {
+    UA_ConnectionQueue *queue = (UA_ConnectionQueue*)data;
+    UA_LOCK(queue->mutex);
+    UA_Boolean scheduled = queue->scheduled;
+    UA_UNLOCK(queue->mutex);
+    if(scheduled &&
+       UA_Server_delayedCallback(server, deleteConnectionQueueTrampoline,
+                                 queue) == UA_STATUSCODE_GOOD)
+        return;
+    queue->connection->free(queue->connection);
+    UA_ConnectionQueue_delete(queue);
+}
+
+void
+UA_Server_deleteConnectionQueues(UA_Server *server) {
+    for(size_t i = 0; i < server->connectionQueuesSize; i++) {
+        UA_ConnectionQueue *queue;
+        while((queue = LIST_FIRST(&server->connectionQueues[i]))) {
+            LIST_REMOVE(queue, listEntry);
+            UA_ConnectionQueue_delete(queue);
+        }
+    }
+    UA_free(server->connectionQueues);
+    server->connectionQueues = NULL;
+    server->connectionQueuesSize = 0;
+    server->connectionQueuesCount = 0;
+}
 #endif
 
+/* With multithreading, workers may still process a message of the connection
+ * or send on it. The connection is closed for further messages right away.
+ * But it is freed (and the socket closed by the network layer) only after the
+ * workers have let go of the connection. */
 void
 UA_Server_removeConnection(UA_Server *server, UA_Connection *connection) {
-    UA_Connection_detachSecureChannel(connection);
 #ifndef UA_ENABLE_MULTITHREADING
+    UA_Connection_detachSecureChannel(connection);
     connection->free(connection);
 #else
-    UA_Server_delayedCallback(server, deleteConnectionTrampoline, connection);
+    UA_ConnectionQueue *queue = findConnectionQueue(server, connection);
+    if(queue) {
+        LIST_REMOVE(queue, listEntry);
+        server->connectionQueuesCount--;
+        closeConnectionQueue(queue);
+    }
+    UA_Connection_detachSecureChannel(connection);
+    if(queue)
+        UA_Server_delayedCallback(server, deleteConnectionQueueTrampoline, queue);
+    else
+        UA_Server_delayedCallback(server, deleteConnectionTrampoline, connection);
 #endif
 }
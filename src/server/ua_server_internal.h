@@ -16,6 +16,7 @@ extern "C" {
 #include "ua_connection_internal.h"
 #include "ua_session_manager.h"
 #include "ua_securechannel_manager.h"
+#include "ua_types_encoding_binary.h"
 
 #ifdef UA_ENABLE_MULTITHREADING
 
@@ -64,6 +65,22 @@ typedef struct serverOnNetwork_hash_entry {
 #endif /* UA_ENABLE_DISCOVERY_MULTICAST */
 #endif /* UA_ENABLE_DISCOVERY */
 
+/* Index of the subtype closures of the ReferenceTypes and DataTypes. Adding a
+ * type to the hierarchy updates the index. Other changes to the hierarchy
+ * invalidate the index and it is rebuilt from the nodestore on demand. */
+struct UA_SubtypeIndexEntry;
+
+typedef struct {
+    struct UA_SubtypeIndexEntry *entries;
+    size_t entriesSize; /* power of two */
+    size_t typesCount;
+    UA_Boolean dirty;
+    UA_LOCK_TYPE(mutex)
+} UA_SubtypeIndex;
+
+void UA_SubtypeIndex_init(UA_SubtypeIndex *index);
+void UA_SubtypeIndex_deleteMembers(UA_SubtypeIndex *index);
+
 struct UA_Server {
     /* Meta */
     UA_DateTime startTime;
@@ -105,22 +122,57 @@ struct UA_Server {
     size_t namespacesSize;
     UA_String *namespaces;
 
+    /* Hash index over config.customDataTypes */
+    UA_DataTypeIndex customTypesIndex;
+
+    /* Subtype closures of the ReferenceTypes and DataTypes in the nodestore */
+    UA_SubtypeIndex subtypeIndex;
+
+#if defined(UA_ENABLE_REQUEST_ARENA) && !defined(UA_ENABLE_MULTITHREADING)
+    /* Memory of the decoded request. The workers have an arena each. */
+    UA_Arena requestArena;
+#endif
+
     /* Callbacks with a repetition interval */
     UA_Timer timer;
 
+#ifdef UA_ENABLE_SUBSCRIPTIONS
+    /* Hash buckets of the SamplingGroups of the MonitoredItems. The number of
+     * buckets is a power of two. */
+    struct UA_SamplingGroupBucket *samplingGroups;
+    size_t samplingGroupsSize;
+    size_t samplingGroupsCount;
+#endif
+
     /* Delayed callbacks */
     SLIST_HEAD(DelayedCallbacksList, UA_DelayedCallback) delayedCallbacks;
 
     /* Worker threads */
 #ifdef UA_ENABLE_MULTITHREADING
-    /* Dispatch queue head for the worker threads (the tail should not be in the same cache line) */
-    struct cds_wfcq_head dispatchQueue_head;
     UA_Worker *workers; /* there are nThread workers in a running server */
-    pthread_cond_t dispatchQueue_condition; /* so the workers don't spin if the queue is empty */
-    pthread_mutex_t dispatchQueue_mutex; /* mutex for access to condition variable */
-    struct cds_wfcq_tail dispatchQueue_tail; /* Dispatch queue tail for the worker threads */
+    UA_UInt32 dispatchCounter; /* Round-robin target for outside callbacks */
+
+    /* Dispatch epochs for the delayed callbacks. Callbacks dispatched from
+     * outside the workers are counted here. The workers count their own. */
+    UA_UInt32 dispatchEpoch;
+    UA_UInt32 dispatched[2];
+    UA_Byte delayedEpoch; /* Epoch index the waiting callbacks wait for */
+    SLIST_HEAD(DelayedCallbacksWaitingList, UA_DelayedCallback) delayedCallbacksWaiting;
+
+    /* Hash buckets of the queues of received messages per connection. The
+     * number of buckets is a power of two. Only accessed from the main loop
+     * (ua_server_binary.c). */
+    struct UA_ConnectionQueueBucket *connectionQueues;
+    size_t connectionQueuesSize;
+    size_t connectionQueuesCount;
 #endif
 
+    /* The messages of different connections are processed in parallel. The
+     * services that change state beyond the nodestore (sessions,
+     * subscriptions, registered servers) and the callbacks that work on that
+     * state (publishing, sampling, cleanup) are serialized with this mutex. */
+    UA_LOCK_TYPE(serviceMutex)
+
     /* For bootstrapping, omit some consistency checks, creating a reference to
      * the parent and member instantiation */
     UA_Boolean bootstrapNS0;
@@ -173,11 +225,33 @@ UA_StatusCode UA_Server_editNode(UA_Server *server, UA_Session *session,
 UA_StatusCode
 UA_Server_delayedCallback(UA_Server *server, UA_ServerCallback callback, void *data);
 
+/* Frees the memory in a delayed callback. So repeated callbacks that were
+ * dispatched before their removal can still access it. Frees immediately if no
+ * worker threads are running. */
+void
+UA_Server_delayedFree(UA_Server *server, void *data);
+
+#ifdef UA_ENABLE_MULTITHREADING
+/* Remove the message queues of connections that were not removed from the
+ * server (e.g. because the network layer is deleted after the server) */
+void UA_Server_deleteConnectionQueues(UA_Server *server);
+#endif
+
 /* Callback is executed in the same thread or, if possible, dispatched to one of
  * the worker threads. */
 void
 UA_Server_workerCallback(UA_Server *server, UA_ServerCallback callback, void *data);
 
+#ifdef UA_ENABLE_REQUEST_ARENA
+/* Initial chunk size of the arenas for the decoded requests */
+#define UA_REQUEST_ARENA_CHUNKSIZE 8192
+
+/* The arena of the current thread. Returns NULL outside of the worker threads
+ * in a multithreaded server. */
+UA_Arena *
+UA_Server_getRequestArena(UA_Server *server);
+#endif
+
 /*********************/
 /* Utility Functions */
 /*********************/
@@ -199,6 +273,44 @@ isNodeInTree(UA_Nodestore *ns, const UA_NodeId *leafNode,
              const UA_NodeId *nodeToFind, const UA_NodeId *referenceTypeIds,
              size_t referenceTypeIdsSize);
 
+/* Tests whether the type is the supertype or one of its (transitive) subtypes.
+ * ReferenceTypes and DataTypes are looked up in the subtype index. Other types
+ * fall back to isNodeInTree along the HasSubtype references. */
+UA_Boolean
+isSubtypeOf(UA_Server *server, const UA_NodeId *typeId,
+            const UA_NodeId *superTypeId);
+
+/* Keep the subtype index current when HasSubtype references are added. All
+ * other changes to the type hierarchy invalidate the index. */
+void
+UA_Server_addSubtypeToIndex(UA_Server *server, const UA_NodeId *superTypeId,
+                            const UA_NodeId *subTypeId);
+
+void
+UA_Server_invalidateSubtypeIndex(UA_Server *server);
+
+/* The browse name, display name and description of nodes are copied into the
+ * interned string pool if UA_ENABLE_NODESTRING_INTERNING is set. Strings that
+ * are not in the pool are deleted as usual. */
+#ifdef UA_ENABLE_NODESTRING_INTERNING
+UA_StatusCode
+UA_Node_copyQualifiedName(const UA_QualifiedName *src, UA_QualifiedName *dst);
+
+void
+UA_Node_deleteQualifiedName(UA_QualifiedName *qn);
+
+UA_StatusCode
+UA_Node_copyLocalizedText(const UA_LocalizedText *src, UA_LocalizedText *dst);
+
+void
+UA_Node_deleteLocalizedText(UA_LocalizedText *lt);
+#else
+# define UA_Node_copyQualifiedName UA_QualifiedName_copy
+# define UA_Node_deleteQualifiedName UA_QualifiedName_deleteMembers
+# define UA_Node_copyLocalizedText UA_LocalizedText_copy
+# define UA_Node_deleteLocalizedText UA_LocalizedText_deleteMembers
+#endif
+
 /* Returns an array with the hierarchy of type nodes. The returned array starts
  * at the leaf and continues "upwards" in the hierarchy based on the
  * ``hasSubType`` references. Since multiple-inheritance is possible in general,
@@ -283,6 +395,26 @@ UA_Server_readWithSession(UA_Server *server, UA_Session *session,
                           const UA_ReadValueId *item,
                           UA_TimestampsToReturn timestamps);
 
+/* Read with an index range that was parsed beforehand (e.g. once for all
+ * samples of a MonitoredItem). If the range is set, the indexRange string of
+ * the item is only checked to be empty for attributes other than the value. */
+UA_DataValue
+UA_Server_readWithSessionRange(UA_Server *server, UA_Session *session,
+                               const UA_ReadValueId *item,
+                               const UA_NumericRange *range,
+                               UA_TimestampsToReturn timestamps);
+
+/* Does the user access level allow the session to read the value? Also true
+ * if the node is no variable (the read fails for all sessions alike). */
+UA_Boolean
+readValueAllowed(UA_Server *server, UA_Session *session, const UA_NodeId *nodeId);
+
+#ifdef UA_ENABLE_SUBSCRIPTIONS
+/* Remove the SamplingGroups that remain when the server is deleted and detach
+ * them from their MonitoredItems (e.g. those of the adminSession) */
+void UA_Server_deleteSamplingGroups(UA_Server *server);
+#endif
+
 /* Checks if a registration timed out and removes that registration.
  * Should be called periodically in main loop */
 void UA_Discovery_cleanupTimedOut(UA_Server *server, UA_DateTime nowMonotonic);
@@ -0,0 +1,342 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "ua_server_internal.h"
+
+/* Every indexed type gets a dense number. The closure of a type is a bitset
+ * with the numbers of the type and all its (transitive) supertypes. The
+ * entries are stored in a hash map with open addressing and linear probing.
+ * Entries are never removed individually. Removing types or HasSubtype
+ * references invalidates the index. It is then rebuilt from the nodestore
+ * with the next lookup. */
+
+#define UA_SUBTYPEINDEX_MINSIZE 64
+
+struct UA_SubtypeIndexEntry {
+    UA_NodeId typeId;     /* The null NodeId marks an empty slot */
+    UA_UInt32 number;     /* Position of the type in the closures */
+    UA_Boolean hasSubtypes;
+    UA_Byte state;        /* For the closure computation during a rebuild */
+    size_t closureSize;   /* Number of 32bit words */
+    UA_UInt32 *closure;
+};
+
+#define UA_SUBTYPEINDEX_OPEN 0
+#define UA_SUBTYPEINDEX_VISITING 1
+#define UA_SUBTYPEINDEX_DONE 2
+
+static UA_Boolean
+isIndexedNodeClass(UA_NodeClass nodeClass) {
+    return (nodeClass == UA_NODECLASS_REFERENCETYPE ||
+            nodeClass == UA_NODECLASS_DATATYPE);
+}
+
+void
+UA_SubtypeIndex_init(UA_SubtypeIndex *index) {
+    memset(index, 0, sizeof(UA_SubtypeIndex));
+    index->dirty = true; /* Built with the first lookup */
+    UA_LOCK_INIT(index->mutex);
+}
+
+static void
+clearEntries(UA_SubtypeIndex *index) {
+    for(size_t i = 0; i < index->entriesSize; ++i) {
+        UA_NodeId_deleteMembers(&index->entries[i].typeId);
+        UA_free(index->entries[i].closure);
+    }
+    UA_free(index->entries);
+    index->entries = NULL;
+    index->entriesSize = 0;
+    index->typesCount = 0;
+}
+
+void
+UA_SubtypeIndex_deleteMembers(UA_SubtypeIndex *index) {
+    clearEntries(index);
+    UA_LOCK_DESTROY(index->mutex);
+}
+
+static struct UA_SubtypeIndexEntry *
+findEntry(const UA_SubtypeIndex *index, const UA_NodeId *typeId) {
+    if(index->entriesSize == 0)
+        return NULL;
+    size_t mask = index->entriesSize - 1;
+    for(size_t i = UA_NodeId_hash(typeId) & mask;; i = (i + 1) & mask) {
+        struct UA_SubtypeIndexEntry *e = &index->entries[i];
+        if(UA_NodeId_isNull(&e->typeId))
+            return NULL;
+        if(UA_NodeId_equal(&e->typeId, typeId))
+            return e;
+    }
+}
+
+static struct UA_SubtypeIndexEntry *
+emptySlot(struct UA_SubtypeIndexEntry *entries, size_t entriesSize,
+          const UA_NodeId *typeId) {
+    size_t mask = entriesSize - 1;
+    size_t i = UA_NodeId_hash(typeId) & mask;
+    while(!UA_NodeId_isNull(&entries[i].typeId))
+        i = (i + 1) & mask;
+    return &entries[i];
+}
+
+/* The hash map is kept at most half full */
+static UA_StatusCode
+growEntries(UA_SubtypeIndex *index) {
+    size_t size = index->entriesSize * 2;
+    if(size == 0)
+        size = UA_SUBTYPEINDEX_MINSIZE;
+    struct UA_SubtypeIndexEntry *entries = (struct UA_SubtypeIndexEntry*)
+        UA_calloc(size, sizeof(struct UA_SubtypeIndexEntry));
+    if(!entries)
+        return UA_STATUSCODE_BADOUTOFMEMORY;
+    for(size_t i = 0; i < index->entriesSize; ++i) {
+        struct UA_SubtypeIndexEntry *e = &index->entries[i];
+        if(!UA_NodeId_isNull(&e->typeId))
+            *emptySlot(entries, size, &e->typeId) = *e;
+    }
+    UA_free(index->entries);
+    index->entries = entries;
+    index->entriesSize = size;
+    return UA_STATUSCODE_GOOD;
+}
+
+/* Adding an entry moves the existing entries if the hash map grows */
+static struct UA_SubtypeIndexEntry *
+addEntry(UA_SubtypeIndex *index, const UA_NodeId *typeId) {
+    if((index->typesCount + 1) * 2 > index->entriesSize &&
+       growEntries(index) != UA_STATUSCODE_GOOD)
+        return NULL;
+    struct UA_SubtypeIndexEntry *e =
+        emptySlot(index->entries, index->entriesSize, typeId);
+    if(UA_NodeId_copy(typeId, &e->typeId) != UA_STATUSCODE_GOOD)
+        return NULL;
+    e->number = (UA_UInt32)index->typesCount;
+    index->typesCount++;
+    return e;
+}
+
+static UA_StatusCode
+growClosure(struct UA_SubtypeIndexEntry *e, size_t size) {
+    if(size <= e->closureSize)
+        return UA_STATUSCODE_GOOD;
+    UA_UInt32 *closure = (UA_UInt32*)UA_realloc(e->closure, size * sizeof(UA_UInt32));
+    if(!closure)
+        return UA_STATUSCODE_BADOUTOFMEMORY;
+    memset(&closure[e->closureSize], 0, (size - e->closureSize) * sizeof(UA_UInt32));
+    e->closure = closure;
+    e->closureSize = size;
+    return UA_STATUSCODE_GOOD;
+}
+
+static UA_StatusCode
+setBit(struct UA_SubtypeIndexEntry *e, UA_UInt32 number) {
+    UA_StatusCode retval = growClosure(e, (number / 32) + 1);
+    if(retval != UA_STATUSCODE_GOOD)
+        return retval;
+    e->closure[number / 32] |= (UA_UInt32)1 << (number % 32);
+    return UA_STATUSCODE_GOOD;
+}
+
+static UA_Boolean
+testBit(const struct UA_SubtypeIndexEntry *e, UA_UInt32 number) {
+    if(number / 32 >= e->closureSize)
+        return false;
+    return (e->closure[number / 32] & ((UA_UInt32)1 << (number % 32))) != 0;
+}
+
+/* Add the closure of the supertype to the closure of the subtype */
+static UA_StatusCode
+mergeClosure(struct UA_SubtypeIndexEntry *e,
+             const struct UA_SubtypeIndexEntry *superType) {
+    UA_StatusCode retval = growClosure(e, superType->closureSize);
+    if(retval != UA_STATUSCODE_GOOD)
+        return retval;
+    for(size_t i = 0; i < superType->closureSize; ++i)
+        e->closure[i] |= superType->closure[i];
+    return UA_STATUSCODE_GOOD;
+}
+
+/**************/
+/* Rebuilding */
+/**************/
+
+typedef struct {
+    UA_SubtypeIndex *index;
+    UA_StatusCode retval;
+} CollectTypesContext;
+
+static void
+collectTypes(CollectTypesContext *ctx, const UA_Node *node) {
+    if(ctx->retval != UA_STATUSCODE_GOOD || !isIndexedNodeClass(node->nodeClass))
+        return;
+    if(!addEntry(ctx->index, &node->nodeId))
+        ctx->retval = UA_STATUSCODE_BADOUTOFMEMORY;
+}
+
+/* Depth-first along the inverse HasSubtype references. The entries do not move
+ * as no entries are added during the computation. */
+static UA_StatusCode
+computeClosure(UA_Server *server, UA_SubtypeIndex *index,
+               struct UA_SubtypeIndexEntry *e) {
+    /* Done or a cycle in the (invalid) type hierarchy */
+    if(e->state != UA_SUBTYPEINDEX_OPEN)
+        return UA_STATUSCODE_GOOD;
+    e->state = UA_SUBTYPEINDEX_VISITING;
+
+    UA_StatusCode retval = setBit(e, e->number);
+    const UA_Node *node = UA_Nodestore_get(server, &e->typeId);
+    if(!node) {
+        e->state = UA_SUBTYPEINDEX_DONE;
+        return retval;
+    }
+
+    for(size_t i = 0; i < node->referencesSize && retval == UA_STATUSCODE_GOOD; ++i) {
+        const UA_NodeReferenceKind *rk = &node->references[i];
+        if(!rk->isInverse || !UA_NodeId_equal(&rk->referenceTypeId, &subtypeId))
+            continue;
+        for(size_t j = 0; j < rk->targetIdsSize; ++j) {
+            struct UA_SubtypeIndexEntry *superType =
+                findEntry(index, &rk->targetIds[j].nodeId);
+            if(!superType)
+                continue;
+            superType->hasSubtypes = true;
+            retval = computeClosure(server, index, superType);
+            retval |= mergeClosure(e, superType);
+            if(retval != UA_STATUSCODE_GOOD)
+                break;
+        }
+    }
+
+    UA_Nodestore_release(server, node);
+    e->state = UA_SUBTYPEINDEX_DONE;
+    return retval;
+}
+
+static UA_StatusCode
+rebuild(UA_Server *server, UA_SubtypeIndex *index) {
+    clearEntries(index);
+
+    /* Number all types in the nodestore */
+    CollectTypesContext ctx = {index, UA_STATUSCODE_GOOD};
+    server->config.nodestore.iterate(server->config.nodestore.context, &ctx,
+                                     (UA_NodestoreVisitor)collectTypes);
+    if(ctx.retval != UA_STATUSCODE_GOOD) {
+        clearEntries(index);
+        return ctx.retval;
+    }
+
+    /* Compute the closures */
+    for(size_t i = 0; i < index->entriesSize; ++i) {
+        struct UA_SubtypeIndexEntry *e = &index->entries[i];
+        if(UA_NodeId_isNull(&e->typeId))
+            continue;
+        UA_StatusCode retval = computeClosure(server, index, e);
+        if(retval != UA_STATUSCODE_GOOD) {
+            clearEntries(index);
+            return retval;
+        }
+    }
+
+    index->dirty = false;
+    return UA_STATUSCODE_GOOD;
+}
+
+/***********/
+/* Updates */
+/***********/
+
+void
+UA_Server_addSubtypeToIndex(UA_Server *server, const UA_NodeId *superTypeId,
+                            const UA_NodeId *subTypeId) {
+    UA_SubtypeIndex *index = &server->subtypeIndex;
+    UA_LOCK(index->mutex);
+    if(index->dirty)
+        goto unlock; /* Rebuilt anyway */
+
+    /* The closures of the existing subtypes would change as well */
+    struct UA_SubtypeIndexEntry *subType = findEntry(index, subTypeId);
+    if(subType && subType->hasSubtypes) {
+        index->dirty = true;
+        goto unlock;
+    }
+
+    /* A type without an entry has no supertypes yet. Types are indexed when
+     * they are linked into the hierarchy. Adding entries may move the
+     * entries. So they are looked up again afterwards. */
+    UA_StatusCode retval = UA_STATUSCODE_GOOD;
+    struct UA_SubtypeIndexEntry *superType = findEntry(index, superTypeId);
+    if(!superType) {
+        const UA_Node *node = UA_Nodestore_get(server, superTypeId);
+        if(!node)
+            goto unlock;
+        UA_Boolean indexed = isIndexedNodeClass(node->nodeClass);
+        UA_Nodestore_release(server, node);
+        if(!indexed)
+            goto unlock;
+        superType = addEntry(index, superTypeId);
+        if(!superType) {
+            index->dirty = true;
+            goto unlock;
+        }
+        retval = setBit(superType, superType->number);
+    }
+    superType->hasSubtypes = true;
+
+    /* Index the subtype */
+    if(!subType) {
+        subType = addEntry(index, subTypeId);
+        if(!subType) {
+            index->dirty = true;
+            goto unlock;
+        }
+        retval |= setBit(subType, subType->number);
+    }
+    subType = findEntry(index, subTypeId);
+    superType = findEntry(index, superTypeId);
+
+    retval |= mergeClosure(subType, superType);
+    if(retval != UA_STATUSCODE_GOOD)
+        index->dirty = true;
+
+ unlock:
+    UA_UNLOCK(index->mutex);
+}
+
+void
+UA_Server_invalidateSubtypeIndex(UA_Server *server) {
+    UA_LOCK(server->subtypeIndex.mutex);
+    server->subtypeIndex.dirty = true;
+    UA_UNLOCK(server->subtypeIndex.mutex);
+}
+
+/**********/
+/* Lookup */
+/**********/
+
+UA_Boolean
+isSubtypeOf(UA_Server *server, const UA_NodeId *typeId,
+            const UA_NodeId *superTypeId) {
+    if(UA_NodeId_equal(typeId, superTypeId))
+        return true;
+
+    UA_SubtypeIndex *index = &server->subtypeIndex;
+    UA_Boolean indexed = false;
+    UA_Boolean result = false;
+    UA_LOCK(index->mutex);
+    if(!index->dirty || rebuild(server, index) == UA_STATUSCODE_GOOD) {
+        const struct UA_SubtypeIndexEntry *e = findEntry(index, typeId);
+        const struct UA_SubtypeIndexEntry *superType = findEntry(index, superTypeId);
+        if(e && superType) {
+            indexed = true;
+            result = testBit(e, superType->number);
+        }
+    }
+    UA_UNLOCK(index->mutex);
+    if(indexed)
+        return result;
+
+    /* Not an indexed type (or out of memory). Walk the hierarchy. */
+    return isNodeInTree(&server->config.nodestore, typeId, superTypeId, &subtypeId, 1);
+}
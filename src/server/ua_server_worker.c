@@ -8,92 +8,288 @@
 #define UA_MAXTIMEOUT 50 /* Max timeout in ms between main-loop iterations */
 
 /**
- * Worker Threads and Dispatch Queue
- * ---------------------------------
- * The worker threads dequeue callbacks from a central Multi-Producer
- * Multi-Consumer Queue (MPMC). When there are no callbacks, workers go idle.
- * The condition to wake them up is triggered whenever a callback is
- * dispatched.
+ * Worker Threads and Work Stealing
+ * --------------------------------
+ * Every worker owns a Chase-Lev deque for the callbacks that are dispatched
+ * from within the worker itself. The owner pushes and takes at the bottom
+ * (LIFO, cache-warm), idle workers steal from the top. Callbacks dispatched
+ * from outside the workers (network layer, timer) go to the MPMC inbox of a
+ * parked worker (or round-robin if all workers are busy). Workers that find no
+ * work anywhere park on their own condition. A dispatch wakes up at most one
+ * worker.
  *
- * Future Plans: Use work-stealing to load-balance between cores.
  * Le, Nhat Minh, et al. "Correct and efficient work-stealing for weak memory
  * models." ACM SIGPLAN Notices. Vol. 48. No. 8. ACM, 2013. */
 
 #ifdef UA_ENABLE_MULTITHREADING
 
+typedef struct {
+    struct cds_wfcq_node node;
+    UA_ServerCallback callback;
+    void *data;
+    UA_Byte epoch; /* Dispatch epoch (index) for the delayed callbacks */
+} WorkerCallback;
+
+/* Must be a power of two. When the deque is full, the worker dispatches to
+ * the inbox instead. */
+#define UA_WORKDEQUE_SIZE 256
+
+typedef struct {
+    long top; /* Thieves take from the top */
+    char padding[64 - sizeof(long)]; /* separate cache lines */
+    long bottom; /* The owner pushes and takes at the bottom */
+    WorkerCallback *buffer[UA_WORKDEQUE_SIZE];
+} UA_WorkDeque;
+
 struct UA_Worker {
     UA_Server *server;
     pthread_t thr;
-    UA_UInt32 counter;
     volatile UA_Boolean running;
 
+    UA_WorkDeque deque;
+
+    /* Callbacks dispatched from outside the workers */
+    struct cds_wfcq_head inbox_head;
+    struct cds_wfcq_tail inbox_tail;
+
+    /* A parked worker waits for the condition. Only the dispatcher that
+     * resets parked from 1 to 0 signals the condition. */
+    UA_UInt32 parked;
+    pthread_mutex_t parkMutex;
+    pthread_cond_t parkCondition;
+
+    /* Callbacks dispatched and finished by this worker (per epoch index).
+     * Written only by the worker itself. */
+    UA_UInt32 dispatched[2];
+    UA_UInt32 finished[2];
+
+#ifdef UA_ENABLE_REQUEST_ARENA
+    UA_Arena requestArena;
+#endif
+
     /* separate cache lines */
-    char padding[64 - sizeof(void*) - sizeof(pthread_t) -
-                 sizeof(UA_UInt32) - sizeof(UA_Boolean)];
+    char padding[64];
 };
 
-typedef struct {
-    struct cds_wfcq_node node;
-    UA_ServerCallback callback;
-    void *data;
+/* The worker of the current thread (or NULL) */
+static UA_THREAD_LOCAL UA_Worker *currentWorker = NULL;
+
+/* Owner only. Returns false if the deque is full. */
+static UA_Boolean
+WorkDeque_push(UA_WorkDeque *dq, WorkerCallback *dc) {
+    long b = CMM_LOAD_SHARED(dq->bottom);
+    long t = CMM_LOAD_SHARED(dq->top);
+    if(b - t >= UA_WORKDEQUE_SIZE)
+        return false;
+    CMM_STORE_SHARED(dq->buffer[b & (UA_WORKDEQUE_SIZE - 1)], dc);
+    cmm_smp_wmb(); /* The entry is visible before the new bottom */
+    CMM_STORE_SHARED(dq->bottom, b + 1);
+    return true;
+}
+
+/* Owner only. Takes the most recently pushed callback. */
+static WorkerCallback *
+WorkDeque_take(UA_WorkDeque *dq) {
+    long b = CMM_LOAD_SHARED(dq->bottom) - 1;
+    CMM_STORE_SHARED(dq->bottom, b);
+    cmm_smp_mb(); /* Publish the bottom before reading the top */
+    long t = CMM_LOAD_SHARED(dq->top);
+    if(t > b) {
+        /* Empty */
+        CMM_STORE_SHARED(dq->bottom, b + 1);
+        return NULL;
+    }
+    WorkerCallback *dc = CMM_LOAD_SHARED(dq->buffer[b & (UA_WORKDEQUE_SIZE - 1)]);
+    if(t == b) {
+        /* The last entry. Race against the thieves. */
+        if(uatomic_cmpxchg(&dq->top, t, t + 1) != t)
+            dc = NULL;
+        CMM_STORE_SHARED(dq->bottom, b + 1);
+    }
+    return dc;
+}
+
+/* Any thread. Takes the oldest callback. Returns NULL if the deque is empty or
+ * if the race against another thief (or the owner) was lost. */
+static WorkerCallback *
+WorkDeque_steal(UA_WorkDeque *dq) {
+    long t = CMM_LOAD_SHARED(dq->top);
+    cmm_smp_mb(); /* Read the top before the bottom */
+    long b = CMM_LOAD_SHARED(dq->bottom);
+    if(t >= b)
+        return NULL;
+    WorkerCallback *dc = CMM_LOAD_SHARED(dq->buffer[t & (UA_WORKDEQUE_SIZE - 1)]);
+    if(uatomic_cmpxchg(&dq->top, t, t + 1) != t)
+        return NULL;
+    return dc;
+}
+
+static WorkerCallback *
+dequeueInbox(UA_Worker *worker) {
+    if(cds_wfcq_empty(&worker->inbox_head, &worker->inbox_tail))
+        return NULL;
+    return (WorkerCallback*)
+        cds_wfcq_dequeue_blocking(&worker->inbox_head, &worker->inbox_tail);
+}
+
+/* Own deque first, then the own inbox, then steal starting from a random
+ * victim */
+static WorkerCallback *
+findWork(UA_Worker *worker) {
+    WorkerCallback *dc = WorkDeque_take(&worker->deque);
+    if(dc)
+        return dc;
+    dc = dequeueInbox(worker);
+    if(dc)
+        return dc;
+
+    UA_Server *server = worker->server;
+    size_t nThreads = server->config.nThreads;
+    size_t start = UA_UInt32_random() % nThreads;
+    for(size_t i = 0; i < nThreads; ++i) {
+        UA_Worker *victim = &server->workers[(start + i) % nThreads];
+        if(victim == worker)
+            continue;
+        dc = WorkDeque_steal(&victim->deque);
+        if(dc)
+            return dc;
+        dc = dequeueInbox(victim);
+        if(dc)
+            return dc;
+    }
+    return NULL;
+}
+
+/* Returns true if the worker was parked and is now signaled */
+static UA_Boolean
+unparkWorker(UA_Worker *worker) {
+    if(uatomic_cmpxchg(&worker->parked, 1, 0) != 1)
+        return false;
+    pthread_mutex_lock(&worker->parkMutex);
+    pthread_cond_signal(&worker->parkCondition);
+    pthread_mutex_unlock(&worker->parkMutex);
+    return true;
+}
+
+static UA_Worker *
+findParkedWorker(UA_Server *server) {
+    for(size_t i = 0; i < server->config.nThreads; ++i) {
+        if(CMM_LOAD_SHARED(server->workers[i].parked))
+            return &server->workers[i];
+    }
+    return NULL;
+}
 
-    UA_Boolean delayed;         /* Is it a delayed callback? */
-    UA_Boolean countersSampled; /* Have the worker counters been sampled? */
-    UA_UInt32 workerCounters[]; /* Counter value for each worker */
-} WorkerCallback; 
+static void
+countDispatched(UA_Server *server, UA_Worker *self, UA_Byte epoch, UA_UInt32 diff) {
+    if(self)
+        CMM_STORE_SHARED(self->dispatched[epoch], self->dispatched[epoch] + diff);
+    else
+        uatomic_add(&server->dispatched[epoch], diff);
+}
 
-/* Forward Declaration */
+/* Can be called from any thread */
 static void
-processDelayedCallback(UA_Server *server, WorkerCallback *dc);
+dispatch(UA_Server *server, WorkerCallback *dc) {
+    /* Count the callback for the current epoch. The epoch is checked again
+     * after counting. If the main loop has flipped the epoch in between, it
+     * might have already compared the counters of the old epoch. Then the
+     * count is moved to the new epoch. */
+    UA_Worker *self = currentWorker;
+    if(self && self->server != server)
+        self = NULL;
+    while(true) {
+        UA_UInt32 epoch = CMM_LOAD_SHARED(server->dispatchEpoch);
+        dc->epoch = (UA_Byte)(epoch & 1);
+        countDispatched(server, self, dc->epoch, 1);
+        cmm_smp_mb(); /* Count before reading the epoch again */
+        if(CMM_LOAD_SHARED(server->dispatchEpoch) == epoch)
+            break;
+        countDispatched(server, self, dc->epoch, (UA_UInt32)-1);
+    }
+
+    /* Push to the own deque and wake up one parked worker to steal */
+    if(self && WorkDeque_push(&self->deque, dc)) {
+        cmm_smp_mb(); /* Publish the entry before looking for parked workers */
+        UA_Worker *target = findParkedWorker(server);
+        while(target && !unparkWorker(target))
+            target = findParkedWorker(server);
+        return;
+    }
+
+    /* Enqueue in the inbox of a parked worker, or round-robin */
+    UA_Worker *target = findParkedWorker(server);
+    if(!target) {
+        UA_UInt32 next = uatomic_add_return(&server->dispatchCounter, 1);
+        target = &server->workers[next % server->config.nThreads];
+    }
+    cds_wfcq_node_init(&dc->node);
+    cds_wfcq_enqueue(&target->inbox_head, &target->inbox_tail, &dc->node);
+    unparkWorker(target);
+}
+
+static void
+processCallback(UA_Worker *worker, WorkerCallback *dc) {
+    dc->callback(worker->server, dc->data);
+    cmm_smp_mb(); /* The callback is done before it is counted as finished */
+    CMM_STORE_SHARED(worker->finished[dc->epoch],
+                     worker->finished[dc->epoch] + 1);
+    UA_free(dc);
+}
 
 static void *
 workerLoop(UA_Worker *worker) {
     UA_Server *server = worker->server;
-    UA_UInt32 *counter = &worker->counter;
     volatile UA_Boolean *running = &worker->running;
+    currentWorker = worker;
 
     /* Initialize the (thread local) random seed with the ram address
      * of the worker. Not for security-critical entropy! */
     UA_random_seed((uintptr_t)worker);
 
     while(*running) {
-        UA_atomic_add(counter, 1);
-        WorkerCallback *dc = (WorkerCallback*)
-            cds_wfcq_dequeue_blocking(&server->dispatchQueue_head,
-                                      &server->dispatchQueue_tail);
+        WorkerCallback *dc = findWork(worker);
         if(!dc) {
-            /* Nothing to do. Sleep until a callback is dispatched */
-            pthread_mutex_lock(&server->dispatchQueue_mutex);
-            pthread_cond_wait(&server->dispatchQueue_condition,
-                              &server->dispatchQueue_mutex);
-            pthread_mutex_unlock(&server->dispatchQueue_mutex);
-            continue;
+            /* Announce that we park and look once more. Dispatchers that
+             * enqueue afterwards see the flag and signal. */
+            pthread_mutex_lock(&worker->parkMutex);
+            uatomic_set(&worker->parked, 1);
+            cmm_smp_mb();
+            dc = findWork(worker);
+            while(!dc && uatomic_read(&worker->parked) && *running)
+                pthread_cond_wait(&worker->parkCondition, &worker->parkMutex);
+            uatomic_set(&worker->parked, 0);
+            pthread_mutex_unlock(&worker->parkMutex);
+            if(!dc)
+                continue;
         }
-
-        if(dc->delayed) {
-            processDelayedCallback(server, dc);
-            continue;
-        }
-        
-        dc->callback(server, dc->data);
-        UA_free(dc);
+        processCallback(worker, dc);
     }
 
+    currentWorker = NULL;
     UA_LOG_DEBUG(server->config.logger, UA_LOGCATEGORY_SERVER,
                  "Worker shut down");
     return NULL;
 }
 
+/* The workers are stopped. Execute the remaining callbacks (that can dispatch
+ * further callbacks) from the main thread. */
 static void
 emptyDispatchQueue(UA_Server *server) {
-    while(!cds_wfcq_empty(&server->dispatchQueue_head,
-                          &server->dispatchQueue_tail)) {
-        WorkerCallback *dc = (WorkerCallback*)
-            cds_wfcq_dequeue_blocking(&server->dispatchQueue_head,
-                                      &server->dispatchQueue_tail);
-        dc->callback(server, dc->data);
-        UA_free(dc);
-    }
+    UA_Boolean found;
+    do {
+        found = false;
+        for(size_t i = 0; i < server->config.nThreads; ++i) {
+            UA_Worker *worker = &server->workers[i];
+            WorkerCallback *dc;
+            while((dc = WorkDeque_steal(&worker->deque)) ||
+                  (dc = dequeueInbox(worker))) {
+                dc->callback(server, dc->data);
+                UA_free(dc);
+                found = true;
+            }
+        }
+    } while(found);
 }
 
 #endif
@@ -112,6 +308,12 @@ UA_Server_workerCallback(UA_Server *server, UA_ServerCallback callback,
     /* Execute immediately */
     callback(server, data);
 #else
+    /* Execute immediately if there are no workers (yet) */
+    if(!server->workers || server->config.nThreads == 0) {
+        callback(server, data);
+        return;
+    }
+
     /* Execute immediately if memory could not be allocated */
     WorkerCallback *dc = (WorkerCallback*)UA_malloc(sizeof(WorkerCallback));
     if(!dc) {
@@ -119,18 +321,26 @@ UA_Server_workerCallback(UA_Server *server, UA_ServerCallback callback,
         return;
     }
 
-    /* Enqueue for the worker threads */
     dc->callback = callback;
     dc->data = data;
-    dc->delayed = false;
-    cds_wfcq_node_init(&dc->node);
-    cds_wfcq_enqueue(&server->dispatchQueue_head,
-                     &server->dispatchQueue_tail, &dc->node);
+    dispatch(server, dc);
+#endif
+}
 
-    /* Wake up sleeping workers */
-    pthread_cond_broadcast(&server->dispatchQueue_condition);
+#ifdef UA_ENABLE_REQUEST_ARENA
+UA_Arena *
+UA_Server_getRequestArena(UA_Server *server) {
+#ifndef UA_ENABLE_MULTITHREADING
+    return &server->requestArena;
+#else
+    /* Callbacks that are executed outside the workers (e.g. when the dispatch
+     * failed) decode onto the heap */
+    if(!currentWorker)
+        return NULL;
+    return &currentWorker->requestArena;
 #endif
 }
+#endif
 
 /**
  * Delayed Callbacks
@@ -139,18 +349,19 @@ UA_Server_workerCallback(UA_Server *server, UA_ServerCallback callback,
  * Delayed Callbacks are called only when all callbacks that were dispatched
  * prior are finished. In the single-threaded case, the callback is added to a
  * singly-linked list that is processed at the end of the server's main-loop. In
- * the multi-threaded case, the delay is ensure by a three-step procedure:
+ * the multi-threaded case, the delay is ensured with dispatch epochs:
  *
- * 1. The delayed callback is dispatched to the worker queue. So it is only
- *    dequeued when all prior callbacks have been dequeued.
+ * 1. Every dispatched callback is counted (per worker) for the current epoch
+ *    index (0 or 1). When it is done, the worker counts it as finished.
  *
- * 2. When the callback is first dequeued by a worker, sample the counter of all
- *    workers. Once all counters have advanced, the callback is ready.
+ * 2. The main loop takes the list of new delayed callbacks and flips the epoch.
+ *    Callbacks dispatched prior to the delayed callbacks are counted for the
+ *    old epoch index. A dispatcher re-reads the epoch after counting. If it
+ *    changed, the count moves to the new epoch. So the main loop never misses
+ *    a callback counted for the old epoch index.
  *
- * 3. Check regularly if the callback is ready by adding it back to the dispatch
- *    queue. */
-
-#ifndef UA_ENABLE_MULTITHREADING
+ * 3. Once dispatched == finished for the old epoch index, the delayed
+ *    callbacks are executed and the next epoch can be started. */
 
 typedef struct UA_DelayedCallback {
     SLIST_ENTRY(UA_DelayedCallback) next;
@@ -158,6 +369,25 @@ typedef struct UA_DelayedCallback {
     void *data;
 } UA_DelayedCallback;
 
+#ifdef UA_ENABLE_MULTITHREADING
+static void
+freeTrampoline(UA_Server *server, void *data) {
+    UA_free(data);
+}
+#endif
+
+void
+UA_Server_delayedFree(UA_Server *server, void *data) {
+#ifdef UA_ENABLE_MULTITHREADING
+    if(server->workers &&
+       UA_Server_delayedCallback(server, freeTrampoline, data) == UA_STATUSCODE_GOOD)
+        return;
+#endif
+    UA_free(data);
+}
+
+#ifndef UA_ENABLE_MULTITHREADING
+
 UA_StatusCode
 UA_Server_delayedCallback(UA_Server *server, UA_ServerCallback callback,
                           void *data) {
@@ -187,70 +417,72 @@ processDelayedCallbacks(UA_Server *server) {
 UA_StatusCode
 UA_Server_delayedCallback(UA_Server *server, UA_ServerCallback callback,
                           void *data) {
-    size_t dcsize = sizeof(WorkerCallback) +
-        (sizeof(UA_UInt32) * server->config.nThreads);
-    WorkerCallback *dc = (WorkerCallback*)UA_malloc(dcsize);
+    UA_DelayedCallback *dc =
+        (UA_DelayedCallback*)UA_malloc(sizeof(UA_DelayedCallback));
     if(!dc)
         return UA_STATUSCODE_BADOUTOFMEMORY;
 
-    /* Enqueue for the worker threads */
     dc->callback = callback;
     dc->data = data;
-    dc->delayed = true;
-    dc->countersSampled = false;
-    cds_wfcq_node_init(&dc->node);
-    cds_wfcq_enqueue(&server->dispatchQueue_head,
-                     &server->dispatchQueue_tail, &dc->node);
 
-    /* Wake up sleeping workers */
-    pthread_cond_broadcast(&server->dispatchQueue_condition);
+    /* Lock-free push to the list head */
+    UA_DelayedCallback *first;
+    do {
+        first = CMM_LOAD_SHARED(server->delayedCallbacks.slh_first);
+        dc->next.sle_next = first;
+    } while(uatomic_cmpxchg(&server->delayedCallbacks.slh_first,
+                            first, dc) != first);
     return UA_STATUSCODE_GOOD;
 }
 
-/* Called from the worker loop */
-static void
-processDelayedCallback(UA_Server *server, WorkerCallback *dc) {
-    /* Set the worker counters */
-    if(!dc->countersSampled) {
-        for(size_t i = 0; i < server->config.nThreads; ++i)
-            dc->workerCounters[i] = server->workers[i].counter;
-        dc->countersSampled = true;
-
-        /* Re-add to the dispatch queue */
-        cds_wfcq_node_init(&dc->node);
-        cds_wfcq_enqueue(&server->dispatchQueue_head,
-                         &server->dispatchQueue_tail, &dc->node);
+/* Have all callbacks dispatched for the epoch index finished? */
+static UA_Boolean
+epochFinished(UA_Server *server, UA_Byte epoch) {
+    if(!server->workers)
+        return true;
+
+    /* Read the finished counters first. Callbacks that are dispatched in
+     * between are counted only as dispatched. */
+    UA_UInt32 finished = 0;
+    for(size_t i = 0; i < server->config.nThreads; ++i)
+        finished += CMM_LOAD_SHARED(server->workers[i].finished[epoch]);
+    cmm_smp_mb();
+    UA_UInt32 dispatched = uatomic_read(&server->dispatched[epoch]);
+    for(size_t i = 0; i < server->config.nThreads; ++i)
+        dispatched += CMM_LOAD_SHARED(server->workers[i].dispatched[epoch]);
+    return (finished == dispatched);
+}
 
-        /* Wake up sleeping workers */
-        pthread_cond_broadcast(&server->dispatchQueue_condition);
-        return;
+static void
+executeDelayedCallbacks(UA_Server *server, UA_DelayedCallback *dc) {
+    while(dc) {
+        UA_DelayedCallback *next = dc->next.sle_next;
+        dc->callback(server, dc->data);
+        UA_free(dc);
+        dc = next;
     }
+}
 
-    /* Have all other jobs finished? */
-    UA_Boolean ready = true;
-    for(size_t i = 0; i < server->config.nThreads; ++i) {
-        if(dc->workerCounters[i] == server->workers[i].counter) {
-            ready = false;
-            break;
-        }
+/* Called from the main loop */
+static void
+processDelayedCallbacks(UA_Server *server) {
+    /* Wait until the epoch of the waiting callbacks is finished */
+    if(server->delayedCallbacksWaiting.slh_first) {
+        if(!epochFinished(server, server->delayedEpoch))
+            return;
+        UA_DelayedCallback *dc = server->delayedCallbacksWaiting.slh_first;
+        server->delayedCallbacksWaiting.slh_first = NULL;
+        executeDelayedCallbacks(server, dc);
     }
 
-    /* Re-add to the dispatch queue.
-     * TODO: What is the impact of this loop?
-     * Can we add a small delay here? */
-    if(!ready) {
-        cds_wfcq_node_init(&dc->node);
-        cds_wfcq_enqueue(&server->dispatchQueue_head,
-                         &server->dispatchQueue_tail, &dc->node);
-
-        /* Wake up sleeping workers */
-        pthread_cond_broadcast(&server->dispatchQueue_condition);
+    /* Take the new delayed callbacks and start the next epoch */
+    UA_DelayedCallback *dc = (UA_DelayedCallback*)
+        uatomic_xchg(&server->delayedCallbacks.slh_first, NULL);
+    if(!dc)
         return;
-    }
-        
-    /* Execute the callback */
-    dc->callback(server, dc->data);
-    UA_free(dc);
+    server->delayedCallbacksWaiting.slh_first = dc;
+    server->delayedEpoch = (UA_Byte)(CMM_LOAD_SHARED(server->dispatchEpoch) & 1);
+    uatomic_inc(&server->dispatchEpoch);
 }
 
 #endif
@@ -278,18 +510,26 @@ UA_Server_run_startup(UA_Server *server) {
 #ifdef UA_ENABLE_MULTITHREADING
     UA_LOG_INFO(server->config.logger, UA_LOGCATEGORY_SERVER,
                 "Spinning up %u worker thread(s)", server->config.nThreads);
-    pthread_cond_init(&server->dispatchQueue_condition, 0);
-    pthread_mutex_init(&server->dispatchQueue_mutex, 0);
-    server->workers = (UA_Worker*)UA_malloc(server->config.nThreads * sizeof(UA_Worker));
-    if(!server->workers)
+    UA_Worker *workers = (UA_Worker*)
+        UA_calloc(server->config.nThreads, sizeof(UA_Worker));
+    if(!workers)
         return UA_STATUSCODE_BADOUTOFMEMORY;
     for(size_t i = 0; i < server->config.nThreads; ++i) {
-        UA_Worker *worker = &server->workers[i];
+        UA_Worker *worker = &workers[i];
         worker->server = server;
-        worker->counter = 0;
         worker->running = true;
-        pthread_create(&worker->thr, NULL, (void* (*)(void*))workerLoop, worker);
+        cds_wfcq_init(&worker->inbox_head, &worker->inbox_tail);
+        pthread_mutex_init(&worker->parkMutex, NULL);
+        pthread_cond_init(&worker->parkCondition, NULL);
+#ifdef UA_ENABLE_REQUEST_ARENA
+        UA_Arena_init(&worker->requestArena, UA_REQUEST_ARENA_CHUNKSIZE);
+#endif
     }
+    /* Workers steal from each other. Publish all before starting the first. */
+    server->workers = workers;
+    for(size_t i = 0; i < server->config.nThreads; ++i)
+        pthread_create(&workers[i].thr, NULL,
+                       (void* (*)(void*))workerLoop, &workers[i]);
 #endif
 
     /* Start the multicast discovery server */
@@ -324,11 +564,9 @@ UA_Server_run_iterate(UA_Server *server, UA_Boolean waitInternal) {
         nl->listen(nl, server, timeout);
     }
 
-#ifndef UA_ENABLE_MULTITHREADING
     /* Process delayed callbacks when all callbacks and
      * network events are done */
     processDelayedCallbacks(server);
-#endif
 
 #if defined(UA_ENABLE_DISCOVERY_MULTICAST) && !defined(UA_ENABLE_MULTITHREADING)
     if(server->config.applicationDescription.applicationType ==
@@ -370,19 +608,42 @@ UA_Server_run_shutdown(UA_Server *server) {
         UA_LOG_INFO(server->config.logger, UA_LOGCATEGORY_SERVER,
                     "Shutting down %u worker thread(s)",
                     server->config.nThreads);
-        for(size_t i = 0; i < server->config.nThreads; ++i)
-            server->workers[i].running = false;
-        pthread_cond_broadcast(&server->dispatchQueue_condition);
+        for(size_t i = 0; i < server->config.nThreads; ++i) {
+            UA_Worker *worker = &server->workers[i];
+            pthread_mutex_lock(&worker->parkMutex);
+            worker->running = false;
+            uatomic_set(&worker->parked, 0);
+            pthread_cond_signal(&worker->parkCondition);
+            pthread_mutex_unlock(&worker->parkMutex);
+        }
         for(size_t i = 0; i < server->config.nThreads; ++i)
             pthread_join(server->workers[i].thr, NULL);
+
+        /* Execute the remaining callbacks in the dispatch queues */
+        emptyDispatchQueue(server);
+
+        for(size_t i = 0; i < server->config.nThreads; ++i) {
+            pthread_mutex_destroy(&server->workers[i].parkMutex);
+            pthread_cond_destroy(&server->workers[i].parkCondition);
+#ifdef UA_ENABLE_REQUEST_ARENA
+            UA_Arena_deleteMembers(&server->workers[i].requestArena);
+#endif
+        }
         UA_free(server->workers);
         server->workers = NULL;
+        server->dispatched[0] = 0;
+        server->dispatched[1] = 0;
     }
 
-    /* Execute the remaining callbacks in the dispatch queue.
-     * This also executes the delayed callbacks. */
-    emptyDispatchQueue(server);
-    
+    /* Execute the remaining delayed callbacks. They can add new delayed
+     * callbacks. */
+    UA_DelayedCallback *dc = server->delayedCallbacksWaiting.slh_first;
+    server->delayedCallbacksWaiting.slh_first = NULL;
+    do {
+        executeDelayedCallbacks(server, dc);
+        dc = (UA_DelayedCallback*)
+            uatomic_xchg(&server->delayedCallbacks.slh_first, NULL);
+    } while(dc);
 #endif
 
     /* Stop multicast discovery */
@@ -297,6 +297,13 @@ void Service_Read(UA_Server *server, UA_Session *session,
                   const UA_ReadRequest *request,
                   UA_ReadResponse *response);
 
+/* Same as Service_Read. But the ReadResponse is encoded into the message as
+ * the results are produced. So the array of results is never allocated. The
+ * requestHandle and timestamp in the response header are set by the caller. */
+UA_StatusCode
+Service_Read_stream(UA_Server *server, UA_Session *session, UA_MessageContext *mc,
+                    const UA_ReadRequest *request, UA_ResponseHeader *responseHeader);
+
 /**
  * Write Service
  * ^^^^^^^^^^^^^
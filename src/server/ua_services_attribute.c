@@ -77,7 +77,7 @@ readIsAbstractAttribute(const UA_Node *node, UA_Variant *v) {
 static UA_StatusCode
 readValueAttributeFromNode(UA_Server *server, UA_Session *session,
                            const UA_VariableNode *vn, UA_DataValue *v,
-                           UA_NumericRange *rangeptr) {
+                           const UA_NumericRange *rangeptr) {
     if(vn->value.data.callback.onRead) {
         vn->value.data.callback.onRead(server, &session->sessionId,
                                        session->sessionHandle, &vn->nodeId,
@@ -98,7 +98,7 @@ static UA_StatusCode
 readValueAttributeFromDataSource(UA_Server *server, UA_Session *session,
                                  const UA_VariableNode *vn, UA_DataValue *v,
                                  UA_TimestampsToReturn timestamps,
-                                 UA_NumericRange *rangeptr) {
+                                 const UA_NumericRange *rangeptr) {
     if(!vn->value.dataSource.read)
         return UA_STATUSCODE_BADINTERNALERROR;
     UA_Boolean sourceTimeStamp = (timestamps == UA_TIMESTAMPSTORETURN_SOURCE ||
@@ -107,15 +107,17 @@ readValueAttributeFromDataSource(UA_Server *server, UA_Session *session,
                                      &vn->nodeId, vn->context, sourceTimeStamp, rangeptr, v);
 }
 
+/* The index range is parsed from the string unless a parsed range is given */
 static UA_StatusCode
 readValueAttributeComplete(UA_Server *server, UA_Session *session,
                            const UA_VariableNode *vn, UA_TimestampsToReturn timestamps,
-                           const UA_String *indexRange, UA_DataValue *v) {
+                           const UA_String *indexRange, const UA_NumericRange *parsedRange,
+                           UA_DataValue *v) {
     /* Compute the index range */
     UA_NumericRange range;
-    UA_NumericRange *rangeptr = NULL;
+    const UA_NumericRange *rangeptr = parsedRange;
     UA_StatusCode retval = UA_STATUSCODE_GOOD;
-    if(indexRange && indexRange->length > 0) {
+    if(!rangeptr && indexRange && indexRange->length > 0) {
         retval = UA_NumericRange_parseFromString(&range, indexRange);
         if(retval != UA_STATUSCODE_GOOD)
             return retval;
@@ -129,7 +131,7 @@ readValueAttributeComplete(UA_Server *server, UA_Session *session,
         retval = readValueAttributeFromDataSource(server, session, vn, v, timestamps, rangeptr);
 
     /* Clean up */
-    if(rangeptr)
+    if(rangeptr == &range)
         UA_free(range.dimensions);
     return retval;
 }
@@ -137,7 +139,8 @@ readValueAttributeComplete(UA_Server *server, UA_Session *session,
 UA_StatusCode
 readValueAttribute(UA_Server *server, UA_Session *session,
                    const UA_VariableNode *vn, UA_DataValue *v) {
-    return readValueAttributeComplete(server, session, vn, UA_TIMESTAMPSTORETURN_NEITHER, NULL, v);
+    return readValueAttributeComplete(server, session, vn, UA_TIMESTAMPSTORETURN_NEITHER,
+                                      NULL, NULL, v);
 }
 
 static const UA_String binEncoding = {sizeof("Default Binary")-1, (UA_Byte*)"Default Binary"};
@@ -153,8 +156,8 @@ static UA_THREAD_LOCAL UA_TimestampsToReturn op_timestampsToReturn;
     }
 
 static void
-Operation_Read(UA_Server *server, UA_Session *session,
-               const UA_ReadValueId *id, UA_DataValue *v) {
+readWithRange(UA_Server *server, UA_Session *session, const UA_ReadValueId *id,
+              const UA_NumericRange *range, UA_DataValue *v) {
     UA_LOG_DEBUG_SESSION(server->config.logger, session,
                          "Read the attribute %i", id->attributeId);
 
@@ -238,7 +241,8 @@ Operation_Read(UA_Server *server, UA_Session *session,
             break;
         }
         retval = readValueAttributeComplete(server, session, (const UA_VariableNode*)node,
-                                            op_timestampsToReturn, &id->indexRange, v);
+                                            op_timestampsToReturn, &id->indexRange,
+                                            range, v);
         break;
     }
     case UA_ATTRIBUTEID_DATATYPE:
@@ -323,23 +327,45 @@ Operation_Read(UA_Server *server, UA_Session *session,
     }
 }
 
-void Service_Read(UA_Server *server, UA_Session *session,
-                  const UA_ReadRequest *request, UA_ReadResponse *response) {
+static void
+Operation_Read(UA_Server *server, UA_Session *session,
+               const UA_ReadValueId *id, UA_DataValue *v) {
+    readWithRange(server, session, id, NULL, v);
+}
+
+/* The checks are shared between Service_Read and Service_Read_stream. When
+ * they pass, the operations are prepared and can be processed with
+ * Operation_Read. */
+static UA_StatusCode
+beginReadRequest(UA_Server *server, UA_Session *session,
+                 const UA_ReadRequest *request) {
     UA_LOG_DEBUG_SESSION(server->config.logger, session,
                          "Processing ReadRequest");
 
     /* Check if the timestampstoreturn is valid */
-    op_timestampsToReturn = request->timestampsToReturn;
-    if(op_timestampsToReturn > UA_TIMESTAMPSTORETURN_NEITHER) {
-        response->responseHeader.serviceResult = UA_STATUSCODE_BADTIMESTAMPSTORETURNINVALID;
-        return;
-    }
+    if(request->timestampsToReturn > UA_TIMESTAMPSTORETURN_NEITHER)
+        return UA_STATUSCODE_BADTIMESTAMPSTORETURNINVALID;
 
     /* Check if maxAge is valid */
-    if(request->maxAge < 0) {
-        response->responseHeader.serviceResult = UA_STATUSCODE_BADMAXAGEINVALID;
+    if(request->maxAge < 0)
+        return UA_STATUSCODE_BADMAXAGEINVALID;
+
+    /* Check the number of operations */
+    if(request->nodesToReadSize == 0)
+        return UA_STATUSCODE_BADNOTHINGTODO;
+    if(request->nodesToReadSize > UA_INT32_MAX)
+        return UA_STATUSCODE_BADTOOMANYOPERATIONS;
+
+    op_timestampsToReturn = request->timestampsToReturn;
+    return UA_STATUSCODE_GOOD;
+}
+
+void Service_Read(UA_Server *server, UA_Session *session,
+                  const UA_ReadRequest *request, UA_ReadResponse *response) {
+    response->responseHeader.serviceResult =
+        beginReadRequest(server, session, request);
+    if(response->responseHeader.serviceResult != UA_STATUSCODE_GOOD)
         return;
-    }
 
     response->responseHeader.serviceResult = 
         UA_Server_processServiceOperations(server, session,
@@ -348,6 +374,37 @@ void Service_Read(UA_Server *server, UA_Session *session,
                   &response->resultsSize, &UA_TYPES[UA_TYPES_DATAVALUE]);
 }
 
+UA_StatusCode
+Service_Read_stream(UA_Server *server, UA_Session *session, UA_MessageContext *mc,
+                    const UA_ReadRequest *request, UA_ResponseHeader *responseHeader) {
+    responseHeader->serviceResult = beginReadRequest(server, session, request);
+
+    /* The encoding is the same as for a UA_ReadResponse. But every result is
+     * encoded (and freed) right after it was read. */
+    UA_StatusCode retval =
+        UA_MessageContext_encode(mc, responseHeader, &UA_TYPES[UA_TYPES_RESPONSEHEADER]);
+    UA_Int32 resultsSize = -1; /* Encoding of an empty array */
+    if(responseHeader->serviceResult == UA_STATUSCODE_GOOD)
+        resultsSize = (UA_Int32)request->nodesToReadSize;
+    retval |= UA_MessageContext_encode(mc, &resultsSize, &UA_TYPES[UA_TYPES_INT32]);
+    if(retval != UA_STATUSCODE_GOOD)
+        return retval;
+
+    for(UA_Int32 i = 0; i < resultsSize; i++) {
+        UA_DataValue v;
+        UA_DataValue_init(&v);
+        Operation_Read(server, session, &request->nodesToRead[i], &v);
+        retval = UA_MessageContext_encode(mc, &v, &UA_TYPES[UA_TYPES_DATAVALUE]);
+        UA_DataValue_deleteMembers(&v);
+        if(retval != UA_STATUSCODE_GOOD)
+            return retval;
+    }
+
+    /* No diagnostic infos */
+    UA_Int32 diagnosticInfosSize = -1;
+    return UA_MessageContext_encode(mc, &diagnosticInfosSize, &UA_TYPES[UA_TYPES_INT32]);
+}
+
 UA_DataValue
 UA_Server_readWithSession(UA_Server *server, UA_Session *session,
                           const UA_ReadValueId *item,
@@ -359,6 +416,33 @@ UA_Server_readWithSession(UA_Server *server, UA_Session *session,
     return dv;
 }
 
+UA_DataValue
+UA_Server_readWithSessionRange(UA_Server *server, UA_Session *session,
+                               const UA_ReadValueId *item,
+                               const UA_NumericRange *range,
+                               UA_TimestampsToReturn timestamps) {
+    UA_DataValue dv;
+    UA_DataValue_init(&dv);
+    op_timestampsToReturn = timestamps;
+    readWithRange(server, session, item, range, &dv);
+    return dv;
+}
+
+UA_Boolean
+readValueAllowed(UA_Server *server, UA_Session *session, const UA_NodeId *nodeId) {
+    const UA_Node *node = UA_Nodestore_get(server, nodeId);
+    if(!node)
+        return true;
+    UA_Boolean allowed = true;
+    if(node->nodeClass & (UA_NODECLASS_VARIABLE | UA_NODECLASS_VARIABLETYPE)) {
+        UA_Byte userAccessLevel = getUserAccessLevel(server, session,
+                                                     (const UA_VariableNode*)node);
+        allowed = ((userAccessLevel & UA_ACCESSLEVELMASK_READ) != 0);
+    }
+    UA_Nodestore_release(server, node);
+    return allowed;
+}
+
 /* Exposes the Read service to local users */
 UA_DataValue
 UA_Server_read(UA_Server *server, const UA_ReadValueId *item,
@@ -455,7 +539,7 @@ compatibleDataType(UA_Server *server, const UA_NodeId *dataType,
         return true;
 
     /* Is the value-type a subtype of the required type? */
-    if(isNodeInTree(&server->config.nodestore, dataType, constraintDataType, &subtypeId, 1))
+    if(isSubtypeOf(server, dataType, constraintDataType))
         return true;
 
     /* If value is a built-in type: The target data type may be a sub type of
@@ -465,13 +549,12 @@ compatibleDataType(UA_Server *server, const UA_NodeId *dataType,
     if(dataType->namespaceIndex == 0 &&
        dataType->identifierType == UA_NODEIDTYPE_NUMERIC &&
        dataType->identifier.numeric <= 25 &&
-       isNodeInTree(&server->config.nodestore, constraintDataType,
-                    dataType, &subtypeId, 1))
+       isSubtypeOf(server, constraintDataType, dataType))
         return true;
 
     /* Enum allows Int32 (only) */
     if(UA_NodeId_equal(dataType, &UA_TYPES[UA_TYPES_INT32].typeId) &&
-       isNodeInTree(&server->config.nodestore, constraintDataType, &enumNodeId, &subtypeId, 1))
+       isSubtypeOf(server, constraintDataType, &enumNodeId))
         return true;
 
     return false;
@@ -1022,20 +1105,20 @@ copyAttributeIntoNode(UA_Server *server, UA_Session *session,
     case UA_ATTRIBUTEID_BROWSENAME:
         CHECK_USERWRITEMASK(UA_WRITEMASK_BROWSENAME);
         CHECK_DATATYPE_SCALAR(QUALIFIEDNAME);
-        UA_QualifiedName_deleteMembers(&node->browseName);
-        UA_QualifiedName_copy((const UA_QualifiedName *)value, &node->browseName);
+        UA_Node_deleteQualifiedName(&node->browseName);
+        UA_Node_copyQualifiedName((const UA_QualifiedName *)value, &node->browseName);
         break;
     case UA_ATTRIBUTEID_DISPLAYNAME:
         CHECK_USERWRITEMASK(UA_WRITEMASK_DISPLAYNAME);
         CHECK_DATATYPE_SCALAR(LOCALIZEDTEXT);
-        UA_LocalizedText_deleteMembers(&node->displayName);
-        UA_LocalizedText_copy((const UA_LocalizedText *)value, &node->displayName);
+        UA_Node_deleteLocalizedText(&node->displayName);
+        UA_Node_copyLocalizedText((const UA_LocalizedText *)value, &node->displayName);
         break;
     case UA_ATTRIBUTEID_DESCRIPTION:
         CHECK_USERWRITEMASK(UA_WRITEMASK_DESCRIPTION);
         CHECK_DATATYPE_SCALAR(LOCALIZEDTEXT);
-        UA_LocalizedText_deleteMembers(&node->description);
-        UA_LocalizedText_copy((const UA_LocalizedText *)value, &node->description);
+        UA_Node_deleteLocalizedText(&node->description);
+        UA_Node_copyLocalizedText((const UA_LocalizedText *)value, &node->description);
         break;
     case UA_ATTRIBUTEID_WRITEMASK:
         CHECK_USERWRITEMASK(UA_WRITEMASK_WRITEMASK);
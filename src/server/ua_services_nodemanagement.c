@@ -119,8 +119,7 @@ checkParentReference(UA_Server *server, UA_Session *session, UA_NodeClass nodeCl
     /* Test if the referencetype is hierarchical */
     const UA_NodeId hierarchicalReference =
         UA_NODEID_NUMERIC(0, UA_NS0ID_HIERARCHICALREFERENCES);
-    if(!isNodeInTree(&server->config.nodestore, referenceTypeId,
-                     &hierarchicalReference, &subtypeId, 1)) {
+    if(!isSubtypeOf(server, referenceTypeId, &hierarchicalReference)) {
         UA_LOG_INFO_SESSION(server->config.logger, session,
                             "AddNodes: Reference type is not hierarchical");
         return UA_STATUSCODE_BADREFERENCETYPEIDINVALID;
@@ -575,7 +574,7 @@ Operation_addNode_begin(UA_Server *server, UA_Session *session,
     node->context = nodeContext;
     UA_StatusCode retval = UA_STATUSCODE_GOOD;
     retval |= UA_NodeId_copy(&item->requestedNewNodeId.nodeId, &node->nodeId);
-    retval |= UA_QualifiedName_copy(&item->browseName, &node->browseName);
+    retval |= UA_Node_copyQualifiedName(&item->browseName, &node->browseName);
     retval |= UA_Node_setAttributes(node, item->nodeAttributes.content.decoded.data,
                                                 item->nodeAttributes.content.decoded.type);
     if(retval != UA_STATUSCODE_GOOD) {
@@ -1032,6 +1031,9 @@ removeDeconstructedNode(UA_Server *server, UA_Session *session,
         removeIncomingReferences(server, session, node);
 
     /* Remove the node in the nodestore */
+    if(node->nodeClass == UA_NODECLASS_REFERENCETYPE ||
+       node->nodeClass == UA_NODECLASS_DATATYPE)
+        UA_Server_invalidateSubtypeIndex(server);
     UA_Nodestore_remove(server, &node->nodeId);
 }
 
@@ -1153,6 +1155,17 @@ addReference(UA_Server *server, UA_Session *session,
         /* ignore returned status code */
         UA_Server_editNode(server, session, &item->sourceNodeId,
                            (UA_EditNodeCallback)deleteOneWayReference, &deleteItem);
+        return;
+    }
+
+    /* Extend the subtype index */
+    if(UA_NodeId_equal(&item->referenceTypeId, &subtypeId)) {
+        if(item->isForward)
+            UA_Server_addSubtypeToIndex(server, &item->sourceNodeId,
+                                        &item->targetNodeId.nodeId);
+        else
+            UA_Server_addSubtypeToIndex(server, &item->targetNodeId.nodeId,
+                                        &item->sourceNodeId);
     }
 }
 
@@ -1207,6 +1220,9 @@ deleteReference(UA_Server *server, UA_Session *session,
     if(*retval != UA_STATUSCODE_GOOD)
         return;
 
+    if(UA_NodeId_equal(&item->referenceTypeId, &subtypeId))
+        UA_Server_invalidateSubtypeIndex(server);
+
     if(!item->deleteBidirectional || item->targetNodeId.serverIndex != 0)
         return;
 
@@ -126,8 +126,9 @@ void Service_CreateSession(UA_Server *server, UA_SecureChannel *channel,
 
     /* Fill the session with more information */
     newSession->maxResponseMessageSize = request->maxResponseMessageSize;
-    newSession->maxRequestMessageSize =
-        channel->connection->localConf.maxMessageSize;
+    UA_Connection *connection = channel->connection;
+    if(connection)
+        newSession->maxRequestMessageSize = connection->localConf.maxMessageSize;
     response->responseHeader.serviceResult |=
         UA_ApplicationDescription_copy(&request->clientDescription,
                                        &newSession->clientDescription);
@@ -144,10 +144,46 @@ Service_SetPublishingMode(UA_Server *server, UA_Session *session,
                   &response->resultsSize, &UA_TYPES[UA_TYPES_STATUSCODE]);
 }
 
-static void
+/* Only the absolute deadband is supported. The percent deadband requires the
+ * EURange of an AnalogItem. */
+static UA_StatusCode
+checkDataChangeFilter(const UA_ExtensionObject *filter, UA_UInt32 attributeId) {
+    if(filter->encoding != UA_EXTENSIONOBJECT_DECODED ||
+       filter->content.decoded.type != &UA_TYPES[UA_TYPES_DATACHANGEFILTER])
+        return UA_STATUSCODE_GOOD;
+    const UA_DataChangeFilter *dcf =
+        (const UA_DataChangeFilter*)filter->content.decoded.data;
+    switch(dcf->deadbandType) {
+    case UA_DEADBANDTYPE_NONE:
+        return UA_STATUSCODE_GOOD;
+    case UA_DEADBANDTYPE_ABSOLUTE:
+        if(attributeId != UA_ATTRIBUTEID_VALUE)
+            return UA_STATUSCODE_BADFILTERNOTALLOWED;
+        if(!(dcf->deadbandValue >= 0.0)) /* Also catches NaN */
+            return UA_STATUSCODE_BADDEADBANDFILTERINVALID;
+        return UA_STATUSCODE_GOOD;
+    case UA_DEADBANDTYPE_PERCENT:
+        return UA_STATUSCODE_BADMONITOREDITEMFILTERUNSUPPORTED;
+    default:
+        return UA_STATUSCODE_BADDEADBANDFILTERINVALID;
+    }
+}
+
+static UA_StatusCode
 setMonitoredItemSettings(UA_Server *server, UA_MonitoredItem *mon,
                          UA_MonitoringMode monitoringMode,
                          const UA_MonitoringParameters *params) {
+    /* DiscardOldest */
+    mon->discardOldest = params->discardOldest;
+
+    /* QueueSize. Allocate first, as this can fail. */
+    UA_UInt32 queueSize;
+    UA_BOUNDEDVALUE_SETWBOUNDS(server->config.queueSizeLimits,
+                               params->queueSize, queueSize);
+    UA_StatusCode retval = MonitoredItem_setQueueSize(mon, queueSize);
+    if(retval != UA_STATUSCODE_GOOD)
+        return retval;
+
     MonitoredItem_unregisterSampleCallback(server, mon);
     mon->monitoringMode = monitoringMode;
 
@@ -180,21 +216,19 @@ setMonitoredItemSettings(UA_Server *server, UA_MonitoredItem *mon,
        params->filter.content.decoded.type != &UA_TYPES[UA_TYPES_DATACHANGEFILTER]) {
         /* Default: Trigger only on the value and the statuscode */
         mon->trigger = UA_DATACHANGETRIGGER_STATUSVALUE;
+        mon->deadbandType = UA_DEADBANDTYPE_NONE;
+        mon->deadbandValue = 0.0;
     } else {
         UA_DataChangeFilter *filter = (UA_DataChangeFilter *)params->filter.content.decoded.data;
         mon->trigger = filter->trigger;
+        mon->deadbandType = (UA_DeadbandType)filter->deadbandType;
+        mon->deadbandValue = filter->deadbandValue;
     }
 
-    /* QueueSize */
-    UA_BOUNDEDVALUE_SETWBOUNDS(server->config.queueSizeLimits,
-                               params->queueSize, mon->maxQueueSize);
-
-    /* DiscardOldest */
-    mon->discardOldest = params->discardOldest;
-
     /* Register sample callback if reporting is enabled */
     if(monitoringMode == UA_MONITORINGMODE_REPORTING)
         MonitoredItem_registerSampleCallback(server, mon);
+    return UA_STATUSCODE_GOOD;
 }
 
 static const UA_String binaryEncoding = {sizeof("Default Binary")-1, (UA_Byte*)"Default Binary"};
@@ -237,6 +271,13 @@ Operation_CreateMonitoredItem(UA_Server *server, UA_Session *session,
         return;
     }
 
+    /* Check the filter */
+    result->statusCode =
+        checkDataChangeFilter(&request->requestedParameters.filter,
+                              request->itemToMonitor.attributeId);
+    if(result->statusCode != UA_STATUSCODE_GOOD)
+        return;
+
     /* Create the monitoreditem */
     UA_MonitoredItem *newMon = UA_MonitoredItem_new();
     if(!newMon) {
@@ -254,16 +295,22 @@ Operation_CreateMonitoredItem(UA_Server *server, UA_Session *session,
     newMon->attributeID = request->itemToMonitor.attributeId;
     newMon->itemId = ++(op_sub->lastMonitoredItemId);
     newMon->timestampsToReturn = op_timestampsToReturn2;
-    setMonitoredItemSettings(server, newMon, request->monitoringMode,
-                             &request->requestedParameters);
     LIST_INSERT_HEAD(&op_sub->monitoredItems, newMon, listEntry);
+    retval = MonitoredItem_setIndexRange(newMon, &request->itemToMonitor.indexRange);
+    if(retval == UA_STATUSCODE_GOOD)
+        retval = setMonitoredItemSettings(server, newMon, request->monitoringMode,
+                                          &request->requestedParameters);
+    if(retval != UA_STATUSCODE_GOOD) {
+        result->statusCode = retval;
+        MonitoredItem_delete(server, newMon);
+        return;
+    }
 
     /* Create the first sample */
     if(request->monitoringMode == UA_MONITORINGMODE_REPORTING)
         UA_MoniteredItem_SampleCallback(server, newMon);
 
     /* Prepare the response */
-    UA_String_copy(&request->itemToMonitor.indexRange, &newMon->indexRange);
     result->revisedSamplingInterval = newMon->samplingInterval;
     result->revisedQueueSize = newMon->maxQueueSize;
     result->monitoredItemId = newMon->itemId;
@@ -312,8 +359,16 @@ Operation_ModifyMonitoredItem(UA_Server *server, UA_Session *session,
         return;
     }
 
-    setMonitoredItemSettings(server, mon, mon->monitoringMode,
-                             &request->requestedParameters);
+    /* Check the filter */
+    result->statusCode = checkDataChangeFilter(&request->requestedParameters.filter,
+                                               mon->attributeID);
+    if(result->statusCode != UA_STATUSCODE_GOOD)
+        return;
+
+    result->statusCode = setMonitoredItemSettings(server, mon, mon->monitoringMode,
+                                                  &request->requestedParameters);
+    if(result->statusCode != UA_STATUSCODE_GOOD)
+        return;
     result->revisedSamplingInterval = mon->samplingInterval;
     result->revisedQueueSize = mon->maxQueueSize;
 }
@@ -49,9 +49,7 @@ relevantReference(UA_Server *server, UA_Boolean includeSubtypes,
                   const UA_NodeId *rootRef, const UA_NodeId *testRef) {
     if(!includeSubtypes)
         return UA_NodeId_equal(rootRef, testRef);
-
-    const UA_NodeId hasSubType = UA_NODEID_NUMERIC(0, UA_NS0ID_HASSUBTYPE);
-    return isNodeInTree(&server->config.nodestore, testRef, rootRef, &hasSubType, 1);
+    return isSubtypeOf(server, testRef, rootRef);
 }
 
 /* Returns whether the node / continuationpoint is done */
@@ -5,11 +5,17 @@
 #include "ua_session_manager.h"
 #include "ua_server_internal.h"
 
+#define UA_SESSIONHASH_MINSIZE 16
+
 UA_StatusCode
 UA_SessionManager_init(UA_SessionManager *sm, UA_Server *server) {
     LIST_INIT(&sm->sessions);
+    sm->tokenHash = NULL;
+    sm->idHash = NULL;
+    sm->hashSize = 0;
     sm->currentSessionCount = 0;
     sm->server = server;
+    UA_LOCK_INIT(sm->mutex);
     return UA_STATUSCODE_GOOD;
 }
 
@@ -20,13 +26,62 @@ void UA_SessionManager_deleteMembers(UA_SessionManager *sm) {
         UA_Session_deleteMembersCleanup(&current->session, sm->server);
         UA_free(current);
     }
+    UA_free(sm->tokenHash);
+    UA_free(sm->idHash);
+    sm->tokenHash = NULL;
+    sm->idHash = NULL;
+    sm->hashSize = 0;
+    UA_LOCK_DESTROY(sm->mutex);
+}
+
+static struct session_hash_bucket *
+tokenBucket(UA_SessionManager *sm, const UA_NodeId *token) {
+    return &sm->tokenHash[UA_NodeId_hash(token) & (sm->hashSize - 1)];
+}
+
+static struct session_hash_bucket *
+idBucket(UA_SessionManager *sm, const UA_NodeId *sessionId) {
+    return &sm->idHash[UA_NodeId_hash(sessionId) & (sm->hashSize - 1)];
+}
+
+/* Rehash all sessions into new buckets */
+static UA_StatusCode
+resizeSessionHash(UA_SessionManager *sm, size_t size) {
+    struct session_hash_bucket *tokenHash = (struct session_hash_bucket*)
+        UA_calloc(size, sizeof(struct session_hash_bucket));
+    struct session_hash_bucket *idHash = (struct session_hash_bucket*)
+        UA_calloc(size, sizeof(struct session_hash_bucket));
+    if(!tokenHash || !idHash) {
+        UA_free(tokenHash);
+        UA_free(idHash);
+        return UA_STATUSCODE_BADOUTOFMEMORY;
+    }
+
+    UA_free(sm->tokenHash);
+    UA_free(sm->idHash);
+    sm->tokenHash = tokenHash;
+    sm->idHash = idHash;
+    sm->hashSize = size;
+
+    session_list_entry *current;
+    LIST_FOREACH(current, &sm->sessions, pointers) {
+        LIST_INSERT_HEAD(tokenBucket(sm, &current->session.authenticationToken),
+                         current, tokenPointers);
+        LIST_INSERT_HEAD(idBucket(sm, &current->session.sessionId),
+                         current, idPointers);
+    }
+    return UA_STATUSCODE_GOOD;
 }
 
 /* Delayed callback to free the session memory */
 static void
 removeSessionCallback(UA_Server *server, void *entry) {
     session_list_entry *sentry = (session_list_entry*)entry;
+    /* Subscriptions and the attached channel are changed under the service
+     * mutex */
+    UA_LOCK(server->serviceMutex);
     UA_Session_deleteMembersCleanup(&sentry->session, server);
+    UA_UNLOCK(server->serviceMutex);
     UA_free(sentry);
 }
 
@@ -47,6 +102,8 @@ removeSession(UA_SessionManager *sm, session_list_entry *sentry) {
 
     /* Detach the session and make the capacity available */
     LIST_REMOVE(sentry, pointers);
+    LIST_REMOVE(sentry, tokenPointers);
+    LIST_REMOVE(sentry, idPointers);
     UA_atomic_add(&sm->currentSessionCount, (UA_UInt32)-1);
     return UA_STATUSCODE_GOOD;
 }
@@ -54,6 +111,7 @@ removeSession(UA_SessionManager *sm, session_list_entry *sentry) {
 void
 UA_SessionManager_cleanupTimedOut(UA_SessionManager *sm,
                                   UA_DateTime nowMonotonic) {
+    UA_LOCK(sm->mutex);
     session_list_entry *sentry, *temp;
     LIST_FOREACH_SAFE(sentry, &sm->sessions, pointers, temp) {
         /* Session has timed out? */
@@ -65,12 +123,15 @@ UA_SessionManager_cleanupTimedOut(UA_SessionManager *sm,
                                                       sentry->session.sessionHandle);
         removeSession(sm, sentry);
     }
+    UA_UNLOCK(sm->mutex);
 }
 
-UA_Session *
-UA_SessionManager_getSessionByToken(UA_SessionManager *sm, const UA_NodeId *token) {
+static UA_Session *
+getSessionByToken(UA_SessionManager *sm, const UA_NodeId *token) {
     session_list_entry *current = NULL;
-    LIST_FOREACH(current, &sm->sessions, pointers) {
+    if(sm->hashSize == 0)
+        goto notfound;
+    LIST_FOREACH(current, tokenBucket(sm, token), tokenPointers) {
         /* Token does not match */
         if(!UA_NodeId_equal(&current->session.authenticationToken, token))
             continue;
@@ -87,6 +148,7 @@ UA_SessionManager_getSessionByToken(UA_SessionManager *sm, const UA_NodeId *toke
     }
 
     /* Session not found */
+ notfound:
     UA_LOG_INFO(sm->server->config.logger, UA_LOGCATEGORY_SESSION,
                 "Try to use Session with token " UA_PRINTF_GUID_FORMAT " but is not found",
                 UA_PRINTF_GUID_DATA(token->identifier.guid));
@@ -94,9 +156,19 @@ UA_SessionManager_getSessionByToken(UA_SessionManager *sm, const UA_NodeId *toke
 }
 
 UA_Session *
-UA_SessionManager_getSessionById(UA_SessionManager *sm, const UA_NodeId *sessionId) {
+UA_SessionManager_getSessionByToken(UA_SessionManager *sm, const UA_NodeId *token) {
+    UA_LOCK(sm->mutex);
+    UA_Session *session = getSessionByToken(sm, token);
+    UA_UNLOCK(sm->mutex);
+    return session;
+}
+
+static UA_Session *
+getSessionById(UA_SessionManager *sm, const UA_NodeId *sessionId) {
     session_list_entry *current = NULL;
-    LIST_FOREACH(current, &sm->sessions, pointers) {
+    if(sm->hashSize == 0)
+        goto notfound;
+    LIST_FOREACH(current, idBucket(sm, sessionId), idPointers) {
         /* Token does not match */
         if(!UA_NodeId_equal(&current->session.sessionId, sessionId))
             continue;
@@ -113,19 +185,34 @@ UA_SessionManager_getSessionById(UA_SessionManager *sm, const UA_NodeId *session
     }
 
     /* Session not found */
+ notfound:
     UA_LOG_INFO(sm->server->config.logger, UA_LOGCATEGORY_SESSION,
                 "Try to use Session with identifier " UA_PRINTF_GUID_FORMAT " but is not found",
                 UA_PRINTF_GUID_DATA(sessionId->identifier.guid));
     return NULL;
 }
 
-/* Creates and adds a session. But it is not yet attached to a secure channel. */
-UA_StatusCode
-UA_SessionManager_createSession(UA_SessionManager *sm, UA_SecureChannel *channel,
-                                const UA_CreateSessionRequest *request, UA_Session **session) {
+UA_Session *
+UA_SessionManager_getSessionById(UA_SessionManager *sm, const UA_NodeId *sessionId) {
+    UA_LOCK(sm->mutex);
+    UA_Session *session = getSessionById(sm, sessionId);
+    UA_UNLOCK(sm->mutex);
+    return session;
+}
+
+static UA_StatusCode
+createSession(UA_SessionManager *sm, const UA_CreateSessionRequest *request,
+              UA_Session **session) {
     if(sm->currentSessionCount >= sm->server->config.maxSessions)
         return UA_STATUSCODE_BADTOOMANYSESSIONS;
 
+    /* Grow the hash buckets. Keep the old buckets if that fails. */
+    if(sm->currentSessionCount >= sm->hashSize) {
+        size_t size = sm->hashSize > 0 ? sm->hashSize * 2 : UA_SESSIONHASH_MINSIZE;
+        if(resizeSessionHash(sm, size) != UA_STATUSCODE_GOOD && sm->hashSize == 0)
+            return UA_STATUSCODE_BADOUTOFMEMORY;
+    }
+
     session_list_entry *newentry = (session_list_entry *)UA_malloc(sizeof(session_list_entry));
     if(!newentry)
         return UA_STATUSCODE_BADOUTOFMEMORY;
@@ -143,18 +230,37 @@ UA_SessionManager_createSession(UA_SessionManager *sm, UA_SecureChannel *channel
 
     UA_Session_updateLifetime(&newentry->session);
     LIST_INSERT_HEAD(&sm->sessions, newentry, pointers);
+    LIST_INSERT_HEAD(tokenBucket(sm, &newentry->session.authenticationToken),
+                     newentry, tokenPointers);
+    LIST_INSERT_HEAD(idBucket(sm, &newentry->session.sessionId),
+                     newentry, idPointers);
     *session = &newentry->session;
     return UA_STATUSCODE_GOOD;
 }
 
+/* Creates and adds a session. But it is not yet attached to a secure channel. */
+UA_StatusCode
+UA_SessionManager_createSession(UA_SessionManager *sm, UA_SecureChannel *channel,
+                                const UA_CreateSessionRequest *request, UA_Session **session) {
+    UA_LOCK(sm->mutex);
+    UA_StatusCode retval = createSession(sm, request, session);
+    UA_UNLOCK(sm->mutex);
+    return retval;
+}
+
 UA_StatusCode
 UA_SessionManager_removeSession(UA_SessionManager *sm, const UA_NodeId *token) {
-    session_list_entry *current;
-    LIST_FOREACH(current, &sm->sessions, pointers) {
-        if(UA_NodeId_equal(&current->session.authenticationToken, token))
-            break;
+    UA_StatusCode retval = UA_STATUSCODE_BADSESSIONIDINVALID;
+    UA_LOCK(sm->mutex);
+    if(sm->hashSize > 0) {
+        session_list_entry *current;
+        LIST_FOREACH(current, tokenBucket(sm, token), tokenPointers) {
+            if(UA_NodeId_equal(&current->session.authenticationToken, token)) {
+                retval = removeSession(sm, current);
+                break;
+            }
+        }
     }
-    if(!current)
-        return UA_STATUSCODE_BADSESSIONIDINVALID;
-    return removeSession(sm, current);
+    UA_UNLOCK(sm->mutex);
+    return retval;
 }
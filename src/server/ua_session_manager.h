@@ -16,13 +16,27 @@ extern "C" {
 
 typedef struct session_list_entry {
     LIST_ENTRY(session_list_entry) pointers;
+    LIST_ENTRY(session_list_entry) tokenPointers; /* bucket in tokenHash */
+    LIST_ENTRY(session_list_entry) idPointers; /* bucket in idHash */
     UA_Session session;
 } session_list_entry;
 
+LIST_HEAD(session_hash_bucket, session_list_entry);
+
 typedef struct UA_SessionManager {
     LIST_HEAD(session_list, session_list_entry) sessions; // doubly-linked list of sessions
+
+    /* Hash buckets over the sessions by authenticationToken and sessionId. The
+     * number of buckets is a power of two and grows with the sessions. */
+    struct session_hash_bucket *tokenHash;
+    struct session_hash_bucket *idHash;
+    size_t hashSize;
+
     UA_UInt32 currentSessionCount;
     UA_Server *server;
+
+    /* Sessions are created, looked up and removed from the worker threads */
+    UA_LOCK_TYPE(mutex)
 } UA_SessionManager;
 
 UA_StatusCode
@@ -20,6 +20,7 @@ UA_Subscription_new(UA_Session *session, UA_UInt32 subscriptionID) {
     newItem->subscriptionID = subscriptionID;
     newItem->state = UA_SUBSCRIPTIONSTATE_NORMAL; /* The first publish response is sent immediately */
     TAILQ_INIT(&newItem->retransmissionQueue);
+    TAILQ_INIT(&newItem->pendingItems);
     return newItem;
 }
 
@@ -80,20 +81,11 @@ countQueuedNotifications(UA_Subscription *sub,
                          UA_Boolean *moreNotifications) {
     if(!sub->publishingEnabled)
         return 0;
-
-    size_t notifications = 0;
-    UA_MonitoredItem *mon;
-    LIST_FOREACH(mon, &sub->monitoredItems, listEntry) {
-        MonitoredItem_queuedValue *qv;
-        TAILQ_FOREACH(qv, &mon->queue, listEntry) {
-            if(notifications >= sub->notificationsPerPublish) {
-                *moreNotifications = true;
-                break;
-            }
-            ++notifications;
-        }
+    if(sub->queuedNotifications > sub->notificationsPerPublish) {
+        *moreNotifications = true;
+        return sub->notificationsPerPublish;
     }
-    return notifications;
+    return sub->queuedNotifications;
 }
 
 static void
@@ -170,19 +162,21 @@ prepareNotificationMessage(UA_Subscription *sub,
     /* Move notifications into the response .. the point of no return */
     size_t l = 0;
     UA_MonitoredItem *mon;
-    LIST_FOREACH(mon, &sub->monitoredItems, listEntry) {
-        MonitoredItem_queuedValue *qv, *qv_tmp;
-        TAILQ_FOREACH_SAFE(qv, &mon->queue, listEntry, qv_tmp) {
-            if(l >= notifications)
-                return UA_STATUSCODE_GOOD;
+    while(l < notifications && (mon = TAILQ_FIRST(&sub->pendingItems))) {
+        while(l < notifications && mon->currentQueueSize > 0) {
+            MonitoredItem_queuedValue *qv = MonitoredItem_queuedSample(mon, 0);
             UA_MonitoredItemNotification *min = &dcn->monitoredItems[l];
             min->clientHandle = qv->clientHandle;
             min->value = qv->value;
-            TAILQ_REMOVE(&mon->queue, qv, listEntry);
-            UA_free(qv);
+            ++mon->queueStart;
+            if(mon->queueStart >= mon->maxQueueSize)
+                mon->queueStart = 0;
             --mon->currentQueueSize;
+            --sub->queuedNotifications;
             ++l;
         }
+        if(mon->currentQueueSize == 0)
+            TAILQ_REMOVE(&sub->pendingItems, mon, pendingEntry);
     }
     return UA_STATUSCODE_GOOD;
 }
@@ -236,6 +230,18 @@ UA_Subscription_publishCallback(UA_Server *server, UA_Subscription *sub) {
         return;
     }
 
+    /* Hold back the response while the client does not keep up with receiving
+     * (backpressure). The notifications remain queued in the MonitoredItems. */
+    UA_Connection *connection = channel->connection;
+    if(connection && connection->getSendQueueSize &&
+       server->config.maxSendQueueSize > 0 &&
+       connection->getSendQueueSize(connection) > server->config.maxSendQueueSize) {
+        UA_LOG_DEBUG_SESSION(server->config.logger, sub->session,
+                             "Subscription %u | The send queue of the "
+                             "connection is full", sub->subscriptionID);
+        return;
+    }
+
     UA_PublishResponse *response = &pre->response;
     UA_NotificationMessage *message = &response->notificationMessage;
     UA_NotificationMessageEntry *retransmission = NULL;
@@ -324,6 +330,17 @@ UA_Subscription_publishCallback(UA_Server *server, UA_Subscription *sub) {
         UA_Subscription_publishCallback(server, sub);
 }
 
+/* The repeated callback is serialized with the subscription services. A
+ * callback that was dispatched before the subscription was deleted can still
+ * run. The memory of the subscription is freed only afterwards. */
+static void
+publishCallbackLocked(UA_Server *server, UA_Subscription *sub) {
+    UA_LOCK(server->serviceMutex);
+    if(sub->publishCallbackIsRegistered)
+        UA_Subscription_publishCallback(server, sub);
+    UA_UNLOCK(server->serviceMutex);
+}
+
 UA_StatusCode
 Subscription_registerPublishCallback(UA_Server *server, UA_Subscription *sub) {
     UA_LOG_DEBUG_SESSION(server->config.logger, sub->session,
@@ -335,7 +352,7 @@ Subscription_registerPublishCallback(UA_Server *server, UA_Subscription *sub) {
 
     UA_StatusCode retval =
         UA_Server_addRepeatedCallback(server,
-                  (UA_ServerCallback)UA_Subscription_publishCallback,
+                  (UA_ServerCallback)publishCallbackLocked,
                   sub, (UA_UInt32)sub->publishingInterval,
                   &sub->publishCallbackId);
     if(retval != UA_STATUSCODE_GOOD)
@@ -20,13 +20,13 @@ typedef enum {
     UA_MONITOREDITEMTYPE_EVENTNOTIFY = 4
 } UA_MonitoredItemType;
 
-typedef struct MonitoredItem_queuedValue {
-    TAILQ_ENTRY(MonitoredItem_queuedValue) listEntry;
+typedef struct {
     UA_UInt32 clientHandle;
     UA_DataValue value;
 } MonitoredItem_queuedValue;
 
-typedef TAILQ_HEAD(QueuedValueQueue, MonitoredItem_queuedValue) QueuedValueQueue;
+struct UA_SamplingGroup;
+typedef struct UA_SamplingGroup UA_SamplingGroup;
 
 typedef struct UA_MonitoredItem {
     LIST_ENTRY(UA_MonitoredItem) listEntry;
@@ -45,24 +45,83 @@ typedef struct UA_MonitoredItem {
     UA_UInt32 maxQueueSize;
     UA_Boolean discardOldest;
     UA_String indexRange;
+    UA_NumericRange parsedIndexRange; /* Parsed once when the item is created */
     // TODO: dataEncoding is hardcoded to UA binary
     UA_DataChangeTrigger trigger;
-
-    /* Sample Callback */
-    UA_UInt64 sampleCallbackId;
-    UA_Boolean sampleCallbackIsRegistered;
-
-    /* Sample Queue */
-    UA_ByteString lastSampledValue;
-    QueuedValueQueue queue;
+    UA_DeadbandType deadbandType; /* None or absolute */
+    UA_Double deadbandValue;
+
+    /* Sampling Group */
+    UA_SamplingGroup *samplingGroup;
+    LIST_ENTRY(UA_MonitoredItem) samplingEntry;
+    UA_Boolean readAllowed; /* User access level checked with every sample */
+
+    /* Sample Queue. A ring buffer with maxQueueSize entries that is allocated
+     * when the queue size is negotiated. The oldest sample is at queueStart. */
+    UA_Boolean hasLastValue;
+    UA_DataValue lastValue; /* Compared with the next sample */
+    UA_ByteString lastValueEncoding; /* Set if the value is compared over the
+                                      * binary encoding */
+    const UA_DataType *orderType; /* The type orderIsBitwise was decided for */
+    UA_Boolean orderIsBitwise;
+    MonitoredItem_queuedValue *queue;
+    UA_UInt32 queueStart;
+
+    /* In the list of MonitoredItems with queued samples in the subscription
+     * (if currentQueueSize > 0) */
+    TAILQ_ENTRY(UA_MonitoredItem) pendingEntry;
 } UA_MonitoredItem;
 
 UA_MonitoredItem * UA_MonitoredItem_new(void);
+
+/* Set the index range string and parse it for the samples */
+UA_StatusCode MonitoredItem_setIndexRange(UA_MonitoredItem *mon, const UA_String *indexRange);
 void MonitoredItem_delete(UA_Server *server, UA_MonitoredItem *monitoredItem);
 void UA_MoniteredItem_SampleCallback(UA_Server *server, UA_MonitoredItem *monitoredItem);
 UA_StatusCode MonitoredItem_registerSampleCallback(UA_Server *server, UA_MonitoredItem *mon);
 UA_StatusCode MonitoredItem_unregisterSampleCallback(UA_Server *server, UA_MonitoredItem *mon);
 
+/* Reallocates the queue. Samples that do not fit are discarded as set by
+ * discardOldest. */
+UA_StatusCode MonitoredItem_setQueueSize(UA_MonitoredItem *mon, UA_UInt32 queueSize);
+
+/* Returns the i-th sample in the queue, starting from the oldest */
+static UA_INLINE MonitoredItem_queuedValue *
+MonitoredItem_queuedSample(UA_MonitoredItem *mon, UA_UInt32 i) {
+    UA_UInt32 index = mon->queueStart + i;
+    if(index >= mon->maxQueueSize)
+        index -= mon->maxQueueSize;
+    return &mon->queue[index];
+}
+
+/*****************/
+/* SamplingGroup */
+/*****************/
+
+/* MonitoredItems that sample the same attribute with the same interval share a
+ * SamplingGroup. The attribute is read once per interval and the sample is
+ * compared with the last sample of every MonitoredItem in the group. */
+struct UA_SamplingGroup {
+    LIST_ENTRY(UA_SamplingGroup) listEntry;
+    UA_UInt32 hash;
+
+    /* Sampled attribute */
+    UA_NodeId nodeId;
+    UA_UInt32 attributeId;
+    UA_String indexRange;
+    UA_NumericRange parsedIndexRange;
+    UA_TimestampsToReturn timestampsToReturn;
+    UA_UInt32 samplingInterval; /* in ms */
+    UA_Session *session; /* Set only for attributes that depend on the user */
+
+    /* Sample Callback */
+    UA_UInt64 sampleCallbackId;
+
+    LIST_HEAD(UA_ListOfSampledMonitoredItems, UA_MonitoredItem) monitoredItems;
+};
+
+LIST_HEAD(UA_SamplingGroupBucket, UA_SamplingGroup);
+
 /****************/
 /* Subscription */
 /****************/
@@ -110,6 +169,11 @@ struct UA_Subscription {
     /* MonitoredItems */
     LIST_HEAD(UA_ListOfUAMonitoredItems, UA_MonitoredItem) monitoredItems;
 
+    /* MonitoredItems with queued samples in the order of their first sample.
+     * Publishing only visits these. */
+    TAILQ_HEAD(UA_ListOfPendingMonitoredItems, UA_MonitoredItem) pendingItems;
+    UA_UInt32 queuedNotifications; /* Sum of the queue sizes */
+
     /* Retransmission Queue */
     ListOfNotificationMessages retransmissionQueue;
     UA_UInt32 retransmissionQueueSize;
@@ -8,8 +8,6 @@
 
 #ifdef UA_ENABLE_SUBSCRIPTIONS /* conditional compilation */
 
-#define UA_VALUENCODING_MAXSTACK 512
-
 UA_MonitoredItem *
 UA_MonitoredItem_new(void) {
     /* Allocate the memory */
@@ -21,7 +19,6 @@ UA_MonitoredItem_new(void) {
     /* Remaining members are covered by calloc zeroing out the memory */
     newItem->monitoredItemType = UA_MONITOREDITEMTYPE_CHANGENOTIFY; /* currently hardcoded */
     newItem->timestampsToReturn = UA_TIMESTAMPSTORETURN_SOURCE;
-    TAILQ_INIT(&newItem->queue);
     return newItem;
 }
 
@@ -31,159 +28,390 @@ MonitoredItem_delete(UA_Server *server, UA_MonitoredItem *monitoredItem) {
     MonitoredItem_unregisterSampleCallback(server, monitoredItem);
 
     /* Clear the queued samples */
-    MonitoredItem_queuedValue *val, *val_tmp;
-    TAILQ_FOREACH_SAFE(val, &monitoredItem->queue, listEntry, val_tmp) {
-        TAILQ_REMOVE(&monitoredItem->queue, val, listEntry);
-        UA_DataValue_deleteMembers(&val->value);
-        UA_free(val);
+    if(monitoredItem->currentQueueSize > 0) {
+        UA_Subscription *sub = monitoredItem->subscription;
+        TAILQ_REMOVE(&sub->pendingItems, monitoredItem, pendingEntry);
+        sub->queuedNotifications -= monitoredItem->currentQueueSize;
     }
+    for(UA_UInt32 i = 0; i < monitoredItem->currentQueueSize; i++)
+        UA_DataValue_deleteMembers(&MonitoredItem_queuedSample(monitoredItem, i)->value);
+    UA_free(monitoredItem->queue);
     monitoredItem->currentQueueSize = 0;
 
     /* Remove the monitored item */
     LIST_REMOVE(monitoredItem, listEntry);
     UA_String_deleteMembers(&monitoredItem->indexRange);
-    UA_ByteString_deleteMembers(&monitoredItem->lastSampledValue);
+    UA_free(monitoredItem->parsedIndexRange.dimensions);
+    UA_DataValue_deleteMembers(&monitoredItem->lastValue);
+    UA_ByteString_deleteMembers(&monitoredItem->lastValueEncoding);
     UA_NodeId_deleteMembers(&monitoredItem->monitoredNodeId);
     UA_free(monitoredItem); // TODO: Use a delayed free
 }
 
+/* Removes the oldest or the newest sample, depending on discardOldest. The
+ * MonitoredItem stays in the list of pending MonitoredItems. So the caller
+ * keeps at least one sample or adds a new one. */
 static void
-ensureSpaceInMonitoredItemQueue(UA_MonitoredItem *mon) {
-    /* Enough space, nothing to do here */
-    if(mon->currentQueueSize < mon->maxQueueSize)
-        return;
+discardQueuedSample(UA_MonitoredItem *mon) {
+    UA_assert(mon->currentQueueSize > 0);
+    MonitoredItem_queuedValue *qv;
+    if(mon->discardOldest) {
+        qv = MonitoredItem_queuedSample(mon, 0);
+        ++mon->queueStart;
+        if(mon->queueStart >= mon->maxQueueSize)
+            mon->queueStart = 0;
+    } else {
+        qv = MonitoredItem_queuedSample(mon, mon->currentQueueSize - 1);
+    }
+    UA_DataValue_deleteMembers(&qv->value);
+    --mon->currentQueueSize;
+    --mon->subscription->queuedNotifications;
+}
 
-    /* Get the item to remove */
-    MonitoredItem_queuedValue *queueItem;
-    if(mon->discardOldest)
-        queueItem = TAILQ_FIRST(&mon->queue);
-    else
-        queueItem = TAILQ_LAST(&mon->queue, QueuedValueQueue);
-    UA_assert(queueItem);
+UA_StatusCode
+MonitoredItem_setQueueSize(UA_MonitoredItem *mon, UA_UInt32 queueSize) {
+    if(queueSize == 0)
+        queueSize = 1;
+    if(mon->queue && queueSize == mon->maxQueueSize)
+        return UA_STATUSCODE_GOOD;
 
-    /* Remove the item */
-    TAILQ_REMOVE(&mon->queue, queueItem, listEntry);
-    UA_DataValue_deleteMembers(&queueItem->value);
-    UA_free(queueItem);
-    --mon->currentQueueSize;
+    MonitoredItem_queuedValue *queue = (MonitoredItem_queuedValue*)
+        UA_malloc(queueSize * sizeof(MonitoredItem_queuedValue));
+    if(!queue)
+        return UA_STATUSCODE_BADOUTOFMEMORY;
+
+    /* Move the samples that fit into the new queue */
+    while(mon->currentQueueSize > queueSize)
+        discardQueuedSample(mon);
+    for(UA_UInt32 i = 0; i < mon->currentQueueSize; i++)
+        queue[i] = *MonitoredItem_queuedSample(mon, i);
+
+    UA_free(mon->queue);
+    mon->queue = queue;
+    mon->queueStart = 0;
+    mon->maxQueueSize = queueSize;
+    return UA_STATUSCODE_GOOD;
+}
+
+/* Converts a numeric value to double for the deadband comparison */
+static UA_Double
+numericToDouble(const void *p, const UA_DataType *type) {
+    switch(type->typeIndex) {
+    case UA_TYPES_SBYTE: return *(const UA_SByte*)p;
+    case UA_TYPES_BYTE: return *(const UA_Byte*)p;
+    case UA_TYPES_INT16: return *(const UA_Int16*)p;
+    case UA_TYPES_UINT16: return *(const UA_UInt16*)p;
+    case UA_TYPES_INT32: return *(const UA_Int32*)p;
+    case UA_TYPES_UINT32: return *(const UA_UInt32*)p;
+    case UA_TYPES_INT64: return (UA_Double)*(const UA_Int64*)p;
+    case UA_TYPES_UINT64: return (UA_Double)*(const UA_UInt64*)p;
+    case UA_TYPES_FLOAT: return *(const UA_Float*)p;
+    default: return *(const UA_Double*)p;
+    }
 }
 
-/* Errors are returned as no change detected */
 static UA_Boolean
-detectValueChangeWithFilter(UA_MonitoredItem *mon, UA_DataValue *value,
-                            UA_ByteString *encoding) {
-    /* Encode the data for comparison */
-    size_t binsize = UA_calcSizeBinary(value, &UA_TYPES[UA_TYPES_DATAVALUE]);
-    if(binsize == 0)
-        return false;
+isNumericType(const UA_DataType *type) {
+    return (type->builtin && type->typeIndex >= UA_TYPES_SBYTE &&
+            type->typeIndex <= UA_TYPES_DOUBLE);
+}
 
-    /* Allocate buffer on the heap if necessary */
-    if(binsize > UA_VALUENCODING_MAXSTACK &&
-       UA_ByteString_allocBuffer(encoding, binsize) != UA_STATUSCODE_GOOD)
-        return false;
+/* Same type, array length and array dimensions */
+static UA_Boolean
+sameShape(const UA_Variant *v1, const UA_Variant *v2) {
+    return (v1->type == v2->type &&
+            v1->arrayLength == v2->arrayLength &&
+            (v1->data == NULL) == (v2->data == NULL) &&
+            UA_Variant_isScalar(v1) == UA_Variant_isScalar(v2) &&
+            v1->arrayDimensionsSize == v2->arrayDimensionsSize &&
+            (v1->arrayDimensionsSize == 0 ||
+             memcmp(v1->arrayDimensions, v2->arrayDimensions,
+                    sizeof(UA_UInt32) * v1->arrayDimensionsSize) == 0));
+}
 
-    /* Encode the value */
-    UA_Byte *bufPos = encoding->data;
-    const UA_Byte *bufEnd = &encoding->data[encoding->length];
-    UA_StatusCode retval = UA_encodeBinary(value, &UA_TYPES[UA_TYPES_DATAVALUE],
-                                           &bufPos, &bufEnd, NULL, NULL);
-    if(retval != UA_STATUSCODE_GOOD)
-        return false;
+/* Types nested deeper are assumed to contain floating point values */
+#define UA_ORDER_MAXDEPTH 8
 
-    /* The value has changed */
-    encoding->length = (uintptr_t)bufPos - (uintptr_t)encoding->data;
-    return !mon->lastSampledValue.data || !UA_String_equal(encoding, &mon->lastSampledValue);
+/* Does the type contain floating point values? They are compared numerically
+ * by UA_order. Variants, DataValues and ExtensionObjects can contain values of
+ * any type. */
+static UA_Boolean
+containsFloat(const UA_DataType *type, size_t depth) {
+    if(type->builtin) {
+        switch(type->typeIndex) {
+        case UA_TYPES_FLOAT:
+        case UA_TYPES_DOUBLE:
+        case UA_TYPES_EXTENSIONOBJECT:
+        case UA_TYPES_DATAVALUE:
+        case UA_TYPES_VARIANT:
+            return true;
+        default:
+            return false;
+        }
+    }
+    if(depth >= UA_ORDER_MAXDEPTH)
+        return true;
+    const UA_DataType *typelists[2] = { UA_TYPES, &type[-type->typeIndex] };
+    for(size_t i = 0; i < type->membersSize; ++i) {
+        const UA_DataTypeMember *m = &type->members[i];
+        const UA_DataType *mt = &typelists[!m->namespaceZero][m->memberTypeIndex];
+        if(containsFloat(mt, depth + 1))
+            return true;
+    }
+    return false;
 }
 
-/* Has this sample changed from the last one? The method may allocate additional
- * space for the encoding buffer. Detect the change in encoding->data. */
+/* Does UA_order compare values of the type bitwise? The result is cached in
+ * the MonitoredItem for the type of the last sample. */
 static UA_Boolean
-detectValueChange(UA_MonitoredItem *mon, UA_DataValue *value, UA_ByteString *encoding) {
-    /* Apply Filter */
-    UA_Boolean hasValue = value->hasValue;
-    if(mon->trigger == UA_DATACHANGETRIGGER_STATUS)
-        value->hasValue = false;
-
-    UA_Boolean hasServerTimestamp = value->hasServerTimestamp;
-    UA_Boolean hasServerPicoseconds = value->hasServerPicoseconds;
-    value->hasServerTimestamp = false;
-    value->hasServerPicoseconds = false;
-
-    UA_Boolean hasSourceTimestamp = value->hasSourceTimestamp;
-    UA_Boolean hasSourcePicoseconds = value->hasSourcePicoseconds;
-    if(mon->trigger < UA_DATACHANGETRIGGER_STATUSVALUETIMESTAMP) {
-        value->hasSourceTimestamp = false;
-        value->hasSourcePicoseconds = false;
+orderIsBitwise(UA_MonitoredItem *mon, const UA_DataType *type) {
+    if(mon->orderType != type) {
+        mon->orderIsBitwise = !containsFloat(type, 0);
+        mon->orderType = type;
     }
+    return mon->orderIsBitwise;
+}
 
-    /* Detect the Value Change */
-    UA_Boolean res = detectValueChangeWithFilter(mon, value, encoding);
+/* Values are compared over their binary encoding if they contain floating
+ * point values and cannot be compared in memory */
+static UA_Boolean
+compareEncoded(UA_MonitoredItem *mon, const UA_Variant *v) {
+    return (v->type && !v->type->overlayable && !orderIsBitwise(mon, v->type));
+}
 
-    /* Reset the filter */
-    value->hasValue = hasValue;
-    value->hasServerTimestamp = hasServerTimestamp;
-    value->hasServerPicoseconds = hasServerPicoseconds;
-    value->hasSourceTimestamp = hasSourceTimestamp;
-    value->hasSourcePicoseconds = hasSourcePicoseconds;
-    return res;
+static UA_StatusCode
+encodeVariant(const UA_Variant *v, UA_ByteString *buf) {
+    size_t size = UA_calcSizeBinary((void*)(uintptr_t)v, &UA_TYPES[UA_TYPES_VARIANT]);
+    UA_StatusCode retval = UA_ByteString_allocBuffer(buf, size);
+    if(retval != UA_STATUSCODE_GOOD)
+        return retval;
+    UA_Byte *pos = buf->data;
+    const UA_Byte *end = &buf->data[buf->length];
+    retval = UA_encodeBinary(v, &UA_TYPES[UA_TYPES_VARIANT], &pos, &end, NULL, NULL);
+    if(retval != UA_STATUSCODE_GOOD)
+        UA_ByteString_deleteMembers(buf);
+    return retval;
 }
 
-/* Returns whether a new sample was created */
+/* A sample with its binary encoding. The encoding is computed when it is
+ * needed for the first time. Then it is shared by all MonitoredItems of the
+ * SamplingGroup. */
+typedef struct {
+    UA_DataValue *value;
+    UA_Boolean encoded;
+    UA_ByteString encoding; /* NULL if the encoding failed */
+} UA_Sample;
+
+static void
+UA_Sample_init(UA_Sample *sample, UA_DataValue *value) {
+    sample->value = value;
+    sample->encoded = false;
+    UA_ByteString_init(&sample->encoding);
+}
+
+static const UA_ByteString *
+UA_Sample_getEncoding(UA_Sample *sample) {
+    if(!sample->encoded) {
+        sample->encoded = true;
+        encodeVariant(&sample->value->value, &sample->encoding);
+    }
+    return sample->encoding.data ? &sample->encoding : NULL;
+}
+
+/* Bitwise comparison of the last value with the sample. Unlike UA_equal, +0.0
+ * and -0.0 are different. Overlayable values are compared in memory. Values
+ * that contain floating point numbers and are equal numerically are compared
+ * over their binary encoding. The encoding of the last value is kept in the
+ * MonitoredItem. */
 static UA_Boolean
-sampleCallbackWithValue(UA_Server *server, UA_Subscription *sub,
-                        UA_MonitoredItem *monitoredItem,
-                        UA_DataValue *value,
-                        UA_ByteString *valueEncoding) {
-    /* Store the pointer to the stack-allocated bytestring to see if a heap-allocation
-     * was necessary */
-    UA_Byte *stackValueEncoding = valueEncoding->data;
+bitwiseEqual(UA_MonitoredItem *mon, const UA_Variant *last, UA_Sample *sample) {
+    const UA_Variant *v = &sample->value->value;
+    if(v->type && v->type->overlayable && sameShape(last, v)) {
+        size_t length = v->arrayLength;
+        if(UA_Variant_isScalar(v))
+            length = 1;
+        return (length == 0 ||
+                memcmp(last->data, v->data, v->type->memSize * length) == 0);
+    }
 
-    /* Has the value changed? */
-    UA_Boolean changed = detectValueChange(monitoredItem, value, valueEncoding);
-    if(!changed)
+    if(!UA_equal(last, v, &UA_TYPES[UA_TYPES_VARIANT]))
         return false;
+    if(!compareEncoded(mon, v))
+        return true;
+
+    const UA_ByteString *encoding = UA_Sample_getEncoding(sample);
+    if(!encoding)
+        return true; /* Fall back to the numeric comparison */
+    if(mon->lastValueEncoding.data)
+        return UA_ByteString_equal(&mon->lastValueEncoding, encoding);
+
+    /* The encoding of the last value could not be stored */
+    UA_ByteString lastEncoding;
+    if(encodeVariant(last, &lastEncoding) != UA_STATUSCODE_GOOD)
+        return true;
+    UA_Boolean equal = UA_ByteString_equal(&lastEncoding, encoding);
+    UA_ByteString_deleteMembers(&lastEncoding);
+    return equal;
+}
 
-    /* Allocate the entry for the publish queue */
-    MonitoredItem_queuedValue *newQueueItem =
-        (MonitoredItem_queuedValue *)UA_malloc(sizeof(MonitoredItem_queuedValue));
-    if(!newQueueItem) {
-        UA_LOG_WARNING_SESSION(server->config.logger, sub->session,
-                               "Subscription %u | MonitoredItem %i | "
-                               "Item for the publishing queue could not be allocated",
-                               sub->subscriptionID, monitoredItem->itemId);
-        return false;
+/* Returns true if the value has changed by more than the absolute deadband.
+ * Arrays have changed if one element is outside of the deadband. Non-numeric
+ * values and arrays of different length are compared bitwise. */
+static UA_Boolean
+outsideDeadband(UA_MonitoredItem *mon, const UA_Variant *v1, UA_Sample *sample,
+                UA_Double deadband) {
+    const UA_Variant *v2 = &sample->value->value;
+    if(!v1->type || !isNumericType(v1->type) || !sameShape(v1, v2))
+        return !bitwiseEqual(mon, v1, sample);
+
+    size_t length = v1->arrayLength;
+    if(UA_Variant_isScalar(v1))
+        length = 1;
+    uintptr_t p1 = (uintptr_t)v1->data;
+    uintptr_t p2 = (uintptr_t)v2->data;
+    for(size_t i = 0; i < length; i++) {
+        UA_Double d1 = numericToDouble((const void*)p1, v1->type);
+        UA_Double d2 = numericToDouble((const void*)p2, v1->type);
+        UA_Double diff = d1 - d2;
+        if(diff != diff) {
+            /* At least one NaN */
+            if(d1 == d1 || d2 == d2)
+                return true;
+        } else if(diff > deadband || diff < -deadband) {
+            return true;
+        }
+        p1 += v1->type->memSize;
+        p2 += v1->type->memSize;
     }
+    return false;
+}
 
-    /* Copy valueEncoding on the heap for the next comparison (if not already done) */
-    if(valueEncoding->data == stackValueEncoding) {
-        UA_ByteString cbs;
-        if(UA_ByteString_copy(valueEncoding, &cbs) != UA_STATUSCODE_GOOD) {
-            UA_LOG_WARNING_SESSION(server->config.logger, sub->session,
-                                   "Subscription %u | MonitoredItem %i | "
-                                   "ByteString to compare values could not be created",
-                                   sub->subscriptionID, monitoredItem->itemId);
-            UA_free(newQueueItem);
-            return false;
+/* Compares the sample with the last sampled value. The trigger of the
+ * MonitoredItem selects the fields of the DataValue that are compared. A
+ * missing StatusCode is Good. The server timestamp is never compared. */
+static UA_Boolean
+detectValueChange(UA_MonitoredItem *mon, UA_Sample *sample) {
+    if(!mon->hasLastValue)
+        return true;
+    const UA_DataValue *last = &mon->lastValue;
+    const UA_DataValue *value = sample->value;
+
+    /* Status */
+    UA_StatusCode s1 = last->hasStatus ? last->status : UA_STATUSCODE_GOOD;
+    UA_StatusCode s2 = value->hasStatus ? value->status : UA_STATUSCODE_GOOD;
+    if(s1 != s2)
+        return true;
+    if(mon->trigger == UA_DATACHANGETRIGGER_STATUS)
+        return false;
+
+    /* Value */
+    if(last->hasValue != value->hasValue)
+        return true;
+    if(value->hasValue) {
+        if(mon->deadbandType == UA_DEADBANDTYPE_ABSOLUTE) {
+            if(outsideDeadband(mon, &last->value, sample, mon->deadbandValue))
+                return true;
+        } else if(!bitwiseEqual(mon, &last->value, sample)) {
+            return true;
         }
-        *valueEncoding = cbs;
+    }
+    if(mon->trigger == UA_DATACHANGETRIGGER_STATUSVALUE)
+        return false;
+
+    /* Source timestamp */
+    if(last->hasSourceTimestamp != value->hasSourceTimestamp ||
+       last->sourceTimestamp != value->sourceTimestamp ||
+       last->hasSourcePicoseconds != value->hasSourcePicoseconds ||
+       last->sourcePicoseconds != value->sourcePicoseconds)
+        return true;
+    return false;
+}
+
+/* Keep the encoding of the last value if it is compared over the encoding. If
+ * the encoding cannot be copied, the last value is encoded for the
+ * comparison. */
+static void
+storeLastValueEncoding(UA_MonitoredItem *mon, UA_Sample *sample) {
+    UA_ByteString_deleteMembers(&mon->lastValueEncoding);
+    if(!sample->value->hasValue || !compareEncoded(mon, &sample->value->value))
+        return;
+    const UA_ByteString *encoding = UA_Sample_getEncoding(sample);
+    if(encoding)
+        UA_ByteString_copy(encoding, &mon->lastValueEncoding);
+}
+
+/* Keeps a copy of the sample for the next comparison. The memory of the last
+ * value is reused for scalars of the same pointer-free type. */
+static UA_StatusCode
+storeLastValue(UA_MonitoredItem *mon, const UA_DataValue *value) {
+    UA_DataValue *last = &mon->lastValue;
+    const UA_DataType *type = value->value.type;
+    if(mon->hasLastValue && last->hasValue && value->hasValue &&
+       type && type->pointerFree && last->value.type == type &&
+       last->value.storageType == UA_VARIANT_DATA &&
+       UA_Variant_isScalar(&last->value) && UA_Variant_isScalar(&value->value) &&
+       last->value.arrayDimensionsSize == 0 && value->value.arrayDimensionsSize == 0) {
+        void *data = last->value.data;
+        memcpy(data, value->value.data, type->memSize);
+        *last = *value;
+        last->value.data = data;
+        last->value.storageType = UA_VARIANT_DATA;
+        return UA_STATUSCODE_GOOD;
     }
 
-    /* Prepare the newQueueItem */
-    if(value->hasValue && value->value.storageType == UA_VARIANT_DATA_NODELETE) {
+    UA_DataValue copy;
+    UA_StatusCode retval = UA_DataValue_copy(value, &copy);
+    if(retval != UA_STATUSCODE_GOOD)
+        return retval;
+    UA_DataValue_deleteMembers(last);
+    *last = copy;
+    mon->hasLastValue = true;
+    return UA_STATUSCODE_GOOD;
+}
+
+/* Compares the sample with the last sample and enqueues the value if it has
+ * changed. If moveValue is set, the value may be moved into the queue instead
+ * of being copied. Returns whether the value was moved. */
+static UA_Boolean
+sampleCallbackWithValue(UA_Server *server, UA_MonitoredItem *monitoredItem,
+                        UA_Sample *sample, UA_Boolean moveValue) {
+    UA_Subscription *sub = monitoredItem->subscription;
+    UA_DataValue *value = sample->value;
+
+    /* Has the value changed? */
+    if(!detectValueChange(monitoredItem, sample))
+        return false;
+
+    /* Prepare the value for the queue */
+    UA_DataValue queueValue;
+    UA_Boolean moved = false;
+    if(moveValue &&
+       (!value->hasValue || value->value.storageType != UA_VARIANT_DATA_NODELETE)) {
+        queueValue = *value; /* Just copy the value and do not release it */
+        moved = true;
+    } else {
         /* Make a deep copy of the value */
-        UA_StatusCode retval = UA_DataValue_copy(value, &newQueueItem->value);
+        UA_StatusCode retval = UA_DataValue_copy(value, &queueValue);
         if(retval != UA_STATUSCODE_GOOD) {
             UA_LOG_WARNING_SESSION(server->config.logger, sub->session,
                                    "Subscription %u | MonitoredItem %i | "
                                    "Item for the publishing queue could not be prepared",
                                    sub->subscriptionID, monitoredItem->itemId);
-            UA_free(newQueueItem);
             return false;
         }
-    } else {
-        newQueueItem->value = *value; /* Just copy the value and do not release it */
     }
-    newQueueItem->clientHandle = monitoredItem->clientHandle;
+
+    /* Keep the value for the next comparison */
+    if(storeLastValue(monitoredItem, value) != UA_STATUSCODE_GOOD) {
+        UA_LOG_WARNING_SESSION(server->config.logger, sub->session,
+                               "Subscription %u | MonitoredItem %i | "
+                               "Value to compare with could not be stored",
+                               sub->subscriptionID, monitoredItem->itemId);
+        if(!moved)
+            UA_DataValue_deleteMembers(&queueValue);
+        return false;
+    }
+    storeLastValueEncoding(monitoredItem, sample);
 
     /* <-- Point of no return --> */
 
@@ -191,75 +419,386 @@ sampleCallbackWithValue(UA_Server *server, UA_Subscription *sub,
                          "Subscription %u | MonitoredItem %u | Sampled a new value",
                          sub->subscriptionID, monitoredItem->itemId);
 
-    /* Replace the encoding for comparison */
-    UA_ByteString_deleteMembers(&monitoredItem->lastSampledValue);
-    monitoredItem->lastSampledValue = *valueEncoding;
-
     /* Add the sample to the queue for publication */
-    ensureSpaceInMonitoredItemQueue(monitoredItem);
-    TAILQ_INSERT_TAIL(&monitoredItem->queue, newQueueItem, listEntry);
+    if(monitoredItem->currentQueueSize == 0)
+        TAILQ_INSERT_TAIL(&sub->pendingItems, monitoredItem, pendingEntry);
+    else if(monitoredItem->currentQueueSize >= monitoredItem->maxQueueSize)
+        discardQueuedSample(monitoredItem);
+    MonitoredItem_queuedValue *qv =
+        MonitoredItem_queuedSample(monitoredItem, monitoredItem->currentQueueSize);
+    qv->clientHandle = monitoredItem->clientHandle;
+    qv->value = queueValue;
     ++monitoredItem->currentQueueSize;
-    return true;;
+    ++sub->queuedNotifications;
+    return moved;
+}
+
+static UA_Boolean
+isDataChangeItem(UA_Server *server, UA_MonitoredItem *monitoredItem) {
+    if(monitoredItem->monitoredItemType == UA_MONITOREDITEMTYPE_CHANGENOTIFY)
+        return true;
+    UA_LOG_DEBUG_SESSION(server->config.logger, monitoredItem->subscription->session,
+                         "Subscription %u | MonitoredItem %i | "
+                         "Not a data change notification",
+                         monitoredItem->subscription->subscriptionID,
+                         monitoredItem->itemId);
+    return false;
+}
+
+/* An empty string parses to no range. The range is only parsed for the value
+ * attribute. For the other attributes the read fails with the string set. */
+static UA_StatusCode
+parseIndexRange(const UA_String *indexRange, UA_UInt32 attributeId,
+                UA_NumericRange *range) {
+    range->dimensionsSize = 0;
+    range->dimensions = NULL;
+    if(indexRange->length == 0 || attributeId != UA_ATTRIBUTEID_VALUE)
+        return UA_STATUSCODE_GOOD;
+    return UA_NumericRange_parseFromString(range, indexRange);
+}
+
+UA_StatusCode
+MonitoredItem_setIndexRange(UA_MonitoredItem *mon, const UA_String *indexRange) {
+    UA_String_deleteMembers(&mon->indexRange);
+    UA_free(mon->parsedIndexRange.dimensions);
+    mon->parsedIndexRange.dimensions = NULL;
+    mon->parsedIndexRange.dimensionsSize = 0;
+    UA_StatusCode retval = UA_String_copy(indexRange, &mon->indexRange);
+    if(retval != UA_STATUSCODE_GOOD)
+        return retval;
+    return parseIndexRange(indexRange, mon->attributeID, &mon->parsedIndexRange);
+}
+
+static UA_DataValue
+readSample(UA_Server *server, UA_Session *session, const UA_NodeId *nodeId,
+           UA_UInt32 attributeId, const UA_String *indexRange,
+           const UA_NumericRange *parsedIndexRange,
+           UA_TimestampsToReturn timestampsToReturn) {
+    UA_ReadValueId rvid;
+    UA_ReadValueId_init(&rvid);
+    rvid.nodeId = *nodeId;
+    rvid.attributeId = attributeId;
+    rvid.indexRange = *indexRange;
+    const UA_NumericRange *range = NULL;
+    if(parsedIndexRange->dimensionsSize > 0)
+        range = parsedIndexRange;
+    return UA_Server_readWithSessionRange(server, session, &rvid, range,
+                                          timestampsToReturn);
 }
 
 void
 UA_MoniteredItem_SampleCallback(UA_Server *server,
                                 UA_MonitoredItem *monitoredItem) {
-    UA_Subscription *sub = monitoredItem->subscription;
-    if(monitoredItem->monitoredItemType != UA_MONITOREDITEMTYPE_CHANGENOTIFY) {
-        UA_LOG_DEBUG_SESSION(server->config.logger, sub->session,
-                             "Subscription %u | MonitoredItem %i | "
-                             "Not a data change notification",
-                             sub->subscriptionID, monitoredItem->itemId);
+    if(!isDataChangeItem(server, monitoredItem))
         return;
-    }
 
     /* Read the value */
-    UA_ReadValueId rvid;
-    UA_ReadValueId_init(&rvid);
-    rvid.nodeId = monitoredItem->monitoredNodeId;
-    rvid.attributeId = monitoredItem->attributeID;
-    rvid.indexRange = monitoredItem->indexRange;
     UA_DataValue value =
-        UA_Server_readWithSession(server, sub->session,
-                                  &rvid, monitoredItem->timestampsToReturn);
+        readSample(server, monitoredItem->subscription->session,
+                   &monitoredItem->monitoredNodeId, monitoredItem->attributeID,
+                   &monitoredItem->indexRange, &monitoredItem->parsedIndexRange,
+                   monitoredItem->timestampsToReturn);
+
+    /* Compare with the last value and enqueue */
+    UA_Sample sample;
+    UA_Sample_init(&sample, &value);
+    if(!sampleCallbackWithValue(server, monitoredItem, &sample, true))
+        UA_DataValue_deleteMembers(&value);
+    UA_ByteString_deleteMembers(&sample.encoding);
+}
 
-    /* Stack-allocate some memory for the value encoding. We might heap-allocate
-     * more memory if needed. This is just enough for scalars and small
-     * structures. */
-    UA_Byte *stackValueEncoding = (UA_Byte *)UA_alloca(UA_VALUENCODING_MAXSTACK);
-    UA_ByteString valueEncoding;
-    valueEncoding.data = stackValueEncoding;
-    valueEncoding.length = UA_VALUENCODING_MAXSTACK;
+/******************/
+/* Sampling Group */
+/******************/
 
-    /* Create a sample and compare with the last value */
-    UA_Boolean newNotification = sampleCallbackWithValue(server, sub, monitoredItem,
-                                                         &value, &valueEncoding);
+#define UA_SAMPLINGGROUPS_MINSIZE 64
+
+/* The user access level is checked with every sample. It can change at any
+ * time. The MonitoredItems of a session are adjacent in the SamplingGroup. So
+ * the access is checked once per session. */
+static void
+checkReadAllowed(UA_Server *server, UA_SamplingGroup *sg) {
+    UA_Session *session = NULL;
+    UA_Boolean allowed = true;
+    UA_MonitoredItem *mon;
+    LIST_FOREACH(mon, &sg->monitoredItems, samplingEntry) {
+        if(mon->attributeID != UA_ATTRIBUTEID_VALUE) {
+            mon->readAllowed = true;
+            continue;
+        }
+        if(!session || mon->subscription->session != session) {
+            session = mon->subscription->session;
+            allowed = readValueAllowed(server, session, &sg->nodeId);
+        }
+        mon->readAllowed = allowed;
+    }
+}
+
+/* Fan-out of a sample that is read once with the session of a MonitoredItem
+ * whose user may read the value. MonitoredItems of users without read access
+ * get an access denied status. The value is moved into the queue of the last
+ * MonitoredItem that receives it, if possible. */
+static void
+UA_SamplingGroup_sampleCallback(UA_Server *server, UA_SamplingGroup *sg) {
+    checkReadAllowed(server, sg);
+
+    /* Find a session that is allowed to read the value and the last
+     * MonitoredItem that receives the value */
+    UA_Session *session = NULL;
+    UA_MonitoredItem *lastAllowed = NULL;
+    UA_MonitoredItem *mon;
+    LIST_FOREACH(mon, &sg->monitoredItems, samplingEntry) {
+        if(!mon->readAllowed)
+            continue;
+        if(!session)
+            session = mon->subscription->session;
+        lastAllowed = mon;
+    }
+
+    /* Read the value once */
+    UA_DataValue value;
+    UA_DataValue_init(&value);
+    if(session)
+        value = readSample(server, session, &sg->nodeId, sg->attributeId,
+                           &sg->indexRange, &sg->parsedIndexRange,
+                           sg->timestampsToReturn);
+
+    UA_Sample sample;
+    UA_Sample_init(&sample, &value);
+
+    UA_DataValue denied;
+    UA_DataValue_init(&denied);
+    denied.hasStatus = true;
+    denied.status = UA_STATUSCODE_BADUSERACCESSDENIED;
+    UA_Sample deniedSample;
+    UA_Sample_init(&deniedSample, &denied);
+
+    UA_Boolean moved = false;
+    LIST_FOREACH(mon, &sg->monitoredItems, samplingEntry) {
+        if(!isDataChangeItem(server, mon))
+            continue;
+        if(!mon->readAllowed) {
+            sampleCallbackWithValue(server, mon, &deniedSample, true);
+            continue;
+        }
+        moved |= sampleCallbackWithValue(server, mon, &sample,
+                                         !moved && mon == lastAllowed);
+    }
 
     /* Clean up */
-    if(!newNotification) {
-        if(valueEncoding.data != stackValueEncoding)
-            UA_ByteString_deleteMembers(&valueEncoding);
+    if(!moved)
         UA_DataValue_deleteMembers(&value);
+    UA_ByteString_deleteMembers(&sample.encoding);
+}
+
+/* Sampling is serialized with the subscription services. The callback can
+ * still run for an emptied SamplingGroup whose removal is pending. */
+static void
+sampleCallbackLocked(UA_Server *server, UA_SamplingGroup *sg) {
+    UA_LOCK(server->serviceMutex);
+    if(!LIST_EMPTY(&sg->monitoredItems))
+        UA_SamplingGroup_sampleCallback(server, sg);
+    UA_UNLOCK(server->serviceMutex);
+}
+
+/* The attributes that depend on the user are not shared between sessions */
+static UA_Boolean
+isUserAttribute(UA_UInt32 attributeId) {
+    return (attributeId == UA_ATTRIBUTEID_USERWRITEMASK ||
+            attributeId == UA_ATTRIBUTEID_USERACCESSLEVEL ||
+            attributeId == UA_ATTRIBUTEID_USEREXECUTABLE);
+}
+
+static UA_UInt32
+samplingGroupHash(const UA_MonitoredItem *mon, UA_UInt32 interval) {
+    return UA_NodeId_hash(&mon->monitoredNodeId) ^
+        (mon->attributeID * 2654435761u) ^ interval;
+}
+
+static UA_Boolean
+samplingGroupMatches(const UA_SamplingGroup *sg, const UA_MonitoredItem *mon,
+                     UA_UInt32 interval, const UA_Session *session) {
+    return (sg->samplingInterval == interval &&
+            sg->attributeId == mon->attributeID &&
+            sg->timestampsToReturn == mon->timestampsToReturn &&
+            sg->session == session &&
+            UA_NodeId_equal(&sg->nodeId, &mon->monitoredNodeId) &&
+            UA_String_equal(&sg->indexRange, &mon->indexRange));
+}
+
+static struct UA_SamplingGroupBucket *
+samplingGroupBucket(UA_Server *server, UA_UInt32 hash) {
+    return &server->samplingGroups[hash & (server->samplingGroupsSize - 1)];
+}
+
+static UA_StatusCode
+resizeSamplingGroups(UA_Server *server, size_t size) {
+    struct UA_SamplingGroupBucket *buckets = (struct UA_SamplingGroupBucket*)
+        UA_malloc(size * sizeof(struct UA_SamplingGroupBucket));
+    if(!buckets)
+        return UA_STATUSCODE_BADOUTOFMEMORY;
+    for(size_t i = 0; i < size; i++)
+        LIST_INIT(&buckets[i]);
+
+    /* Rehash */
+    struct UA_SamplingGroupBucket *old = server->samplingGroups;
+    size_t oldSize = server->samplingGroupsSize;
+    server->samplingGroups = buckets;
+    server->samplingGroupsSize = size;
+    for(size_t i = 0; i < oldSize; i++) {
+        UA_SamplingGroup *sg;
+        while((sg = LIST_FIRST(&old[i]))) {
+            LIST_REMOVE(sg, listEntry);
+            LIST_INSERT_HEAD(samplingGroupBucket(server, sg->hash), sg, listEntry);
+        }
+    }
+    UA_free(old);
+    return UA_STATUSCODE_GOOD;
+}
+
+static void
+UA_SamplingGroup_deleteMembers(UA_SamplingGroup *sg) {
+    UA_NodeId_deleteMembers(&sg->nodeId);
+    UA_String_deleteMembers(&sg->indexRange);
+    UA_free(sg->parsedIndexRange.dimensions);
+}
+
+/* The index range was parsed when it was set in the MonitoredItem */
+static UA_StatusCode
+copyIndexRange(const UA_NumericRange *src, UA_NumericRange *dst) {
+    dst->dimensionsSize = 0;
+    dst->dimensions = NULL;
+    if(src->dimensionsSize == 0)
+        return UA_STATUSCODE_GOOD;
+    size_t size = sizeof(UA_NumericRangeDimension) * src->dimensionsSize;
+    dst->dimensions = (UA_NumericRangeDimension*)UA_malloc(size);
+    if(!dst->dimensions)
+        return UA_STATUSCODE_BADOUTOFMEMORY;
+    memcpy(dst->dimensions, src->dimensions, size);
+    dst->dimensionsSize = src->dimensionsSize;
+    return UA_STATUSCODE_GOOD;
+}
+
+static UA_SamplingGroup *
+UA_SamplingGroup_new(UA_Server *server, const UA_MonitoredItem *mon,
+                     UA_UInt32 interval, UA_Session *session, UA_UInt32 hash) {
+    /* Grow the hash buckets. Lookups still work with longer chains if the
+     * buckets cannot be grown. */
+    if(server->samplingGroupsCount >= server->samplingGroupsSize) {
+        size_t size = server->samplingGroupsSize * 2;
+        if(size == 0)
+            size = UA_SAMPLINGGROUPS_MINSIZE;
+        if(resizeSamplingGroups(server, size) != UA_STATUSCODE_GOOD &&
+           server->samplingGroupsSize == 0)
+            return NULL;
+    }
+
+    UA_SamplingGroup *sg = (UA_SamplingGroup*)UA_calloc(1, sizeof(UA_SamplingGroup));
+    if(!sg)
+        return NULL;
+    sg->hash = hash;
+    sg->attributeId = mon->attributeID;
+    sg->timestampsToReturn = mon->timestampsToReturn;
+    sg->samplingInterval = interval;
+    sg->session = session;
+    LIST_INIT(&sg->monitoredItems);
+    UA_StatusCode retval = UA_NodeId_copy(&mon->monitoredNodeId, &sg->nodeId);
+    retval |= UA_String_copy(&mon->indexRange, &sg->indexRange);
+    if(retval == UA_STATUSCODE_GOOD)
+        retval = copyIndexRange(&mon->parsedIndexRange, &sg->parsedIndexRange);
+    if(retval == UA_STATUSCODE_GOOD)
+        retval = UA_Server_addRepeatedCallback(server,
+                                               (UA_ServerCallback)sampleCallbackLocked,
+                                               sg, interval, &sg->sampleCallbackId);
+    if(retval != UA_STATUSCODE_GOOD) {
+        UA_SamplingGroup_deleteMembers(sg);
+        UA_free(sg);
+        return NULL;
     }
+
+    LIST_INSERT_HEAD(samplingGroupBucket(server, hash), sg, listEntry);
+    server->samplingGroupsCount++;
+    return sg;
 }
 
 UA_StatusCode
 MonitoredItem_registerSampleCallback(UA_Server *server, UA_MonitoredItem *mon) {
-    UA_StatusCode retval =
-        UA_Server_addRepeatedCallback(server, (UA_ServerCallback)UA_MoniteredItem_SampleCallback,
-                                      mon, (UA_UInt32)mon->samplingInterval, &mon->sampleCallbackId);
-    if(retval == UA_STATUSCODE_GOOD)
-        mon->sampleCallbackIsRegistered = true;
-    return retval;
+    if(mon->samplingGroup)
+        return UA_STATUSCODE_GOOD;
+
+    /* Find the SamplingGroup */
+    UA_UInt32 interval = (UA_UInt32)mon->samplingInterval;
+    UA_Session *session = NULL;
+    if(isUserAttribute(mon->attributeID))
+        session = mon->subscription->session;
+    UA_UInt32 hash = samplingGroupHash(mon, interval);
+    UA_SamplingGroup *sg = NULL;
+    if(server->samplingGroupsSize > 0) {
+        LIST_FOREACH(sg, samplingGroupBucket(server, hash), listEntry) {
+            if(samplingGroupMatches(sg, mon, interval, session))
+                break;
+        }
+    }
+
+    /* Create a new SamplingGroup */
+    if(!sg) {
+        sg = UA_SamplingGroup_new(server, mon, interval, session, hash);
+        if(!sg)
+            return UA_STATUSCODE_BADINTERNALERROR;
+    }
+
+    /* Keep the MonitoredItems of a session adjacent */
+    UA_MonitoredItem *other;
+    LIST_FOREACH(other, &sg->monitoredItems, samplingEntry) {
+        if(other->subscription->session == mon->subscription->session)
+            break;
+    }
+    if(other)
+        LIST_INSERT_AFTER(other, mon, samplingEntry);
+    else
+        LIST_INSERT_HEAD(&sg->monitoredItems, mon, samplingEntry);
+    mon->samplingGroup = sg;
+    return UA_STATUSCODE_GOOD;
 }
 
 UA_StatusCode
 MonitoredItem_unregisterSampleCallback(UA_Server *server, UA_MonitoredItem *mon) {
-    if(!mon->sampleCallbackIsRegistered)
+    UA_SamplingGroup *sg = mon->samplingGroup;
+    if(!sg)
+        return UA_STATUSCODE_GOOD;
+    LIST_REMOVE(mon, samplingEntry);
+    mon->samplingGroup = NULL;
+    if(!LIST_EMPTY(&sg->monitoredItems))
         return UA_STATUSCODE_GOOD;
-    mon->sampleCallbackIsRegistered = false;
-    return UA_Server_removeRepeatedCallback(server, mon->sampleCallbackId);
+
+    /* Remove the empty SamplingGroup */
+    LIST_REMOVE(sg, listEntry);
+    server->samplingGroupsCount--;
+    UA_StatusCode retval = UA_Server_removeRepeatedCallback(server, sg->sampleCallbackId);
+    UA_SamplingGroup_deleteMembers(sg);
+    UA_Server_delayedFree(server, sg);
+    return retval;
+}
+
+void
+UA_Server_deleteSamplingGroups(UA_Server *server) {
+    for(size_t i = 0; i < server->samplingGroupsSize; i++) {
+        UA_SamplingGroup *sg;
+        while((sg = LIST_FIRST(&server->samplingGroups[i]))) {
+            UA_MonitoredItem *mon;
+            while((mon = LIST_FIRST(&sg->monitoredItems))) {
+                LIST_REMOVE(mon, samplingEntry);
+                mon->samplingGroup = NULL;
+            }
+            LIST_REMOVE(sg, listEntry);
+            UA_SamplingGroup_deleteMembers(sg);
+            UA_free(sg);
+        }
+    }
+    UA_free(server->samplingGroups);
+    server->samplingGroups = NULL;
+    server->samplingGroupsSize = 0;
+    server->samplingGroupsCount = 0;
 }
 
 #endif /* UA_ENABLE_SUBSCRIPTIONS */
@@ -75,16 +75,32 @@ prependIncompleteChunk(UA_Connection *connection, UA_ByteString *message) {
     return UA_STATUSCODE_GOOD;
 }
 
+/* The buffer is allocated for the complete chunk if the chunk length is
+ * already known. Then the following packets are appended in place. */
 static UA_StatusCode
-bufferIncompleteChunk(UA_Connection *connection, const UA_Byte *pos, const UA_Byte *end) {
+bufferIncompleteChunk(UA_Connection *connection, const UA_Byte *pos,
+                      const UA_Byte *end, size_t chunkLength) {
     size_t length = (uintptr_t)end - (uintptr_t)pos;
-    UA_StatusCode retval = UA_ByteString_allocBuffer(&connection->incompleteMessage, length);
+    if(chunkLength < length)
+        chunkLength = length;
+    UA_StatusCode retval = UA_ByteString_allocBuffer(&connection->incompleteMessage, chunkLength);
     if(retval != UA_STATUSCODE_GOOD)
         return retval;
     memcpy(connection->incompleteMessage.data, pos, length);
+    connection->incompleteMessage.length = length;
     return UA_STATUSCODE_GOOD;
 }
 
+static size_t
+decodeChunkLength(const UA_Byte *pos) {
+    UA_UInt32 chunk_length = 0;
+    UA_ByteString temp = { 8, (UA_Byte*)(uintptr_t)pos }; /* At least 8 byte left */
+    size_t temp_offset = 4;
+    /* Decoding the UInt32 cannot fail */
+    UA_UInt32_decodeBinary(&temp, &temp_offset, &chunk_length);
+    return chunk_length;
+}
+
 static UA_StatusCode
 processChunk(UA_Connection *connection, void *application,
              UA_Connection_processChunk processCallback,
@@ -94,7 +110,7 @@ processChunk(UA_Connection *connection, void *application,
 
     /* At least 8 byte needed for the header. Wait for the next chunk. */
     if(length < 8) {
-        bufferIncompleteChunk(connection, pos, end);
+        bufferIncompleteChunk(connection, pos, end, 0);
         *done = true;
         return UA_STATUSCODE_GOOD;
     }
@@ -115,25 +131,25 @@ processChunk(UA_Connection *connection, void *application,
         return UA_STATUSCODE_BADTCPMESSAGETYPEINVALID;
     }
 
-    UA_UInt32 chunk_length = 0;
-    UA_ByteString temp = { 8, (UA_Byte*)(uintptr_t)pos }; /* At least 8 byte left */
-    size_t temp_offset = 4;
-    /* Decoding the UInt32 cannot fail */
-    UA_UInt32_decodeBinary(&temp, &temp_offset, &chunk_length);
+    size_t chunk_length = decodeChunkLength(pos);
 
-    /* The message size is not allowed */
+    /* The message size is not allowed. Check before the buffer for an
+     * incomplete chunk is allocated with the announced length. */
     if(chunk_length < 16 || chunk_length > connection->localConf.recvBufferSize)
         return UA_STATUSCODE_BADTCPMESSAGETOOLARGE;
+    if(connection->localConf.maxMessageSize != 0 &&
+       chunk_length > connection->localConf.maxMessageSize)
+        return UA_STATUSCODE_BADTCPMESSAGETOOLARGE;
 
     /* Wait for the next packet to process the complete chunk */
     if(chunk_length > length) {
-        bufferIncompleteChunk(connection, pos, end);
+        bufferIncompleteChunk(connection, pos, end, chunk_length);
         *done = true;
         return UA_STATUSCODE_GOOD;
     }
 
     /* Process the chunk; forward the position pointer */
-    temp.length = chunk_length;
+    UA_ByteString temp = { chunk_length, (UA_Byte*)(uintptr_t)pos };
     *posp += chunk_length;
     *done = false;
     return processCallback(application, connection, &temp);
@@ -143,13 +159,39 @@ UA_StatusCode
 UA_Connection_processChunks(UA_Connection *connection, void *application,
                             UA_Connection_processChunk processCallback,
                             const UA_ByteString *packet) {
-    /* If we have stored an incomplete chunk, prefix to the received message.
-     * After this block, connection->incompleteMessage is always empty. The
-     * message and the buffer is released if allocating the memory fails. */
+    /* If we have stored an incomplete chunk with a known length, append to it
+     * in place and process it once complete. If even the header is
+     * incomplete, prefix to the received message. After this block,
+     * connection->incompleteMessage is always empty (unless the packet did not
+     * complete the chunk). The message and the buffer is released if
+     * allocating the memory fails. */
     UA_Boolean realloced = false;
     UA_ByteString message = *packet;
     UA_StatusCode retval;
-    if(connection->incompleteMessage.length > 0) {
+    if(connection->incompleteMessage.length >= 8) {
+        UA_ByteString *incomplete = &connection->incompleteMessage;
+        size_t missing = decodeChunkLength(incomplete->data) - incomplete->length;
+        size_t copy = MIN(missing, message.length);
+        memcpy(&incomplete->data[incomplete->length], message.data, copy);
+        incomplete->length += copy;
+        if(copy < missing)
+            return UA_STATUSCODE_GOOD;
+
+        /* Process the completed chunk */
+        UA_ByteString chunk = *incomplete;
+        *incomplete = UA_BYTESTRING_NULL;
+        const UA_Byte *chunkPos = chunk.data;
+        UA_Boolean chunkDone = true;
+        retval = processChunk(connection, application, processCallback, &chunkPos,
+                              &chunk.data[chunk.length], &chunkDone);
+        UA_ByteString_deleteMembers(&chunk);
+        if(retval != UA_STATUSCODE_GOOD)
+            return retval;
+        message.data += copy;
+        message.length -= copy;
+        if(message.length == 0)
+            return UA_STATUSCODE_GOOD;
+    } else if(connection->incompleteMessage.length > 0) {
         retval = prependIncompleteChunk(connection, &message);
         if(retval != UA_STATUSCODE_GOOD)
             return retval;
@@ -224,12 +266,15 @@ UA_Connection_receiveChunksBlocking(UA_Connection *connection, void *application
     return retval;
 }
 
+/* The connection and the channel can be detached concurrently from both sides.
+ * Taking the pointer with an exchange makes sure that only one of them
+ * continues with the channel. */
 void UA_Connection_detachSecureChannel(UA_Connection *connection) {
-    UA_SecureChannel *channel = connection->channel;
+    UA_SecureChannel *channel = (UA_SecureChannel*)
+        UA_atomic_xchg((void**)&connection->channel, NULL);
     if(channel)
         /* only replace when the channel points to this connection */
         UA_atomic_cmpxchg((void**)&channel->connection, connection, NULL);
-    UA_atomic_xchg((void**)&connection->channel, NULL);
 }
 
 // TODO: Return an error code
@@ -32,6 +32,7 @@ UA_SecureChannel_init(UA_SecureChannel *channel,
     UA_StatusCode retval = UA_STATUSCODE_GOOD;
 
     memset(channel, 0, sizeof(UA_SecureChannel));
+    UA_LOCK_INIT(channel->sendMutex);
     channel->state = UA_SECURECHANNELSTATE_FRESH;
     channel->securityPolicy = securityPolicy;
 
@@ -68,8 +69,9 @@ void UA_SecureChannel_deleteMembersCleanup(UA_SecureChannel* channel) {
         channel->securityPolicy->channelModule.deleteContext(channel->channelContext);
 
     /* Detach from the connection */
-    if(channel->connection)
-        UA_Connection_detachSecureChannel(channel->connection);
+    UA_Connection *connection = channel->connection;
+    if(connection)
+        UA_Connection_detachSecureChannel(connection);
 
     /* Remove session pointers (not the sessions) */
     struct SessionEntry *se, *temp;
@@ -405,6 +407,25 @@ calculatePaddingSym(const UA_SecurityPolicy *securityPolicy, const void *channel
     return padding;
 }
 
+/* Set the encoding position after the message header. The bytes for the
+ * signature and the padding are hidden at the end. */
+static void
+setBufPos(UA_ChunkInfo *ci, UA_Byte **buf_pos, const UA_Byte **buf_end) {
+    const UA_SecureChannel *channel = ci->channel;
+    const UA_SecurityPolicy *securityPolicy = channel->securityPolicy;
+    *buf_pos = &ci->messageBuffer.data[UA_SECURE_MESSAGE_HEADER_LENGTH];
+    *buf_end = &ci->messageBuffer.data[ci->messageBuffer.length];
+
+    if(channel->securityMode == UA_MESSAGESECURITYMODE_SIGN ||
+       channel->securityMode == UA_MESSAGESECURITYMODE_SIGNANDENCRYPT)
+        *buf_end -= securityPolicy->symmetricModule.cryptoModule.
+            getLocalSignatureSize(securityPolicy, channel->channelContext);
+
+    /* Hide a byte needed for padding */
+    if(channel->securityMode == UA_MESSAGESECURITYMODE_SIGNANDENCRYPT)
+        *buf_end -= 2;
+}
+
 /* Sends a message using symmetric encryption if defined
  *
  * @param ci the chunk information that is used to send the chunk.
@@ -415,9 +436,7 @@ static UA_StatusCode
 sendChunkSymmetric(UA_ChunkInfo* ci, UA_Byte **buf_pos, const UA_Byte **buf_end) {
     UA_SecureChannel* const channel = ci->channel;
     const UA_SecurityPolicy *securityPolicy = channel->securityPolicy;
-    UA_Connection* const connection = channel->connection;
-    if(!connection)
-        return UA_STATUSCODE_BADINTERNALERROR;
+    UA_Connection* const connection = ci->connection;
 
     /* Will this chunk surpass the capacity of the SecureChannel for the message? */
     UA_Byte *buf_body_start = ci->messageBuffer.data + UA_SECURE_MESSAGE_HEADER_LENGTH;
@@ -425,14 +444,16 @@ sendChunkSymmetric(UA_ChunkInfo* ci, UA_Byte **buf_pos, const UA_Byte **buf_end)
     size_t bodyLength = (uintptr_t)buf_body_end - (uintptr_t)buf_body_start;
     ci->messageSizeSoFar += bodyLength;
     ci->chunksSoFar++;
-    if(ci->messageSizeSoFar > connection->remoteConf.maxMessageSize &&
-       connection->remoteConf.maxMessageSize != 0)
-        ci->errorCode = UA_STATUSCODE_BADRESPONSETOOLARGE;
-    if(ci->chunksSoFar > connection->remoteConf.maxChunkCount &&
-       connection->remoteConf.maxChunkCount != 0)
-        ci->errorCode = UA_STATUSCODE_BADRESPONSETOOLARGE;
+    if(!ci->abort) {
+        if(ci->messageSizeSoFar > connection->remoteConf.maxMessageSize &&
+           connection->remoteConf.maxMessageSize != 0)
+            ci->errorCode = UA_STATUSCODE_BADRESPONSETOOLARGE;
+        if(ci->chunksSoFar > connection->remoteConf.maxChunkCount &&
+           connection->remoteConf.maxChunkCount != 0)
+            ci->errorCode = UA_STATUSCODE_BADRESPONSETOOLARGE;
+    }
     if(ci->errorCode != UA_STATUSCODE_GOOD) {
-        connection->releaseSendBuffer(channel->connection, &ci->messageBuffer);
+        connection->releaseSendBuffer(connection, &ci->messageBuffer);
         return ci->errorCode;
     }
 
@@ -469,14 +490,12 @@ sendChunkSymmetric(UA_ChunkInfo* ci, UA_Byte **buf_pos, const UA_Byte **buf_end)
     respHeader.secureChannelId = channel->securityToken.channelId;
     respHeader.messageHeader.messageTypeAndChunkType = ci->messageType;
     respHeader.messageHeader.messageSize = (UA_UInt32)total_length;
-    if(ci->errorCode == UA_STATUSCODE_GOOD) {
-        if(ci->final)
-            respHeader.messageHeader.messageTypeAndChunkType += UA_CHUNKTYPE_FINAL;
-        else
-            respHeader.messageHeader.messageTypeAndChunkType += UA_CHUNKTYPE_INTERMEDIATE;
-    } else {
+    if(ci->abort)
         respHeader.messageHeader.messageTypeAndChunkType += UA_CHUNKTYPE_ABORT;
-    }
+    else if(ci->final)
+        respHeader.messageHeader.messageTypeAndChunkType += UA_CHUNKTYPE_FINAL;
+    else
+        respHeader.messageHeader.messageTypeAndChunkType += UA_CHUNKTYPE_INTERMEDIATE;
     ci->errorCode |= UA_encodeBinary(&respHeader,
                                      &UA_TRANSPORT[UA_TRANSPORT_SECURECONVERSATIONMESSAGEHEADER],
                                      &header_pos, buf_end, NULL, NULL);
@@ -505,7 +524,7 @@ sendChunkSymmetric(UA_ChunkInfo* ci, UA_Byte **buf_pos, const UA_Byte **buf_end)
         ci->errorCode = securityPolicy->symmetricModule.cryptoModule.
             sign(securityPolicy, channel->channelContext, &dataToSign, &signature);
         if(ci->errorCode != UA_STATUSCODE_GOOD) {
-            connection->releaseSendBuffer(channel->connection, &ci->messageBuffer);
+            connection->releaseSendBuffer(connection, &ci->messageBuffer);
             return ci->errorCode;
         }
     }
@@ -518,17 +537,17 @@ sendChunkSymmetric(UA_ChunkInfo* ci, UA_Byte **buf_pos, const UA_Byte **buf_end)
         ci->errorCode = securityPolicy->symmetricModule.cryptoModule.
             encrypt(securityPolicy, channel->channelContext, &dataToEncrypt);
         if(ci->errorCode != UA_STATUSCODE_GOOD) {
-            connection->releaseSendBuffer(channel->connection, &ci->messageBuffer);
+            connection->releaseSendBuffer(connection, &ci->messageBuffer);
             return ci->errorCode;
         }
     }
 
     /* Send the chunk, the buffer is freed in the network layer */
     ci->messageBuffer.length = respHeader.messageHeader.messageSize;
-    connection->send(channel->connection, &ci->messageBuffer);
+    connection->send(connection, &ci->messageBuffer);
 
     /* Replace with the buffer for the next chunk */
-    if(!ci->final && ci->errorCode == UA_STATUSCODE_GOOD) {
+    if(!ci->final && !ci->abort && ci->errorCode == UA_STATUSCODE_GOOD) {
         UA_StatusCode retval =
             connection->getSendBuffer(connection, connection->localConf.sendBufferSize,
                                       &ci->messageBuffer);
@@ -537,26 +556,14 @@ sendChunkSymmetric(UA_ChunkInfo* ci, UA_Byte **buf_pos, const UA_Byte **buf_end)
 
         /* Forward the data pointer so that the payload is encoded after the
          * message header */
-        *buf_pos = &ci->messageBuffer.data[UA_SECURE_MESSAGE_HEADER_LENGTH];
-        *buf_end = &ci->messageBuffer.data[ci->messageBuffer.length];
-
-        if(channel->securityMode == UA_MESSAGESECURITYMODE_SIGN ||
-           channel->securityMode == UA_MESSAGESECURITYMODE_SIGNANDENCRYPT)
-            *buf_end -= securityPolicy->symmetricModule.cryptoModule.
-            getLocalSignatureSize(securityPolicy, channel->channelContext);
-
-        /* Hide a byte needed for padding */
-        if(channel->securityMode == UA_MESSAGESECURITYMODE_SIGNANDENCRYPT)
-            *buf_end -= 2;
+        setBufPos(ci, buf_pos, buf_end);
     }
     return ci->errorCode;
 }
 
 UA_StatusCode
-UA_SecureChannel_sendSymmetricMessage(UA_SecureChannel* channel, UA_UInt32 requestId,
-                                      UA_MessageType messageType, const void *content,
-                                      const UA_DataType *contentType) {
-    const UA_SecurityPolicy *const securityPolicy = channel->securityPolicy;
+UA_MessageContext_begin(UA_MessageContext *mc, UA_SecureChannel *channel,
+                        UA_UInt32 requestId, UA_MessageType messageType) {
     UA_Connection* connection = channel->connection;
     if(!connection)
         return UA_STATUSCODE_BADINTERNALERROR;
@@ -565,60 +572,120 @@ UA_SecureChannel_sendSymmetricMessage(UA_SecureChannel* channel, UA_UInt32 reque
     if(connection->localConf.sendBufferSize <= UA_SECURE_MESSAGE_HEADER_LENGTH)
         return UA_STATUSCODE_BADRESPONSETOOLARGE;
 
+    /* Released when the message is finished or aborted */
+    UA_LOCK(channel->sendMutex);
+
     /* Create the chunking info structure */
-    UA_ChunkInfo ci;
-    ci.channel = channel;
-    ci.requestId = requestId;
-    ci.chunksSoFar = 0;
-    ci.messageSizeSoFar = 0;
-    ci.final = false;
-    ci.errorCode = UA_STATUSCODE_GOOD;
-    ci.messageBuffer = UA_BYTESTRING_NULL;
-    ci.messageType = messageType;
+    UA_ChunkInfo *ci = &mc->ci;
+    ci->channel = channel;
+    ci->connection = connection;
+    ci->requestId = requestId;
+    ci->chunksSoFar = 0;
+    ci->messageSizeSoFar = 0;
+    ci->final = false;
+    ci->abort = false;
+    ci->errorCode = UA_STATUSCODE_GOOD;
+    ci->messageBuffer = UA_BYTESTRING_NULL;
+    ci->messageType = messageType;
 
     /* Allocate the message buffer */
     UA_StatusCode retval =
         connection->getSendBuffer(connection, connection->localConf.sendBufferSize,
-                                  &ci.messageBuffer);
-    if(retval != UA_STATUSCODE_GOOD)
+                                  &ci->messageBuffer);
+    if(retval != UA_STATUSCODE_GOOD) {
+        UA_UNLOCK(channel->sendMutex);
         return retval;
+    }
 
     /* Hide the message beginning where the header will be encoded */
-    UA_Byte *buf_start = &ci.messageBuffer.data[UA_SECURE_MESSAGE_HEADER_LENGTH];
-    const UA_Byte *buf_end = &ci.messageBuffer.data[ci.messageBuffer.length];
+    setBufPos(ci, &mc->buf_pos, &mc->buf_end);
+    return UA_STATUSCODE_GOOD;
+}
 
-    /* Hide bytes for signature */
-    if(channel->securityMode == UA_MESSAGESECURITYMODE_SIGN ||
-       channel->securityMode == UA_MESSAGESECURITYMODE_SIGNANDENCRYPT)
-        buf_end -= securityPolicy->symmetricModule.cryptoModule.
-        getLocalSignatureSize(securityPolicy, channel->channelContext);
+UA_StatusCode
+UA_MessageContext_encode(UA_MessageContext *mc, const void *content,
+                         const UA_DataType *contentType) {
+    /* Encode with the chunking callback */
+    return UA_encodeBinary(content, contentType, &mc->buf_pos, &mc->buf_end,
+                           (UA_exchangeEncodeBuffer)sendChunkSymmetric, &mc->ci);
+}
 
-    /* Hide one byte for padding */
-    if(channel->securityMode == UA_MESSAGESECURITYMODE_SIGNANDENCRYPT)
-        buf_end -= 2;
+UA_StatusCode
+UA_MessageContext_finish(UA_MessageContext *mc) {
+    mc->ci.final = true;
+    UA_StatusCode retval = sendChunkSymmetric(&mc->ci, &mc->buf_pos, &mc->buf_end);
+    if(retval != UA_STATUSCODE_GOOD) {
+        /* The final chunk was not sent */
+        mc->ci.final = false;
+        UA_MessageContext_abort(mc, retval);
+        return retval;
+    }
+    UA_UNLOCK(mc->ci.channel->sendMutex);
+    return retval;
+}
 
-    /* Encode the message type */
-    UA_NodeId typeId = UA_NODEID_NUMERIC(0, contentType->binaryEncodingId);
-    retval = UA_encodeBinary(&typeId, &UA_TYPES[UA_TYPES_NODEID],
-                             &buf_start, &buf_end, NULL, NULL);
+void
+UA_MessageContext_abort(UA_MessageContext *mc, UA_StatusCode error) {
+    UA_ChunkInfo *ci = &mc->ci;
+    if(ci->final)
+        return;
+    UA_Connection *connection = ci->connection;
 
-    /* Encode with the chunking callback */
-    retval |= UA_encodeBinary(content, contentType, &buf_start, &buf_end,
-        (UA_exchangeEncodeBuffer)sendChunkSymmetric, &ci);
+    /* A chunk that failed to send was counted. But its buffer was already
+     * released. */
+    UA_UInt16 sentChunks = ci->chunksSoFar;
+    if(ci->errorCode != UA_STATUSCODE_GOOD) {
+        if(sentChunks > 0)
+            sentChunks--;
+    } else {
+        connection->releaseSendBuffer(connection, &ci->messageBuffer);
+    }
+
+    /* Chunks of the message were sent already. An abort chunk tells the
+     * receiver to discard them. The body of the abort chunk is the error code
+     * and a reason. */
+    if(sentChunks > 0 &&
+       connection->getSendBuffer(connection, connection->localConf.sendBufferSize,
+                                 &ci->messageBuffer) == UA_STATUSCODE_GOOD) {
+        ci->abort = true;
+        ci->errorCode = UA_STATUSCODE_GOOD;
+        setBufPos(ci, &mc->buf_pos, &mc->buf_end);
+        UA_String reason = UA_STRING_NULL;
+        UA_StatusCode retval =
+            UA_encodeBinary(&error, &UA_TYPES[UA_TYPES_STATUSCODE],
+                            &mc->buf_pos, &mc->buf_end, NULL, NULL);
+        retval |= UA_encodeBinary(&reason, &UA_TYPES[UA_TYPES_STRING],
+                                  &mc->buf_pos, &mc->buf_end, NULL, NULL);
+        if(retval == UA_STATUSCODE_GOOD)
+            sendChunkSymmetric(ci, &mc->buf_pos, &mc->buf_end);
+        else
+            connection->releaseSendBuffer(connection, &ci->messageBuffer);
+    }
+    UA_UNLOCK(ci->channel->sendMutex);
+}
+
+UA_StatusCode
+UA_SecureChannel_sendSymmetricMessage(UA_SecureChannel* channel, UA_UInt32 requestId,
+                                      UA_MessageType messageType, const void *content,
+                                      const UA_DataType *contentType) {
+    UA_MessageContext mc;
+    UA_StatusCode retval = UA_MessageContext_begin(&mc, channel, requestId, messageType);
+    if(retval != UA_STATUSCODE_GOOD)
+        return retval;
+
+    /* Encode the message type and the content */
+    UA_NodeId typeId = UA_NODEID_NUMERIC(0, contentType->binaryEncodingId);
+    retval = UA_MessageContext_encode(&mc, &typeId, &UA_TYPES[UA_TYPES_NODEID]);
+    retval |= UA_MessageContext_encode(&mc, content, contentType);
 
     /* Encoding failed, release the message */
     if(retval != UA_STATUSCODE_GOOD) {
-        if(!ci.final) {
-            /* the abort message was not sent */
-            ci.errorCode = retval;
-            sendChunkSymmetric(&ci, &buf_start, &buf_end);
-        }
+        UA_MessageContext_abort(&mc, retval);
         return retval;
     }
 
     /* Encoding finished, send the final chunk */
-    ci.final = UA_TRUE;
-    return sendChunkSymmetric(&ci, &buf_start, &buf_end);
+    return UA_MessageContext_finish(&mc);
 }
 
 /*****************************/
@@ -638,15 +705,24 @@ UA_SecureChannel_removeChunks(UA_SecureChannel *channel, UA_UInt32 requestId) {
     }
 }
 
+/* The capacity is (at least) doubled when exceeded. So every byte of a message
+ * with N chunks is moved O(1) times on average instead of O(N). */
 static UA_StatusCode
 appendChunk(struct ChunkEntry* const chunkEntry, const UA_ByteString* const chunkBody) {
-    UA_Byte* new_bytes = (UA_Byte*)
-        UA_realloc(chunkEntry->bytes.data, chunkEntry->bytes.length + chunkBody->length);
-    if(!new_bytes) {
-        UA_ByteString_deleteMembers(&chunkEntry->bytes);
-        return UA_STATUSCODE_BADOUTOFMEMORY;
+    size_t length = chunkEntry->bytes.length + chunkBody->length;
+    if(length > chunkEntry->capacity) {
+        size_t capacity = chunkEntry->capacity * 2;
+        if(capacity < length)
+            capacity = length;
+        UA_Byte* new_bytes = (UA_Byte*)UA_realloc(chunkEntry->bytes.data, capacity);
+        if(!new_bytes) {
+            UA_ByteString_deleteMembers(&chunkEntry->bytes);
+            chunkEntry->capacity = 0;
+            return UA_STATUSCODE_BADOUTOFMEMORY;
+        }
+        chunkEntry->bytes.data = new_bytes;
+        chunkEntry->capacity = capacity;
     }
-    chunkEntry->bytes.data = new_bytes;
     memcpy(&chunkEntry->bytes.data[chunkEntry->bytes.length], chunkBody->data, chunkBody->length);
     chunkEntry->bytes.length += chunkBody->length;
     return UA_STATUSCODE_GOOD;
@@ -668,6 +744,7 @@ UA_SecureChannel_appendChunk(UA_SecureChannel* channel, UA_UInt32 requestId,
             return UA_STATUSCODE_BADOUTOFMEMORY;
         ch->requestId = requestId;
         UA_ByteString_init(&ch->bytes);
+        ch->capacity = 0;
         LIST_INSERT_HEAD(&channel->chunks, ch, pointers);
     }
 
@@ -27,11 +27,13 @@ struct SessionEntry {
     UA_Session *session; // Just a pointer. The session is held in the session manager or the client
 };
 
-/* For chunked requests */
+/* For chunked requests. The buffer grows geometrically. bytes.length is the
+ * used part of the capacity. */
 struct ChunkEntry {
     LIST_ENTRY(ChunkEntry) pointers;
     UA_UInt32 requestId;
     UA_ByteString bytes;
+    size_t capacity;
 };
 
 typedef enum {
@@ -64,6 +66,12 @@ struct UA_SecureChannel {
 
     LIST_HEAD(session_pointerlist, SessionEntry) sessions;
     LIST_HEAD(chunk_pointerlist, ChunkEntry) chunks;
+
+    /* The chunks of a message are sent without interleaving with the chunks
+     * of messages sent from other threads. Initialized in
+     * UA_SecureChannel_init and destroyed by the owner of the channel after
+     * the cleanup. */
+    UA_LOCK_TYPE(sendMutex)
 };
 
 UA_StatusCode
@@ -110,6 +118,8 @@ UA_SecureChannel_sendAsymmetricOPNMessage(UA_SecureChannel *channel, UA_UInt32 r
 /* For sending responses in multiple chunks */
 typedef struct {
     UA_SecureChannel *channel;
+    UA_Connection *connection; /* Taken once when the message begins. The
+                                * channel may be detached meanwhile. */
     UA_UInt32 requestId;
     UA_UInt32 messageType;
 
@@ -119,8 +129,37 @@ typedef struct {
     UA_ByteString messageBuffer;
     UA_StatusCode errorCode;
     UA_Boolean final;
+    UA_Boolean abort; /* Send an abort chunk */
 } UA_ChunkInfo;
 
+/* Streaming of a symmetric message. The content is encoded with one or more
+ * calls to UA_MessageContext_encode. Full chunks are sent as soon as the send
+ * buffer is exhausted. So large messages are never held in memory completely.
+ * After _begin succeeded, the message context is cleaned up by either _finish
+ * or _abort. */
+typedef struct {
+    UA_ChunkInfo ci;
+    UA_Byte *buf_pos;
+    const UA_Byte *buf_end;
+} UA_MessageContext;
+
+UA_StatusCode
+UA_MessageContext_begin(UA_MessageContext *mc, UA_SecureChannel *channel,
+                        UA_UInt32 requestId, UA_MessageType messageType);
+
+UA_StatusCode
+UA_MessageContext_encode(UA_MessageContext *mc, const void *content,
+                         const UA_DataType *contentType);
+
+/* Sends the final chunk. The message is aborted if that fails. */
+UA_StatusCode
+UA_MessageContext_finish(UA_MessageContext *mc);
+
+/* Releases the buffer of the unfinished message. If chunks of the message
+ * were sent already, an abort chunk with the error code is sent. */
+void
+UA_MessageContext_abort(UA_MessageContext *mc, UA_StatusCode error);
+
 typedef UA_StatusCode
 (UA_ProcessMessageCallback)(void *application, UA_SecureChannel *channel,
                             UA_MessageType messageType, UA_UInt32 requestId,
@@ -7,6 +7,7 @@
 #include "ua_util.h"
 #ifdef UA_ENABLE_SUBSCRIPTIONS
 #include "server/ua_subscription.h"
+#include "server/ua_server_internal.h"
 #endif
 
 UA_Session adminSession = {
@@ -76,7 +77,7 @@ void UA_Session_deleteMembersCleanup(UA_Session *session, UA_Server* server) {
     LIST_FOREACH_SAFE(currents, &session->serverSubscriptions, listEntry, temps) {
         LIST_REMOVE(currents, listEntry);
         UA_Subscription_deleteMembers(currents, server);
-        UA_free(currents);
+        UA_Server_delayedFree(server, currents);
     }
     UA_PublishResponseEntry *entry;
     while((entry = SIMPLEQ_FIRST(&session->responseQueue))) {
@@ -106,7 +107,7 @@ UA_Session_deleteSubscription(UA_Server *server, UA_Session *session,
         return UA_STATUSCODE_BADSUBSCRIPTIONIDINVALID;
     LIST_REMOVE(sub, listEntry);
     UA_Subscription_deleteMembers(sub, server);
-    UA_free(sub);
+    UA_Server_delayedFree(server, sub);
     return UA_STATUSCODE_GOOD;
 }
 
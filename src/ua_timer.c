@@ -11,34 +11,45 @@
  * by Dmitry Vyukov.
  * http://www.1024cores.net/home/lock-free-algorithms/queues/intrusive-mpsc-node-based-queue
  *
- * The RepeatedCallback structure is used both in the sorted list of callbacks
- * and in the MPSC changes queue. For the changes queue, we differentiate
- * between three cases encoded in the callback pointer.
+ * The RepeatedCallback structure is used both in the heap of callbacks and in
+ * the MPSC changes queue. For the changes queue, we differentiate between three
+ * cases encoded in the callback pointer.
  *
- * callback > 0x01: add the new repeated callback to the sorted list
+ * callback > 0x01: add the new repeated callback to the heap
  * callback == 0x00: remove the callback with the same id
  * callback == 0x01: change the interval of the existing callback */
 
 #define REMOVE_SENTINEL 0x00
 #define CHANGE_SENTINEL 0x01
 
+#define UA_TIMER_HEAPARITY 4
+#define UA_TIMER_MINSIZE 16
+
 struct UA_TimerCallbackEntry {
-    SLIST_ENTRY(UA_TimerCallbackEntry) next; /* Next element in the list */
+    SLIST_ENTRY(UA_TimerCallbackEntry) next; /* Next element in the MPSC queue */
     UA_DateTime nextTime;                    /* The next time when the callbacks
                                               * are to be executed */
     UA_UInt64 interval;                      /* Interval in 100ns resolution */
     UA_UInt64 id;                            /* Id of the repeated callback */
 
+    size_t heapIndex;                        /* Position in the heap */
+    UA_TimerCallbackEntry *idNext;           /* Next entry in the id bucket */
+
     UA_TimerCallback callback;
     void *data;
 };
 
 void
 UA_Timer_init(UA_Timer *t) {
-    SLIST_INIT(&t->repeatedCallbacks);
+    t->heap = NULL;
+    t->heapSize = 0;
+    t->heapCapacity = 0;
+    t->idMap = NULL;
+    t->idMapSize = 0;
     t->changes_head = (UA_TimerCallbackEntry*)&t->changes_stub;
     t->changes_tail = (UA_TimerCallbackEntry*)&t->changes_stub;
     t->changes_stub = NULL;
+    t->changes_pending = NULL;
     t->idCounter = 0;
 }
 
@@ -117,30 +128,157 @@ UA_Timer_addRepeatedCallback(UA_Timer *t, UA_TimerCallback callback,
     return UA_STATUSCODE_GOOD;
 }
 
+/********/
+/* Heap */
+/********/
+
+/* Entries with the same timestamp are executed in the order they were added */
+static UA_Boolean
+entryBefore(const UA_TimerCallbackEntry *a, const UA_TimerCallbackEntry *b) {
+    if(a->nextTime != b->nextTime)
+        return a->nextTime < b->nextTime;
+    return a->id < b->id;
+}
+
 static void
-addTimerCallbackEntry(UA_Timer *t, UA_TimerCallbackEntry * UA_RESTRICT tc) {
-    /* Find the last entry before this callback */
-    UA_TimerCallbackEntry *tmpTc, *afterTc = NULL;
-    SLIST_FOREACH(tmpTc, &t->repeatedCallbacks, next) {
-        if(tmpTc->nextTime >= tc->nextTime)
+heapSet(UA_Timer *t, size_t pos, UA_TimerCallbackEntry *tc) {
+    t->heap[pos] = tc;
+    tc->heapIndex = pos;
+}
+
+static void
+heapSiftUp(UA_Timer *t, size_t pos) {
+    UA_TimerCallbackEntry *tc = t->heap[pos];
+    while(pos > 0) {
+        size_t parent = (pos - 1) / UA_TIMER_HEAPARITY;
+        if(!entryBefore(tc, t->heap[parent]))
             break;
-        afterTc = tmpTc;
-
-        /* The goal is to have many repeated callbacks with the same repetition
-         * interval in a "block" in order to reduce linear search for re-entry
-         * to the sorted list after processing. Allow the first execution to lie
-         * between "nextTime - 1s" and "nextTime" if this adjustment groups
-         * callbacks with the same repetition interval. */
-        if(tmpTc->interval == tc->interval &&
-           tmpTc->nextTime > (tc->nextTime - UA_SEC_TO_DATETIME))
-            tc->nextTime = tmpTc->nextTime;
+        heapSet(t, pos, t->heap[parent]);
+        pos = parent;
     }
+    heapSet(t, pos, tc);
+}
 
-    /* Add the repeated callback */
-    if(afterTc)
-        SLIST_INSERT_AFTER(afterTc, tc, next);
+static void
+heapSiftDown(UA_Timer *t, size_t pos) {
+    UA_TimerCallbackEntry *tc = t->heap[pos];
+    while(true) {
+        /* Find the earliest child */
+        size_t first = (pos * UA_TIMER_HEAPARITY) + 1;
+        if(first >= t->heapSize)
+            break;
+        size_t last = first + UA_TIMER_HEAPARITY;
+        if(last > t->heapSize)
+            last = t->heapSize;
+        size_t min = first;
+        for(size_t i = first + 1; i < last; i++) {
+            if(entryBefore(t->heap[i], t->heap[min]))
+                min = i;
+        }
+        if(!entryBefore(t->heap[min], tc))
+            break;
+        heapSet(t, pos, t->heap[min]);
+        pos = min;
+    }
+    heapSet(t, pos, tc);
+}
+
+/* Restore the heap property after the timestamp of an entry has changed */
+static void
+heapUpdate(UA_Timer *t, size_t pos) {
+    if(pos > 0 && entryBefore(t->heap[pos], t->heap[(pos - 1) / UA_TIMER_HEAPARITY]))
+        heapSiftUp(t, pos);
     else
-        SLIST_INSERT_HEAD(&t->repeatedCallbacks, tc, next);
+        heapSiftDown(t, pos);
+}
+
+static void
+heapRemove(UA_Timer *t, size_t pos) {
+    t->heapSize--;
+    if(pos == t->heapSize)
+        return;
+    heapSet(t, pos, t->heap[t->heapSize]);
+    heapUpdate(t, pos);
+}
+
+/**********/
+/* Id Map */
+/**********/
+
+static UA_TimerCallbackEntry **
+idBucket(UA_Timer *t, UA_UInt64 id) {
+    /* The ids are consecutive and need no hash function */
+    return &t->idMap[id & (t->idMapSize - 1)];
+}
+
+static UA_TimerCallbackEntry *
+findTimerCallbackEntry(UA_Timer *t, UA_UInt64 id) {
+    if(t->idMapSize == 0)
+        return NULL;
+    UA_TimerCallbackEntry *tc = *idBucket(t, id);
+    while(tc && tc->id != id)
+        tc = tc->idNext;
+    return tc;
+}
+
+static void
+idMapRemove(UA_Timer *t, UA_TimerCallbackEntry *tc) {
+    UA_TimerCallbackEntry **prev = idBucket(t, tc->id);
+    while(*prev != tc)
+        prev = &(*prev)->idNext;
+    *prev = tc->idNext;
+}
+
+static UA_StatusCode
+idMapResize(UA_Timer *t, size_t size) {
+    UA_TimerCallbackEntry **idMap = (UA_TimerCallbackEntry**)
+        UA_calloc(size, sizeof(UA_TimerCallbackEntry*));
+    if(!idMap)
+        return UA_STATUSCODE_BADOUTOFMEMORY;
+    UA_free(t->idMap);
+    t->idMap = idMap;
+    t->idMapSize = size;
+    for(size_t i = 0; i < t->heapSize; i++) {
+        UA_TimerCallbackEntry **bucket = idBucket(t, t->heap[i]->id);
+        t->heap[i]->idNext = *bucket;
+        *bucket = t->heap[i];
+    }
+    return UA_STATUSCODE_GOOD;
+}
+
+static UA_StatusCode
+addTimerCallbackEntry(UA_Timer *t, UA_TimerCallbackEntry * UA_RESTRICT tc) {
+    /* Grow the heap */
+    if(t->heapSize >= t->heapCapacity) {
+        size_t capacity = t->heapCapacity * 2;
+        if(capacity == 0)
+            capacity = UA_TIMER_MINSIZE;
+        UA_TimerCallbackEntry **heap = (UA_TimerCallbackEntry**)
+            UA_realloc(t->heap, capacity * sizeof(UA_TimerCallbackEntry*));
+        if(!heap)
+            return UA_STATUSCODE_BADOUTOFMEMORY;
+        t->heap = heap;
+        t->heapCapacity = capacity;
+    }
+
+    /* Grow the id map. Lookups still work with longer chains if the map
+     * cannot be grown. */
+    if(t->heapSize >= t->idMapSize) {
+        size_t size = t->idMapSize * 2;
+        if(size == 0)
+            size = UA_TIMER_MINSIZE;
+        if(idMapResize(t, size) != UA_STATUSCODE_GOOD && t->idMapSize == 0)
+            return UA_STATUSCODE_BADOUTOFMEMORY;
+    }
+
+    /* Add the repeated callback */
+    UA_TimerCallbackEntry **bucket = idBucket(t, tc->id);
+    tc->idNext = *bucket;
+    *bucket = tc;
+    heapSet(t, t->heapSize, tc);
+    t->heapSize++;
+    heapSiftUp(t, tc->heapIndex);
+    return UA_STATUSCODE_GOOD;
 }
 
 UA_StatusCode
@@ -170,18 +308,7 @@ UA_Timer_changeRepeatedCallbackInterval(UA_Timer *t, UA_UInt64 callbackId,
 static void
 changeTimerCallbackEntryInterval(UA_Timer *t, UA_UInt64 callbackId,
                                  UA_UInt64 interval, UA_DateTime nextTime) {
-    /* Remove from the sorted list */
-    UA_TimerCallbackEntry *tc, *prev = NULL;
-    SLIST_FOREACH(tc, &t->repeatedCallbacks, next) {
-        if(callbackId == tc->id) {
-            if(prev)
-                SLIST_REMOVE_AFTER(prev, next);
-            else
-                SLIST_REMOVE_HEAD(&t->repeatedCallbacks, next);
-            break;
-        }
-        prev = tc;
-    }
+    UA_TimerCallbackEntry *tc = findTimerCallbackEntry(t, callbackId);
     if(!tc)
         return;
 
@@ -189,13 +316,12 @@ changeTimerCallbackEntryInterval(UA_Timer *t, UA_UInt64 callbackId,
     tc->interval = interval;
     tc->nextTime = nextTime;
 
-    /* Reinsert at the new position */
-    addTimerCallbackEntry(t, tc);
+    /* Move to the new position */
+    heapUpdate(t, tc->heapIndex);
 }
 
-/* Removing a repeated callback: Add an entry with the "nextTime" timestamp set
- * to UA_INT64_MAX. The next iteration picks this up and removes the repated
- * callback from the linked list. */
+/* Removing a repeated callback: Add an entry with the remove sentinel. The next
+ * iteration picks this up and removes the repated callback from the heap. */
 UA_StatusCode
 UA_Timer_removeRepeatedCallback(UA_Timer *t, UA_UInt64 callbackId) {
     /* Allocate the repeated callback structure */
@@ -215,25 +341,22 @@ UA_Timer_removeRepeatedCallback(UA_Timer *t, UA_UInt64 callbackId) {
 
 static void
 removeRepeatedCallback(UA_Timer *t, UA_UInt64 callbackId) {
-    UA_TimerCallbackEntry *tc, *prev = NULL;
-    SLIST_FOREACH(tc, &t->repeatedCallbacks, next) {
-        if(callbackId == tc->id) {
-            if(prev)
-                SLIST_REMOVE_AFTER(prev, next);
-            else
-                SLIST_REMOVE_HEAD(&t->repeatedCallbacks, next);
-            UA_free(tc);
-            break;
-        }
-        prev = tc;
-    }
+    UA_TimerCallbackEntry *tc = findTimerCallbackEntry(t, callbackId);
+    if(!tc)
+        return;
+    heapRemove(t, tc->heapIndex);
+    idMapRemove(t, tc);
+    UA_free(tc);
 }
 
 /* Process the changes that were added to the MPSC queue (by other threads) */
 static void
 processChanges(UA_Timer *t) {
-    UA_TimerCallbackEntry *change;
-    while((change = dequeueChange(t))) {
+    UA_TimerCallbackEntry *change = t->changes_pending;
+    t->changes_pending = NULL;
+    if(!change)
+        change = dequeueChange(t);
+    for(; change; change = dequeueChange(t)) {
         switch((uintptr_t)change->callback) {
         case REMOVE_SENTINEL:
             removeRepeatedCallback(t, change->id);
@@ -245,7 +368,13 @@ processChanges(UA_Timer *t) {
             UA_free(change);
             break;
         default:
-            addTimerCallbackEntry(t, change);
+            /* Out of memory. Retry in the next iteration. The remaining
+             * changes stay in the queue. A remove that follows in the queue
+             * must not be processed before the add. */
+            if(addTimerCallbackEntry(t, change) != UA_STATUSCODE_GOOD) {
+                t->changes_pending = change;
+                return;
+            }
         }
     }
 }
@@ -257,37 +386,12 @@ UA_Timer_process(UA_Timer *t, UA_DateTime nowMonotonic,
     /* Insert and remove callbacks */
     processChanges(t);
 
-    /* Find the last callback to be executed now */
-    UA_TimerCallbackEntry *firstAfter, *lastNow = NULL;
-    SLIST_FOREACH(firstAfter, &t->repeatedCallbacks, next) {
-        if(firstAfter->nextTime > nowMonotonic)
+    /* Dispatch the callbacks that have timed out. Every callback is
+     * rescheduled in place and sifted down the heap. */
+    while(t->heapSize > 0) {
+        UA_TimerCallbackEntry *tc = t->heap[0];
+        if(tc->nextTime > nowMonotonic)
             break;
-        lastNow = firstAfter;
-    }
-
-    /* Nothing to do */
-    if(!lastNow) {
-        if(firstAfter)
-            return firstAfter->nextTime;
-        return UA_INT64_MAX;
-    }
-
-    /* Put the callbacks that are executed now in a separate list */
-    UA_TimerCallbackList executedNowList;
-    executedNowList.slh_first = SLIST_FIRST(&t->repeatedCallbacks);
-    lastNow->next.sle_next = NULL;
-
-    /* Fake entry to represent the first element in the newly-sorted list */
-    UA_TimerCallbackEntry tmp_first;
-    tmp_first.nextTime = nowMonotonic - 1; /* never matches for last_dispatched */
-    tmp_first.next.sle_next = firstAfter;
-    UA_TimerCallbackEntry *last_dispatched = &tmp_first;
-
-    /* Iterate over the list of callbacks to process now */
-    UA_TimerCallbackEntry *tc;
-    while((tc = SLIST_FIRST(&executedNowList))) {
-        /* Remove from the list */
-        SLIST_REMOVE_HEAD(&executedNowList, next);
 
         /* Dispatch/process callback */
         dispatchCallback(application, tc->callback, tc->data);
@@ -297,58 +401,37 @@ UA_Timer_process(UA_Timer *t, UA_DateTime nowMonotonic,
         tc->nextTime += (UA_Int64)tc->interval;
         if(tc->nextTime < nowMonotonic)
             tc->nextTime = nowMonotonic + 1;
-
-        /* Find the new position for tc to keep the list sorted */
-        UA_TimerCallbackEntry *prev_tc;
-        if(last_dispatched->nextTime == tc->nextTime) {
-            /* We try to "batch" repeatedCallbacks with the same interval. This
-             * saves a linear search when the last dispatched entry has the same
-             * nextTime timestamp as this entry. */
-            UA_assert(last_dispatched != &tmp_first);
-            prev_tc = last_dispatched;
-        } else {
-            /* Find the position for the next execution by a linear search
-             * starting at last_dispatched or the first element */
-            if(last_dispatched->nextTime < tc->nextTime)
-                prev_tc = last_dispatched;
-            else
-                prev_tc = &tmp_first;
-
-            while(true) {
-                UA_TimerCallbackEntry *n = SLIST_NEXT(prev_tc, next);
-                if(!n || n->nextTime >= tc->nextTime)
-                    break;
-                prev_tc = n;
-            }
-
-            /* Update last_dispatched */
-            last_dispatched = tc;
-        }
-
-        /* Add entry to the new position in the sorted list */
-        SLIST_INSERT_AFTER(prev_tc, tc, next);
+        heapSiftDown(t, 0);
     }
 
-    /* Set the entry-point for the newly sorted list */
-    t->repeatedCallbacks.slh_first = tmp_first.next.sle_next;
-
     /* Re-repeat processAddRemoved since one of the callbacks might have removed
      * or added a callback. So we return a correct timeout. */
     processChanges(t);
 
     /* Return timestamp of next repetition */
-    return SLIST_FIRST(&t->repeatedCallbacks)->nextTime;
+    if(t->heapSize == 0)
+        return UA_INT64_MAX;
+    return t->heap[0]->nextTime;
 }
 
 void
 UA_Timer_deleteMembers(UA_Timer *t) {
     /* Process changes to empty the MPSC queue */
     processChanges(t);
+    UA_free(t->changes_pending);
+    t->changes_pending = NULL;
+    UA_TimerCallbackEntry *change;
+    while((change = dequeueChange(t)))
+        UA_free(change);
 
     /* Remove repeated callbacks */
-    UA_TimerCallbackEntry *current;
-    while((current = SLIST_FIRST(&t->repeatedCallbacks))) {
-        SLIST_REMOVE_HEAD(&t->repeatedCallbacks, next);
-        UA_free(current);
-    }
+    for(size_t i = 0; i < t->heapSize; i++)
+        UA_free(t->heap[i]);
+    UA_free(t->heap);
+    UA_free(t->idMap);
+    t->heap = NULL;
+    t->heapSize = 0;
+    t->heapCapacity = 0;
+    t->idMap = NULL;
+    t->idMapSize = 0;
 }
@@ -20,18 +20,27 @@ extern "C" {
 struct UA_TimerCallbackEntry;
 typedef struct UA_TimerCallbackEntry UA_TimerCallbackEntry;
 
-/* Linked-list definition */
-typedef SLIST_HEAD(UA_TimerCallbackList, UA_TimerCallbackEntry) UA_TimerCallbackList;
-
 typedef struct {
-    /* The linked list of callbacks is sorted according to the execution timestamp. */
-    UA_TimerCallbackList repeatedCallbacks;
+    /* The callbacks are kept in a 4-ary min-heap ordered by the execution
+     * timestamp. Adding, removing and rescheduling a callback is O(log n). */
+    UA_TimerCallbackEntry **heap;
+    size_t heapSize;
+    size_t heapCapacity;
+
+    /* Lookup of the callbacks by their identifier for changes and removal. The
+     * buckets are chained. The number of buckets is a power of two. */
+    UA_TimerCallbackEntry **idMap;
+    size_t idMapSize;
 
     /* Changes to the repeated callbacks in a multi-producer single-consumer queue */
     UA_TimerCallbackEntry * volatile changes_head;
     UA_TimerCallbackEntry *changes_tail;
     UA_TimerCallbackEntry *changes_stub;
 
+    /* A dequeued change that could not be processed for lack of memory. It is
+     * retried before the changes that follow in the queue. */
+    UA_TimerCallbackEntry *changes_pending;
+
     UA_UInt64 idCounter;
 } UA_Timer;
 
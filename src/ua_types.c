@@ -6,6 +6,7 @@
 #include "ua_types.h"
 #include "ua_types_generated.h"
 #include "ua_types_generated_handling.h"
+#include "ua_types_encoding_binary.h"
 
 #include "pcg_basic.h"
 #include "libc_time.h"
@@ -25,16 +26,18 @@ const UA_Guid UA_GUID_NULL = {0, 0, 0, {0,0,0,0,0,0,0,0}};
 const UA_NodeId UA_NODEID_NULL = {0, UA_NODEIDTYPE_NUMERIC, {0}};
 const UA_ExpandedNodeId UA_EXPANDEDNODEID_NULL = {{0, UA_NODEIDTYPE_NUMERIC, {0}}, {0, NULL}, 0};
 
-/* TODO: The standard-defined types are ordered. See if binary search is
- * more efficient. */
+/* Lookup in the generated hash index */
 const UA_DataType *
 UA_findDataType(const UA_NodeId *typeId) {
     if(typeId->identifierType != UA_NODEIDTYPE_NUMERIC ||
        typeId->namespaceIndex != 0)
         return NULL;
-    for(size_t i = 0; i < UA_TYPES_COUNT; ++i) {
-        if(UA_TYPES[i].typeId.identifier.numeric == typeId->identifier.numeric)
-            return &UA_TYPES[i];
+    size_t h = UA_DataTypeIndex_hash(typeId->identifier.numeric, UA_TYPES_INDEXSIZE);
+    while(UA_TYPES_TYPEIDINDEX[h] != UA_DATATYPEINDEX_EMPTY) {
+        const UA_DataType *type = &UA_TYPES[UA_TYPES_TYPEIDINDEX[h]];
+        if(type->typeId.identifier.numeric == typeId->identifier.numeric)
+            return type;
+        h = (h + 1) & (UA_TYPES_INDEXSIZE - 1);
     }
     return NULL;
 }
@@ -999,6 +1002,337 @@ UA_delete(void *p, const UA_DataType *type) {
     UA_free(p);
 }
 
+/**************/
+/* Comparison */
+/**************/
+
+typedef UA_Order
+(*UA_orderSignature)(const void *p1, const void *p2, const UA_DataType *type);
+
+static UA_Order order_noInit(const void *p1, const void *p2, const UA_DataType *type);
+static UA_Order arrayOrder(const void *p1, size_t p1Length, const void *p2,
+                           size_t p2Length, const UA_DataType *type);
+
+#define UA_NUMERICORDER(NAME, TYPE)                                     \
+    static UA_Order                                                     \
+    NAME(const TYPE *p1, const TYPE *p2, const UA_DataType *_) {        \
+        if(*p1 != *p2)                                                  \
+            return (*p1 < *p2) ? UA_ORDER_LESS : UA_ORDER_MORE;         \
+        return UA_ORDER_EQ;                                             \
+    }
+
+UA_NUMERICORDER(booleanOrder, UA_Boolean)
+UA_NUMERICORDER(sByteOrder, UA_SByte)
+UA_NUMERICORDER(byteOrder, UA_Byte)
+UA_NUMERICORDER(int16Order, UA_Int16)
+UA_NUMERICORDER(uInt16Order, UA_UInt16)
+UA_NUMERICORDER(int32Order, UA_Int32)
+UA_NUMERICORDER(uInt32Order, UA_UInt32)
+UA_NUMERICORDER(int64Order, UA_Int64)
+UA_NUMERICORDER(uInt64Order, UA_UInt64)
+
+/* All comparisons with NaN are false. So NaN is treated separately: It is equal
+ * to NaN and ordered before all other values. */
+#define UA_FLOATORDER(NAME, TYPE)                                       \
+    static UA_Order                                                     \
+    NAME(const TYPE *p1, const TYPE *p2, const UA_DataType *_) {        \
+        if(*p1 < *p2)                                                   \
+            return UA_ORDER_LESS;                                       \
+        if(*p1 > *p2)                                                   \
+            return UA_ORDER_MORE;                                       \
+        UA_Boolean nan1 = (*p1 != *p1);                                 \
+        UA_Boolean nan2 = (*p2 != *p2);                                 \
+        if(nan1 == nan2)                                                \
+            return UA_ORDER_EQ;                                         \
+        return nan1 ? UA_ORDER_LESS : UA_ORDER_MORE;                    \
+    }
+
+UA_FLOATORDER(floatOrder, UA_Float)
+UA_FLOATORDER(doubleOrder, UA_Double)
+
+static UA_Order
+stringOrder(const UA_String *p1, const UA_String *p2, const UA_DataType *_) {
+    if(p1->length != p2->length)
+        return (p1->length < p2->length) ? UA_ORDER_LESS : UA_ORDER_MORE;
+    if(p1->length == 0)
+        return UA_ORDER_EQ;
+    int cmp = memcmp(p1->data, p2->data, p1->length);
+    if(cmp != 0)
+        return (cmp < 0) ? UA_ORDER_LESS : UA_ORDER_MORE;
+    return UA_ORDER_EQ;
+}
+
+static UA_Order
+guidOrder(const UA_Guid *p1, const UA_Guid *p2, const UA_DataType *_) {
+    if(p1->data1 != p2->data1)
+        return (p1->data1 < p2->data1) ? UA_ORDER_LESS : UA_ORDER_MORE;
+    if(p1->data2 != p2->data2)
+        return (p1->data2 < p2->data2) ? UA_ORDER_LESS : UA_ORDER_MORE;
+    if(p1->data3 != p2->data3)
+        return (p1->data3 < p2->data3) ? UA_ORDER_LESS : UA_ORDER_MORE;
+    int cmp = memcmp(p1->data4, p2->data4, 8);
+    if(cmp != 0)
+        return (cmp < 0) ? UA_ORDER_LESS : UA_ORDER_MORE;
+    return UA_ORDER_EQ;
+}
+
+static UA_Order
+nodeIdOrder(const UA_NodeId *p1, const UA_NodeId *p2, const UA_DataType *_) {
+    if(p1->namespaceIndex != p2->namespaceIndex)
+        return (p1->namespaceIndex < p2->namespaceIndex) ? UA_ORDER_LESS : UA_ORDER_MORE;
+    if(p1->identifierType != p2->identifierType)
+        return (p1->identifierType < p2->identifierType) ? UA_ORDER_LESS : UA_ORDER_MORE;
+    switch(p1->identifierType) {
+    case UA_NODEIDTYPE_NUMERIC:
+        return uInt32Order(&p1->identifier.numeric, &p2->identifier.numeric, NULL);
+    case UA_NODEIDTYPE_GUID:
+        return guidOrder(&p1->identifier.guid, &p2->identifier.guid, NULL);
+    case UA_NODEIDTYPE_STRING:
+    case UA_NODEIDTYPE_BYTESTRING:
+        return stringOrder(&p1->identifier.string, &p2->identifier.string, NULL);
+    default:
+        return UA_ORDER_EQ;
+    }
+}
+
+static UA_Order
+expandedNodeIdOrder(const UA_ExpandedNodeId *p1, const UA_ExpandedNodeId *p2,
+                    const UA_DataType *_) {
+    if(p1->serverIndex != p2->serverIndex)
+        return (p1->serverIndex < p2->serverIndex) ? UA_ORDER_LESS : UA_ORDER_MORE;
+    UA_Order o = stringOrder(&p1->namespaceUri, &p2->namespaceUri, NULL);
+    if(o != UA_ORDER_EQ)
+        return o;
+    return nodeIdOrder(&p1->nodeId, &p2->nodeId, NULL);
+}
+
+static UA_Order
+localizedTextOrder(const UA_LocalizedText *p1, const UA_LocalizedText *p2,
+                   const UA_DataType *_) {
+    UA_Order o = stringOrder(&p1->locale, &p2->locale, NULL);
+    if(o != UA_ORDER_EQ)
+        return o;
+    return stringOrder(&p1->text, &p2->text, NULL);
+}
+
+/* Compares pointers to the type descriptions */
+static UA_Order
+typePointerOrder(const UA_DataType *t1, const UA_DataType *t2) {
+    if(t1 == t2)
+        return UA_ORDER_EQ;
+    return ((uintptr_t)t1 < (uintptr_t)t2) ? UA_ORDER_LESS : UA_ORDER_MORE;
+}
+
+static UA_Order
+extensionObjectOrder(const UA_ExtensionObject *p1, const UA_ExtensionObject *p2,
+                     const UA_DataType *_) {
+    /* The NODELETE flag does not change the content */
+    UA_ExtensionObjectEncoding enc1 = p1->encoding;
+    UA_ExtensionObjectEncoding enc2 = p2->encoding;
+    if(enc1 > UA_EXTENSIONOBJECT_DECODED)
+        enc1 = UA_EXTENSIONOBJECT_DECODED;
+    if(enc2 > UA_EXTENSIONOBJECT_DECODED)
+        enc2 = UA_EXTENSIONOBJECT_DECODED;
+    if(enc1 != enc2)
+        return (enc1 < enc2) ? UA_ORDER_LESS : UA_ORDER_MORE;
+
+    if(enc1 < UA_EXTENSIONOBJECT_DECODED) {
+        UA_Order o = nodeIdOrder(&p1->content.encoded.typeId,
+                                 &p2->content.encoded.typeId, NULL);
+        if(o != UA_ORDER_EQ)
+            return o;
+        return stringOrder(&p1->content.encoded.body,
+                           &p2->content.encoded.body, NULL);
+    }
+
+    UA_Order o = typePointerOrder(p1->content.decoded.type, p2->content.decoded.type);
+    if(o != UA_ORDER_EQ)
+        return o;
+    if(!p1->content.decoded.type)
+        return UA_ORDER_EQ;
+    if(p1->content.decoded.data == p2->content.decoded.data)
+        return UA_ORDER_EQ;
+    if(!p1->content.decoded.data || !p2->content.decoded.data)
+        return (!p1->content.decoded.data) ? UA_ORDER_LESS : UA_ORDER_MORE;
+    return UA_order(p1->content.decoded.data, p2->content.decoded.data,
+                    p1->content.decoded.type);
+}
+
+static UA_Order
+variantOrder(const UA_Variant *p1, const UA_Variant *p2, const UA_DataType *_) {
+    UA_Order o = typePointerOrder(p1->type, p2->type);
+    if(o != UA_ORDER_EQ || !p1->type)
+        return o;
+
+    /* Scalars before arrays */
+    UA_Boolean s1 = UA_Variant_isScalar(p1);
+    UA_Boolean s2 = UA_Variant_isScalar(p2);
+    if(s1 != s2)
+        return s1 ? UA_ORDER_LESS : UA_ORDER_MORE;
+    if(s1)
+        return UA_order(p1->data, p2->data, p1->type);
+
+    /* Undefined arrays before empty arrays */
+    if(p1->arrayLength == 0 && p2->arrayLength == 0 &&
+       (p1->data == NULL) != (p2->data == NULL))
+        return (p1->data == NULL) ? UA_ORDER_LESS : UA_ORDER_MORE;
+
+    o = arrayOrder(p1->data, p1->arrayLength, p2->data, p2->arrayLength, p1->type);
+    if(o != UA_ORDER_EQ)
+        return o;
+    return arrayOrder(p1->arrayDimensions, p1->arrayDimensionsSize,
+                      p2->arrayDimensions, p2->arrayDimensionsSize,
+                      &UA_TYPES[UA_TYPES_UINT32]);
+}
+
+/* Fields that are not set are ordered before fields that are set */
+#define UA_OPTIONALORDER(HAS1, HAS2, ORDER) do {                        \
+        if((HAS1) != (HAS2))                                            \
+            return (HAS1) ? UA_ORDER_MORE : UA_ORDER_LESS;              \
+        if(HAS1) {                                                      \
+            UA_Order fo = ORDER;                                        \
+            if(fo != UA_ORDER_EQ)                                       \
+                return fo;                                              \
+        }                                                               \
+    } while(0)
+
+static UA_Order
+dataValueOrder(const UA_DataValue *p1, const UA_DataValue *p2,
+               const UA_DataType *_) {
+    UA_OPTIONALORDER(p1->hasValue, p2->hasValue,
+                     variantOrder(&p1->value, &p2->value, NULL));
+    UA_OPTIONALORDER(p1->hasStatus, p2->hasStatus,
+                     uInt32Order(&p1->status, &p2->status, NULL));
+    UA_OPTIONALORDER(p1->hasSourceTimestamp, p2->hasSourceTimestamp,
+                     int64Order(&p1->sourceTimestamp, &p2->sourceTimestamp, NULL));
+    UA_OPTIONALORDER(p1->hasSourcePicoseconds, p2->hasSourcePicoseconds,
+                     uInt16Order(&p1->sourcePicoseconds, &p2->sourcePicoseconds, NULL));
+    UA_OPTIONALORDER(p1->hasServerTimestamp, p2->hasServerTimestamp,
+                     int64Order(&p1->serverTimestamp, &p2->serverTimestamp, NULL));
+    UA_OPTIONALORDER(p1->hasServerPicoseconds, p2->hasServerPicoseconds,
+                     uInt16Order(&p1->serverPicoseconds, &p2->serverPicoseconds, NULL));
+    return UA_ORDER_EQ;
+}
+
+static UA_Order
+diagnosticInfoOrder(const UA_DiagnosticInfo *p1, const UA_DiagnosticInfo *p2,
+                    const UA_DataType *_) {
+    UA_OPTIONALORDER(p1->hasSymbolicId, p2->hasSymbolicId,
+                     int32Order(&p1->symbolicId, &p2->symbolicId, NULL));
+    UA_OPTIONALORDER(p1->hasNamespaceUri, p2->hasNamespaceUri,
+                     int32Order(&p1->namespaceUri, &p2->namespaceUri, NULL));
+    UA_OPTIONALORDER(p1->hasLocalizedText, p2->hasLocalizedText,
+                     int32Order(&p1->localizedText, &p2->localizedText, NULL));
+    UA_OPTIONALORDER(p1->hasLocale, p2->hasLocale,
+                     int32Order(&p1->locale, &p2->locale, NULL));
+    UA_OPTIONALORDER(p1->hasAdditionalInfo, p2->hasAdditionalInfo,
+                     stringOrder(&p1->additionalInfo, &p2->additionalInfo, NULL));
+    UA_OPTIONALORDER(p1->hasInnerStatusCode, p2->hasInnerStatusCode,
+                     uInt32Order(&p1->innerStatusCode, &p2->innerStatusCode, NULL));
+    UA_Boolean inner1 = p1->hasInnerDiagnosticInfo && p1->innerDiagnosticInfo;
+    UA_Boolean inner2 = p2->hasInnerDiagnosticInfo && p2->innerDiagnosticInfo;
+    UA_OPTIONALORDER(inner1, inner2,
+                     diagnosticInfoOrder(p1->innerDiagnosticInfo,
+                                         p2->innerDiagnosticInfo, NULL));
+    return UA_ORDER_EQ;
+}
+
+static const UA_orderSignature orderJumpTable[UA_BUILTIN_TYPES_COUNT + 1] = {
+    (UA_orderSignature)booleanOrder,
+    (UA_orderSignature)sByteOrder,
+    (UA_orderSignature)byteOrder,
+    (UA_orderSignature)int16Order,
+    (UA_orderSignature)uInt16Order,
+    (UA_orderSignature)int32Order,
+    (UA_orderSignature)uInt32Order,
+    (UA_orderSignature)int64Order,
+    (UA_orderSignature)uInt64Order,
+    (UA_orderSignature)floatOrder,
+    (UA_orderSignature)doubleOrder,
+    (UA_orderSignature)stringOrder,
+    (UA_orderSignature)int64Order, // DateTime
+    (UA_orderSignature)guidOrder,
+    (UA_orderSignature)stringOrder, // ByteString
+    (UA_orderSignature)stringOrder, // XmlElement
+    (UA_orderSignature)nodeIdOrder,
+    (UA_orderSignature)expandedNodeIdOrder,
+    (UA_orderSignature)uInt32Order, // StatusCode
+    (UA_orderSignature)order_noInit, // QualifiedName
+    (UA_orderSignature)localizedTextOrder,
+    (UA_orderSignature)extensionObjectOrder,
+    (UA_orderSignature)dataValueOrder,
+    (UA_orderSignature)variantOrder,
+    (UA_orderSignature)diagnosticInfoOrder,
+    (UA_orderSignature)order_noInit // all others
+};
+
+/* Arrays are ordered by their length first. Equal arrays of overlayable types
+ * are detected with a single memcmp. */
+static UA_Order
+arrayOrder(const void *p1, size_t p1Length, const void *p2, size_t p2Length,
+           const UA_DataType *type) {
+    if(p1Length != p2Length)
+        return (p1Length < p2Length) ? UA_ORDER_LESS : UA_ORDER_MORE;
+    if(p1Length == 0 || p1 == p2)
+        return UA_ORDER_EQ;
+    if(type->overlayable && memcmp(p1, p2, type->memSize * p1Length) == 0)
+        return UA_ORDER_EQ;
+
+    uintptr_t u1 = (uintptr_t)p1;
+    uintptr_t u2 = (uintptr_t)p2;
+    size_t fi = type->builtin ? type->typeIndex : UA_BUILTIN_TYPES_COUNT;
+    for(size_t i = 0; i < p1Length; ++i) {
+        UA_Order o = orderJumpTable[fi]((const void*)u1, (const void*)u2, type);
+        if(o != UA_ORDER_EQ)
+            return o;
+        u1 += type->memSize;
+        u2 += type->memSize;
+    }
+    return UA_ORDER_EQ;
+}
+
+static UA_Order
+order_noInit(const void *p1, const void *p2, const UA_DataType *type) {
+    uintptr_t u1 = (uintptr_t)p1;
+    uintptr_t u2 = (uintptr_t)p2;
+    u8 membersSize = type->membersSize;
+    for(size_t i = 0; i < membersSize; ++i) {
+        const UA_DataTypeMember *m= &type->members[i];
+        const UA_DataType *typelists[2] = { UA_TYPES, &type[-type->typeIndex] };
+        const UA_DataType *mt = &typelists[!m->namespaceZero][m->memberTypeIndex];
+        UA_Order o;
+        if(!m->isArray) {
+            u1 += m->padding;
+            u2 += m->padding;
+            size_t fi = mt->builtin ? mt->typeIndex : UA_BUILTIN_TYPES_COUNT;
+            o = orderJumpTable[fi]((const void*)u1, (const void*)u2, mt);
+            u1 += mt->memSize;
+            u2 += mt->memSize;
+        } else {
+            u1 += m->padding;
+            u2 += m->padding;
+            size_t size1 = *(const size_t*)u1;
+            size_t size2 = *(const size_t*)u2;
+            u1 += sizeof(size_t);
+            u2 += sizeof(size_t);
+            o = arrayOrder(*(void* const*)u1, size1, *(void* const*)u2, size2, mt);
+            u1 += sizeof(void*);
+            u2 += sizeof(void*);
+        }
+        if(o != UA_ORDER_EQ)
+            return o;
+    }
+    return UA_ORDER_EQ;
+}
+
+UA_Order
+UA_order(const void *p1, const void *p2, const UA_DataType *type) {
+    if(p1 == p2)
+        return UA_ORDER_EQ;
+    size_t fi = type->builtin ? type->typeIndex : UA_BUILTIN_TYPES_COUNT;
+    return orderJumpTable[fi](p1, p2, type);
+}
+
 /******************/
 /* Array Handling */
 /******************/
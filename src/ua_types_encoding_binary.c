@@ -58,11 +58,30 @@ extern const UA_calcSizeBinarySignature calcSizeBinaryJumpTable[UA_BUILTIN_TYPES
  * UA_decodeBinary */
 static UA_THREAD_LOCAL size_t g_customTypesArraySize;
 static UA_THREAD_LOCAL const UA_DataType *g_customTypesArray;
+static UA_THREAD_LOCAL const UA_DataTypeIndex *g_customTypesIndex;
 
 /* Pointers to the current position and the last position in the buffer */
 static UA_THREAD_LOCAL u8 *g_pos;
 static UA_THREAD_LOCAL const u8 *g_end;
 
+/* Arena for the decoded memory. Set inside UA_decodeBinaryArena. The heap is
+ * used if NULL. Memory taken from the arena is never freed individually.
+ * Strings and overlayable arrays may also point into the decoded buffer. */
+static UA_THREAD_LOCAL UA_Arena *g_arena;
+
+static void *
+decodeAlloc(size_t size) {
+    if(g_arena)
+        return UA_Arena_alloc(g_arena, size);
+    return UA_calloc(1, size);
+}
+
+static void
+decodeFree(void *p) {
+    if(!g_arena)
+        UA_free(p);
+}
+
 /* In UA_encodeBinaryInternal, we store a pointer to the last "good" position in
  * the buffer. When encoding reaches the end of the buffer, send out a chunk
  * until that position, replace the buffer and retry encoding after the last
@@ -551,15 +570,37 @@ Array_decodeBinary(void *UA_RESTRICT *UA_RESTRICT dst,
     if(g_pos + ((type->memSize * length) / 32) > g_end)
         return UA_STATUSCODE_BADDECODINGERROR;
 
+    if(length > SIZE_MAX / type->memSize)
+        return UA_STATUSCODE_BADDECODINGERROR;
+
+    /* Reference overlayable arrays (and strings) in the buffer instead of
+     * copying when decoding into an arena. The arena is reset before the
+     * buffer is released. The position must be aligned for the member type.
+     * The memSize is a multiple of the alignment. So its lowest set bit is
+     * sufficient. */
+    if(g_arena && type->overlayable) {
+        size_t align = type->memSize & (~type->memSize + 1);
+        if(align > UA_ARENA_ALIGNMENT)
+            align = UA_ARENA_ALIGNMENT;
+        if(((uintptr_t)g_pos & (align - 1)) == 0) {
+            if(g_end < g_pos + (type->memSize * length))
+                return UA_STATUSCODE_BADDECODINGERROR;
+            *dst = g_pos;
+            g_pos += type->memSize * length;
+            *out_length = length;
+            return UA_STATUSCODE_GOOD;
+        }
+    }
+
     /* Allocate memory */
-    *dst = UA_calloc(length, type->memSize);
+    *dst = decodeAlloc(length * type->memSize);
     if(!*dst)
         return UA_STATUSCODE_BADOUTOFMEMORY;
 
     if(type->overlayable) {
         /* memcpy overlayable array */
         if(g_end < g_pos + (type->memSize * length)) {
-            UA_free(*dst);
+            decodeFree(*dst);
             *dst = NULL;
             return UA_STATUSCODE_BADDECODINGERROR;
         }
@@ -573,7 +614,8 @@ Array_decodeBinary(void *UA_RESTRICT *UA_RESTRICT dst,
             ret = decodeBinaryJumpTable[decode_index]((void*)ptr, type);
             if(ret != UA_STATUSCODE_GOOD) {
                 // +1 because last element is also already initialized
-                UA_Array_delete(*dst, i+1, type);
+                if(!g_arena)
+                    UA_Array_delete(*dst, i+1, type);
                 *dst = NULL;
                 return ret;
             }
@@ -852,6 +894,22 @@ LocalizedText_decodeBinary(UA_LocalizedText *dst, const UA_DataType *_) {
     return ret;
 }
 
+static const UA_DataType *
+findDataTypeInIndex(const UA_DataType *types, const UA_UInt16 *index,
+                    size_t indexSize, const UA_NodeId *typeId) {
+    if(indexSize == 0)
+        return NULL;
+    size_t h = UA_DataTypeIndex_hash(typeId->identifier.numeric, indexSize);
+    while(index[h] != UA_DATATYPEINDEX_EMPTY) {
+        const UA_DataType *type = &types[index[h]];
+        if(type->binaryEncodingId == typeId->identifier.numeric &&
+           type->typeId.namespaceIndex == typeId->namespaceIndex)
+            return type;
+        h = (h + 1) & (indexSize - 1);
+    }
+    return NULL;
+}
+
 /* The binary encoding has a different nodeid from the data type. So it is not
  * possible to reuse UA_findDataType */
 const UA_DataType *
@@ -860,21 +918,61 @@ UA_findDataTypeByBinary(const UA_NodeId *typeId) {
     if(typeId->identifierType != UA_NODEIDTYPE_NUMERIC)
         return NULL;
 
-    /* Custom or standard data type? */
-    const UA_DataType *types = UA_TYPES;
-    size_t typesSize = UA_TYPES_COUNT;
-    if(typeId->namespaceIndex != 0) {
-        types = g_customTypesArray;
-        typesSize = g_customTypesArraySize;
+    /* Standard data type */
+    if(typeId->namespaceIndex == 0)
+        return findDataTypeInIndex(UA_TYPES, UA_TYPES_ENCODINGINDEX,
+                                   UA_TYPES_INDEXSIZE, typeId);
+
+    /* Custom data type */
+    if(g_customTypesIndex)
+        return findDataTypeInIndex(g_customTypesIndex->types, g_customTypesIndex->index,
+                                   g_customTypesIndex->indexSize, typeId);
+    for(size_t i = 0; i < g_customTypesArraySize; ++i) {
+        if(g_customTypesArray[i].binaryEncodingId == typeId->identifier.numeric &&
+           g_customTypesArray[i].typeId.namespaceIndex == typeId->namespaceIndex)
+            return &g_customTypesArray[i];
     }
+    return NULL;
+}
 
-    /* Iterate over the array */
+UA_StatusCode
+UA_DataTypeIndex_init(UA_DataTypeIndex *index, size_t typesSize,
+                      const UA_DataType *types) {
+    memset(index, 0, sizeof(UA_DataTypeIndex));
+    if(typesSize == 0)
+        return UA_STATUSCODE_GOOD;
+    if(typesSize >= UA_DATATYPEINDEX_EMPTY)
+        return UA_STATUSCODE_BADOUTOFRANGE;
+
+    /* At most half full */
+    size_t indexSize = 2;
+    while(indexSize < 2 * typesSize)
+        indexSize <<= 1;
+    index->index = (UA_UInt16*)UA_malloc(sizeof(UA_UInt16) * indexSize);
+    if(!index->index)
+        return UA_STATUSCODE_BADOUTOFMEMORY;
+    for(size_t i = 0; i < indexSize; ++i)
+        index->index[i] = UA_DATATYPEINDEX_EMPTY;
+
+    /* Insert in order. The first matching type is found first, same as with
+     * the linear search. */
     for(size_t i = 0; i < typesSize; ++i) {
-        if(types[i].binaryEncodingId == typeId->identifier.numeric &&
-           types[i].typeId.namespaceIndex == typeId->namespaceIndex)
-            return &types[i];
+        size_t h = UA_DataTypeIndex_hash(types[i].binaryEncodingId, indexSize);
+        while(index->index[h] != UA_DATATYPEINDEX_EMPTY)
+            h = (h + 1) & (indexSize - 1);
+        index->index[h] = (UA_UInt16)i;
     }
-    return NULL;
+
+    index->types = types;
+    index->typesSize = typesSize;
+    index->indexSize = indexSize;
+    return UA_STATUSCODE_GOOD;
+}
+
+void
+UA_DataTypeIndex_deleteMembers(UA_DataTypeIndex *index) {
+    UA_free(index->index);
+    memset(index, 0, sizeof(UA_DataTypeIndex));
 }
 
 /* ExtensionObject */
@@ -952,7 +1050,7 @@ ExtensionObject_decodeBinaryContent(UA_ExtensionObject *dst, const UA_NodeId *ty
     }
 
     /* Allocate memory */
-    dst->content.decoded.data = UA_new(type);
+    dst->content.decoded.data = decodeAlloc(type->memSize);
     if(!dst->content.decoded.data)
         return UA_STATUSCODE_BADOUTOFMEMORY;
 
@@ -976,7 +1074,8 @@ ExtensionObject_decodeBinary(UA_ExtensionObject *dst, const UA_DataType *_) {
     if(typeId.identifierType != UA_NODEIDTYPE_NUMERIC)
         ret = UA_STATUSCODE_BADDECODINGERROR;
     if(ret != UA_STATUSCODE_GOOD) {
-        UA_NodeId_deleteMembers(&typeId);
+        if(!g_arena)
+            UA_NodeId_deleteMembers(&typeId);
         return ret;
     }
 
@@ -1099,7 +1198,8 @@ Variant_decodeBinaryUnwrapExtensionObject(UA_Variant *dst) {
     u8 encoding;
     ret = Byte_decodeBinary(&encoding, NULL);
     if(ret != UA_STATUSCODE_GOOD) {
-        UA_NodeId_deleteMembers(&typeId);
+        if(!g_arena)
+            UA_NodeId_deleteMembers(&typeId);
         return ret;
     }
 
@@ -1112,11 +1212,12 @@ Variant_decodeBinaryUnwrapExtensionObject(UA_Variant *dst) {
         /* Reset and decode as ExtensionObject */
         dst->type = &UA_TYPES[UA_TYPES_EXTENSIONOBJECT];
         g_pos = old_pos;
-        UA_NodeId_deleteMembers(&typeId);
+        if(!g_arena)
+            UA_NodeId_deleteMembers(&typeId);
     }
 
     /* Allocate memory */
-    dst->data = UA_new(dst->type);
+    dst->data = decodeAlloc(dst->type->memSize);
     if(!dst->data)
         return UA_STATUSCODE_BADOUTOFMEMORY;
 
@@ -1152,7 +1253,7 @@ Variant_decodeBinary(UA_Variant *dst, const UA_DataType *_) {
     if(isArray) {
         ret = Array_decodeBinary(&dst->data, &dst->arrayLength, dst->type);
     } else if(typeIndex != UA_TYPES_EXTENSIONOBJECT) {
-        dst->data = UA_new(dst->type);
+        dst->data = decodeAlloc(dst->type->memSize);
         if(!dst->data)
             return UA_STATUSCODE_BADOUTOFMEMORY;
         ret = decodeBinaryJumpTable[typeIndex](dst->data, dst->type);
@@ -1340,7 +1441,7 @@ DiagnosticInfo_decodeBinary(UA_DiagnosticInfo *dst, const UA_DataType *_) {
     if(encodingMask & 0x40) {
         /* innerDiagnosticInfo is allocated on the heap */
         dst->innerDiagnosticInfo = (UA_DiagnosticInfo*)
-            UA_calloc(1, sizeof(UA_DiagnosticInfo));
+            decodeAlloc(sizeof(UA_DiagnosticInfo));
         if(!dst->innerDiagnosticInfo)
             return UA_STATUSCODE_BADOUTOFMEMORY;
         dst->hasInnerDiagnosticInfo = true;
@@ -1387,6 +1488,10 @@ const UA_encodeBinarySignature encodeBinaryJumpTable[UA_BUILTIN_TYPES_COUNT + 1]
 
 static status
 UA_encodeBinaryInternal(const void *src, const UA_DataType *type) {
+#ifdef UA_ENABLE_COMPILED_ENCODING
+    if(type->binaryEncoding)
+        return type->binaryEncoding->encodeBinary(src, type);
+#endif
     uintptr_t ptr = (uintptr_t)src;
     status ret = UA_STATUSCODE_GOOD;
     u8 membersSize = type->membersSize;
@@ -1472,6 +1577,10 @@ const UA_decodeBinarySignature decodeBinaryJumpTable[UA_BUILTIN_TYPES_COUNT + 1]
 
 static status
 UA_decodeBinaryInternal(void *dst, const UA_DataType *type) {
+#ifdef UA_ENABLE_COMPILED_ENCODING
+    if(type->binaryEncoding)
+        return type->binaryEncoding->decodeBinary(dst, type);
+#endif
     uintptr_t ptr = (uintptr_t)dst;
     status ret = UA_STATUSCODE_GOOD;
     u8 membersSize = type->membersSize;
@@ -1519,8 +1628,31 @@ UA_decodeBinary(const UA_ByteString *src, size_t *offset, void *dst,
     /* Clean up */
     if(ret == UA_STATUSCODE_GOOD)
         *offset = (size_t)(g_pos - src->data) / sizeof(u8);
-    else
+    else if(!g_arena)
         UA_deleteMembers(dst, type);
+    else
+        memset(dst, 0, type->memSize); /* freed with the arena */
+    return ret;
+}
+
+status
+UA_decodeBinaryIndexed(const UA_ByteString *src, size_t *offset, void *dst,
+                       const UA_DataType *type,
+                       const UA_DataTypeIndex *customTypes) {
+    g_customTypesIndex = customTypes;
+    status ret = UA_decodeBinary(src, offset, dst, type, customTypes->typesSize,
+                                 customTypes->types);
+    g_customTypesIndex = NULL;
+    return ret;
+}
+
+status
+UA_decodeBinaryArena(const UA_ByteString *src, size_t *offset, void *dst,
+                     const UA_DataType *type, const UA_DataTypeIndex *customTypes,
+                     UA_Arena *arena) {
+    g_arena = arena;
+    status ret = UA_decodeBinaryIndexed(src, offset, dst, type, customTypes);
+    g_arena = NULL;
     return ret;
 }
 
@@ -1748,6 +1880,10 @@ const UA_calcSizeBinarySignature calcSizeBinaryJumpTable[UA_BUILTIN_TYPES_COUNT
 
 size_t
 UA_calcSizeBinary(void *p, const UA_DataType *type) {
+#ifdef UA_ENABLE_COMPILED_ENCODING
+    if(type->binaryEncoding)
+        return type->binaryEncoding->calcSizeBinary(p, type);
+#endif
     size_t s = 0;
     uintptr_t ptr = (uintptr_t)p;
     u8 membersSize = type->membersSize;
@@ -1770,3 +1906,128 @@ UA_calcSizeBinary(void *p, const UA_DataType *type) {
     }
     return s;
 }
+
+/*********************/
+/* Compiled Encoding */
+/*********************/
+
+#ifdef UA_ENABLE_COMPILED_ENCODING
+
+/* The member did not fit into the buffer. Exchange/send the buffer and encode
+ * the member again. */
+static status
+encodeBinaryMemberAgain(const void *src, const UA_DataType *type, size_t memSize,
+                        UA_encodeBinarySignature encodeType, u8 *oldpos) {
+    g_pos = oldpos;
+    status ret = exchangeBuffer();
+    if(ret != UA_STATUSCODE_GOOD)
+        return ret;
+    if(g_pos + memSize > g_end)
+        return UA_STATUSCODE_BADENCODINGLIMITSEXCEEDED;
+    return encodeType(src, type);
+}
+
+/* Same as one iteration of the member loop in UA_encodeBinaryInternal */
+status
+UA_encodeBinaryMember(const void *src, const UA_DataType *type) {
+    size_t encode_index = type->builtin ? type->typeIndex : UA_BUILTIN_TYPES_COUNT;
+    u8 *oldpos = g_pos;
+    status ret = encodeBinaryJumpTable[encode_index](src, type);
+    if(ret != UA_STATUSCODE_BADENCODINGLIMITSEXCEEDED)
+        return ret;
+    return encodeBinaryMemberAgain(src, type, type->memSize,
+                                   encodeBinaryJumpTable[encode_index], oldpos);
+}
+
+status
+UA_encodeBinaryArrayMember(const void *src, size_t length, const UA_DataType *type) {
+    return Array_encodeBinary(src, length, type);
+}
+
+status
+UA_decodeBinaryMember(void *dst, const UA_DataType *type) {
+    size_t fi = type->builtin ? type->typeIndex : UA_BUILTIN_TYPES_COUNT;
+    return decodeBinaryJumpTable[fi](dst, type);
+}
+
+status
+UA_decodeBinaryArrayMember(void **dst, size_t *length, const UA_DataType *type) {
+    return Array_decodeBinary(dst, length, type);
+}
+
+size_t
+UA_calcSizeBinaryMember(const void *src, const UA_DataType *type) {
+    size_t encode_index = type->builtin ? type->typeIndex : UA_BUILTIN_TYPES_COUNT;
+    return calcSizeBinaryJumpTable[encode_index](src, type);
+}
+
+size_t
+UA_calcSizeBinaryArrayMember(const void *src, size_t length, const UA_DataType *type) {
+    return Array_calcSizeBinary(src, length, type);
+}
+
+/* Typed members of the builtin types. The generated code calls them directly
+ * instead of dispatching through the jump tables. */
+#define BINARY_MEMBER(TYPE, CTYPE, ENCODE, DECODE)                      \
+    status                                                              \
+    UA_##TYPE##_encodeBinaryMember(const UA_##TYPE *src) {              \
+        u8 *oldpos = g_pos;                                             \
+        status ret = ENCODE((const CTYPE*)src, NULL);                   \
+        if(ret != UA_STATUSCODE_BADENCODINGLIMITSEXCEEDED)              \
+            return ret;                                                 \
+        return encodeBinaryMemberAgain(src, NULL, sizeof(UA_##TYPE),    \
+                                       (UA_encodeBinarySignature)ENCODE, oldpos); \
+    }                                                                   \
+    status                                                              \
+    UA_##TYPE##_decodeBinaryMember(UA_##TYPE *dst) {                    \
+        return DECODE((CTYPE*)dst, NULL);                               \
+    }
+
+#define BINARY_MEMBER_CALCSIZE(TYPE, CALCSIZE)                          \
+    size_t                                                              \
+    UA_##TYPE##_calcSizeBinaryMember(const UA_##TYPE *src) {            \
+        return CALCSIZE(src, NULL);                                     \
+    }
+
+BINARY_MEMBER(Boolean, bool, Boolean_encodeBinary, Boolean_decodeBinary)
+BINARY_MEMBER(SByte, u8, Byte_encodeBinary, Byte_decodeBinary)
+BINARY_MEMBER(Byte, u8, Byte_encodeBinary, Byte_decodeBinary)
+BINARY_MEMBER(Int16, u16, UInt16_encodeBinary, UInt16_decodeBinary)
+BINARY_MEMBER(UInt16, u16, UInt16_encodeBinary, UInt16_decodeBinary)
+BINARY_MEMBER(Int32, u32, UInt32_encodeBinary, UInt32_decodeBinary)
+BINARY_MEMBER(UInt32, u32, UInt32_encodeBinary, UInt32_decodeBinary)
+BINARY_MEMBER(Int64, u64, UInt64_encodeBinary, UInt64_decodeBinary)
+BINARY_MEMBER(UInt64, u64, UInt64_encodeBinary, UInt64_decodeBinary)
+#if UA_BINARY_OVERLAYABLE_FLOAT
+BINARY_MEMBER(Float, u32, Float_encodeBinary, Float_decodeBinary)
+BINARY_MEMBER(Double, u64, Double_encodeBinary, Double_decodeBinary)
+#else
+BINARY_MEMBER(Float, UA_Float, Float_encodeBinary, Float_decodeBinary)
+BINARY_MEMBER(Double, UA_Double, Double_encodeBinary, Double_decodeBinary)
+#endif
+BINARY_MEMBER(String, UA_String, String_encodeBinary, String_decodeBinary)
+BINARY_MEMBER(DateTime, u64, UInt64_encodeBinary, UInt64_decodeBinary)
+BINARY_MEMBER(Guid, UA_Guid, Guid_encodeBinary, Guid_decodeBinary)
+BINARY_MEMBER(ByteString, UA_String, String_encodeBinary, String_decodeBinary)
+BINARY_MEMBER(XmlElement, UA_String, String_encodeBinary, String_decodeBinary)
+BINARY_MEMBER(NodeId, UA_NodeId, NodeId_encodeBinary, NodeId_decodeBinary)
+BINARY_MEMBER(ExpandedNodeId, UA_ExpandedNodeId, ExpandedNodeId_encodeBinary, ExpandedNodeId_decodeBinary)
+BINARY_MEMBER(StatusCode, u32, UInt32_encodeBinary, UInt32_decodeBinary)
+BINARY_MEMBER(LocalizedText, UA_LocalizedText, LocalizedText_encodeBinary, LocalizedText_decodeBinary)
+BINARY_MEMBER(ExtensionObject, UA_ExtensionObject, ExtensionObject_encodeBinary, ExtensionObject_decodeBinary)
+BINARY_MEMBER(DataValue, UA_DataValue, DataValue_encodeBinary, DataValue_decodeBinary)
+BINARY_MEMBER(Variant, UA_Variant, Variant_encodeBinary, Variant_decodeBinary)
+BINARY_MEMBER(DiagnosticInfo, UA_DiagnosticInfo, DiagnosticInfo_encodeBinary, DiagnosticInfo_decodeBinary)
+
+BINARY_MEMBER_CALCSIZE(String, String_calcSizeBinary)
+BINARY_MEMBER_CALCSIZE(ByteString, String_calcSizeBinary)
+BINARY_MEMBER_CALCSIZE(XmlElement, String_calcSizeBinary)
+BINARY_MEMBER_CALCSIZE(NodeId, NodeId_calcSizeBinary)
+BINARY_MEMBER_CALCSIZE(ExpandedNodeId, ExpandedNodeId_calcSizeBinary)
+BINARY_MEMBER_CALCSIZE(LocalizedText, LocalizedText_calcSizeBinary)
+BINARY_MEMBER_CALCSIZE(ExtensionObject, ExtensionObject_calcSizeBinary)
+BINARY_MEMBER_CALCSIZE(DataValue, DataValue_calcSizeBinary)
+BINARY_MEMBER_CALCSIZE(Variant, Variant_calcSizeBinary)
+BINARY_MEMBER_CALCSIZE(DiagnosticInfo, DiagnosticInfo_calcSizeBinary)
+
+#endif /* UA_ENABLE_COMPILED_ENCODING */
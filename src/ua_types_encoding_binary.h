@@ -10,6 +10,7 @@ extern "C" {
 #endif
 
 #include "ua_types.h"
+#include "ua_util.h"
 
 typedef UA_StatusCode (*UA_exchangeEncodeBuffer)(void *handle, UA_Byte **bufPos, const UA_Byte **bufEnd);
 
@@ -41,6 +42,116 @@ size_t UA_calcSizeBinary(void *p, const UA_DataType *type);
 
 const UA_DataType *UA_findDataTypeByBinary(const UA_NodeId *typeId);
 
+/* Hash index into an array of data types by the numeric binaryEncodingId. The
+ * index uses open addressing with linear probing. The indexes for UA_TYPES are
+ * generated at build time with the same hash function. */
+#define UA_DATATYPEINDEX_EMPTY 0xFFFF
+
+typedef struct {
+    const UA_DataType *types;
+    size_t typesSize;
+    size_t indexSize; /* power of two */
+    UA_UInt16 *index; /* position in types or UA_DATATYPEINDEX_EMPTY */
+} UA_DataTypeIndex;
+
+static UA_INLINE size_t
+UA_DataTypeIndex_hash(UA_UInt32 id, size_t indexSize) {
+    UA_UInt32 h = id * 2654435761u;
+    h ^= h >> 16;
+    return h & (indexSize - 1);
+}
+
+UA_StatusCode
+UA_DataTypeIndex_init(UA_DataTypeIndex *index, size_t typesSize,
+                      const UA_DataType *types);
+
+void UA_DataTypeIndex_deleteMembers(UA_DataTypeIndex *index);
+
+/* Same as UA_decodeBinary. But the custom types are looked up in the index. */
+UA_StatusCode
+UA_decodeBinaryIndexed(const UA_ByteString *src, size_t *offset, void *dst,
+                       const UA_DataType *type,
+                       const UA_DataTypeIndex *customTypes) UA_FUNC_ATTR_WARN_UNUSED_RESULT;
+
+/* Same as UA_decodeBinaryIndexed. But all memory of the decoded value is taken
+ * from the arena. Strings, ByteStrings and arrays of overlayable types are not
+ * copied but borrowed from src where the alignment permits. The value must not
+ * be deleted with UA_deleteMembers. It is released with the next reset of the
+ * arena, also if decoding fails. src must not be released or modified before
+ * that. */
+UA_StatusCode
+UA_decodeBinaryArena(const UA_ByteString *src, size_t *offset, void *dst,
+                     const UA_DataType *type, const UA_DataTypeIndex *customTypes,
+                     UA_Arena *arena) UA_FUNC_ATTR_WARN_UNUSED_RESULT;
+
+#ifdef UA_ENABLE_COMPILED_ENCODING
+/* Building blocks for the compiled encoding functions generated by
+ * tools/generate_datatypes.py. They continue the ongoing UA_encodeBinary,
+ * UA_decodeBinary or UA_calcSizeBinary for a single member. */
+UA_StatusCode
+UA_encodeBinaryMember(const void *src, const UA_DataType *type);
+
+UA_StatusCode
+UA_encodeBinaryArrayMember(const void *src, size_t length, const UA_DataType *type);
+
+UA_StatusCode
+UA_decodeBinaryMember(void *dst, const UA_DataType *type);
+
+UA_StatusCode
+UA_decodeBinaryArrayMember(void **dst, size_t *length, const UA_DataType *type);
+
+size_t
+UA_calcSizeBinaryMember(const void *src, const UA_DataType *type);
+
+size_t
+UA_calcSizeBinaryArrayMember(const void *src, size_t length, const UA_DataType *type);
+
+/* Typed members of the builtin types (except QualifiedName). The calcSize
+ * variant exists only for the builtin types without a fixed binary size. */
+#define UA_BINARY_MEMBER(TYPE)                                          \
+    UA_StatusCode UA_##TYPE##_encodeBinaryMember(const UA_##TYPE *src); \
+    UA_StatusCode UA_##TYPE##_decodeBinaryMember(UA_##TYPE *dst);
+
+#define UA_BINARY_MEMBER_CALCSIZE(TYPE)                                 \
+    size_t UA_##TYPE##_calcSizeBinaryMember(const UA_##TYPE *src);
+
+UA_BINARY_MEMBER(Boolean)
+UA_BINARY_MEMBER(SByte)
+UA_BINARY_MEMBER(Byte)
+UA_BINARY_MEMBER(Int16)
+UA_BINARY_MEMBER(UInt16)
+UA_BINARY_MEMBER(Int32)
+UA_BINARY_MEMBER(UInt32)
+UA_BINARY_MEMBER(Int64)
+UA_BINARY_MEMBER(UInt64)
+UA_BINARY_MEMBER(Float)
+UA_BINARY_MEMBER(Double)
+UA_BINARY_MEMBER(String)
+UA_BINARY_MEMBER(DateTime)
+UA_BINARY_MEMBER(Guid)
+UA_BINARY_MEMBER(ByteString)
+UA_BINARY_MEMBER(XmlElement)
+UA_BINARY_MEMBER(NodeId)
+UA_BINARY_MEMBER(ExpandedNodeId)
+UA_BINARY_MEMBER(StatusCode)
+UA_BINARY_MEMBER(LocalizedText)
+UA_BINARY_MEMBER(ExtensionObject)
+UA_BINARY_MEMBER(DataValue)
+UA_BINARY_MEMBER(Variant)
+UA_BINARY_MEMBER(DiagnosticInfo)
+
+UA_BINARY_MEMBER_CALCSIZE(String)
+UA_BINARY_MEMBER_CALCSIZE(ByteString)
+UA_BINARY_MEMBER_CALCSIZE(XmlElement)
+UA_BINARY_MEMBER_CALCSIZE(NodeId)
+UA_BINARY_MEMBER_CALCSIZE(ExpandedNodeId)
+UA_BINARY_MEMBER_CALCSIZE(LocalizedText)
+UA_BINARY_MEMBER_CALCSIZE(ExtensionObject)
+UA_BINARY_MEMBER_CALCSIZE(DataValue)
+UA_BINARY_MEMBER_CALCSIZE(Variant)
+UA_BINARY_MEMBER_CALCSIZE(DiagnosticInfo)
+#endif
+
 #ifdef __cplusplus
 }
 #endif
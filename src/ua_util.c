@@ -86,3 +86,104 @@ UA_parseEndpointUrl(const UA_String *endpointUrl, UA_String *outHostname,
 
     return UA_STATUSCODE_GOOD;
 }
+
+/*******************/
+/* Arena Allocator */
+/*******************/
+
+#define UA_ARENA_ALIGN(size) \
+    (((size) + (UA_ARENA_ALIGNMENT - 1)) & ~(size_t)(UA_ARENA_ALIGNMENT - 1))
+
+struct UA_ArenaChunk {
+    UA_ArenaChunk *next;
+    size_t size; /* Usable bytes behind the (aligned) header */
+    size_t used;
+};
+
+#define UA_ARENA_HEADERSIZE UA_ARENA_ALIGN(sizeof(UA_ArenaChunk))
+
+static UA_ArenaChunk *
+newChunk(size_t size) {
+    if(size > SIZE_MAX - UA_ARENA_HEADERSIZE)
+        return NULL;
+    UA_ArenaChunk *chunk = (UA_ArenaChunk*)UA_malloc(UA_ARENA_HEADERSIZE + size);
+    if(!chunk)
+        return NULL;
+    chunk->next = NULL;
+    chunk->size = size;
+    chunk->used = 0;
+    return chunk;
+}
+
+void
+UA_Arena_init(UA_Arena *arena, size_t chunkSize) {
+    arena->chunks = NULL;
+    arena->chunkSize = UA_ARENA_ALIGN(chunkSize);
+    if(arena->chunkSize == 0)
+        arena->chunkSize = UA_ARENA_ALIGNMENT;
+}
+
+void *
+UA_Arena_alloc(UA_Arena *arena, size_t size) {
+    if(size > SIZE_MAX - UA_ARENA_ALIGNMENT)
+        return NULL;
+    size = UA_ARENA_ALIGN(size);
+
+    UA_ArenaChunk *chunk = arena->chunks;
+    if(!chunk || chunk->size - chunk->used < size) {
+        if(chunk && size > chunk->size / 4) {
+            /* Large allocations get a chunk of their own behind the current
+             * chunk. The remaining space of the current chunk stays usable. */
+            UA_ArenaChunk *large = newChunk(size);
+            if(!large)
+                return NULL;
+            large->used = size;
+            large->next = chunk->next;
+            chunk->next = large;
+            void *p = (u8*)large + UA_ARENA_HEADERSIZE;
+            memset(p, 0, size);
+            return p;
+        }
+
+        /* Add a new current chunk with twice the size */
+        size_t chunkSize = arena->chunkSize;
+        if(chunk && chunk->size <= SIZE_MAX / 2)
+            chunkSize = chunk->size * 2;
+        if(chunkSize < size)
+            chunkSize = size;
+        chunk = newChunk(chunkSize);
+        if(!chunk)
+            return NULL;
+        chunk->next = arena->chunks;
+        arena->chunks = chunk;
+    }
+
+    void *p = (u8*)chunk + UA_ARENA_HEADERSIZE + chunk->used;
+    chunk->used += size;
+    memset(p, 0, size);
+    return p;
+}
+
+void
+UA_Arena_reset(UA_Arena *arena) {
+    UA_ArenaChunk *current = arena->chunks;
+    if(!current)
+        return;
+
+    /* Keep the current chunk. It is the largest of the regular chunks. */
+    UA_ArenaChunk *chunk = current->next;
+    while(chunk) {
+        UA_ArenaChunk *next = chunk->next;
+        UA_free(chunk);
+        chunk = next;
+    }
+    current->next = NULL;
+    current->used = 0;
+}
+
+void
+UA_Arena_deleteMembers(UA_Arena *arena) {
+    UA_Arena_reset(arena);
+    UA_free(arena->chunks);
+    arena->chunks = NULL;
+}
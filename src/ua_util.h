@@ -34,6 +34,25 @@ extern "C" {
 #  define UA_THREAD_LOCAL
 #endif
 
+/* Mutexes
+ * -------
+ * Protect state that is shared between the worker threads. Single-threaded
+ * builds declare no mutex members and the macros expand to nothing. */
+#ifdef UA_ENABLE_MULTITHREADING
+# include <pthread.h>
+# define UA_LOCK_TYPE(NAME) pthread_mutex_t NAME;
+# define UA_LOCK_INIT(LOCK) pthread_mutex_init(&(LOCK), NULL)
+# define UA_LOCK_DESTROY(LOCK) pthread_mutex_destroy(&(LOCK))
+# define UA_LOCK(LOCK) pthread_mutex_lock(&(LOCK))
+# define UA_UNLOCK(LOCK) pthread_mutex_unlock(&(LOCK))
+#else
+# define UA_LOCK_TYPE(NAME)
+# define UA_LOCK_INIT(LOCK) do {} while(0)
+# define UA_LOCK_DESTROY(LOCK) do {} while(0)
+# define UA_LOCK(LOCK) do {} while(0)
+# define UA_UNLOCK(LOCK) do {} while(0)
+#endif
+
 /* Integer Shortnames
  * ------------------
  * These are not exposed on the public API, since many user-applications make
@@ -121,6 +140,37 @@ size_t UA_readNumber(u8 *buf, size_t buflen, u32 *number);
 #define MIN(A,B) (A > B ? B : A)
 #define MAX(A,B) (A > B ? A : B)
 
+/* Arena Allocator
+ * ---------------
+ * Bump allocator for values that all share the same lifetime (e.g. a decoded
+ * request). Allocations are zeroed and aligned for all builtin types. They are
+ * not freed individually but all at once with UA_Arena_reset. When the current
+ * chunk is exhausted, a new chunk of twice the size is added. Large
+ * allocations get a chunk of their own. The reset keeps the current chunk, so
+ * that an arena that is reused for similar requests does not touch the heap
+ * at all. */
+
+/* Alignment of all allocations. Sufficient for the builtin types (64bit
+ * integers, doubles and pointers). */
+#define UA_ARENA_ALIGNMENT 8
+
+typedef struct UA_ArenaChunk UA_ArenaChunk;
+
+typedef struct {
+    UA_ArenaChunk *chunks; /* The current chunk comes first */
+    size_t chunkSize;      /* Size of the first chunk */
+} UA_Arena;
+
+void UA_Arena_init(UA_Arena *arena, size_t chunkSize);
+
+/* Returns NULL if no memory could be allocated */
+void * UA_Arena_alloc(UA_Arena *arena, size_t size);
+
+/* Releases all allocations */
+void UA_Arena_reset(UA_Arena *arena);
+
+void UA_Arena_deleteMembers(UA_Arena *arena);
+
 #ifdef UA_DEBUG_DUMP_PKGS
 void UA_EXPORT UA_dump_hex_pkg(UA_Byte* buffer, size_t bufferLen);
 #endif
@@ -8,7 +8,10 @@
 #include "ua_types_generated_handling.h"
 #include "ua_types_generated_encoding_binary.h"
 #include "ua_securechannel.h"
+#include "ua_connection_internal.h"
 #include "ua_util.h"
+#include "ua_securitypolicy_none.h"
+#include "ua_log_stdout.h"
 #include "check.h"
 
 UA_ByteString *buffers;
@@ -162,6 +165,278 @@ START_TEST(encodeTwoStringsIntoTenChunksShallWork) {
 END_TEST
 
 
+/* Records the chunks received over the connection */
+static UA_Byte received[2048];
+static size_t receivedLength;
+static size_t receivedChunks;
+
+static UA_StatusCode
+processChunkMockUp(void *application, UA_Connection *connection, UA_ByteString *chunk) {
+    ck_assert(receivedLength + chunk->length <= sizeof(received));
+    memcpy(&received[receivedLength], chunk->data, chunk->length);
+    receivedLength += chunk->length;
+    receivedChunks++;
+    return UA_STATUSCODE_GOOD;
+}
+
+START_TEST(receiveChunksSplitAcrossPacketsShallWork) {
+    /* Three chunks of different length back to back */
+    UA_Byte stream[300];
+    size_t chunkLengths[3] = {100, 16, 184};
+    size_t streamPos = 0;
+    for(size_t c = 0; c < 3; c++) {
+        UA_Byte *chunk = &stream[streamPos];
+        memcpy(chunk, "MSGC", 4);
+        size_t length = chunkLengths[c];
+        chunk[4] = (UA_Byte)length; /* little endian */
+        chunk[5] = (UA_Byte)(length >> 8);
+        chunk[6] = 0;
+        chunk[7] = 0;
+        for(size_t i = 8; i < length; i++)
+            chunk[i] = (UA_Byte)(c + i);
+        streamPos += length;
+    }
+
+    /* Deliver the stream in packets of every size */
+    for(size_t packetSize = 1; packetSize <= sizeof(stream); packetSize++) {
+        UA_Connection connection;
+        memset(&connection, 0, sizeof(UA_Connection));
+        connection.localConf.recvBufferSize = 1024;
+        receivedLength = 0;
+        receivedChunks = 0;
+        for(size_t pos = 0; pos < sizeof(stream); pos += packetSize) {
+            UA_ByteString packet = {MIN(packetSize, sizeof(stream) - pos), &stream[pos]};
+            UA_StatusCode retval =
+                UA_Connection_processChunks(&connection, NULL, processChunkMockUp, &packet);
+            ck_assert_uint_eq(retval, UA_STATUSCODE_GOOD);
+        }
+        ck_assert_uint_eq(receivedChunks, 3);
+        ck_assert_uint_eq(receivedLength, sizeof(stream));
+        ck_assert(memcmp(received, stream, sizeof(stream)) == 0);
+        ck_assert_uint_eq(connection.incompleteMessage.length, 0);
+    }
+}
+END_TEST
+
+
+/* The receive buffer of a connection is reused for the next recv. Every packet
+ * is copied into the same buffer, which is overwritten after processing. So
+ * the bytes of incomplete chunks are only kept if they were moved out of the
+ * receive buffer. */
+static UA_Byte recvBuffer[1024];
+
+static UA_StatusCode
+receivePacket(UA_Connection *connection, void *application,
+              UA_Connection_processChunk processCallback,
+              const UA_Byte *data, size_t length) {
+    ck_assert(length <= sizeof(recvBuffer));
+    memcpy(recvBuffer, data, length);
+    UA_ByteString packet = {length, recvBuffer};
+    UA_StatusCode retval =
+        UA_Connection_processChunks(connection, application, processCallback, &packet);
+    memset(recvBuffer, 0xff, sizeof(recvBuffer));
+    return retval;
+}
+
+static void
+writeChunkHeader(UA_Byte *chunk, const char *type, size_t length) {
+    memcpy(chunk, type, 4);
+    UA_Byte *bufPos = &chunk[4];
+    const UA_Byte *bufEnd = &chunk[8];
+    UA_UInt32 length32 = (UA_UInt32)length;
+    UA_UInt32_encodeBinary(&length32, &bufPos, &bufEnd);
+}
+
+/* A MSG chunk for a channel with the None policy that is not yet opened.
+ * Returns the chunk length. */
+static size_t
+writeMsgChunk(UA_Byte *chunk, const char *type, UA_UInt32 sequenceNumber,
+              UA_UInt32 requestId, const UA_Byte *body, size_t bodyLength) {
+    size_t length = 24 + bodyLength;
+    writeChunkHeader(chunk, type, length);
+    UA_UInt32 header[4] = {0, 0, sequenceNumber, requestId}; /* channel, token */
+    UA_Byte *bufPos = &chunk[8];
+    const UA_Byte *bufEnd = &chunk[24];
+    for(size_t i = 0; i < 4; i++)
+        UA_UInt32_encodeBinary(&header[i], &bufPos, &bufEnd);
+    memcpy(&chunk[24], body, bodyLength);
+    return length;
+}
+
+static UA_UInt32 messageRequestIds[4];
+static size_t messageLengths[4];
+static size_t receivedMessages;
+
+static UA_StatusCode
+processMessageMockUp(void *application, UA_SecureChannel *channel,
+                     UA_MessageType messageType, UA_UInt32 requestId,
+                     const UA_ByteString *message) {
+    ck_assert_uint_eq(messageType, UA_MESSAGETYPE_MSG);
+    ck_assert(receivedMessages < 4);
+    ck_assert(receivedLength + message->length <= sizeof(received));
+    memcpy(&received[receivedLength], message->data, message->length);
+    receivedLength += message->length;
+    messageRequestIds[receivedMessages] = requestId;
+    messageLengths[receivedMessages] = message->length;
+    receivedMessages++;
+    return UA_STATUSCODE_GOOD;
+}
+
+static UA_StatusCode
+processSecureChunk(void *application, UA_Connection *connection, UA_ByteString *chunk) {
+    return UA_SecureChannel_processChunk((UA_SecureChannel*)application, chunk,
+                                         processMessageMockUp, NULL);
+}
+
+START_TEST(receiveChunkTypesWithReusedBufferShallWork) {
+    UA_Byte bodies[468];
+    for(size_t i = 0; i < sizeof(bodies); i++)
+        bodies[i] = (UA_Byte)(i * 7);
+
+    /* Request 1 has two intermediate and a final chunk. Request 2 is aborted
+     * in between. Request 3 is a single final chunk. */
+    UA_Byte stream[24 * 6 + sizeof(bodies)];
+    size_t streamLength = 0;
+    streamLength += writeMsgChunk(&stream[streamLength], "MSGC", 1, 1, &bodies[0], 100);
+    streamLength += writeMsgChunk(&stream[streamLength], "MSGC", 2, 2, &bodies[100], 80);
+    streamLength += writeMsgChunk(&stream[streamLength], "MSGC", 3, 1, &bodies[180], 200);
+    streamLength += writeMsgChunk(&stream[streamLength], "MSGA", 4, 2, &bodies[380], 8);
+    streamLength += writeMsgChunk(&stream[streamLength], "MSGF", 5, 1, &bodies[388], 50);
+    streamLength += writeMsgChunk(&stream[streamLength], "MSGF", 6, 3, &bodies[438], 30);
+    ck_assert_uint_eq(streamLength, sizeof(stream));
+
+    UA_SecurityPolicy policy;
+    UA_SecurityPolicy_None(&policy, UA_BYTESTRING_NULL, UA_Log_Stdout);
+
+    /* Deliver the stream in packets of every size */
+    for(size_t packetSize = 1; packetSize <= sizeof(stream); packetSize++) {
+        UA_Connection connection;
+        memset(&connection, 0, sizeof(UA_Connection));
+        connection.localConf.recvBufferSize = 1024;
+        UA_SecureChannel channel;
+        UA_StatusCode retval = UA_SecureChannel_init(&channel, &policy, &UA_BYTESTRING_NULL);
+        ck_assert_uint_eq(retval, UA_STATUSCODE_GOOD);
+        receivedLength = 0;
+        receivedMessages = 0;
+        for(size_t pos = 0; pos < sizeof(stream); pos += packetSize) {
+            retval = receivePacket(&connection, &channel, processSecureChunk, &stream[pos],
+                                   MIN(packetSize, sizeof(stream) - pos));
+            ck_assert_uint_eq(retval, UA_STATUSCODE_GOOD);
+        }
+
+        ck_assert_uint_eq(receivedMessages, 2);
+        ck_assert_uint_eq(messageRequestIds[0], 1);
+        ck_assert_uint_eq(messageLengths[0], 350);
+        ck_assert(memcmp(received, bodies, 100) == 0);
+        ck_assert(memcmp(&received[100], &bodies[180], 200) == 0);
+        ck_assert(memcmp(&received[300], &bodies[388], 50) == 0);
+        ck_assert_uint_eq(messageRequestIds[1], 3);
+        ck_assert_uint_eq(messageLengths[1], 30);
+        ck_assert(memcmp(&received[350], &bodies[438], 30) == 0);
+
+        /* Nothing is left over */
+        ck_assert(LIST_EMPTY(&channel.chunks));
+        ck_assert_uint_eq(connection.incompleteMessage.length, 0);
+        UA_SecureChannel_deleteMembersCleanup(&channel);
+        UA_Connection_deleteMembers(&connection);
+    }
+    policy.deleteMembers(&policy);
+}
+END_TEST
+
+START_TEST(receiveChunkExceedingLimitsShallFail) {
+    UA_Byte chunk[300];
+    memset(chunk, 0, sizeof(chunk));
+    UA_Connection connection;
+    memset(&connection, 0, sizeof(UA_Connection));
+    connection.localConf.recvBufferSize = 256;
+
+    /* The chunk fits exactly into the receive buffer */
+    receivedLength = 0;
+    receivedChunks = 0;
+    writeChunkHeader(chunk, "MSGF", 256);
+    UA_StatusCode retval = receivePacket(&connection, NULL, processChunkMockUp, chunk, 256);
+    ck_assert_uint_eq(retval, UA_STATUSCODE_GOOD);
+    ck_assert_uint_eq(receivedChunks, 1);
+
+    /* One byte too many. Also fails if the header arrives in pieces. */
+    writeChunkHeader(chunk, "MSGF", 257);
+    retval = receivePacket(&connection, NULL, processChunkMockUp, chunk, 100);
+    ck_assert_uint_eq(retval, UA_STATUSCODE_BADTCPMESSAGETOOLARGE);
+    UA_Connection_deleteMembers(&connection);
+    for(size_t i = 0; i < 7; i++) {
+        retval = receivePacket(&connection, NULL, processChunkMockUp, &chunk[i], 1);
+        ck_assert_uint_eq(retval, UA_STATUSCODE_GOOD);
+    }
+    retval = receivePacket(&connection, NULL, processChunkMockUp, &chunk[7], 93);
+    ck_assert_uint_eq(retval, UA_STATUSCODE_BADTCPMESSAGETOOLARGE);
+    UA_Connection_deleteMembers(&connection);
+
+    /* No buffer is allocated for the announced length */
+    writeChunkHeader(chunk, "MSGF", UA_UINT32_MAX);
+    retval = receivePacket(&connection, NULL, processChunkMockUp, chunk, 8);
+    ck_assert_uint_eq(retval, UA_STATUSCODE_BADTCPMESSAGETOOLARGE);
+    ck_assert_uint_eq(connection.incompleteMessage.length, 0);
+
+    /* A single chunk must not exceed the maximum message size */
+    connection.localConf.maxMessageSize = 128;
+    writeChunkHeader(chunk, "MSGC", 129);
+    retval = receivePacket(&connection, NULL, processChunkMockUp, chunk, 50);
+    ck_assert_uint_eq(retval, UA_STATUSCODE_BADTCPMESSAGETOOLARGE);
+    ck_assert_uint_eq(connection.incompleteMessage.length, 0);
+    writeChunkHeader(chunk, "MSGC", 128);
+    retval = receivePacket(&connection, NULL, processChunkMockUp, chunk, 128);
+    ck_assert_uint_eq(retval, UA_STATUSCODE_GOOD);
+    ck_assert_uint_eq(receivedChunks, 2);
+    UA_Connection_deleteMembers(&connection);
+}
+END_TEST
+
+START_TEST(receiveChunkIntoPresizedBufferShallWork) {
+    /* Chunks of 900, 50 and 100 byte */
+    UA_Byte stream[1050];
+    for(size_t i = 0; i < sizeof(stream); i++)
+        stream[i] = (UA_Byte)i;
+    writeChunkHeader(stream, "MSGC", 900);
+    writeChunkHeader(&stream[900], "MSGC", 50);
+    writeChunkHeader(&stream[950], "MSGF", 100);
+
+    UA_Connection connection;
+    memset(&connection, 0, sizeof(UA_Connection));
+    connection.localConf.recvBufferSize = 1024;
+    receivedLength = 0;
+    receivedChunks = 0;
+
+    /* The first packets are appended in place to the buffer for the chunk */
+    UA_StatusCode retval = receivePacket(&connection, NULL, processChunkMockUp, stream, 500);
+    ck_assert_uint_eq(retval, UA_STATUSCODE_GOOD);
+    ck_assert_uint_eq(connection.incompleteMessage.length, 500);
+    const UA_Byte *presized = connection.incompleteMessage.data;
+    retval = receivePacket(&connection, NULL, processChunkMockUp, &stream[500], 350);
+    ck_assert_uint_eq(retval, UA_STATUSCODE_GOOD);
+    ck_assert_uint_eq(receivedChunks, 0);
+    ck_assert_uint_eq(connection.incompleteMessage.length, 850);
+    ck_assert_ptr_eq(connection.incompleteMessage.data, presized);
+
+    /* The packet completes the first chunk, contains the second chunk and
+     * starts the third chunk. All complete chunks are processed. */
+    retval = receivePacket(&connection, NULL, processChunkMockUp, &stream[850], 150);
+    ck_assert_uint_eq(retval, UA_STATUSCODE_GOOD);
+    ck_assert_uint_eq(receivedChunks, 2);
+    ck_assert_uint_eq(receivedLength, 950);
+    ck_assert_uint_eq(connection.incompleteMessage.length, 50);
+
+    retval = receivePacket(&connection, NULL, processChunkMockUp, &stream[1000], 50);
+    ck_assert_uint_eq(retval, UA_STATUSCODE_GOOD);
+    ck_assert_uint_eq(receivedChunks, 3);
+    ck_assert_uint_eq(receivedLength, sizeof(stream));
+    ck_assert(memcmp(received, stream, sizeof(stream)) == 0);
+    ck_assert_uint_eq(connection.incompleteMessage.length, 0);
+    UA_Connection_deleteMembers(&connection);
+}
+END_TEST
+
+
 static Suite *testSuite_builtin(void) {
     Suite *s = suite_create("Chunked encoding");
     TCase *tc_message = tcase_create("encode chunking");
@@ -169,6 +444,12 @@ static Suite *testSuite_builtin(void) {
     tcase_add_test(tc_message,encodeStringIntoFiveChunksShallWork);
     tcase_add_test(tc_message,encodeTwoStringsIntoTenChunksShallWork);
     suite_add_tcase(s, tc_message);
+    TCase *tc_receive = tcase_create("receive chunks");
+    tcase_add_test(tc_receive,receiveChunksSplitAcrossPacketsShallWork);
+    tcase_add_test(tc_receive,receiveChunkTypesWithReusedBufferShallWork);
+    tcase_add_test(tc_receive,receiveChunkExceedingLimitsShallFail);
+    tcase_add_test(tc_receive,receiveChunkIntoPresizedBufferShallWork);
+    suite_add_tcase(s, tc_receive);
     return s;
 }
 
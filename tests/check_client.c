@@ -13,6 +13,7 @@
 #include "ua_client_highlevel.h"
 #include "ua_network_tcp.h"
 #include "check.h"
+#include "testing_clock.h"
 
 UA_Server *server;
 UA_ServerConfig *config;
@@ -100,6 +101,144 @@ START_TEST(Client_read) {
 END_TEST
 
 
+static void
+readChunkedCallback(UA_Client *client, void *userdata,
+                    UA_UInt32 requestId, const UA_ReadResponse *response) {
+    UA_ReadResponse_copy(response, (UA_ReadResponse*)userdata);
+    /* Forward the testing clock so that UA_Client_runAsync returns */
+    UA_sleep(100);
+}
+
+/* Without UA_ENABLE_MULTITHREADING, the en/decoding state is shared between
+ * threads. So the server is iterated in the test thread while the response is
+ * streamed. The messages are small enough for the socket buffers. Failures are
+ * checked on the returned response after the server thread was restarted. */
+static UA_ReadResponse
+readChunked(UA_Client *client, const UA_ReadRequest *request) {
+    UA_ReadResponse response;
+    UA_ReadResponse_init(&response);
+    __UA_Client_AsyncService(client, request, &UA_TYPES[UA_TYPES_READREQUEST],
+                             (UA_ClientAsyncServiceCallback)readChunkedCallback,
+                             &UA_TYPES[UA_TYPES_READRESPONSE], &response, NULL);
+    UA_Server_run_iterate(server, false);
+    UA_Client_runAsync(client, 10);
+    return response;
+}
+
+START_TEST(Client_read_chunked) {
+    /* The server chunks the response to the client's receive buffer size */
+    UA_ClientConfig clientConfig = UA_ClientConfig_default;
+    clientConfig.localConnectionConfig.recvBufferSize = 8192;
+    UA_Client *client = UA_Client_new(clientConfig);
+    UA_StatusCode retval = UA_Client_connect(client, "opc.tcp://localhost:4840");
+    ck_assert_uint_eq(retval, UA_STATUSCODE_GOOD);
+
+    /* Stop the server thread */
+    *running = false;
+    pthread_join(server_thread, NULL);
+
+    /* The response is larger than the send buffer and streamed in chunks */
+    const size_t items = 1000;
+    UA_ReadValueId *rvi = (UA_ReadValueId*)
+        UA_Array_new(items, &UA_TYPES[UA_TYPES_READVALUEID]);
+    for(size_t i = 0; i < items; i++) {
+        rvi[i].nodeId = UA_NODEID_STRING_ALLOC(1, "my.variable");
+        rvi[i].attributeId = UA_ATTRIBUTEID_NODEID;
+    }
+    UA_ReadRequest request;
+    UA_ReadRequest_init(&request);
+    request.nodesToRead = rvi;
+    request.nodesToReadSize = items;
+    request.timestampsToReturn = UA_TIMESTAMPSTORETURN_SERVER;
+
+    UA_ReadResponse response = readChunked(client, &request);
+
+    /* An empty request fails as a whole */
+    request.nodesToReadSize = 0;
+    UA_ReadResponse emptyResponse = readChunked(client, &request);
+    request.nodesToReadSize = items;
+
+    /* Restart the server thread */
+    *running = true;
+    pthread_create(&server_thread, NULL, serverloop, NULL);
+
+    ck_assert_uint_eq(response.responseHeader.serviceResult, UA_STATUSCODE_GOOD);
+    ck_assert_uint_eq(response.resultsSize, items);
+    for(size_t i = 0; i < items; i++) {
+        ck_assert(response.results[i].hasValue);
+        ck_assert(response.results[i].hasServerTimestamp);
+        ck_assert(UA_NodeId_equal((UA_NodeId*)response.results[i].value.data,
+                                  &rvi[i].nodeId));
+    }
+    UA_ReadResponse_deleteMembers(&response);
+
+    ck_assert_uint_eq(emptyResponse.responseHeader.serviceResult,
+                      UA_STATUSCODE_BADNOTHINGTODO);
+    ck_assert_uint_eq(emptyResponse.resultsSize, 0);
+    UA_ReadResponse_deleteMembers(&emptyResponse);
+
+    UA_Array_delete(rvi, items, &UA_TYPES[UA_TYPES_READVALUEID]);
+    UA_Client_disconnect(client);
+    UA_Client_delete(client);
+}
+END_TEST
+
+START_TEST(Client_read_tooLarge) {
+    /* The response exceeds the maximum message size of the client */
+    UA_ClientConfig clientConfig = UA_ClientConfig_default;
+    clientConfig.localConnectionConfig.recvBufferSize = 8192;
+    clientConfig.localConnectionConfig.maxMessageSize = 32768;
+    UA_Client *client = UA_Client_new(clientConfig);
+    UA_StatusCode retval = UA_Client_connect(client, "opc.tcp://localhost:4840");
+    ck_assert_uint_eq(retval, UA_STATUSCODE_GOOD);
+
+    /* Stop the server thread */
+    *running = false;
+    pthread_join(server_thread, NULL);
+
+    /* Every value is an array of 16366 integers */
+    const size_t items = 4;
+    UA_ReadValueId *rvi = (UA_ReadValueId*)
+        UA_Array_new(items, &UA_TYPES[UA_TYPES_READVALUEID]);
+    for(size_t i = 0; i < items; i++) {
+        rvi[i].nodeId = UA_NODEID_STRING_ALLOC(1, "my.variable");
+        rvi[i].attributeId = UA_ATTRIBUTEID_VALUE;
+    }
+    UA_ReadRequest request;
+    UA_ReadRequest_init(&request);
+    request.nodesToRead = rvi;
+    request.nodesToReadSize = items;
+    request.timestampsToReturn = UA_TIMESTAMPSTORETURN_SERVER;
+
+    /* The chunks that were streamed are aborted and the request fails */
+    UA_ReadResponse response = readChunked(client, &request);
+
+    /* The connection remains usable */
+    rvi[0].attributeId = UA_ATTRIBUTEID_NODEID;
+    request.nodesToReadSize = 1;
+    UA_ReadResponse smallResponse = readChunked(client, &request);
+    request.nodesToReadSize = items;
+
+    /* Restart the server thread */
+    *running = true;
+    pthread_create(&server_thread, NULL, serverloop, NULL);
+
+    ck_assert_uint_eq(response.responseHeader.serviceResult,
+                      UA_STATUSCODE_BADRESPONSETOOLARGE);
+    ck_assert_uint_eq(response.resultsSize, 0);
+    UA_ReadResponse_deleteMembers(&response);
+
+    ck_assert_uint_eq(smallResponse.responseHeader.serviceResult, UA_STATUSCODE_GOOD);
+    ck_assert_uint_eq(smallResponse.resultsSize, 1);
+    ck_assert(smallResponse.results[0].hasValue);
+    UA_ReadResponse_deleteMembers(&smallResponse);
+
+    UA_Array_delete(rvi, items, &UA_TYPES[UA_TYPES_READVALUEID]);
+    UA_Client_disconnect(client);
+    UA_Client_delete(client);
+}
+END_TEST
+
 START_TEST(Client_reconnect) {
         UA_ClientConfig clientConfig = UA_ClientConfig_default;
         clientConfig.timeout = 100;
@@ -141,6 +280,8 @@ static Suite* testSuite_Client(void) {
     tcase_add_checked_fixture(tc_client, setup, teardown);
     tcase_add_test(tc_client, Client_connect);
     tcase_add_test(tc_client, Client_read);
+    tcase_add_test(tc_client, Client_read_chunked);
+    tcase_add_test(tc_client, Client_read_tooLarge);
     suite_add_tcase(s,tc_client);
     TCase *tc_client_reconnect = tcase_create("Client Reconnect");
     tcase_add_test(tc_client_reconnect, Client_reconnect);
@@ -0,0 +1,251 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "ua_server.h"
+#include "ua_config_default.h"
+#include "ua_types_encoding_binary.h"
+#include "ua_transport_generated.h"
+#include "ua_transport_generated_encoding_binary.h"
+
+#include "check.h"
+#include "testing_clock.h"
+
+/* The default configuration uses the epoll network layer when
+ * UA_ENABLE_NETWORK_EPOLL is set. The tests talk to the server over raw
+ * sockets and drive the server loop from the test thread. */
+
+#define MAXITERATIONS 1000
+
+UA_Server *server = NULL;
+UA_ServerConfig *config = NULL;
+
+static void setup(void) {
+    config = UA_ServerConfig_new_default();
+#ifdef UA_ENABLE_MULTITHREADING
+    config->nThreads = 1;
+#endif
+    server = UA_Server_new(config);
+    UA_Server_run_startup(server);
+}
+
+static void teardown(void) {
+    UA_Server_run_shutdown(server);
+    UA_Server_delete(server);
+    UA_ServerConfig_delete(config);
+}
+
+static int
+connectSocket(void) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    ck_assert_int_ge(fd, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(struct sockaddr_in));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(4840);
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    ck_assert_int_eq(connect(fd, (struct sockaddr*)&addr, sizeof(addr)), 0);
+    return fd;
+}
+
+static void
+sendHello(int fd) {
+    UA_Byte data[256];
+    UA_TcpHelloMessage hello;
+    memset(&hello, 0, sizeof(UA_TcpHelloMessage));
+    hello.receiveBufferSize = UA_ConnectionConfig_default.recvBufferSize;
+    hello.sendBufferSize = UA_ConnectionConfig_default.sendBufferSize;
+    hello.endpointUrl = UA_STRING("opc.tcp://localhost:4840");
+
+    UA_Byte *bufPos = &data[8]; /* skip the header */
+    const UA_Byte *bufEnd = &data[sizeof(data)];
+    UA_StatusCode retval = UA_TcpHelloMessage_encodeBinary(&hello, &bufPos, &bufEnd);
+    ck_assert_uint_eq(retval, UA_STATUSCODE_GOOD);
+
+    UA_TcpMessageHeader header;
+    header.messageTypeAndChunkType = UA_CHUNKTYPE_FINAL + UA_MESSAGETYPE_HEL;
+    header.messageSize = (UA_UInt32)(bufPos - data);
+    bufPos = data;
+    retval = UA_TcpMessageHeader_encodeBinary(&header, &bufPos, &bufEnd);
+    ck_assert_uint_eq(retval, UA_STATUSCODE_GOOD);
+
+    ssize_t n = send(fd, data, header.messageSize, 0);
+    ck_assert_int_eq(n, (ssize_t)header.messageSize);
+}
+
+/* Iterate the server until a complete message arrives on the socket or the
+ * socket is closed. Returns the message type or zero for a closed socket. */
+static UA_UInt32
+receiveMessage(int fd) {
+    UA_Byte data[256];
+    size_t received = 0;
+    for(size_t i = 0; i < MAXITERATIONS; i++) {
+        UA_Server_run_iterate(server, false);
+        ssize_t n = recv(fd, &data[received], sizeof(data) - received, MSG_DONTWAIT);
+        if(n == 0)
+            return 0;
+        if(n < 0) {
+            ck_assert(errno == EAGAIN || errno == EWOULDBLOCK);
+            UA_realsleep(1); /* The workers process the message */
+            continue;
+        }
+        received += (size_t)n;
+        if(received < 8)
+            continue;
+        UA_TcpMessageHeader header;
+        size_t offset = 0;
+        UA_ByteString buf = {received, data};
+        UA_StatusCode retval = UA_TcpMessageHeader_decodeBinary(&buf, &offset, &header);
+        ck_assert_uint_eq(retval, UA_STATUSCODE_GOOD);
+        ck_assert(header.messageSize <= sizeof(data));
+        if(received >= header.messageSize) {
+            /* Exactly one message is expected */
+            ck_assert_uint_eq(received, header.messageSize);
+            return header.messageTypeAndChunkType;
+        }
+    }
+    ck_assert_msg(false, "No message received");
+    return 0;
+}
+
+/* Nothing else arrives on the socket while the server keeps running */
+static void
+expectSilence(int fd) {
+    UA_Byte data[8];
+    for(size_t i = 0; i < 10; i++) {
+        UA_Server_run_iterate(server, false);
+        UA_realsleep(1);
+        ssize_t n = recv(fd, data, sizeof(data), MSG_DONTWAIT);
+        ck_assert_int_lt(n, 0);
+        ck_assert(errno == EAGAIN || errno == EWOULDBLOCK);
+    }
+}
+
+START_TEST(Epoll_helloAckClose) {
+    int fd = connectSocket();
+    sendHello(fd);
+    ck_assert_uint_eq(receiveMessage(fd), UA_CHUNKTYPE_FINAL + UA_MESSAGETYPE_ACK);
+    expectSilence(fd);
+    close(fd);
+
+    /* The server picks up the closed connection */
+    for(size_t i = 0; i < 10; i++)
+        UA_Server_run_iterate(server, false);
+} END_TEST
+
+/* Clients close the connection before the server has answered. The socket ids
+ * are reused for the next connection. Late responses for the old connection
+ * must not arrive on the new connection. */
+START_TEST(Epoll_closeBeforeResponse) {
+    for(size_t i = 0; i < 50; i++) {
+        int old = connectSocket();
+        sendHello(old);
+        close(old);
+
+        int fd = connectSocket();
+        sendHello(fd);
+        ck_assert_uint_eq(receiveMessage(fd), UA_CHUNKTYPE_FINAL + UA_MESSAGETYPE_ACK);
+        expectSilence(fd);
+        close(fd);
+    }
+} END_TEST
+
+#ifdef UA_ENABLE_MULTITHREADING
+
+static volatile UA_Boolean workerBlocked;
+static volatile UA_Boolean workerReleased;
+static UA_UInt64 blockId;
+
+static void
+blockWorkerCallback(UA_Server *serverPtr, void *data) {
+    UA_Server_removeRepeatedCallback(serverPtr, blockId);
+    workerBlocked = true;
+    while(!workerReleased)
+        UA_realsleep(1);
+}
+
+/* The worker processes the message of a connection after the client has closed
+ * it and a new connection was accepted. The response of the worker must not
+ * arrive on the new connection. */
+START_TEST(Epoll_lateResponseAfterClose) {
+    int old = connectSocket();
+    UA_Server_run_iterate(server, false);
+
+    /* Keep the only worker busy */
+    workerBlocked = false;
+    workerReleased = false;
+    UA_Server_addRepeatedCallback(server, blockWorkerCallback, NULL, 10, &blockId);
+    UA_sleep(15);
+    for(size_t i = 0; i < MAXITERATIONS && !workerBlocked; i++) {
+        UA_Server_run_iterate(server, false);
+        UA_realsleep(1);
+    }
+    ck_assert(workerBlocked);
+
+    /* The message is queued for the worker. Then the connection is removed. */
+    sendHello(old);
+    close(old);
+    for(size_t i = 0; i < 10; i++)
+        UA_Server_run_iterate(server, false);
+
+    /* Accept the new connection before the worker answers the old one */
+    int fd = connectSocket();
+    for(size_t i = 0; i < 10; i++)
+        UA_Server_run_iterate(server, false);
+    workerReleased = true;
+    expectSilence(fd);
+
+    sendHello(fd);
+    ck_assert_uint_eq(receiveMessage(fd), UA_CHUNKTYPE_FINAL + UA_MESSAGETYPE_ACK);
+    close(fd);
+} END_TEST
+
+#endif
+
+/* The server answers an invalid message with an error and closes the
+ * connection */
+START_TEST(Epoll_closeByServer) {
+    int fd = connectSocket();
+    const char garbage[] = "XXXF\x10\x00\x00\x00garbage!";
+    ck_assert_int_eq(send(fd, garbage, 16, 0), 16);
+    ck_assert_uint_eq(receiveMessage(fd), UA_CHUNKTYPE_FINAL + UA_MESSAGETYPE_ERR);
+    ck_assert_uint_eq(receiveMessage(fd), 0);
+    close(fd);
+
+    /* The server still accepts new connections */
+    fd = connectSocket();
+    sendHello(fd);
+    ck_assert_uint_eq(receiveMessage(fd), UA_CHUNKTYPE_FINAL + UA_MESSAGETYPE_ACK);
+    close(fd);
+} END_TEST
+
+static Suite* testSuite_Epoll(void) {
+    Suite *s = suite_create("Network Layer Epoll");
+    TCase *tc = tcase_create("Connections");
+    tcase_add_checked_fixture(tc, setup, teardown);
+    tcase_add_test(tc, Epoll_helloAckClose);
+    tcase_add_test(tc, Epoll_closeBeforeResponse);
+    tcase_add_test(tc, Epoll_closeByServer);
+#ifdef UA_ENABLE_MULTITHREADING
+    tcase_add_test(tc, Epoll_lateResponseAfterClose);
+#endif
+    suite_add_tcase(s, tc);
+    return s;
+}
+
+int main(void) {
+    Suite *s = testSuite_Epoll();
+    SRunner *sr = srunner_create(s);
+    srunner_set_fork_status(sr, CK_NOFORK);
+    srunner_run_all(sr,CK_NORMAL);
+    int number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
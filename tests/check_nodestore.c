@@ -26,6 +26,7 @@ typedef struct UA_NodeMapEntry {
     struct UA_NodeMapEntry *orig; /* the version this is a copy from (or NULL) */
     UA_UInt16 refCount; /* How many consumers have a reference to the node? */
     UA_Boolean deleted; /* Node was marked as deleted and can be deleted when refCount == 0 */
+    void *slab;
     UA_Node node;
 } UA_NodeMapEntry;
 
@@ -91,6 +92,22 @@ START_TEST(replaceOldNode) {
 }
 END_TEST
 
+START_TEST(replaceNodeRepeatedly) {
+    UA_Node* n1 = createNode(0,2253);
+    ns.insertNode(ns.context, n1, NULL);
+    UA_NodeId in1 = UA_NODEID_NUMERIC(0,2253);
+    for(UA_UInt32 i = 0; i < 100; i++) {
+        UA_Node* n2;
+        ck_assert_int_eq(ns.getNodeCopy(ns.context, &in1, &n2), UA_STATUSCODE_GOOD);
+        ((UA_VariableNode*)n2)->accessLevel = (UA_Byte)i;
+        ck_assert_int_eq(ns.replaceNode(ns.context, n2), UA_STATUSCODE_GOOD);
+    }
+    const UA_Node* nr = ns.getNode(ns.context, &in1);
+    ck_assert_int_eq(((const UA_VariableNode*)nr)->accessLevel, 99);
+    ns.releaseNode(ns.context, nr);
+}
+END_TEST
+
 START_TEST(findNodeInUA_NodeStoreWithSingleEntry) {
     UA_Node* n1 = createNode(0,2253);
     ns.insertNode(ns.context, n1, NULL);
@@ -200,6 +217,136 @@ START_TEST(failToFindNonExistantNodeInUA_NodeStoreWithSeveralEntries) {
 }
 END_TEST
 
+START_TEST(mixDenseAndHashedNodeIds) {
+    /* Dense numeric ids in two namespaces, a numeric id beyond the dense
+     * pages and a string id */
+    for(UA_UInt32 i = 0; i < 600; i++) {
+        ns.insertNode(ns.context, createNode(0, (UA_Int32)i), NULL);
+        ns.insertNode(ns.context, createNode(3, (UA_Int32)(i * 7)), NULL);
+    }
+    ns.insertNode(ns.context, createNode(1, 23372337), NULL);
+    UA_Node *sn = ns.newNode(ns.context, UA_NODECLASS_VARIABLE);
+    sn->nodeId = UA_NODEID_STRING_ALLOC(1, "dense.or.not");
+    ck_assert_int_eq(ns.insertNode(ns.context, sn, NULL), UA_STATUSCODE_GOOD);
+
+    UA_Node *dup = createNode(3, 7 * 599);
+    ck_assert_int_eq(ns.insertNode(ns.context, dup, NULL), UA_STATUSCODE_BADNODEIDEXISTS);
+
+    UA_NodeId id = UA_NODEID_NUMERIC(3, 7 * 300);
+    const UA_Node *nr = ns.getNode(ns.context, &id);
+    ck_assert_ptr_ne(nr, NULL);
+    ck_assert(UA_NodeId_equal(&nr->nodeId, &id));
+    ns.releaseNode(ns.context, nr);
+    id = UA_NODEID_NUMERIC(3, 7 * 300 + 1);
+    ck_assert_ptr_eq(ns.getNode(ns.context, &id), NULL);
+    id = UA_NODEID_NUMERIC(2, 5);
+    ck_assert_ptr_eq(ns.getNode(ns.context, &id), NULL);
+    id = UA_NODEID_NUMERIC(1, 23372337);
+    nr = ns.getNode(ns.context, &id);
+    ck_assert_ptr_ne(nr, NULL);
+    ns.releaseNode(ns.context, nr);
+    id = UA_NODEID_STRING(1, "dense.or.not");
+    nr = ns.getNode(ns.context, &id);
+    ck_assert_ptr_ne(nr, NULL);
+    ns.releaseNode(ns.context, nr);
+
+    /* Remove a dense node */
+    id = UA_NODEID_NUMERIC(0, 42);
+    ck_assert_int_eq(ns.removeNode(ns.context, &id), UA_STATUSCODE_GOOD);
+    ck_assert_ptr_eq(ns.getNode(ns.context, &id), NULL);
+    ck_assert_int_eq(ns.removeNode(ns.context, &id), UA_STATUSCODE_BADNODEIDUNKNOWN);
+
+    zeroCnt = 0;
+    visitCnt = 0;
+    ns.iterate(ns.context, NULL, checkZeroVisitor);
+    ck_assert_int_eq(zeroCnt, 0);
+    ck_assert_int_eq(visitCnt, 1201);
+}
+END_TEST
+
+#define HASHED_ID(i) ((1u << 24) + (UA_UInt32)(i) * 13)
+
+static void removeVisitor(void *context, const UA_Node* node) {
+    visitCnt++;
+    if(node->nodeId.identifier.numeric % 3 != 0)
+        ns.removeNode(ns.context, &node->nodeId);
+}
+
+START_TEST(removeHashedNodesWhileIterating) {
+    /* Numeric identifiers beyond the dense pages are stored in the hash-map */
+    for(UA_UInt32 i = 0; i < 3000; i++)
+        ns.insertNode(ns.context, createNode(1, (UA_Int32)HASHED_ID(i)), NULL);
+
+    /* Every node is visited once although the removal shifts the entries */
+    visitCnt = 0;
+    ns.iterate(ns.context, NULL, removeVisitor);
+    ck_assert_int_eq(visitCnt, 3000);
+
+    for(UA_UInt32 i = 0; i < 3000; i++) {
+        UA_NodeId id = UA_NODEID_NUMERIC(1, HASHED_ID(i));
+        const UA_Node *nr = ns.getNode(ns.context, &id);
+        if(HASHED_ID(i) % 3 != 0) {
+            ck_assert_ptr_eq(nr, NULL);
+            continue;
+        }
+        ck_assert_ptr_ne(nr, NULL);
+        ns.releaseNode(ns.context, nr);
+    }
+
+    /* Shrink the hash-map by removing all but a few nodes */
+    UA_UInt32 left = 0;
+    for(UA_UInt32 i = 0; i < 3000; i++) {
+        if(HASHED_ID(i) % 3 != 0 || i % 100 == 0)
+            continue;
+        UA_NodeId id = UA_NODEID_NUMERIC(1, HASHED_ID(i));
+        ck_assert_int_eq(ns.removeNode(ns.context, &id), UA_STATUSCODE_GOOD);
+    }
+    for(UA_UInt32 i = 0; i < 3000; i += 100) {
+        UA_NodeId id = UA_NODEID_NUMERIC(1, HASHED_ID(i));
+        const UA_Node *nr = ns.getNode(ns.context, &id);
+        if(HASHED_ID(i) % 3 != 0) {
+            ck_assert_ptr_eq(nr, NULL);
+            continue;
+        }
+        ck_assert_ptr_ne(nr, NULL);
+        ns.releaseNode(ns.context, nr);
+        left++;
+    }
+
+    zeroCnt = 0;
+    visitCnt = 0;
+    ns.iterate(ns.context, NULL, checkZeroVisitor);
+    ck_assert_int_eq(zeroCnt, 0);
+    ck_assert_int_eq(visitCnt, left);
+}
+END_TEST
+
+static void removeAllVisitor(void *context, const UA_Node* node) {
+    visitCnt++;
+    ck_assert_int_eq(ns.removeNode(ns.context, &node->nodeId), UA_STATUSCODE_GOOD);
+}
+
+START_TEST(removeAllHashedNodesWhileIterating) {
+    for(UA_UInt32 i = 0; i < 3000; i++)
+        ns.insertNode(ns.context, createNode(1, (UA_Int32)HASHED_ID(i)), NULL);
+
+    /* The hash-map would shrink when most nodes are removed. Still, every node
+     * is visited once. */
+    visitCnt = 0;
+    ns.iterate(ns.context, NULL, removeAllVisitor);
+    ck_assert_int_eq(visitCnt, 3000);
+
+    for(UA_UInt32 i = 0; i < 3000; i++) {
+        UA_NodeId id = UA_NODEID_NUMERIC(1, HASHED_ID(i));
+        ck_assert_ptr_eq(ns.getNode(ns.context, &id), NULL);
+    }
+
+    visitCnt = 0;
+    ns.iterate(ns.context, NULL, checkZeroVisitor);
+    ck_assert_int_eq(visitCnt, 0);
+}
+END_TEST
+
 /************************************/
 /* Performance Profiling Test Cases */
 /************************************/
@@ -274,12 +421,16 @@ static Suite * namespace_suite (void) {
     tcase_add_test (tc_find, findNodeInExpandedNamespace);
     tcase_add_test (tc_find, failToFindNonExistantNodeInUA_NodeStoreWithSeveralEntries);
     tcase_add_test (tc_find, failToFindNodeInOtherUA_NodeStore);
+    tcase_add_test (tc_find, mixDenseAndHashedNodeIds);
+    tcase_add_test (tc_find, removeHashedNodesWhileIterating);
+    tcase_add_test (tc_find, removeAllHashedNodesWhileIterating);
     suite_add_tcase (s, tc_find);
 
     TCase *tc_replace = tcase_create("Replace");
     tcase_add_checked_fixture(tc_replace, setup, teardown);
     tcase_add_test (tc_replace, replaceExistingNode);
     tcase_add_test (tc_replace, replaceOldNode);
+    tcase_add_test (tc_replace, replaceNodeRepeatedly);
     suite_add_tcase (s, tc_replace);
 
     TCase* tc_iterate = tcase_create ("Iterate");
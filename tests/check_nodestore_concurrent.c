@@ -0,0 +1,268 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "ua_types.h"
+#include "ua_plugin_nodestore.h"
+#include "ua_nodestore_concurrent.h"
+#include "ua_util.h"
+#include "check.h"
+
+#ifdef UA_ENABLE_MULTITHREADING
+#include <pthread.h>
+#endif
+
+UA_Nodestore ns;
+
+static void setup(void) {
+    UA_Nodestore_concurrent_new(&ns);
+}
+
+static void teardown(void) {
+    ns.deleteNodestore(ns.context);
+}
+
+static UA_Node* createNode(UA_Int16 nsid, UA_Int32 id) {
+    UA_Node *p = ns.newNode(ns.context, UA_NODECLASS_VARIABLE);
+    p->nodeId.identifierType = UA_NODEIDTYPE_NUMERIC;
+    p->nodeId.namespaceIndex = nsid;
+    p->nodeId.identifier.numeric = id;
+    return p;
+}
+
+static int visitCnt = 0;
+static void countVisitor(void *context, const UA_Node* node) {
+    ck_assert_ptr_ne(node, NULL);
+    visitCnt++;
+}
+
+START_TEST(findInsertedNode) {
+    UA_Node* n1 = createNode(0,2253);
+    ck_assert_int_eq(ns.insertNode(ns.context, n1, NULL), UA_STATUSCODE_GOOD);
+    UA_NodeId in1 = UA_NODEID_NUMERIC(0,2253);
+    const UA_Node* nr = ns.getNode(ns.context, &in1);
+    ck_assert_ptr_eq(nr, n1);
+    ns.releaseNode(ns.context, nr);
+
+    UA_NodeId in2 = UA_NODEID_NUMERIC(1,2253);
+    ck_assert_ptr_eq(ns.getNode(ns.context, &in2), NULL);
+}
+END_TEST
+
+START_TEST(failToInsertDuplicate) {
+    ns.insertNode(ns.context, createNode(0,2253), NULL);
+    UA_StatusCode retval = ns.insertNode(ns.context, createNode(0,2253), NULL);
+    ck_assert_int_eq(retval, UA_STATUSCODE_BADNODEIDEXISTS);
+}
+END_TEST
+
+START_TEST(failToInsertDuplicateAfterRemove) {
+    /* The duplicate check must continue past the tombstones */
+    for(UA_UInt32 i = 1; i <= 40; i++)
+        ns.insertNode(ns.context, createNode(0,i), NULL);
+    for(UA_UInt32 i = 1; i <= 40; i += 2) {
+        UA_NodeId id = UA_NODEID_NUMERIC(0, i);
+        ck_assert_int_eq(ns.removeNode(ns.context, &id), UA_STATUSCODE_GOOD);
+    }
+    for(UA_UInt32 i = 2; i <= 40; i += 2) {
+        UA_StatusCode retval = ns.insertNode(ns.context, createNode(0,i), NULL);
+        ck_assert_int_eq(retval, UA_STATUSCODE_BADNODEIDEXISTS);
+    }
+}
+END_TEST
+
+START_TEST(insertWithFreshNodeId) {
+    UA_NodeId added;
+    UA_Node *n = createNode(1,0);
+    ck_assert_int_eq(ns.insertNode(ns.context, n, &added), UA_STATUSCODE_GOOD);
+    ck_assert_uint_ne(added.identifier.numeric, 0);
+    const UA_Node *nr = ns.getNode(ns.context, &added);
+    ck_assert_ptr_eq(nr, n);
+    ns.releaseNode(ns.context, nr);
+}
+END_TEST
+
+START_TEST(replaceOldNode) {
+    ns.insertNode(ns.context, createNode(0,2253), NULL);
+    UA_NodeId in1 = UA_NODEID_NUMERIC(0,2253);
+    UA_Node* n2;
+    UA_Node* n3;
+    ns.getNodeCopy(ns.context, &in1, &n2);
+    ns.getNodeCopy(ns.context, &in1, &n3);
+
+    /* shall succeed */
+    UA_StatusCode retval = ns.replaceNode(ns.context, n2);
+    ck_assert_int_eq(retval, UA_STATUSCODE_GOOD);
+
+    /* shall fail */
+    retval = ns.replaceNode(ns.context, n3);
+    ck_assert_int_ne(retval, UA_STATUSCODE_GOOD);
+
+    const UA_Node *nr = ns.getNode(ns.context, &in1);
+    ck_assert_ptr_eq(nr, n2);
+    ns.releaseNode(ns.context, nr);
+}
+END_TEST
+
+START_TEST(checkedOutNodeSurvivesReplaceAndRemove) {
+    UA_Node *n1 = createNode(0,2253);
+    n1->writeMask = 42;
+    ns.insertNode(ns.context, n1, NULL);
+    UA_NodeId in1 = UA_NODEID_NUMERIC(0,2253);
+
+    const UA_Node *held = ns.getNode(ns.context, &in1);
+    UA_Node *copy;
+    ns.getNodeCopy(ns.context, &in1, &copy);
+    copy->writeMask = 43;
+    ck_assert_int_eq(ns.replaceNode(ns.context, copy), UA_STATUSCODE_GOOD);
+    ck_assert_int_eq(ns.removeNode(ns.context, &in1), UA_STATUSCODE_GOOD);
+
+    /* The old version remains readable until it is released */
+    ck_assert_uint_eq(held->writeMask, 42);
+    ck_assert_ptr_eq(ns.getNode(ns.context, &in1), NULL);
+    ns.releaseNode(ns.context, held);
+}
+END_TEST
+
+START_TEST(growAndShrink) {
+    for(UA_UInt32 i = 0; i < 2000; i++)
+        ck_assert_int_eq(ns.insertNode(ns.context, createNode(0,i+1), NULL),
+                         UA_STATUSCODE_GOOD);
+    for(UA_UInt32 i = 0; i < 1990; i++) {
+        UA_NodeId id = UA_NODEID_NUMERIC(0, i+1);
+        ck_assert_int_eq(ns.removeNode(ns.context, &id), UA_STATUSCODE_GOOD);
+    }
+    for(UA_UInt32 i = 1990; i < 2000; i++) {
+        UA_NodeId id = UA_NODEID_NUMERIC(0, i+1);
+        const UA_Node *nr = ns.getNode(ns.context, &id);
+        ck_assert_ptr_ne(nr, NULL);
+        ns.releaseNode(ns.context, nr);
+    }
+    visitCnt = 0;
+    ns.iterate(ns.context, NULL, countVisitor);
+    ck_assert_int_eq(visitCnt, 10);
+}
+END_TEST
+
+START_TEST(churnWithTombstones) {
+    /* Repeated insert/remove must not fill the table with tombstones */
+    for(UA_UInt32 i = 0; i < 5000; i++) {
+        UA_NodeId id = UA_NODEID_NUMERIC(0, i+1);
+        ck_assert_int_eq(ns.insertNode(ns.context, createNode(0,i+1), NULL),
+                         UA_STATUSCODE_GOOD);
+        ck_assert_int_eq(ns.removeNode(ns.context, &id), UA_STATUSCODE_GOOD);
+    }
+    UA_NodeId id = UA_NODEID_NUMERIC(0, 1);
+    ck_assert_ptr_eq(ns.getNode(ns.context, &id), NULL);
+}
+END_TEST
+
+#ifdef UA_ENABLE_MULTITHREADING
+
+#define THREADS 4
+#define ROUNDS 200
+#define NODES 500
+
+static volatile UA_Boolean running;
+
+static void *readerThread(void *arg) {
+    UA_NodeId id = UA_NODEID_NUMERIC(0, 0);
+    size_t found = 0;
+    while(running) {
+        for(UA_UInt32 i = 0; i < NODES; i++) {
+            id.identifier.numeric = i+1;
+            const UA_Node *n = ns.getNode(ns.context, &id);
+            if(!n)
+                continue;
+            /* The node is immutable while it is checked out */
+            ck_assert_uint_eq(n->nodeId.identifier.numeric, i+1);
+            ns.releaseNode(ns.context, n);
+            found++;
+        }
+    }
+    return (void*)found;
+}
+
+START_TEST(concurrentReadersAndWriter) {
+    for(UA_UInt32 i = 0; i < NODES; i++)
+        ns.insertNode(ns.context, createNode(0,i+1), NULL);
+
+    running = true;
+    pthread_t t[THREADS];
+    for(int i = 0; i < THREADS; i++)
+        pthread_create(&t[i], NULL, readerThread, NULL);
+
+    /* Replace, remove and re-insert while the readers are active */
+    UA_NodeId id = UA_NODEID_NUMERIC(0, 0);
+    for(UA_UInt32 r = 0; r < ROUNDS; r++) {
+        for(UA_UInt32 i = 0; i < NODES; i += 7) {
+            id.identifier.numeric = i+1;
+            UA_Node *copy;
+            if(ns.getNodeCopy(ns.context, &id, &copy) != UA_STATUSCODE_GOOD)
+                continue;
+            copy->writeMask = r;
+            ns.replaceNode(ns.context, copy);
+        }
+        id.identifier.numeric = (r % NODES) + 1;
+        ns.removeNode(ns.context, &id);
+        ns.insertNode(ns.context, createNode(0, (r % NODES) + 1), NULL);
+    }
+
+    running = false;
+    for(int i = 0; i < THREADS; i++)
+        pthread_join(t[i], NULL);
+
+    visitCnt = 0;
+    ns.iterate(ns.context, NULL, countVisitor);
+    ck_assert_int_eq(visitCnt, NODES);
+}
+END_TEST
+
+#endif
+
+static Suite * namespace_suite (void) {
+    Suite *s = suite_create ("UA_NodeStore_Concurrent");
+
+    TCase* tc_find = tcase_create ("Find");
+    tcase_add_checked_fixture(tc_find, setup, teardown);
+    tcase_add_test (tc_find, findInsertedNode);
+    tcase_add_test (tc_find, failToInsertDuplicate);
+    tcase_add_test (tc_find, failToInsertDuplicateAfterRemove);
+    tcase_add_test (tc_find, insertWithFreshNodeId);
+    suite_add_tcase (s, tc_find);
+
+    TCase *tc_replace = tcase_create("Replace");
+    tcase_add_checked_fixture(tc_replace, setup, teardown);
+    tcase_add_test (tc_replace, replaceOldNode);
+    tcase_add_test (tc_replace, checkedOutNodeSurvivesReplaceAndRemove);
+    suite_add_tcase (s, tc_replace);
+
+    TCase *tc_resize = tcase_create("Resize");
+    tcase_add_checked_fixture(tc_resize, setup, teardown);
+    tcase_add_test (tc_resize, growAndShrink);
+    tcase_add_test (tc_resize, churnWithTombstones);
+    suite_add_tcase (s, tc_resize);
+
+#ifdef UA_ENABLE_MULTITHREADING
+    TCase *tc_concurrent = tcase_create("Concurrent");
+    tcase_add_checked_fixture(tc_concurrent, setup, teardown);
+    tcase_add_test (tc_concurrent, concurrentReadersAndWriter);
+    suite_add_tcase (s, tc_concurrent);
+#endif
+
+    return s;
+}
+
+int main (void) {
+    int number_failed = 0;
+    Suite *s = namespace_suite();
+    SRunner *sr = srunner_create(s);
+    srunner_set_fork_status(sr,CK_NOFORK);
+    srunner_run_all(sr, CK_NORMAL);
+    number_failed += srunner_ntests_failed (sr);
+    srunner_free(sr);
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
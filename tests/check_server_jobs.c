@@ -5,6 +5,8 @@
 #include "ua_server.h"
 #include "server/ua_server_internal.h"
 #include "ua_config_default.h"
+#include "ua_transport_generated.h"
+#include "ua_transport_generated_encoding_binary.h"
 
 #include "check.h"
 #include "testing_clock.h"
@@ -14,6 +16,9 @@ UA_ServerConfig *config = NULL;
 
 static void setup(void) {
     config = UA_ServerConfig_new_default();
+#ifdef UA_ENABLE_MULTITHREADING
+    config->nThreads = 4;
+#endif
     server = UA_Server_new(config);
     UA_Server_run_startup(server);
 }
@@ -69,6 +74,304 @@ START_TEST(Server_repeatedCallbackRemoveItself) {
 }
 END_TEST
 
+static void
+timerDispatch(void *application, UA_TimerCallback callback, void *data) {
+    callback(application, data);
+}
+
+static void
+timerCountCallback(void *application, void *data) {
+    (*(UA_UInt32*)data)++;
+}
+
+START_TEST(Timer_manyRepeatedCallbacks) {
+    UA_Timer timer;
+    UA_Timer_init(&timer);
+
+    /* Callbacks with different intervals */
+    UA_UInt32 counts[1000];
+    UA_UInt64 ids[1000];
+    memset(counts, 0, sizeof(counts));
+    for(size_t i = 0; i < 1000; i++)
+        UA_Timer_addRepeatedCallback(&timer, timerCountCallback, &counts[i],
+                                     (UA_UInt32)(5 + (i % 50)), &ids[i]);
+
+    /* Remove every second callback and slow down every fourth */
+    for(size_t i = 0; i < 1000; i += 2) {
+        if(i % 4 == 0)
+            UA_Timer_changeRepeatedCallbackInterval(&timer, ids[i], 100);
+        UA_Timer_removeRepeatedCallback(&timer, ids[i+1]);
+    }
+
+    /* Run for one second in steps of 1ms */
+    for(size_t i = 0; i < 1000; i++) {
+        UA_sleep(1);
+        UA_Timer_process(&timer, UA_DateTime_nowMonotonic(), timerDispatch, NULL);
+    }
+
+    for(size_t i = 0; i < 1000; i++) {
+        if(i % 2 == 1)
+            ck_assert_uint_eq(counts[i], 0);
+        else if(i % 4 == 0)
+            ck_assert_uint_eq(counts[i], 10);
+        else
+            ck_assert_uint_eq(counts[i], 1000 / (5 + (i % 50)));
+    }
+
+    UA_Timer_deleteMembers(&timer);
+}
+END_TEST
+
+#ifdef UA_ENABLE_MULTITHREADING
+
+static volatile uint32_t finishedCallbacks;
+static volatile uint32_t finishedAtDelayed;
+static volatile UA_Boolean delayedExecuted;
+
+static void
+countCallback(UA_Server *serverPtr, void *data) {
+    UA_atomic_add(&finishedCallbacks, 1);
+}
+
+static void
+slowCountCallback(UA_Server *serverPtr, void *data) {
+    UA_realsleep(1);
+    UA_atomic_add(&finishedCallbacks, 1);
+}
+
+/* Dispatches from within a worker go to the own deque and are stolen */
+static void
+fanOutCallback(UA_Server *serverPtr, void *data) {
+    for(size_t i = 0; i < 10; i++)
+        UA_Server_workerCallback(serverPtr, countCallback, NULL);
+}
+
+static void
+delayedCallback(UA_Server *serverPtr, void *data) {
+    finishedAtDelayed = finishedCallbacks;
+    delayedExecuted = true;
+}
+
+START_TEST(Server_dispatchFromWorkers) {
+    finishedCallbacks = 0;
+    for(size_t i = 0; i < 100; i++)
+        UA_Server_workerCallback(server, fanOutCallback, NULL);
+    for(size_t i = 0; i < 500 && finishedCallbacks < 1000; i++)
+        UA_realsleep(10);
+    ck_assert_uint_eq(finishedCallbacks, 1000);
+}
+END_TEST
+
+START_TEST(Server_delayedCallbackWaitsForDispatched) {
+    finishedCallbacks = 0;
+    delayedExecuted = false;
+    for(size_t i = 0; i < 100; i++)
+        UA_Server_workerCallback(server, slowCountCallback, NULL);
+    UA_Server_delayedCallback(server, delayedCallback, NULL);
+    for(size_t i = 0; i < 500 && !delayedExecuted; i++) {
+        UA_Server_run_iterate(server, false);
+        UA_realsleep(10);
+    }
+    ck_assert_uint_eq(delayedExecuted, true);
+    ck_assert_uint_eq(finishedAtDelayed, 100);
+}
+END_TEST
+
+/* A connection whose messages are processed by the workers. Sending can be
+ * held up to keep the worker of the connection busy. */
+typedef struct {
+    UA_Connection connection;
+    volatile uint32_t sent;
+    volatile uint32_t closed;
+    volatile UA_Boolean holdSend;
+    volatile UA_Boolean sendHeld;
+    volatile UA_Boolean freed;
+    volatile UA_Boolean sentAfterFree;
+} TestConnection;
+
+static UA_StatusCode
+testGetSendBuffer(UA_Connection *connection, size_t length, UA_ByteString *buf) {
+    return UA_ByteString_allocBuffer(buf, length);
+}
+
+static void
+testReleaseSendBuffer(UA_Connection *connection, UA_ByteString *buf) {
+    UA_ByteString_deleteMembers(buf);
+}
+
+static UA_StatusCode
+testSend(UA_Connection *connection, UA_ByteString *buf) {
+    TestConnection *tc = (TestConnection*)connection;
+    if(tc->freed)
+        tc->sentAfterFree = true;
+    tc->sendHeld = tc->holdSend;
+    while(tc->holdSend)
+        UA_realsleep(1);
+    UA_ByteString_deleteMembers(buf);
+    UA_atomic_add(&tc->sent, 1);
+    return UA_STATUSCODE_GOOD;
+}
+
+static void
+testClose(UA_Connection *connection) {
+    UA_atomic_add(&((TestConnection*)connection)->closed, 1);
+}
+
+static void
+testFree(UA_Connection *connection) {
+    UA_Connection_deleteMembers(connection);
+    ((TestConnection*)connection)->freed = true;
+}
+
+static void
+initTestConnection(TestConnection *tc, UA_Int32 sockfd) {
+    memset(tc, 0, sizeof(TestConnection));
+    UA_Connection *c = &tc->connection;
+    c->state = UA_CONNECTION_OPENING;
+    c->localConf = UA_ConnectionConfig_default;
+    c->remoteConf = UA_ConnectionConfig_default;
+    c->sockfd = sockfd;
+    c->getSendBuffer = testGetSendBuffer;
+    c->releaseSendBuffer = testReleaseSendBuffer;
+    c->send = testSend;
+    c->close = testClose;
+    c->free = testFree;
+}
+
+static UA_ByteString
+encodeHello(UA_Byte *data, size_t size) {
+    UA_TcpHelloMessage hello;
+    memset(&hello, 0, sizeof(UA_TcpHelloMessage));
+    hello.receiveBufferSize = UA_ConnectionConfig_default.recvBufferSize;
+    hello.sendBufferSize = UA_ConnectionConfig_default.sendBufferSize;
+    hello.endpointUrl = UA_STRING("opc.tcp://localhost:4840");
+
+    UA_Byte *bufPos = &data[8]; /* skip the header */
+    const UA_Byte *bufEnd = &data[size];
+    UA_StatusCode retval = UA_TcpHelloMessage_encodeBinary(&hello, &bufPos, &bufEnd);
+    ck_assert_uint_eq(retval, UA_STATUSCODE_GOOD);
+
+    UA_TcpMessageHeader header;
+    header.messageTypeAndChunkType = UA_CHUNKTYPE_FINAL + UA_MESSAGETYPE_HEL;
+    header.messageSize = (UA_UInt32)(bufPos - data);
+    bufPos = data;
+    retval = UA_TcpMessageHeader_encodeBinary(&header, &bufPos, &bufEnd);
+    ck_assert_uint_eq(retval, UA_STATUSCODE_GOOD);
+
+    UA_ByteString msg = {header.messageSize, data};
+    return msg;
+}
+
+static void
+iterateUntil(volatile UA_Boolean *flag) {
+    for(size_t i = 0; i < 1000 && !*flag; i++) {
+        UA_Server_run_iterate(server, false);
+        UA_realsleep(1);
+    }
+    ck_assert(*flag);
+}
+
+static TestConnection connA, connB;
+
+/* The worker of connection A is held up in sending. Connection B is processed
+ * meanwhile. Then the client closes A. The messages that are still queued for
+ * A are dropped. A is freed only after the worker has let go of it. */
+START_TEST(Server_processConnectionsParallelAndClose) {
+    UA_Byte data[256];
+    UA_ByteString hello = encodeHello(data, sizeof(data));
+    initTestConnection(&connA, 1);
+    initTestConnection(&connB, 2);
+
+    /* The worker for A sends the ACK. The following messages are queued. */
+    connA.holdSend = true;
+    UA_Server_processBinaryMessage(server, &connA.connection, &hello);
+    iterateUntil(&connA.sendHeld);
+    for(size_t i = 0; i < 10; i++)
+        UA_Server_processBinaryMessage(server, &connA.connection, &hello);
+
+    /* B is answered while A is held up */
+    UA_Server_processBinaryMessage(server, &connB.connection, &hello);
+    for(size_t i = 0; i < 1000 && connB.sent == 0; i++)
+        UA_realsleep(1);
+    ck_assert_uint_eq(connB.sent, 1);
+
+    /* Closed by the client. A is not freed while the worker sends. */
+    UA_Server_removeConnection(server, &connA.connection);
+    UA_Server_removeConnection(server, &connB.connection);
+    for(size_t i = 0; i < 20; i++) {
+        UA_Server_run_iterate(server, false);
+        UA_realsleep(1);
+    }
+    ck_assert(!connA.freed);
+
+    connA.holdSend = false;
+    iterateUntil(&connA.freed);
+    iterateUntil(&connB.freed);
+    ck_assert_uint_eq(connA.sent, 1);
+    ck_assert(!connA.sentAfterFree);
+    ck_assert_uint_eq(connB.sent, 1);
+    ck_assert_uint_eq(connA.closed, 0);
+}
+END_TEST
+
+/* The server closes the connection after an invalid message. The messages
+ * queued behind it are not processed. */
+START_TEST(Server_processConnectionClosedByServer) {
+    UA_Byte data[256];
+    UA_ByteString hello = encodeHello(data, sizeof(data));
+    initTestConnection(&connA, 1);
+
+    /* The worker sends the ERR message */
+    connA.holdSend = true;
+    const char garbage[] = "XXXF\x10\x00\x00\x00garbage!";
+    UA_ByteString msg = {16, (UA_Byte*)(uintptr_t)garbage};
+    UA_Server_processBinaryMessage(server, &connA.connection, &msg);
+    iterateUntil(&connA.sendHeld);
+    for(size_t i = 0; i < 10; i++)
+        UA_Server_processBinaryMessage(server, &connA.connection, &hello);
+    connA.holdSend = false;
+
+    /* The network layer removes the connection after the close */
+    for(size_t i = 0; i < 1000 && connA.closed == 0; i++)
+        UA_realsleep(1);
+    ck_assert_uint_eq(connA.closed, 1);
+    UA_Server_removeConnection(server, &connA.connection);
+    iterateUntil(&connA.freed);
+    ck_assert_uint_eq(connA.sent, 1);
+    ck_assert_uint_eq(connA.closed, 1);
+}
+END_TEST
+
+/* A client floods the connection while the worker is busy. The connection is
+ * closed once more bytes are queued than allowed. */
+START_TEST(Server_processConnectionQueueLimit) {
+    UA_Byte data[256];
+    UA_ByteString hello = encodeHello(data, sizeof(data));
+    initTestConnection(&connA, 1);
+    server->config.maxReceiveQueueSize = (UA_UInt32)(5 * hello.length);
+
+    connA.holdSend = true;
+    UA_Server_processBinaryMessage(server, &connA.connection, &hello);
+    iterateUntil(&connA.sendHeld);
+    for(size_t i = 0; i < 5; i++)
+        UA_Server_processBinaryMessage(server, &connA.connection, &hello);
+    uint32_t closedAtLimit = connA.closed;
+    UA_Server_processBinaryMessage(server, &connA.connection, &hello);
+    uint32_t closedAboveLimit = connA.closed;
+
+    /* Release the worker before checking. The queued messages are dropped. */
+    connA.holdSend = false;
+    ck_assert_uint_eq(closedAtLimit, 0);
+    ck_assert_uint_eq(closedAboveLimit, 1);
+    UA_Server_removeConnection(server, &connA.connection);
+    iterateUntil(&connA.freed);
+    ck_assert_uint_eq(connA.sent, 1);
+    ck_assert_uint_eq(connA.closed, 1);
+}
+END_TEST
+
+#endif
+
 static Suite* testSuite_Client(void) {
     Suite *s = suite_create("Server Callbacks");
     TCase *tc_server = tcase_create("Server Repeated Callbacks");
@@ -76,6 +379,19 @@ static Suite* testSuite_Client(void) {
     tcase_add_test(tc_server, Server_addRemoveRepeatedCallback);
     tcase_add_test(tc_server, Server_repeatedCallbackRemoveItself);
     suite_add_tcase(s, tc_server);
+    TCase *tc_timer = tcase_create("Timer");
+    tcase_add_test(tc_timer, Timer_manyRepeatedCallbacks);
+    suite_add_tcase(s, tc_timer);
+#ifdef UA_ENABLE_MULTITHREADING
+    TCase *tc_workers = tcase_create("Server Worker Dispatch");
+    tcase_add_checked_fixture(tc_workers, setup, teardown);
+    tcase_add_test(tc_workers, Server_dispatchFromWorkers);
+    tcase_add_test(tc_workers, Server_delayedCallbackWaitsForDispatched);
+    tcase_add_test(tc_workers, Server_processConnectionsParallelAndClose);
+    tcase_add_test(tc_workers, Server_processConnectionClosedByServer);
+    tcase_add_test(tc_workers, Server_processConnectionQueueLimit);
+    suite_add_tcase(s, tc_workers);
+#endif
     return s;
 }
 
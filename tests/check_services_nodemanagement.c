@@ -262,6 +262,82 @@ START_TEST(DeleteObjectAndReferences) {
     UA_BrowseResult_deleteMembers(&br);
 } END_TEST
 
+START_TEST(SubtypeIndexFollowsReferenceTypes) {
+    UA_NodeId hierarchical = UA_NODEID_NUMERIC(0, UA_NS0ID_HIERARCHICALREFERENCES);
+    UA_NodeId nonHierarchical = UA_NODEID_NUMERIC(0, UA_NS0ID_NONHIERARCHICALREFERENCES);
+    UA_NodeId organizes = UA_NODEID_NUMERIC(0, UA_NS0ID_ORGANIZES);
+    ck_assert(isSubtypeOf(server, &organizes, &hierarchical));
+    ck_assert(!isSubtypeOf(server, &organizes, &nonHierarchical));
+
+    /* Add two levels of reference types below the indexed hierarchy */
+    UA_ReferenceTypeAttributes attr = UA_ReferenceTypeAttributes_default;
+    attr.displayName = UA_LOCALIZEDTEXT("", "RefA");
+    UA_NodeId refA = UA_NODEID_NUMERIC(1, 5000);
+    UA_StatusCode res =
+        UA_Server_addReferenceTypeNode(server, refA, hierarchical,
+                                       UA_NODEID_NUMERIC(0, UA_NS0ID_HASSUBTYPE),
+                                       UA_QUALIFIEDNAME(1, "RefA"), attr, NULL, NULL);
+    ck_assert_int_eq(res, UA_STATUSCODE_GOOD);
+    attr.displayName = UA_LOCALIZEDTEXT("", "RefB");
+    UA_NodeId refB = UA_NODEID_NUMERIC(1, 5001);
+    res = UA_Server_addReferenceTypeNode(server, refB, refA,
+                                         UA_NODEID_NUMERIC(0, UA_NS0ID_HASSUBTYPE),
+                                         UA_QUALIFIEDNAME(1, "RefB"), attr, NULL, NULL);
+    ck_assert_int_eq(res, UA_STATUSCODE_GOOD);
+
+    ck_assert(isSubtypeOf(server, &refB, &refA));
+    ck_assert(isSubtypeOf(server, &refB, &hierarchical));
+    ck_assert(!isSubtypeOf(server, &refB, &nonHierarchical));
+    ck_assert(!isSubtypeOf(server, &refA, &refB));
+
+    /* Removing the type invalidates the index */
+    res = UA_Server_deleteNode(server, refB, true);
+    ck_assert_int_eq(res, UA_STATUSCODE_GOOD);
+    ck_assert(!isSubtypeOf(server, &refB, &refA));
+    ck_assert(isSubtypeOf(server, &refA, &hierarchical));
+} END_TEST
+
+/* Linking an indexed type below a new supertype grows the index */
+START_TEST(SubtypeIndexGrowsForNewSupertype) {
+    UA_NodeId baseDataType = UA_NODEID_NUMERIC(0, UA_NS0ID_BASEDATATYPE);
+    UA_NodeId int32Type = UA_NODEID_NUMERIC(0, UA_NS0ID_INT32);
+    ck_assert(isSubtypeOf(server, &int32Type, &baseDataType));
+
+    /* Fill the index until the next entry makes it grow */
+    UA_SubtypeIndex *index = &server->subtypeIndex;
+    UA_DataTypeAttributes attr = UA_DataTypeAttributes_default;
+    UA_NodeId leaf;
+    UA_UInt32 leafNumber = 6000;
+    do {
+        leaf = UA_NODEID_NUMERIC(1, leafNumber++);
+        UA_StatusCode res =
+            UA_Server_addDataTypeNode(server, leaf, baseDataType,
+                                      UA_NODEID_NUMERIC(0, UA_NS0ID_HASSUBTYPE),
+                                      UA_QUALIFIEDNAME(1, "Leaf"), attr, NULL, NULL);
+        ck_assert_int_eq(res, UA_STATUSCODE_GOOD);
+    } while((index->typesCount + 1) * 2 <= index->entriesSize);
+    ck_assert(!index->dirty);
+    size_t entriesSize = index->entriesSize;
+
+    /* The new type is not linked into the hierarchy yet */
+    UA_NodeId newType = UA_NODEID_NUMERIC(1, 7000);
+    UA_StatusCode res =
+        UA_Server_addNode_begin(server, UA_NODECLASS_DATATYPE, newType,
+                                UA_QUALIFIEDNAME(1, "NewType"), UA_NODEID_NULL,
+                                &attr, &UA_TYPES[UA_TYPES_DATATYPEATTRIBUTES],
+                                NULL, NULL);
+    ck_assert_int_eq(res, UA_STATUSCODE_GOOD);
+    res = UA_Server_addReference(server, newType, UA_NODEID_NUMERIC(0, UA_NS0ID_HASSUBTYPE),
+                                 UA_EXPANDEDNODEID_NUMERIC(1, leafNumber - 1), true);
+    ck_assert_int_eq(res, UA_STATUSCODE_GOOD);
+    ck_assert_uint_gt(index->entriesSize, entriesSize);
+    ck_assert(!index->dirty);
+
+    ck_assert(isSubtypeOf(server, &leaf, &newType));
+    ck_assert(isSubtypeOf(server, &leaf, &baseDataType));
+    ck_assert(!isSubtypeOf(server, &newType, &leaf));
+    ck_assert(isSubtypeOf(server, &int32Type, &baseDataType));
+} END_TEST
 
 /* Example taken from tutorial_server_object.c */
 START_TEST(InstantiateObjectType) {
@@ -354,6 +430,59 @@ START_TEST(InstantiateObjectType) {
     ck_assert_int_eq(retval, UA_STATUSCODE_GOOD);
 } END_TEST
 
+#ifdef UA_ENABLE_NODESTRING_INTERNING
+START_TEST(InstancesShareInternedStrings) {
+    UA_NodeId typeId;
+    UA_ObjectTypeAttributes otAttr = UA_ObjectTypeAttributes_default;
+    otAttr.displayName = UA_LOCALIZEDTEXT("en-US", "SensorType");
+    UA_StatusCode retval =
+        UA_Server_addObjectTypeNode(server, UA_NODEID_NULL,
+                                    UA_NODEID_NUMERIC(0, UA_NS0ID_BASEOBJECTTYPE),
+                                    UA_NODEID_NUMERIC(0, UA_NS0ID_HASSUBTYPE),
+                                    UA_QUALIFIEDNAME(1, "SensorType"), otAttr,
+                                    NULL, &typeId);
+    ck_assert_int_eq(retval, UA_STATUSCODE_GOOD);
+
+    UA_NodeId tempId;
+    UA_VariableAttributes vAttr = UA_VariableAttributes_default;
+    vAttr.displayName = UA_LOCALIZEDTEXT("en-US", "Temperature");
+    vAttr.description = UA_LOCALIZEDTEXT("en-US", "Temperature in degrees Celsius");
+    retval = UA_Server_addVariableNode(server, UA_NODEID_NULL, typeId,
+                                       UA_NODEID_NUMERIC(0, UA_NS0ID_HASCOMPONENT),
+                                       UA_QUALIFIEDNAME(1, "Temperature"),
+                                       UA_NODEID_NUMERIC(0, UA_NS0ID_BASEDATAVARIABLETYPE),
+                                       vAttr, NULL, &tempId);
+    ck_assert_int_eq(retval, UA_STATUSCODE_GOOD);
+    retval = UA_Server_addReference(server, tempId,
+                                    UA_NODEID_NUMERIC(0, UA_NS0ID_HASMODELLINGRULE),
+                                    UA_EXPANDEDNODEID_NUMERIC(0, UA_NS0ID_MODELLINGRULE_MANDATORY), true);
+    ck_assert_int_eq(retval, UA_STATUSCODE_GOOD);
+
+    UA_NodeStringPoolStatistics before;
+    UA_NodeStringPool_getStatistics(&before);
+
+    UA_ObjectAttributes oAttr = UA_ObjectAttributes_default;
+    oAttr.displayName = UA_LOCALIZEDTEXT("en-US", "Sensor");
+    for(size_t i = 0; i < 50; i++) {
+        retval = UA_Server_addObjectNode(server, UA_NODEID_NULL,
+                                         UA_NODEID_NUMERIC(0, UA_NS0ID_OBJECTSFOLDER),
+                                         UA_NODEID_NUMERIC(0, UA_NS0ID_ORGANIZES),
+                                         UA_QUALIFIEDNAME(1, "Sensor"), typeId,
+                                         oAttr, NULL, NULL);
+        ck_assert_int_eq(retval, UA_STATUSCODE_GOOD);
+    }
+
+    /* Only "Sensor" is new. The instantiated children share the strings of the
+     * type definition. */
+    UA_NodeStringPoolStatistics after;
+    UA_NodeStringPool_getStatistics(&after);
+    ck_assert_uint_eq(after.strings, before.strings + 1);
+    ck_assert_uint_ge(after.references, before.references + (50 * 8));
+    ck_assert_uint_lt(after.bytesUsed - before.bytesUsed,
+                      after.bytesUnshared - before.bytesUnshared);
+} END_TEST
+#endif
+
 int main(void) {
     Suite *s = suite_create("services_nodemanagement");
 
@@ -364,12 +493,17 @@ int main(void) {
     tcase_add_test(tc_addnodes, AddNodeTwiceGivesError);
     tcase_add_test(tc_addnodes, AddObjectWithConstructor);
     tcase_add_test(tc_addnodes, InstantiateObjectType);
+#ifdef UA_ENABLE_NODESTRING_INTERNING
+    tcase_add_test(tc_addnodes, InstancesShareInternedStrings);
+#endif
     suite_add_tcase(s, tc_addnodes);
 
     TCase *tc_deletenodes = tcase_create("deletenodes");
     tcase_add_checked_fixture(tc_deletenodes, setup, teardown);
     tcase_add_test(tc_deletenodes, DeleteObjectWithDestructor);
     tcase_add_test(tc_deletenodes, DeleteObjectAndReferences);
+    tcase_add_test(tc_deletenodes, SubtypeIndexFollowsReferenceTypes);
+    tcase_add_test(tc_deletenodes, SubtypeIndexGrowsForNewSupertype);
     suite_add_tcase(s, tc_deletenodes);
 
     SRunner *sr = srunner_create(s);
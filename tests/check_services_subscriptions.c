@@ -196,6 +196,74 @@ START_TEST(Server_publishCallback) {
 }
 END_TEST
 
+static size_t
+fullSendQueueSize(UA_Connection *connection) {
+    return config->maxSendQueueSize + 1;
+}
+
+START_TEST(Server_publishBackpressure) {
+    UA_CreateSubscriptionRequest request;
+    UA_CreateSubscriptionRequest_init(&request);
+    request.publishingEnabled = true;
+    UA_CreateSubscriptionResponse response;
+    UA_CreateSubscriptionResponse_init(&response);
+    Service_CreateSubscription(server, &adminSession, &request, &response);
+    ck_assert_uint_eq(response.responseHeader.serviceResult, UA_STATUSCODE_GOOD);
+    UA_UInt32 subId = response.subscriptionId;
+    UA_CreateSubscriptionResponse_deleteMembers(&response);
+    UA_Subscription *sub = UA_Session_getSubscriptionByID(&adminSession, subId);
+    ck_assert_ptr_ne(sub, NULL);
+
+    /* A connection that does not keep up with receiving */
+    UA_Connection connection;
+    memset(&connection, 0, sizeof(UA_Connection));
+    connection.getSendQueueSize = fullSendQueueSize;
+    UA_SecureChannel channel;
+    memset(&channel, 0, sizeof(UA_SecureChannel));
+    channel.connection = &connection;
+    adminSession.channel = &channel;
+
+    /* Without a publish request, the subscription is late regardless */
+    SIMPLEQ_INIT(&adminSession.responseQueue);
+    sub->currentKeepAliveCount = sub->maxKeepAliveCount;
+    UA_Subscription_publishCallback(server, sub);
+    ck_assert_uint_eq(sub->state, UA_SUBSCRIPTIONSTATE_LATE);
+    UA_UInt32 lifetimeCount = sub->currentLifetimeCount;
+    sub->currentKeepAliveCount = sub->maxKeepAliveCount;
+    UA_Subscription_publishCallback(server, sub);
+    ck_assert_uint_eq(sub->currentLifetimeCount, lifetimeCount + 1);
+    sub->state = UA_SUBSCRIPTIONSTATE_NORMAL;
+
+    /* A keepalive is due and a publish request is waiting */
+    UA_PublishResponseEntry *pre = (UA_PublishResponseEntry*)
+        UA_malloc(sizeof(UA_PublishResponseEntry));
+    ck_assert_ptr_ne(pre, NULL);
+    pre->requestId = 1;
+    UA_PublishResponse_init(&pre->response);
+    SIMPLEQ_INSERT_TAIL(&adminSession.responseQueue, pre, listEntry);
+    sub->currentKeepAliveCount = sub->maxKeepAliveCount;
+
+    /* The response is held back */
+    UA_Subscription_publishCallback(server, sub);
+    ck_assert_ptr_eq(SIMPLEQ_FIRST(&adminSession.responseQueue), pre);
+    ck_assert_uint_ne(sub->state, UA_SUBSCRIPTIONSTATE_LATE);
+
+    /* Clean up */
+    SIMPLEQ_REMOVE_HEAD(&adminSession.responseQueue, listEntry);
+    UA_free(pre);
+    adminSession.channel = NULL;
+    UA_DeleteSubscriptionsRequest del_request;
+    UA_DeleteSubscriptionsRequest_init(&del_request);
+    del_request.subscriptionIdsSize = 1;
+    del_request.subscriptionIds = &subId;
+    UA_DeleteSubscriptionsResponse del_response;
+    UA_DeleteSubscriptionsResponse_init(&del_response);
+    Service_DeleteSubscriptions(server, &adminSession, &del_request, &del_response);
+    ck_assert_uint_eq(del_response.responseHeader.serviceResult, UA_STATUSCODE_GOOD);
+    UA_DeleteSubscriptionsResponse_deleteMembers(&del_response);
+}
+END_TEST
+
 START_TEST(Server_createMonitoredItems) {
     UA_CreateMonitoredItemsRequest request;
     UA_CreateMonitoredItemsRequest_init(&request);
@@ -303,6 +371,694 @@ START_TEST(Server_deleteMonitoredItems) {
 }
 END_TEST
 
+static UA_UInt32
+createSampledItem(UA_UInt32 subId, const UA_NodeId *nodeId, UA_Double interval) {
+    UA_MonitoredItemCreateRequest item;
+    UA_MonitoredItemCreateRequest_init(&item);
+    item.itemToMonitor.nodeId = *nodeId;
+    item.itemToMonitor.attributeId = UA_ATTRIBUTEID_VALUE;
+    item.monitoringMode = UA_MONITORINGMODE_REPORTING;
+    item.requestedParameters.samplingInterval = interval;
+    item.requestedParameters.queueSize = 10;
+
+    UA_CreateMonitoredItemsRequest request;
+    UA_CreateMonitoredItemsRequest_init(&request);
+    request.subscriptionId = subId;
+    request.timestampsToReturn = UA_TIMESTAMPSTORETURN_NEITHER;
+    request.itemsToCreateSize = 1;
+    request.itemsToCreate = &item;
+
+    UA_CreateMonitoredItemsResponse response;
+    UA_CreateMonitoredItemsResponse_init(&response);
+    Service_CreateMonitoredItems(server, &adminSession, &request, &response);
+    ck_assert_uint_eq(response.responseHeader.serviceResult, UA_STATUSCODE_GOOD);
+    ck_assert_uint_eq(response.resultsSize, 1);
+    ck_assert_uint_eq(response.results[0].statusCode, UA_STATUSCODE_GOOD);
+    UA_UInt32 monId = response.results[0].monitoredItemId;
+    UA_CreateMonitoredItemsResponse_deleteMembers(&response);
+    return monId;
+}
+
+static volatile UA_Boolean callbacksFinished;
+
+static void
+finishedCallback(UA_Server *serverPtr, void *data) {
+    callbacksFinished = true;
+}
+
+/* Advance the fake clock, dispatch the callbacks that are due and wait until
+ * they have finished. The delayed callback runs only after all callbacks that
+ * were dispatched before. */
+static void
+runCallbacks(UA_UInt32 ms) {
+    UA_sleep(ms);
+    UA_Server_run_iterate(server, false);
+    callbacksFinished = false;
+    UA_StatusCode retval = UA_Server_delayedCallback(server, finishedCallback, NULL);
+    ck_assert_uint_eq(retval, UA_STATUSCODE_GOOD);
+    while(!callbacksFinished)
+        UA_Server_run_iterate(server, false);
+}
+
+static MonitoredItem_queuedValue *
+newestSample(UA_MonitoredItem *mon) {
+    ck_assert_uint_gt(mon->currentQueueSize, 0);
+    return MonitoredItem_queuedSample(mon, mon->currentQueueSize - 1);
+}
+
+START_TEST(Server_sharedSamplingGroup) {
+    /* A variable to sample */
+    UA_VariableAttributes attr = UA_VariableAttributes_default;
+    UA_Int32 value = 1;
+    UA_Variant_setScalar(&attr.value, &value, &UA_TYPES[UA_TYPES_INT32]);
+    UA_NodeId nodeId = UA_NODEID_STRING(1, "sampled.variable");
+    UA_StatusCode retval =
+        UA_Server_addVariableNode(server, nodeId, UA_NODEID_NUMERIC(0, UA_NS0ID_OBJECTSFOLDER),
+                                  UA_NODEID_NUMERIC(0, UA_NS0ID_ORGANIZES),
+                                  UA_QUALIFIEDNAME(1, "sampled.variable"),
+                                  UA_NODEID_NUMERIC(0, UA_NS0ID_BASEDATAVARIABLETYPE),
+                                  attr, NULL, NULL);
+    ck_assert_uint_eq(retval, UA_STATUSCODE_GOOD);
+
+    /* Two subscriptions that publish rarely */
+    UA_UInt32 subIds[2];
+    for(size_t i = 0; i < 2; i++) {
+        UA_CreateSubscriptionRequest request;
+        UA_CreateSubscriptionRequest_init(&request);
+        request.publishingEnabled = true;
+        request.requestedPublishingInterval = 1000;
+        UA_CreateSubscriptionResponse response;
+        UA_CreateSubscriptionResponse_init(&response);
+        Service_CreateSubscription(server, &adminSession, &request, &response);
+        ck_assert_uint_eq(response.responseHeader.serviceResult, UA_STATUSCODE_GOOD);
+        subIds[i] = response.subscriptionId;
+        UA_CreateSubscriptionResponse_deleteMembers(&response);
+    }
+
+    /* Items with the same interval share the SamplingGroup */
+    UA_UInt32 monId1 = createSampledItem(subIds[0], &nodeId, 100);
+    UA_UInt32 monId2 = createSampledItem(subIds[1], &nodeId, 100);
+    ck_assert_uint_eq(server->samplingGroupsCount, 1);
+    UA_UInt32 monId3 = createSampledItem(subIds[1], &nodeId, 200);
+    ck_assert_uint_eq(server->samplingGroupsCount, 2);
+
+    UA_Subscription *sub1 = UA_Session_getSubscriptionByID(&adminSession, subIds[0]);
+    UA_Subscription *sub2 = UA_Session_getSubscriptionByID(&adminSession, subIds[1]);
+    UA_MonitoredItem *mon1 = UA_Subscription_getMonitoredItem(sub1, monId1);
+    UA_MonitoredItem *mon2 = UA_Subscription_getMonitoredItem(sub2, monId2);
+    UA_MonitoredItem *mon3 = UA_Subscription_getMonitoredItem(sub2, monId3);
+    ck_assert_ptr_eq(mon1->samplingGroup, mon2->samplingGroup);
+    ck_assert_ptr_ne(mon1->samplingGroup, mon3->samplingGroup);
+    ck_assert_uint_eq(mon1->currentQueueSize, 1);
+    ck_assert_uint_eq(mon2->currentQueueSize, 1);
+
+    /* The new value is sampled once and queued for both items */
+    value = 2;
+    UA_Variant var;
+    UA_Variant_setScalar(&var, &value, &UA_TYPES[UA_TYPES_INT32]);
+    retval = UA_Server_writeValue(server, nodeId, var);
+    ck_assert_uint_eq(retval, UA_STATUSCODE_GOOD);
+    runCallbacks(101);
+    ck_assert_uint_eq(mon1->currentQueueSize, 2);
+    ck_assert_uint_eq(mon2->currentQueueSize, 2);
+    ck_assert_uint_eq(mon3->currentQueueSize, 1);
+    MonitoredItem_queuedValue *qv1 = newestSample(mon1);
+    MonitoredItem_queuedValue *qv2 = newestSample(mon2);
+    ck_assert_int_eq(*(UA_Int32*)qv1->value.value.data, 2);
+    ck_assert_int_eq(*(UA_Int32*)qv2->value.value.data, 2);
+    ck_assert_ptr_ne(qv1->value.value.data, qv2->value.value.data);
+
+    /* The SamplingGroups are removed with the last item */
+    UA_DeleteSubscriptionsRequest del_request;
+    UA_DeleteSubscriptionsRequest_init(&del_request);
+    del_request.subscriptionIdsSize = 1;
+    del_request.subscriptionIds = &subIds[0];
+    UA_DeleteSubscriptionsResponse del_response;
+    UA_DeleteSubscriptionsResponse_init(&del_response);
+    Service_DeleteSubscriptions(server, &adminSession, &del_request, &del_response);
+    UA_DeleteSubscriptionsResponse_deleteMembers(&del_response);
+    ck_assert_uint_eq(server->samplingGroupsCount, 2);
+
+    del_request.subscriptionIds = &subIds[1];
+    UA_DeleteSubscriptionsResponse_init(&del_response);
+    Service_DeleteSubscriptions(server, &adminSession, &del_request, &del_response);
+    UA_DeleteSubscriptionsResponse_deleteMembers(&del_response);
+    ck_assert_uint_eq(server->samplingGroupsCount, 0);
+}
+END_TEST
+
+static size_t accessLevelCalls;
+static UA_Boolean denyReads;
+static UA_Byte deniedUser;
+
+/* Sessions with the deniedUser context may not read the value when denyReads
+ * is set */
+static UA_Byte
+getUserAccessLevel_test(const UA_NodeId *sessionId, void *sessionContext,
+                        const UA_NodeId *nodeId, void *nodeContext) {
+    accessLevelCalls++;
+    if(denyReads && sessionContext == &deniedUser)
+        return UA_ACCESSLEVELMASK_WRITE;
+    return 0xFF;
+}
+
+static UA_UInt32
+createSessionSubscription(UA_Session *session) {
+    UA_CreateSubscriptionRequest request;
+    UA_CreateSubscriptionRequest_init(&request);
+    request.publishingEnabled = true;
+    request.requestedPublishingInterval = 1000;
+    UA_CreateSubscriptionResponse response;
+    UA_CreateSubscriptionResponse_init(&response);
+    Service_CreateSubscription(server, session, &request, &response);
+    ck_assert_uint_eq(response.responseHeader.serviceResult, UA_STATUSCODE_GOOD);
+    UA_UInt32 subId = response.subscriptionId;
+    UA_CreateSubscriptionResponse_deleteMembers(&response);
+    return subId;
+}
+
+static UA_MonitoredItem *
+createSessionItem(UA_Session *session, UA_UInt32 subId, const UA_NodeId *nodeId) {
+    UA_MonitoredItemCreateRequest item;
+    UA_MonitoredItemCreateRequest_init(&item);
+    item.itemToMonitor.nodeId = *nodeId;
+    item.itemToMonitor.attributeId = UA_ATTRIBUTEID_VALUE;
+    item.monitoringMode = UA_MONITORINGMODE_REPORTING;
+    item.requestedParameters.samplingInterval = 100;
+    item.requestedParameters.queueSize = 10;
+
+    UA_CreateMonitoredItemsRequest request;
+    UA_CreateMonitoredItemsRequest_init(&request);
+    request.subscriptionId = subId;
+    request.timestampsToReturn = UA_TIMESTAMPSTORETURN_NEITHER;
+    request.itemsToCreateSize = 1;
+    request.itemsToCreate = &item;
+
+    UA_CreateMonitoredItemsResponse response;
+    UA_CreateMonitoredItemsResponse_init(&response);
+    Service_CreateMonitoredItems(server, session, &request, &response);
+    ck_assert_uint_eq(response.responseHeader.serviceResult, UA_STATUSCODE_GOOD);
+    ck_assert_uint_eq(response.resultsSize, 1);
+    ck_assert_uint_eq(response.results[0].statusCode, UA_STATUSCODE_GOOD);
+    UA_UInt32 monId = response.results[0].monitoredItemId;
+    UA_CreateMonitoredItemsResponse_deleteMembers(&response);
+    UA_Subscription *sub = UA_Session_getSubscriptionByID(session, subId);
+    return UA_Subscription_getMonitoredItem(sub, monId);
+}
+
+/* Sessions with different access levels share the SamplingGroup. The access is
+ * checked with every sample. The value is read with the session that may read
+ * it, also if the session that may not read it comes first in the group. */
+START_TEST(Server_samplingGroupAccessLevel) {
+    server->config.accessControl.getUserAccessLevel = getUserAccessLevel_test;
+    denyReads = false;
+
+    UA_VariableAttributes attr = UA_VariableAttributes_default;
+    UA_Int32 value = 1;
+    UA_Variant_setScalar(&attr.value, &value, &UA_TYPES[UA_TYPES_INT32]);
+    attr.accessLevel = UA_ACCESSLEVELMASK_READ | UA_ACCESSLEVELMASK_WRITE;
+    UA_NodeId nodeId = UA_NODEID_STRING(1, "access.variable");
+    UA_StatusCode retval =
+        UA_Server_addVariableNode(server, nodeId, UA_NODEID_NUMERIC(0, UA_NS0ID_OBJECTSFOLDER),
+                                  UA_NODEID_NUMERIC(0, UA_NS0ID_ORGANIZES),
+                                  UA_QUALIFIEDNAME(1, "access.variable"),
+                                  UA_NODEID_NUMERIC(0, UA_NS0ID_BASEDATAVARIABLETYPE),
+                                  attr, NULL, NULL);
+    ck_assert_uint_eq(retval, UA_STATUSCODE_GOOD);
+
+    UA_Session allowedSession;
+    UA_Session_init(&allowedSession);
+    allowedSession.sessionHandle = NULL;
+    UA_Session deniedSession;
+    UA_Session_init(&deniedSession);
+    deniedSession.sessionHandle = &deniedUser;
+
+    UA_UInt32 allowedSubId = createSessionSubscription(&allowedSession);
+    UA_UInt32 deniedSubId = createSessionSubscription(&deniedSession);
+    UA_MonitoredItem *allowedMon = createSessionItem(&allowedSession, allowedSubId, &nodeId);
+    UA_MonitoredItem *deniedMon = createSessionItem(&deniedSession, deniedSubId, &nodeId);
+    ck_assert_uint_eq(allowedMon->currentQueueSize, 1);
+    ck_assert_uint_eq(deniedMon->currentQueueSize, 1);
+
+    ck_assert_ptr_eq(allowedMon->samplingGroup, deniedMon->samplingGroup);
+    ck_assert_ptr_eq(LIST_FIRST(&deniedMon->samplingGroup->monitoredItems), deniedMon);
+
+    /* The read access of the user is revoked. The new value is sampled only
+     * for the allowed session. The access is checked once per session and by
+     * the read itself. */
+    denyReads = true;
+    value = 2;
+    UA_Variant var;
+    UA_Variant_setScalar(&var, &value, &UA_TYPES[UA_TYPES_INT32]);
+    retval = UA_Server_writeValue(server, nodeId, var);
+    ck_assert_uint_eq(retval, UA_STATUSCODE_GOOD);
+    size_t calls = accessLevelCalls;
+    runCallbacks(101);
+    ck_assert_uint_eq(accessLevelCalls, calls + 3);
+    ck_assert(allowedMon->readAllowed);
+    ck_assert(!deniedMon->readAllowed);
+    ck_assert_uint_eq(allowedMon->currentQueueSize, 2);
+    MonitoredItem_queuedValue *qv = newestSample(allowedMon);
+    ck_assert(!qv->value.hasStatus);
+    ck_assert(qv->value.hasValue);
+    ck_assert_int_eq(*(UA_Int32*)qv->value.value.data, 2);
+    ck_assert_uint_eq(deniedMon->currentQueueSize, 2);
+    qv = newestSample(deniedMon);
+    ck_assert(!qv->value.hasValue);
+    ck_assert_uint_eq(qv->value.status, UA_STATUSCODE_BADUSERACCESSDENIED);
+
+    /* The read access is granted again */
+    denyReads = false;
+    value = 3;
+    retval = UA_Server_writeValue(server, nodeId, var);
+    ck_assert_uint_eq(retval, UA_STATUSCODE_GOOD);
+    runCallbacks(101);
+    ck_assert(deniedMon->readAllowed);
+    ck_assert_uint_eq(deniedMon->currentQueueSize, 3);
+    qv = newestSample(deniedMon);
+    ck_assert(qv->value.hasValue);
+    ck_assert_int_eq(*(UA_Int32*)qv->value.value.data, 3);
+
+    UA_Session_deleteMembersCleanup(&allowedSession, server);
+    UA_Session_deleteMembersCleanup(&deniedSession, server);
+    ck_assert_uint_eq(server->samplingGroupsCount, 0);
+}
+END_TEST
+
+static void
+writeDouble(const UA_NodeId *nodeId, UA_Double value) {
+    UA_Variant var;
+    UA_Variant_setScalar(&var, &value, &UA_TYPES[UA_TYPES_DOUBLE]);
+    UA_StatusCode retval = UA_Server_writeValue(server, *nodeId, var);
+    ck_assert_uint_eq(retval, UA_STATUSCODE_GOOD);
+    runCallbacks(101);
+}
+
+START_TEST(Server_deadbandFilter) {
+    UA_VariableAttributes attr = UA_VariableAttributes_default;
+    UA_Double value = 10.0;
+    UA_Variant_setScalar(&attr.value, &value, &UA_TYPES[UA_TYPES_DOUBLE]);
+    UA_NodeId nodeId = UA_NODEID_STRING(1, "deadband.variable");
+    UA_StatusCode retval =
+        UA_Server_addVariableNode(server, nodeId, UA_NODEID_NUMERIC(0, UA_NS0ID_OBJECTSFOLDER),
+                                  UA_NODEID_NUMERIC(0, UA_NS0ID_ORGANIZES),
+                                  UA_QUALIFIEDNAME(1, "deadband.variable"),
+                                  UA_NODEID_NUMERIC(0, UA_NS0ID_BASEDATAVARIABLETYPE),
+                                  attr, NULL, NULL);
+    ck_assert_uint_eq(retval, UA_STATUSCODE_GOOD);
+
+    UA_CreateSubscriptionRequest sub_request;
+    UA_CreateSubscriptionRequest_init(&sub_request);
+    sub_request.publishingEnabled = true;
+    sub_request.requestedPublishingInterval = 1000;
+    UA_CreateSubscriptionResponse sub_response;
+    UA_CreateSubscriptionResponse_init(&sub_response);
+    Service_CreateSubscription(server, &adminSession, &sub_request, &sub_response);
+    ck_assert_uint_eq(sub_response.responseHeader.serviceResult, UA_STATUSCODE_GOOD);
+    UA_UInt32 subId = sub_response.subscriptionId;
+    UA_CreateSubscriptionResponse_deleteMembers(&sub_response);
+
+    /* Items with an absolute and a percent deadband */
+    UA_DataChangeFilter filter;
+    UA_DataChangeFilter_init(&filter);
+    filter.trigger = UA_DATACHANGETRIGGER_STATUSVALUE;
+    filter.deadbandType = UA_DEADBANDTYPE_ABSOLUTE;
+    filter.deadbandValue = 1.0;
+    UA_MonitoredItemCreateRequest items[2];
+    for(size_t i = 0; i < 2; i++) {
+        UA_MonitoredItemCreateRequest_init(&items[i]);
+        items[i].itemToMonitor.nodeId = nodeId;
+        items[i].itemToMonitor.attributeId = UA_ATTRIBUTEID_VALUE;
+        items[i].monitoringMode = UA_MONITORINGMODE_REPORTING;
+        items[i].requestedParameters.samplingInterval = 100;
+        items[i].requestedParameters.queueSize = 10;
+        items[i].requestedParameters.filter.encoding = UA_EXTENSIONOBJECT_DECODED;
+        items[i].requestedParameters.filter.content.decoded.type =
+            &UA_TYPES[UA_TYPES_DATACHANGEFILTER];
+        items[i].requestedParameters.filter.content.decoded.data = &filter;
+    }
+    UA_DataChangeFilter percentFilter = filter;
+    percentFilter.deadbandType = UA_DEADBANDTYPE_PERCENT;
+    items[1].requestedParameters.filter.content.decoded.data = &percentFilter;
+
+    UA_CreateMonitoredItemsRequest request;
+    UA_CreateMonitoredItemsRequest_init(&request);
+    request.subscriptionId = subId;
+    request.timestampsToReturn = UA_TIMESTAMPSTORETURN_NEITHER;
+    request.itemsToCreateSize = 2;
+    request.itemsToCreate = items;
+    UA_CreateMonitoredItemsResponse response;
+    UA_CreateMonitoredItemsResponse_init(&response);
+    Service_CreateMonitoredItems(server, &adminSession, &request, &response);
+    ck_assert_uint_eq(response.responseHeader.serviceResult, UA_STATUSCODE_GOOD);
+    ck_assert_uint_eq(response.resultsSize, 2);
+    ck_assert_uint_eq(response.results[0].statusCode, UA_STATUSCODE_GOOD);
+    ck_assert_uint_eq(response.results[1].statusCode,
+                      UA_STATUSCODE_BADMONITOREDITEMFILTERUNSUPPORTED);
+    UA_UInt32 monId = response.results[0].monitoredItemId;
+    UA_CreateMonitoredItemsResponse_deleteMembers(&response);
+
+    UA_Subscription *sub = UA_Session_getSubscriptionByID(&adminSession, subId);
+    UA_MonitoredItem *mon = UA_Subscription_getMonitoredItem(sub, monId);
+    ck_assert_uint_eq(mon->currentQueueSize, 1);
+
+    /* Changes within the deadband are not reported */
+    writeDouble(&nodeId, 10.5);
+    ck_assert_uint_eq(mon->currentQueueSize, 1);
+    writeDouble(&nodeId, 9.2);
+    ck_assert_uint_eq(mon->currentQueueSize, 1);
+
+    /* The deadband is relative to the last reported value */
+    writeDouble(&nodeId, 11.5);
+    ck_assert_uint_eq(mon->currentQueueSize, 2);
+    writeDouble(&nodeId, 11.0);
+    ck_assert_uint_eq(mon->currentQueueSize, 2);
+    MonitoredItem_queuedValue *qv = newestSample(mon);
+    ck_assert(*(UA_Double*)qv->value.value.data == 11.5);
+
+    UA_DeleteSubscriptionsRequest del_request;
+    UA_DeleteSubscriptionsRequest_init(&del_request);
+    del_request.subscriptionIdsSize = 1;
+    del_request.subscriptionIds = &subId;
+    UA_DeleteSubscriptionsResponse del_response;
+    UA_DeleteSubscriptionsResponse_init(&del_response);
+    Service_DeleteSubscriptions(server, &adminSession, &del_request, &del_response);
+    UA_DeleteSubscriptionsResponse_deleteMembers(&del_response);
+}
+END_TEST
+
+/* Without a deadband, the values are compared bitwise. +0.0 and -0.0 are
+ * equal numerically but a change. */
+START_TEST(Server_bitwiseValueChange) {
+    UA_VariableAttributes attr = UA_VariableAttributes_default;
+    UA_Double value = 0.0;
+    UA_Variant_setScalar(&attr.value, &value, &UA_TYPES[UA_TYPES_DOUBLE]);
+    UA_NodeId nodeId = UA_NODEID_STRING(1, "bitwise.variable");
+    UA_StatusCode retval =
+        UA_Server_addVariableNode(server, nodeId, UA_NODEID_NUMERIC(0, UA_NS0ID_OBJECTSFOLDER),
+                                  UA_NODEID_NUMERIC(0, UA_NS0ID_ORGANIZES),
+                                  UA_QUALIFIEDNAME(1, "bitwise.variable"),
+                                  UA_NODEID_NUMERIC(0, UA_NS0ID_BASEDATAVARIABLETYPE),
+                                  attr, NULL, NULL);
+    ck_assert_uint_eq(retval, UA_STATUSCODE_GOOD);
+
+    UA_CreateSubscriptionRequest sub_request;
+    UA_CreateSubscriptionRequest_init(&sub_request);
+    sub_request.publishingEnabled = true;
+    sub_request.requestedPublishingInterval = 1000;
+    UA_CreateSubscriptionResponse sub_response;
+    UA_CreateSubscriptionResponse_init(&sub_response);
+    Service_CreateSubscription(server, &adminSession, &sub_request, &sub_response);
+    ck_assert_uint_eq(sub_response.responseHeader.serviceResult, UA_STATUSCODE_GOOD);
+    UA_UInt32 subId = sub_response.subscriptionId;
+    UA_CreateSubscriptionResponse_deleteMembers(&sub_response);
+
+    UA_UInt32 monId = createSampledItem(subId, &nodeId, 100);
+    UA_Subscription *sub = UA_Session_getSubscriptionByID(&adminSession, subId);
+    UA_MonitoredItem *mon = UA_Subscription_getMonitoredItem(sub, monId);
+    ck_assert_uint_eq(mon->deadbandType, UA_DEADBANDTYPE_NONE);
+    ck_assert_uint_eq(mon->currentQueueSize, 1);
+
+    /* Scalar */
+    writeDouble(&nodeId, -0.0);
+    ck_assert_uint_eq(mon->currentQueueSize, 2);
+    writeDouble(&nodeId, -0.0);
+    ck_assert_uint_eq(mon->currentQueueSize, 2);
+    writeDouble(&nodeId, 0.0);
+    ck_assert_uint_eq(mon->currentQueueSize, 3);
+
+    /* Nested in an array of variants */
+    UA_Variant inner;
+    UA_Variant_setScalar(&inner, &value, &UA_TYPES[UA_TYPES_DOUBLE]);
+    UA_Variant var;
+    UA_Variant_setArray(&var, &inner, 1, &UA_TYPES[UA_TYPES_VARIANT]);
+    value = 0.0;
+    retval = UA_Server_writeValue(server, nodeId, var);
+    ck_assert_uint_eq(retval, UA_STATUSCODE_GOOD);
+    runCallbacks(101);
+    ck_assert_uint_eq(mon->currentQueueSize, 4);
+    value = -0.0;
+    retval = UA_Server_writeValue(server, nodeId, var);
+    ck_assert_uint_eq(retval, UA_STATUSCODE_GOOD);
+    runCallbacks(101);
+    ck_assert_uint_eq(mon->currentQueueSize, 5);
+    retval = UA_Server_writeValue(server, nodeId, var);
+    ck_assert_uint_eq(retval, UA_STATUSCODE_GOOD);
+    runCallbacks(101);
+    ck_assert_uint_eq(mon->currentQueueSize, 5);
+    ck_assert(mon->lastValueEncoding.data != NULL);
+
+    /* A structure without floating point members is not encoded */
+    UA_BuildInfo buildInfo;
+    UA_BuildInfo_init(&buildInfo);
+    buildInfo.productName = UA_STRING("bitwise");
+    UA_Variant_setScalar(&var, &buildInfo, &UA_TYPES[UA_TYPES_BUILDINFO]);
+    retval = UA_Server_writeValue(server, nodeId, var);
+    ck_assert_uint_eq(retval, UA_STATUSCODE_GOOD);
+    runCallbacks(101);
+    ck_assert_uint_eq(mon->currentQueueSize, 6);
+    retval = UA_Server_writeValue(server, nodeId, var);
+    ck_assert_uint_eq(retval, UA_STATUSCODE_GOOD);
+    runCallbacks(101);
+    ck_assert_uint_eq(mon->currentQueueSize, 6);
+    ck_assert(mon->orderIsBitwise);
+    ck_assert_ptr_eq(mon->lastValueEncoding.data, NULL);
+
+    /* Nested in a structure */
+    UA_MonitoringParameters params;
+    UA_MonitoringParameters_init(&params);
+    params.queueSize = 1;
+    UA_Variant_setScalar(&var, &params, &UA_TYPES[UA_TYPES_MONITORINGPARAMETERS]);
+    retval = UA_Server_writeValue(server, nodeId, var);
+    ck_assert_uint_eq(retval, UA_STATUSCODE_GOOD);
+    runCallbacks(101);
+    ck_assert_uint_eq(mon->currentQueueSize, 7);
+    ck_assert(!mon->orderIsBitwise);
+    params.samplingInterval = -0.0;
+    retval = UA_Server_writeValue(server, nodeId, var);
+    ck_assert_uint_eq(retval, UA_STATUSCODE_GOOD);
+    runCallbacks(101);
+    ck_assert_uint_eq(mon->currentQueueSize, 8);
+    retval = UA_Server_writeValue(server, nodeId, var);
+    ck_assert_uint_eq(retval, UA_STATUSCODE_GOOD);
+    runCallbacks(101);
+    ck_assert_uint_eq(mon->currentQueueSize, 8);
+
+    UA_DeleteSubscriptionsRequest del_request;
+    UA_DeleteSubscriptionsRequest_init(&del_request);
+    del_request.subscriptionIdsSize = 1;
+    del_request.subscriptionIds = &subId;
+    UA_DeleteSubscriptionsResponse del_response;
+    UA_DeleteSubscriptionsResponse_init(&del_response);
+    Service_DeleteSubscriptions(server, &adminSession, &del_request, &del_response);
+    UA_DeleteSubscriptionsResponse_deleteMembers(&del_response);
+}
+END_TEST
+
+static void
+writeInt32(const UA_NodeId *nodeId, UA_Int32 value) {
+    UA_Variant var;
+    UA_Variant_setScalar(&var, &value, &UA_TYPES[UA_TYPES_INT32]);
+    UA_StatusCode retval = UA_Server_writeValue(server, *nodeId, var);
+    ck_assert_uint_eq(retval, UA_STATUSCODE_GOOD);
+    runCallbacks(101);
+}
+
+static UA_Int32
+queuedInt32(UA_MonitoredItem *mon, UA_UInt32 i) {
+    return *(UA_Int32*)MonitoredItem_queuedSample(mon, i)->value.value.data;
+}
+
+START_TEST(Server_monitoredItemQueue) {
+    UA_VariableAttributes attr = UA_VariableAttributes_default;
+    UA_Int32 value = 0;
+    UA_Variant_setScalar(&attr.value, &value, &UA_TYPES[UA_TYPES_INT32]);
+    UA_NodeId nodeId = UA_NODEID_STRING(1, "queue.variable");
+    UA_StatusCode retval =
+        UA_Server_addVariableNode(server, nodeId, UA_NODEID_NUMERIC(0, UA_NS0ID_OBJECTSFOLDER),
+                                  UA_NODEID_NUMERIC(0, UA_NS0ID_ORGANIZES),
+                                  UA_QUALIFIEDNAME(1, "queue.variable"),
+                                  UA_NODEID_NUMERIC(0, UA_NS0ID_BASEDATAVARIABLETYPE),
+                                  attr, NULL, NULL);
+    ck_assert_uint_eq(retval, UA_STATUSCODE_GOOD);
+
+    UA_CreateSubscriptionRequest sub_request;
+    UA_CreateSubscriptionRequest_init(&sub_request);
+    sub_request.publishingEnabled = true;
+    sub_request.requestedPublishingInterval = 1000;
+    UA_CreateSubscriptionResponse sub_response;
+    UA_CreateSubscriptionResponse_init(&sub_response);
+    Service_CreateSubscription(server, &adminSession, &sub_request, &sub_response);
+    ck_assert_uint_eq(sub_response.responseHeader.serviceResult, UA_STATUSCODE_GOOD);
+    UA_UInt32 subId = sub_response.subscriptionId;
+    UA_CreateSubscriptionResponse_deleteMembers(&sub_response);
+
+    /* Without discardOldest, the newest sample is replaced in a full queue */
+    UA_UInt32 monId = createSampledItem(subId, &nodeId, 100);
+    UA_Subscription *sub = UA_Session_getSubscriptionByID(&adminSession, subId);
+    UA_MonitoredItem *mon = UA_Subscription_getMonitoredItem(sub, monId);
+    ck_assert_uint_eq(mon->maxQueueSize, 10);
+    for(UA_Int32 i = 1; i <= 14; i++)
+        writeInt32(&nodeId, i);
+    ck_assert_uint_eq(mon->currentQueueSize, 10);
+    ck_assert_uint_eq(sub->queuedNotifications, 10);
+    ck_assert_ptr_eq(TAILQ_FIRST(&sub->pendingItems), mon);
+    for(UA_UInt32 i = 0; i < 9; i++)
+        ck_assert_int_eq(queuedInt32(mon, i), (UA_Int32)i);
+    ck_assert_int_eq(queuedInt32(mon, 9), 14);
+
+    /* Shrink the queue and wrap around with discardOldest */
+    UA_MonitoredItemModifyRequest item;
+    UA_MonitoredItemModifyRequest_init(&item);
+    item.monitoredItemId = monId;
+    item.requestedParameters.samplingInterval = 100;
+    item.requestedParameters.queueSize = 3;
+    item.requestedParameters.discardOldest = true;
+    UA_ModifyMonitoredItemsRequest request;
+    UA_ModifyMonitoredItemsRequest_init(&request);
+    request.subscriptionId = subId;
+    request.timestampsToReturn = UA_TIMESTAMPSTORETURN_NEITHER;
+    request.itemsToModifySize = 1;
+    request.itemsToModify = &item;
+    UA_ModifyMonitoredItemsResponse response;
+    UA_ModifyMonitoredItemsResponse_init(&response);
+    Service_ModifyMonitoredItems(server, &adminSession, &request, &response);
+    ck_assert_uint_eq(response.responseHeader.serviceResult, UA_STATUSCODE_GOOD);
+    ck_assert_uint_eq(response.resultsSize, 1);
+    ck_assert_uint_eq(response.results[0].statusCode, UA_STATUSCODE_GOOD);
+    ck_assert_uint_eq(response.results[0].revisedQueueSize, 3);
+    UA_ModifyMonitoredItemsResponse_deleteMembers(&response);
+    ck_assert_uint_eq(mon->currentQueueSize, 3);
+    ck_assert_uint_eq(sub->queuedNotifications, 3);
+    ck_assert_int_eq(queuedInt32(mon, 0), 7);
+    ck_assert_int_eq(queuedInt32(mon, 2), 14);
+
+    for(UA_Int32 i = 15; i <= 16; i++)
+        writeInt32(&nodeId, i);
+    ck_assert_uint_eq(mon->currentQueueSize, 3);
+    ck_assert_uint_ne(mon->queueStart, 0);
+    ck_assert_int_eq(queuedInt32(mon, 0), 14);
+    ck_assert_int_eq(queuedInt32(mon, 1), 15);
+    ck_assert_int_eq(queuedInt32(mon, 2), 16);
+    ck_assert_uint_eq(sub->queuedNotifications, 3);
+
+    /* Removing the MonitoredItem removes its notifications */
+    retval = UA_Subscription_deleteMonitoredItem(server, sub, monId);
+    ck_assert_uint_eq(retval, UA_STATUSCODE_GOOD);
+    ck_assert_uint_eq(sub->queuedNotifications, 0);
+    ck_assert(TAILQ_EMPTY(&sub->pendingItems));
+
+    UA_DeleteSubscriptionsRequest del_request;
+    UA_DeleteSubscriptionsRequest_init(&del_request);
+    del_request.subscriptionIdsSize = 1;
+    del_request.subscriptionIds = &subId;
+    UA_DeleteSubscriptionsResponse del_response;
+    UA_DeleteSubscriptionsResponse_init(&del_response);
+    Service_DeleteSubscriptions(server, &adminSession, &del_request, &del_response);
+    UA_DeleteSubscriptionsResponse_deleteMembers(&del_response);
+}
+END_TEST
+
+START_TEST(Server_indexRangeMonitoredItem) {
+    UA_VariableAttributes attr = UA_VariableAttributes_default;
+    UA_Int32 values[10] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9};
+    UA_Variant_setArray(&attr.value, values, 10, &UA_TYPES[UA_TYPES_INT32]);
+    attr.valueRank = 1;
+    UA_NodeId nodeId = UA_NODEID_STRING(1, "range.variable");
+    UA_StatusCode retval =
+        UA_Server_addVariableNode(server, nodeId, UA_NODEID_NUMERIC(0, UA_NS0ID_OBJECTSFOLDER),
+                                  UA_NODEID_NUMERIC(0, UA_NS0ID_ORGANIZES),
+                                  UA_QUALIFIEDNAME(1, "range.variable"),
+                                  UA_NODEID_NUMERIC(0, UA_NS0ID_BASEDATAVARIABLETYPE),
+                                  attr, NULL, NULL);
+    ck_assert_uint_eq(retval, UA_STATUSCODE_GOOD);
+
+    UA_CreateSubscriptionRequest sub_request;
+    UA_CreateSubscriptionRequest_init(&sub_request);
+    sub_request.publishingEnabled = true;
+    sub_request.requestedPublishingInterval = 1000;
+    UA_CreateSubscriptionResponse sub_response;
+    UA_CreateSubscriptionResponse_init(&sub_response);
+    Service_CreateSubscription(server, &adminSession, &sub_request, &sub_response);
+    ck_assert_uint_eq(sub_response.responseHeader.serviceResult, UA_STATUSCODE_GOOD);
+    UA_UInt32 subId = sub_response.subscriptionId;
+    UA_CreateSubscriptionResponse_deleteMembers(&sub_response);
+
+    /* A valid and an invalid index range */
+    UA_MonitoredItemCreateRequest items[2];
+    for(size_t i = 0; i < 2; i++) {
+        UA_MonitoredItemCreateRequest_init(&items[i]);
+        items[i].itemToMonitor.nodeId = nodeId;
+        items[i].itemToMonitor.attributeId = UA_ATTRIBUTEID_VALUE;
+        items[i].monitoringMode = UA_MONITORINGMODE_REPORTING;
+        items[i].requestedParameters.samplingInterval = 100;
+        items[i].requestedParameters.queueSize = 10;
+    }
+    items[0].itemToMonitor.indexRange = UA_STRING("2:4");
+    items[1].itemToMonitor.indexRange = UA_STRING("4:2");
+
+    UA_CreateMonitoredItemsRequest request;
+    UA_CreateMonitoredItemsRequest_init(&request);
+    request.subscriptionId = subId;
+    request.timestampsToReturn = UA_TIMESTAMPSTORETURN_NEITHER;
+    request.itemsToCreateSize = 2;
+    request.itemsToCreate = items;
+    UA_CreateMonitoredItemsResponse response;
+    UA_CreateMonitoredItemsResponse_init(&response);
+    Service_CreateMonitoredItems(server, &adminSession, &request, &response);
+    ck_assert_uint_eq(response.responseHeader.serviceResult, UA_STATUSCODE_GOOD);
+    ck_assert_uint_eq(response.resultsSize, 2);
+    ck_assert_uint_eq(response.results[0].statusCode, UA_STATUSCODE_GOOD);
+    ck_assert_uint_eq(response.results[1].statusCode, UA_STATUSCODE_BADINDEXRANGEINVALID);
+    UA_UInt32 monId = response.results[0].monitoredItemId;
+    UA_CreateMonitoredItemsResponse_deleteMembers(&response);
+
+    /* The range was parsed once. The SamplingGroup has a copy. */
+    UA_Subscription *sub = UA_Session_getSubscriptionByID(&adminSession, subId);
+    UA_MonitoredItem *mon = UA_Subscription_getMonitoredItem(sub, monId);
+    ck_assert_uint_eq(mon->parsedIndexRange.dimensionsSize, 1);
+    ck_assert_uint_eq(mon->parsedIndexRange.dimensions[0].min, 2);
+    ck_assert_uint_eq(mon->parsedIndexRange.dimensions[0].max, 4);
+    UA_NumericRange *sgRange = &mon->samplingGroup->parsedIndexRange;
+    ck_assert_uint_eq(sgRange->dimensionsSize, 1);
+    ck_assert_ptr_ne(sgRange->dimensions, mon->parsedIndexRange.dimensions);
+    ck_assert_uint_eq(sgRange->dimensions[0].min, 2);
+    ck_assert_uint_eq(sgRange->dimensions[0].max, 4);
+    ck_assert_uint_eq(mon->currentQueueSize, 1);
+    MonitoredItem_queuedValue *qv = newestSample(mon);
+    ck_assert_uint_eq(qv->value.value.arrayLength, 3);
+    ck_assert_int_eq(((UA_Int32*)qv->value.value.data)[0], 2);
+
+    /* A change outside of the range is not reported */
+    values[8] = 80;
+    UA_Variant var;
+    UA_Variant_setArray(&var, values, 10, &UA_TYPES[UA_TYPES_INT32]);
+    retval = UA_Server_writeValue(server, nodeId, var);
+    ck_assert_uint_eq(retval, UA_STATUSCODE_GOOD);
+    runCallbacks(101);
+    ck_assert_uint_eq(mon->currentQueueSize, 1);
+
+    /* A change within the range is sampled */
+    values[3] = 30;
+    retval = UA_Server_writeValue(server, nodeId, var);
+    ck_assert_uint_eq(retval, UA_STATUSCODE_GOOD);
+    runCallbacks(101);
+    ck_assert_uint_eq(mon->currentQueueSize, 2);
+    qv = newestSample(mon);
+    ck_assert_uint_eq(qv->value.value.arrayLength, 3);
+    ck_assert_int_eq(((UA_Int32*)qv->value.value.data)[1], 30);
+
+    UA_DeleteSubscriptionsRequest del_request;
+    UA_DeleteSubscriptionsRequest_init(&del_request);
+    del_request.subscriptionIdsSize = 1;
+    del_request.subscriptionIds = &subId;
+    UA_DeleteSubscriptionsResponse del_response;
+    UA_DeleteSubscriptionsResponse_init(&del_response);
+    Service_DeleteSubscriptions(server, &adminSession, &del_request, &del_response);
+    UA_DeleteSubscriptionsResponse_deleteMembers(&del_response);
+}
+END_TEST
+
 #endif /* UA_ENABLE_SUBSCRIPTIONS */
 
 static Suite* testSuite_Client(void) {
@@ -321,6 +1077,13 @@ static Suite* testSuite_Client(void) {
     tcase_add_test(tc_server, Server_deleteSubscription);
     tcase_add_test(tc_server, Server_republish_invalid);
     tcase_add_test(tc_server, Server_publishCallback);
+    tcase_add_test(tc_server, Server_publishBackpressure);
+    tcase_add_test(tc_server, Server_sharedSamplingGroup);
+    tcase_add_test(tc_server, Server_samplingGroupAccessLevel);
+    tcase_add_test(tc_server, Server_deadbandFilter);
+    tcase_add_test(tc_server, Server_bitwiseValueChange);
+    tcase_add_test(tc_server, Server_monitoredItemQueue);
+    tcase_add_test(tc_server, Server_indexRangeMonitoredItem);
 #endif /* UA_ENABLE_SUBSCRIPTIONS */
     suite_add_tcase(s, tc_server);
 
@@ -4,9 +4,13 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "ua_types.h"
 #include "server/ua_services.h"
+#include "server/ua_server_internal.h"
+#include "ua_transport_generated_handling.h"
+#include "ua_config_default.h"
 #include "check.h"
 
 START_TEST(Session_init_ShallWork) {
@@ -46,11 +50,109 @@ START_TEST(Session_updateLifetime_ShallWork) {
 }
 END_TEST
 
+#define SESSIONS 100
+
+START_TEST(SessionManager_lookupManySessions) {
+    UA_ServerConfig *config = UA_ServerConfig_new_default();
+    UA_Server *server = UA_Server_new(config);
+    UA_SessionManager *sm = &server->sessionManager;
+
+    UA_CreateSessionRequest request;
+    UA_CreateSessionRequest_init(&request);
+    UA_Session *sessions[SESSIONS];
+    for(size_t i = 0; i < SESSIONS; i++) {
+        UA_StatusCode retval = UA_SessionManager_createSession(sm, NULL, &request, &sessions[i]);
+        ck_assert_uint_eq(retval, UA_STATUSCODE_GOOD);
+    }
+
+    /* Remove every other session */
+    for(size_t i = 0; i < SESSIONS; i += 2) {
+        UA_StatusCode retval =
+            UA_SessionManager_removeSession(sm, &sessions[i]->authenticationToken);
+        ck_assert_uint_eq(retval, UA_STATUSCODE_GOOD);
+    }
+
+    for(size_t i = 0; i < SESSIONS; i++) {
+        UA_Session *expected = (i % 2 == 0) ? NULL : sessions[i];
+        ck_assert_ptr_eq(UA_SessionManager_getSessionByToken(sm, &sessions[i]->authenticationToken),
+                         expected);
+        ck_assert_ptr_eq(UA_SessionManager_getSessionById(sm, &sessions[i]->sessionId),
+                         expected);
+    }
+
+    /* Run the delayed callbacks that free the removed sessions */
+    UA_Server_run_startup(server);
+    UA_Server_run_shutdown(server);
+    UA_Server_delete(server);
+    UA_ServerConfig_delete(config);
+}
+END_TEST
+
+#define CHANNELS 24
+
+/* More channels than the initial hash buckets. Lookups of ids that share a
+ * bucket with an open channel or of closed channels find no channel. */
+START_TEST(SecureChannelManager_lookupManyChannels) {
+    UA_ServerConfig *config = UA_ServerConfig_new_default();
+    UA_Server *server = UA_Server_new(config);
+    UA_SecureChannelManager *cm = &server->secureChannelManager;
+    const UA_SecurityPolicy *policy = &config->endpoints[0].securityPolicy;
+
+    UA_AsymmetricAlgorithmSecurityHeader asymHeader;
+    UA_AsymmetricAlgorithmSecurityHeader_init(&asymHeader);
+    UA_OpenSecureChannelRequest request;
+    UA_OpenSecureChannelRequest_init(&request);
+    request.securityMode = UA_MESSAGESECURITYMODE_NONE;
+
+    UA_Connection connections[CHANNELS];
+    UA_SecureChannel *channels[CHANNELS];
+    memset(connections, 0, sizeof(connections));
+    for(size_t i = 0; i < CHANNELS; i++) {
+        UA_StatusCode retval =
+            UA_SecureChannelManager_create(cm, &connections[i], policy, &asymHeader);
+        ck_assert_uint_eq(retval, UA_STATUSCODE_GOOD);
+        channels[i] = connections[i].channel;
+        UA_OpenSecureChannelResponse response;
+        UA_OpenSecureChannelResponse_init(&response);
+        retval = UA_SecureChannelManager_open(cm, channels[i], &request, &response);
+        ck_assert_uint_eq(retval, UA_STATUSCODE_GOOD);
+        UA_OpenSecureChannelResponse_deleteMembers(&response);
+
+        /* The next ids are not handed out yet */
+        UA_UInt32 id = channels[i]->securityToken.channelId;
+        ck_assert_ptr_eq(UA_SecureChannelManager_get(cm, id), channels[i]);
+        ck_assert_ptr_eq(UA_SecureChannelManager_get(cm, id + 16), NULL);
+    }
+
+    /* Close every other channel */
+    for(size_t i = 0; i < CHANNELS; i += 2) {
+        UA_StatusCode retval =
+            UA_SecureChannelManager_close(cm, channels[i]->securityToken.channelId);
+        ck_assert_uint_eq(retval, UA_STATUSCODE_GOOD);
+    }
+
+    for(size_t i = 0; i < CHANNELS; i++) {
+        UA_UInt32 id = channels[0]->securityToken.channelId + (UA_UInt32)i;
+        UA_SecureChannel *expected = (i % 2 == 0) ? NULL : channels[i];
+        ck_assert_ptr_eq(UA_SecureChannelManager_get(cm, id), expected);
+        ck_assert_ptr_eq(UA_SecureChannelManager_get(cm, id + CHANNELS), NULL);
+    }
+
+    /* Run the delayed callbacks that free the closed channels */
+    UA_Server_run_startup(server);
+    UA_Server_run_shutdown(server);
+    UA_Server_delete(server);
+    UA_ServerConfig_delete(config);
+}
+END_TEST
+
 static Suite* testSuite_Session(void) {
     Suite *s = suite_create("Session");
     TCase *tc_core = tcase_create("Core");
     tcase_add_test(tc_core, Session_init_ShallWork);
     tcase_add_test(tc_core, Session_updateLifetime_ShallWork);
+    tcase_add_test(tc_core, SessionManager_lookupManySessions);
+    tcase_add_test(tc_core, SecureChannelManager_lookupManyChannels);
 
     suite_add_tcase(s,tc_core);
     return s;
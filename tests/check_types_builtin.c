@@ -1417,6 +1417,73 @@ START_TEST(UA_Variant_copyShallWorkOn2DArrayExample) {
 }
 END_TEST
 
+START_TEST(UA_order_shallWorkOnNumbersAndStrings) {
+    UA_Int32 i1 = -5, i2 = 3;
+    ck_assert_int_eq(UA_order(&i1, &i2, &UA_TYPES[UA_TYPES_INT32]), UA_ORDER_LESS);
+    ck_assert_int_eq(UA_order(&i2, &i1, &UA_TYPES[UA_TYPES_INT32]), UA_ORDER_MORE);
+
+    UA_Double zero = 0.0, negZero = -0.0, d1 = -1.0;
+    UA_Double nan = zero / zero;
+    ck_assert(UA_equal(&nan, &nan, &UA_TYPES[UA_TYPES_DOUBLE]));
+    ck_assert_int_eq(UA_order(&nan, &d1, &UA_TYPES[UA_TYPES_DOUBLE]), UA_ORDER_LESS);
+    ck_assert_int_eq(UA_order(&d1, &nan, &UA_TYPES[UA_TYPES_DOUBLE]), UA_ORDER_MORE);
+    ck_assert(UA_equal(&zero, &negZero, &UA_TYPES[UA_TYPES_DOUBLE]));
+
+    UA_String s1 = UA_STRING("abc"), s2 = UA_STRING("abd"), s3 = UA_STRING("ab");
+    ck_assert_int_eq(UA_order(&s1, &s2, &UA_TYPES[UA_TYPES_STRING]), UA_ORDER_LESS);
+    ck_assert_int_eq(UA_order(&s1, &s3, &UA_TYPES[UA_TYPES_STRING]), UA_ORDER_MORE);
+
+    UA_NodeId n1 = UA_NODEID_NUMERIC(1, 100), n2 = UA_NODEID_STRING(1, "abc");
+    ck_assert_int_eq(UA_order(&n1, &n2, &UA_TYPES[UA_TYPES_NODEID]), UA_ORDER_LESS);
+}
+END_TEST
+
+START_TEST(UA_order_shallWorkOnVariantsAndDataValues) {
+    UA_Int32 a1[3] = {1, 2, 3};
+    UA_Int32 a2[3] = {1, 2, 4};
+    UA_DataValue dv1, dv2;
+    UA_DataValue_init(&dv1);
+    UA_DataValue_init(&dv2);
+    dv1.hasValue = true;
+    dv2.hasValue = true;
+    UA_Variant_setArray(&dv1.value, a1, 3, &UA_TYPES[UA_TYPES_INT32]);
+    UA_Variant_setArray(&dv2.value, a2, 3, &UA_TYPES[UA_TYPES_INT32]);
+    ck_assert_int_eq(UA_order(&dv1, &dv2, &UA_TYPES[UA_TYPES_DATAVALUE]), UA_ORDER_LESS);
+
+    /* Equal content in different memory */
+    a2[2] = 3;
+    ck_assert(UA_equal(&dv1, &dv2, &UA_TYPES[UA_TYPES_DATAVALUE]));
+
+    /* Scalars are ordered before arrays */
+    UA_Variant_setScalar(&dv2.value, a2, &UA_TYPES[UA_TYPES_INT32]);
+    ck_assert_int_eq(UA_order(&dv1, &dv2, &UA_TYPES[UA_TYPES_DATAVALUE]), UA_ORDER_MORE);
+
+    /* Fields that are not set come first */
+    UA_Variant_setArray(&dv2.value, a2, 3, &UA_TYPES[UA_TYPES_INT32]);
+    dv2.hasStatus = true;
+    dv2.status = UA_STATUSCODE_GOOD;
+    ck_assert_int_eq(UA_order(&dv1, &dv2, &UA_TYPES[UA_TYPES_DATAVALUE]), UA_ORDER_LESS);
+
+    /* The deep copy of a structured type is equal */
+    UA_ReadRequest rr;
+    UA_ReadRequest_init(&rr);
+    UA_ReadValueId rvi[2];
+    UA_ReadValueId_init(&rvi[0]);
+    UA_ReadValueId_init(&rvi[1]);
+    rvi[0].nodeId = UA_NODEID_STRING(1, "a");
+    rvi[1].indexRange = UA_STRING("1:2");
+    rr.nodesToRead = rvi;
+    rr.nodesToReadSize = 2;
+    UA_ReadRequest rr2;
+    UA_StatusCode retval = UA_ReadRequest_copy(&rr, &rr2);
+    ck_assert_uint_eq(retval, UA_STATUSCODE_GOOD);
+    ck_assert(UA_equal(&rr, &rr2, &UA_TYPES[UA_TYPES_READREQUEST]));
+    rr2.nodesToRead[1].attributeId = 13;
+    ck_assert_int_eq(UA_order(&rr, &rr2, &UA_TYPES[UA_TYPES_READREQUEST]), UA_ORDER_LESS);
+    UA_ReadRequest_deleteMembers(&rr2);
+}
+END_TEST
+
 START_TEST(UA_ExtensionObject_encodeDecodeShallWorkOnExtensionObject) {
     /* UA_Int32 val = 42; */
     /* UA_VariableAttributes varAttr; */
@@ -1541,6 +1608,11 @@ static Suite *testSuite_builtin(void) {
     tcase_add_test(tc_copy, UA_LocalizedText_copycstringShallWorkOnInputExample);
     tcase_add_test(tc_copy, UA_DataValue_copyShallWorkOnInputExample);
     suite_add_tcase(s, tc_copy);
+
+    TCase *tc_order = tcase_create("order");
+    tcase_add_test(tc_order, UA_order_shallWorkOnNumbersAndStrings);
+    tcase_add_test(tc_order, UA_order_shallWorkOnVariantsAndDataValues);
+    suite_add_tcase(s, tc_order);
     return s;
 }
 
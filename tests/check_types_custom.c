@@ -71,6 +71,8 @@ static const UA_DataType PointType = {
                                          identifier used on the wire (the
                                          namespaceindex is from .typeId) */
     members
+    UA_BINARYENCODING(NULL)          /* .binaryEncoding, interpreted from
+                                         the members */
 };
 
 START_TEST(parseCustomScalar) {
@@ -193,12 +195,89 @@ START_TEST(parseCustomArray) {
     UA_ByteString_deleteMembers(&buf);
 } END_TEST
 
+#define MANY_TYPES 300
+
+START_TEST(parseCustomArrayIndexed) {
+    /* Many custom types that differ in the binary encoding id */
+    UA_DataType types[MANY_TYPES];
+    for(size_t i = 0; i < MANY_TYPES; ++i) {
+        types[i] = PointType;
+        types[i].typeIndex = (UA_UInt16)i;
+        types[i].binaryEncodingId = (UA_UInt16)(5000 + (i * 7));
+    }
+    UA_DataTypeIndex index;
+    UA_StatusCode retval = UA_DataTypeIndex_init(&index, MANY_TYPES, types);
+    ck_assert_int_eq(retval, UA_STATUSCODE_GOOD);
+
+    Point ps[MANY_TYPES];
+    UA_ExtensionObject eo[MANY_TYPES];
+    for(size_t i = 0; i < MANY_TYPES; ++i) {
+        ps[i].x = (UA_Float)i;
+        ps[i].y = 0.0;
+        ps[i].z = 0.0;
+        UA_ExtensionObject_init(&eo[i]);
+        eo[i].encoding = UA_EXTENSIONOBJECT_DECODED_NODELETE;
+        eo[i].content.decoded.data = &ps[i];
+        eo[i].content.decoded.type = &types[i];
+    }
+
+    UA_Variant var;
+    UA_Variant_init(&var);
+    UA_Variant_setArray(&var, eo, MANY_TYPES, &UA_TYPES[UA_TYPES_EXTENSIONOBJECT]);
+
+    size_t buflen = UA_calcSizeBinary(&var, &UA_TYPES[UA_TYPES_VARIANT]);
+    UA_ByteString buf;
+    retval = UA_ByteString_allocBuffer(&buf, buflen);
+    ck_assert_int_eq(retval, UA_STATUSCODE_GOOD);
+
+    UA_Byte *pos = buf.data;
+    const UA_Byte *end = &buf.data[buf.length];
+    retval = UA_encodeBinary(&var, &UA_TYPES[UA_TYPES_VARIANT],
+                             &pos, &end, NULL, NULL);
+    ck_assert_int_eq(retval, UA_STATUSCODE_GOOD);
+
+    UA_Variant var2;
+    size_t offset = 0;
+    retval = UA_decodeBinaryIndexed(&buf, &offset, &var2,
+                                    &UA_TYPES[UA_TYPES_VARIANT], &index);
+    ck_assert_int_eq(retval, UA_STATUSCODE_GOOD);
+    ck_assert_int_eq(var2.arrayLength, MANY_TYPES);
+
+    for(size_t i = 0; i < MANY_TYPES; i++) {
+        UA_ExtensionObject *eo2 = &((UA_ExtensionObject*)var2.data)[i];
+        ck_assert_int_eq(eo2->encoding, UA_EXTENSIONOBJECT_DECODED);
+        ck_assert_ptr_eq(eo2->content.decoded.type, &types[i]);
+        ck_assert((int)((Point*)eo2->content.decoded.data)->x == (int)i);
+    }
+
+    UA_Variant_deleteMembers(&var2);
+    UA_ByteString_deleteMembers(&buf);
+    UA_DataTypeIndex_deleteMembers(&index);
+} END_TEST
+
+START_TEST(findStandardDataTypes) {
+    for(size_t i = 0; i < UA_TYPES_COUNT; ++i) {
+        const UA_DataType *type = UA_findDataType(&UA_TYPES[i].typeId);
+        ck_assert_ptr_ne(type, NULL);
+        ck_assert(UA_NodeId_equal(&type->typeId, &UA_TYPES[i].typeId));
+        if(UA_TYPES[i].binaryEncodingId == 0)
+            continue;
+        UA_NodeId encodingId = UA_NODEID_NUMERIC(0, UA_TYPES[i].binaryEncodingId);
+        ck_assert_ptr_eq(UA_findDataTypeByBinary(&encodingId), &UA_TYPES[i]);
+    }
+    UA_NodeId unknown = UA_NODEID_NUMERIC(0, 123456);
+    ck_assert_ptr_eq(UA_findDataType(&unknown), NULL);
+    ck_assert_ptr_eq(UA_findDataTypeByBinary(&unknown), NULL);
+} END_TEST
+
 int main(void) {
     Suite *s  = suite_create("Test Custom DataType Encoding");
     TCase *tc = tcase_create("test cases");
     tcase_add_test(tc, parseCustomScalar);
     tcase_add_test(tc, parseCustomScalarExtensionObject);
     tcase_add_test(tc, parseCustomArray);
+    tcase_add_test(tc, parseCustomArrayIndexed);
+    tcase_add_test(tc, findStandardDataTypes);
     suite_add_tcase(s, tc);
 
     SRunner *sr = srunner_create(s);
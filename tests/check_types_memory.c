@@ -223,6 +223,180 @@ START_TEST(decodeComplexTypeFromRandomBufferShallSurvive) {
 }
 END_TEST
 
+START_TEST(copyShallBeEqual) {
+    // given
+    UA_ByteString msg1;
+    UA_StatusCode retval = UA_ByteString_allocBuffer(&msg1, 256); // fixed size
+    ck_assert_int_eq(retval, UA_STATUSCODE_GOOD);
+#ifdef _WIN32
+    srand(42);
+#else
+    srandom(42);
+#endif
+    for(int n = 0;n < RANDOM_TESTS;n++) {
+        for(size_t i = 0;i < msg1.length;i++) {
+#ifdef _WIN32
+            msg1.data[i] = (UA_Byte)rand();
+#else
+            msg1.data[i] = (UA_Byte)random();
+#endif
+        }
+        size_t pos = 0;
+        void *obj1 = UA_new(&UA_TYPES[_i]);
+        void *obj2 = UA_new(&UA_TYPES[_i]);
+        retval = UA_decodeBinary(&msg1, &pos, obj1, &UA_TYPES[_i], 0, NULL);
+        if(retval == UA_STATUSCODE_GOOD) {
+            // when
+            retval = UA_copy(obj1, obj2, &UA_TYPES[_i]);
+            // then
+            ck_assert_int_eq(retval, UA_STATUSCODE_GOOD);
+            ck_assert_msg(UA_equal(obj1, obj2, &UA_TYPES[_i]),
+                          "copy differs idx=%d,nodeid=%i", _i,
+                          UA_TYPES[_i].typeId.identifier.numeric);
+        }
+        // finally
+        UA_delete(obj1, &UA_TYPES[_i]);
+        UA_delete(obj2, &UA_TYPES[_i]);
+    }
+    UA_ByteString_deleteMembers(&msg1);
+}
+END_TEST
+
+START_TEST(arenaDecodeShallEqualHeapDecode) {
+    UA_ByteString msg1;
+    UA_StatusCode retval = UA_ByteString_allocBuffer(&msg1, 256); // fixed size
+    ck_assert_int_eq(retval, UA_STATUSCODE_GOOD);
+    UA_DataTypeIndex index;
+    retval = UA_DataTypeIndex_init(&index, 0, NULL);
+    ck_assert_int_eq(retval, UA_STATUSCODE_GOOD);
+    UA_Arena arena;
+    UA_Arena_init(&arena, 64); /* small chunks to test the growth */
+#ifdef _WIN32
+    srand(42);
+#else
+    srandom(42);
+#endif
+    for(int n = 0;n < RANDOM_TESTS;n++) {
+        for(size_t i = 0;i < msg1.length;i++) {
+#ifdef _WIN32
+            msg1.data[i] = (UA_Byte)rand();
+#else
+            msg1.data[i] = (UA_Byte)random();
+#endif
+        }
+        size_t pos1 = 0;
+        size_t pos2 = 0;
+        void *obj1 = UA_new(&UA_TYPES[_i]);
+        void *obj2 = UA_new(&UA_TYPES[_i]);
+        UA_StatusCode retval1 = UA_decodeBinary(&msg1, &pos1, obj1, &UA_TYPES[_i], 0, NULL);
+        UA_StatusCode retval2 = UA_decodeBinaryArena(&msg1, &pos2, obj2, &UA_TYPES[_i],
+                                                     &index, &arena);
+        ck_assert_int_eq(retval1, retval2);
+        if(retval1 == UA_STATUSCODE_GOOD) {
+            ck_assert_uint_eq(pos1, pos2);
+            ck_assert_msg(UA_equal(obj1, obj2, &UA_TYPES[_i]),
+                          "arena decode differs idx=%d,nodeid=%i", _i,
+                          UA_TYPES[_i].typeId.identifier.numeric);
+        }
+        UA_delete(obj1, &UA_TYPES[_i]);
+        UA_free(obj2); /* the members are released with the arena */
+        UA_Arena_reset(&arena);
+    }
+    UA_Arena_deleteMembers(&arena);
+    UA_DataTypeIndex_deleteMembers(&index);
+    UA_ByteString_deleteMembers(&msg1);
+}
+END_TEST
+
+START_TEST(arenaDecodeShallBorrowFromBuffer) {
+    /* A WriteValue with a ByteString and a Float array */
+    UA_Float floats[16];
+    for(size_t i = 0; i < 16; i++)
+        floats[i] = (UA_Float)i;
+    UA_WriteValue wv;
+    UA_WriteValue_init(&wv);
+    wv.nodeId = UA_NODEID_STRING(1, "blob");
+    wv.attributeId = UA_ATTRIBUTEID_VALUE;
+    wv.value.hasValue = true;
+    UA_Variant_setArray(&wv.value.value, floats, 16, &UA_TYPES[UA_TYPES_FLOAT]);
+
+    /* Encode at an offset where the floats are aligned and at offsets where
+     * they are not */
+    size_t borrowedFloats = 0;
+    for(size_t shift = 0; shift < 4; shift++) {
+        UA_ByteString buf;
+        UA_StatusCode retval = UA_ByteString_allocBuffer(&buf, 256);
+        ck_assert_int_eq(retval, UA_STATUSCODE_GOOD);
+        UA_Byte *pos = &buf.data[shift];
+        const UA_Byte *end = &buf.data[buf.length];
+        retval = UA_encodeBinary(&wv, &UA_TYPES[UA_TYPES_WRITEVALUE], &pos, &end, NULL, NULL);
+        ck_assert_int_eq(retval, UA_STATUSCODE_GOOD);
+
+        UA_DataTypeIndex index;
+        retval = UA_DataTypeIndex_init(&index, 0, NULL);
+        ck_assert_int_eq(retval, UA_STATUSCODE_GOOD);
+        UA_Arena arena;
+        UA_Arena_init(&arena, 64);
+        UA_WriteValue wv2;
+        size_t offset = shift;
+        retval = UA_decodeBinaryArena(&buf, &offset, &wv2, &UA_TYPES[UA_TYPES_WRITEVALUE],
+                                      &index, &arena);
+        ck_assert_int_eq(retval, UA_STATUSCODE_GOOD);
+        ck_assert(UA_equal(&wv, &wv2, &UA_TYPES[UA_TYPES_WRITEVALUE]));
+
+        /* The strings are always borrowed. The floats only if aligned. */
+        UA_Byte *data = wv2.nodeId.identifier.string.data;
+        ck_assert(data >= buf.data && data < &buf.data[buf.length]);
+        data = (UA_Byte*)wv2.value.value.data;
+        if(data >= buf.data && data < &buf.data[buf.length]) {
+            ck_assert_uint_eq((uintptr_t)data % sizeof(UA_Float), 0);
+            borrowedFloats++;
+        }
+
+        UA_Arena_deleteMembers(&arena);
+        UA_DataTypeIndex_deleteMembers(&index);
+        UA_ByteString_deleteMembers(&buf);
+    }
+    ck_assert_uint_eq(borrowedFloats, 1);
+}
+END_TEST
+
+START_TEST(arenaShallGrowAndReset) {
+    UA_Arena arena;
+    UA_Arena_init(&arena, 64);
+
+    /* Allocations are zeroed and aligned */
+    UA_Byte *b = (UA_Byte*)UA_Arena_alloc(&arena, 3);
+    ck_assert_ptr_ne(b, NULL);
+    UA_Double *d = (UA_Double*)UA_Arena_alloc(&arena, sizeof(UA_Double));
+    ck_assert_ptr_ne(d, NULL);
+    ck_assert_uint_eq((uintptr_t)d % sizeof(UA_Double), 0);
+    ck_assert(*d == 0.0);
+
+    /* Fill beyond the first chunk and add a large allocation */
+    for(size_t i = 0; i < 100; i++) {
+        UA_UInt32 *u = (UA_UInt32*)UA_Arena_alloc(&arena, sizeof(UA_UInt32));
+        ck_assert_ptr_ne(u, NULL);
+        ck_assert_uint_eq(*u, 0);
+        *u = 0xffffffff;
+    }
+    UA_Byte *large = (UA_Byte*)UA_Arena_alloc(&arena, 10000);
+    ck_assert_ptr_ne(large, NULL);
+    memset(large, 0xff, 10000);
+
+    /* The reset keeps the current chunk. The next allocations are zeroed. */
+    UA_Arena_reset(&arena);
+    ck_assert_ptr_ne(arena.chunks, NULL);
+    for(size_t i = 0; i < 100; i++) {
+        UA_UInt32 *u = (UA_UInt32*)UA_Arena_alloc(&arena, sizeof(UA_UInt32));
+        ck_assert_ptr_ne(u, NULL);
+        ck_assert_uint_eq(*u, 0);
+    }
+    UA_Arena_deleteMembers(&arena);
+    ck_assert_ptr_eq(arena.chunks, NULL);
+}
+END_TEST
+
 START_TEST(calcSizeBinaryShallBeCorrect) {
     /* Empty variants (with no type defined) cannot be encoded. This is intentional. Discovery configuration is just a base class and void * */
     if(_i == UA_TYPES_VARIANT ||
@@ -254,6 +428,86 @@ START_TEST(calcSizeBinaryShallBeCorrect) {
 }
 END_TEST
 
+#ifdef UA_ENABLE_COMPILED_ENCODING
+
+/* Encode with the type and return the number of bytes in buf */
+static size_t
+encodeToBuffer(const void *obj, const UA_DataType *type, UA_ByteString *buf) {
+    UA_Byte *pos = buf->data;
+    const UA_Byte *end = &buf->data[buf->length];
+    UA_StatusCode retval = UA_encodeBinary(obj, type, &pos, &end, NULL, NULL);
+    ck_assert_int_eq(retval, UA_STATUSCODE_GOOD);
+    return (uintptr_t)(pos - buf->data);
+}
+
+/* The generated encoding functions produce the same results as the interpreted
+ * encoding of the members */
+START_TEST(compiledEncodingShallEqualInterpreted) {
+    if(!UA_TYPES[_i].binaryEncoding)
+        return;
+    UA_DataType interpreted = UA_TYPES[_i];
+    interpreted.binaryEncoding = NULL;
+
+    UA_ByteString msg1, buf1, buf2;
+    UA_StatusCode retval = UA_ByteString_allocBuffer(&msg1, 256);
+    retval |= UA_ByteString_allocBuffer(&buf1, 1024);
+    retval |= UA_ByteString_allocBuffer(&buf2, 1024);
+    ck_assert_int_eq(retval, UA_STATUSCODE_GOOD);
+#ifdef _WIN32
+    srand(42);
+#else
+    srandom(42);
+#endif
+    for(int n = 0;n < RANDOM_TESTS;n++) {
+        /* The first round decodes from a zeroed buffer */
+        for(size_t i = 0;i < msg1.length;i++) {
+            if(n == 0)
+                msg1.data[i] = 0;
+            else
+#ifdef _WIN32
+                msg1.data[i] = (UA_Byte)rand();
+#else
+                msg1.data[i] = (UA_Byte)random();
+#endif
+        }
+
+        /* Decode */
+        size_t pos1 = 0;
+        size_t pos2 = 0;
+        void *obj1 = UA_new(&UA_TYPES[_i]);
+        void *obj2 = UA_new(&UA_TYPES[_i]);
+        UA_StatusCode retval1 = UA_decodeBinary(&msg1, &pos1, obj1, &UA_TYPES[_i], 0, NULL);
+        UA_StatusCode retval2 = UA_decodeBinary(&msg1, &pos2, obj2, &interpreted, 0, NULL);
+        ck_assert_int_eq(retval1, retval2);
+        if(retval1 == UA_STATUSCODE_GOOD) {
+            ck_assert_uint_eq(pos1, pos2);
+
+            /* CalcSize */
+            size_t size1 = UA_calcSizeBinary(obj1, &UA_TYPES[_i]);
+            size_t size2 = UA_calcSizeBinary(obj1, &interpreted);
+            ck_assert_uint_eq(size1, size2);
+
+            /* Encode. Also compare the decoded values over their encoding. */
+            size_t len1 = encodeToBuffer(obj1, &UA_TYPES[_i], &buf1);
+            size_t len2 = encodeToBuffer(obj1, &interpreted, &buf2);
+            ck_assert_uint_eq(len1, size1);
+            ck_assert_uint_eq(len1, len2);
+            ck_assert(memcmp(buf1.data, buf2.data, len1) == 0);
+            len2 = encodeToBuffer(obj2, &interpreted, &buf2);
+            ck_assert_uint_eq(len1, len2);
+            ck_assert(memcmp(buf1.data, buf2.data, len1) == 0);
+        }
+        UA_delete(obj1, &UA_TYPES[_i]);
+        UA_delete(obj2, &UA_TYPES[_i]);
+    }
+    UA_ByteString_deleteMembers(&msg1);
+    UA_ByteString_deleteMembers(&buf1);
+    UA_ByteString_deleteMembers(&buf2);
+}
+END_TEST
+
+#endif
+
 int main(void) {
     int number_failed = 0;
     SRunner *sr;
@@ -273,10 +527,26 @@ int main(void) {
     tcase_add_loop_test(tc, decodeComplexTypeFromRandomBufferShallSurvive, UA_TYPES_NODEID, UA_TYPES_COUNT - 1);
     suite_add_tcase(s, tc);
 
+    tc = tcase_create("Test order");
+    tcase_add_loop_test(tc, copyShallBeEqual, UA_TYPES_BOOLEAN, UA_TYPES_COUNT - 1);
+    suite_add_tcase(s, tc);
+
+    tc = tcase_create("Test arena");
+    tcase_add_test(tc, arenaShallGrowAndReset);
+    tcase_add_test(tc, arenaDecodeShallBorrowFromBuffer);
+    tcase_add_loop_test(tc, arenaDecodeShallEqualHeapDecode, UA_TYPES_BOOLEAN, UA_TYPES_COUNT - 1);
+    suite_add_tcase(s, tc);
+
     tc = tcase_create("Test calcSizeBinary");
     tcase_add_loop_test(tc, calcSizeBinaryShallBeCorrect, UA_TYPES_BOOLEAN, UA_TYPES_COUNT - 1);
     suite_add_tcase(s, tc);
 
+#ifdef UA_ENABLE_COMPILED_ENCODING
+    tc = tcase_create("Test compiled encoding");
+    tcase_add_loop_test(tc, compiledEncodingShallEqualInterpreted, UA_TYPES_BOOLEAN, UA_TYPES_COUNT - 1);
+    suite_add_tcase(s, tc);
+#endif
+
     sr = srunner_create(s);
     srunner_set_fork_status(sr, CK_NOFORK);
     srunner_run_all (sr, CK_NORMAL);
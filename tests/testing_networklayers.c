@@ -47,5 +47,6 @@ UA_Connection createDummyConnection(void) {
     c.recv = NULL;
     c.releaseRecvBuffer = dummyReleaseRecvBuffer;
     c.close = dummyClose;
+    c.getSendQueueSize = NULL;
     return c;
 }
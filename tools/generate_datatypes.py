@@ -53,6 +53,12 @@ builtin_overlayable = {"Boolean": "true", "SByte": "true", "Byte": "true",
                        "offsetof(UA_Guid, data3) == (sizeof(UA_UInt16) + sizeof(UA_UInt32)) && " + \
                        "offsetof(UA_Guid, data4) == (2*sizeof(UA_UInt32)))"}
 
+# Types with a fixed size on the binary stream. Used to compute the size of
+# compiled encodings at generation time.
+builtin_binarysize = {"Boolean": 1, "SByte": 1, "Byte": 1, "Int16": 2, "UInt16": 2,
+                      "Int32": 4, "UInt32": 4, "Int64": 8, "UInt64": 8, "Float": 4,
+                      "Double": 8, "DateTime": 8, "Guid": 16, "StatusCode": 4}
+
 ################
 # Type Classes #
 ################
@@ -82,6 +88,22 @@ class Type(object):
                 self.description = child.text
                 break
 
+    def binarysize(self):
+        "Size on the binary stream if it is fixed. Otherwise None."
+        if isinstance(self, EnumerationType):
+            return 4
+        return builtin_binarysize.get(self.name)
+
+    def binarymember(self):
+        "Builtin type with typed member encoding functions for the compiled encoding. Otherwise None."
+        if isinstance(self, EnumerationType):
+            return "Int32"
+        if isinstance(self, OpaqueType):
+            return types[self.baseType].binarymember()
+        if isinstance(self, BuiltinType) and self.name != "QualifiedName":
+            return self.name
+        return None
+
     def datatype_c(self):
         xmlEncodingId = "0"
         binaryEncodingId = "0"
@@ -101,7 +123,11 @@ class Type(object):
             "    " + self.pointerfree + ", /* .pointerFree */\n" + \
             "    " + self.overlayable + ", /* .overlayable */ \n" + \
             "    " + binaryEncodingId + ", /* .binaryEncodingId */\n" + \
-            "    %s_members" % self.name + " /* .members */\n}"
+            "    %s_members" % self.name + " /* .members */\n" + \
+            "    UA_BINARYENCODING(%s) /* .binaryEncoding */\n}" % self.binaryencoding_ptr()
+
+    def binaryencoding_ptr(self):
+        return "NULL"
 
     def members_c(self):
         if len(self.members)==0:
@@ -240,6 +266,64 @@ class StructType(Type):
                 self.overlayable = "false"
             before = m
 
+    def binaryencoding_ptr(self):
+        if not args.compiled_encoding:
+            return "NULL"
+        return "&%s_binaryEncoding" % self.name
+
+    def encoding_compiled_c(self):
+        "Straight-line encoding functions instead of interpreting the members"
+        enc = "static UA_StatusCode\n%s_encodeBinaryCompiled(const void *p, const UA_DataType *_) {\n" % self.name
+        dec = "static UA_StatusCode\n%s_decodeBinaryCompiled(void *p, const UA_DataType *_) {\n" % self.name
+        size = "static size_t\n%s_calcSizeBinaryCompiled(const void *p, const UA_DataType *_) {\n" % self.name
+        if len(self.members) == 0:
+            enc += "    return UA_STATUSCODE_GOOD;\n}\n"
+            dec += "    return UA_STATUSCODE_GOOD;\n}\n"
+            size += "    return 0;\n}\n"
+        else:
+            enc += "    const UA_%s *src = (const UA_%s*)p;\n" % (self.name, self.name)
+            enc += "    UA_StatusCode ret = UA_STATUSCODE_GOOD;\n"
+            dec += "    UA_%s *dst = (UA_%s*)p;\n" % (self.name, self.name)
+            dec += "    UA_StatusCode ret = UA_STATUSCODE_GOOD;\n"
+            fixedsize = 0
+            sizes = []
+            for m in self.members:
+                t = m.memberType.datatype_ptr()
+                if m.isArray:
+                    enc += "    ret = UA_encodeBinaryArrayMember(src->%s, src->%sSize, %s);\n" % (m.name, m.name, t)
+                    dec += "    ret = UA_decodeBinaryArrayMember((void**)&dst->%s, &dst->%sSize, %s);\n" % (m.name, m.name, t)
+                    sizes.append("UA_calcSizeBinaryArrayMember(src->%s, src->%sSize, %s)" % (m.name, m.name, t))
+                elif m.memberType.binarymember():
+                    # Direct call without dispatching through the jump table
+                    b = m.memberType.binarymember()
+                    cast = "" if b == m.memberType.name else "(const UA_%s*)" % b
+                    enc += "    ret = UA_%s_encodeBinaryMember(%s&src->%s);\n" % (b, cast, m.name)
+                    cast = "" if b == m.memberType.name else "(UA_%s*)" % b
+                    dec += "    ret = UA_%s_decodeBinaryMember(%s&dst->%s);\n" % (b, cast, m.name)
+                    if m.memberType.binarysize() != None:
+                        fixedsize += m.memberType.binarysize()
+                    else:
+                        sizes.append("UA_%s_calcSizeBinaryMember(&src->%s)" % (b, m.name))
+                else:
+                    enc += "    ret = UA_encodeBinaryMember(&src->%s, %s);\n" % (m.name, t)
+                    dec += "    ret = UA_decodeBinaryMember(&dst->%s, %s);\n" % (m.name, t)
+                    if m.memberType.binarysize() != None:
+                        fixedsize += m.memberType.binarysize()
+                    else:
+                        sizes.append("UA_calcSizeBinaryMember(&src->%s, %s)" % (m.name, t))
+                enc += "    if(ret != UA_STATUSCODE_GOOD)\n        return ret;\n"
+                dec += "    if(ret != UA_STATUSCODE_GOOD)\n        return ret;\n"
+            enc += "    return ret;\n}\n"
+            dec += "    return ret;\n}\n"
+            if len(sizes) > 0:
+                size += "    const UA_%s *src = (const UA_%s*)p;\n" % (self.name, self.name)
+            size += "    return " + " +\n        ".join([str(fixedsize)] + sizes) + ";\n}\n"
+        return enc + "\n" + dec + "\n" + size + "\n" + \
+            "static const UA_DataTypeBinaryEncoding %s_binaryEncoding = {\n" % self.name + \
+            "    %s_encodeBinaryCompiled,\n" % self.name + \
+            "    %s_decodeBinaryCompiled,\n" % self.name + \
+            "    %s_calcSizeBinaryCompiled\n};" % self.name
+
     def typedef_h(self):
         if len(self.members) == 0:
             return "typedef void * UA_%s;" % self.name
@@ -357,6 +441,34 @@ def parseTypeDescriptions(f, namespaceid):
             definitions[i["baseType"]].binaryEncodingId = i["id"]
     return definitions
 
+###################
+# Hash Type Index #
+###################
+
+# Must match UA_DataTypeIndex_hash in src/ua_types_encoding_binary.h
+def typeindex_hash(id, size):
+    h = (id * 2654435761) & 0xffffffff
+    h ^= h >> 16
+    return h & (size - 1)
+
+def typeindex(types, key):
+    "Open addressing with linear probing. 0xFFFF marks empty entries."
+    size = 2
+    while size < 2 * len(types):
+        size *= 2
+    index = [0xFFFF] * size
+    for i, t in enumerate(types):
+        if not t.name in typedescriptions:
+            continue
+        id = int(key(typedescriptions[t.name]))
+        if id == 0:
+            continue # not a valid identifier in namespace zero
+        h = typeindex_hash(id, size)
+        while index[h] != 0xFFFF:
+            h = (h + 1) & (size - 1)
+        index[h] = i
+    return index
+
 def merge_dicts(*dict_args):
     """
     Given any number of dicts, shallow copy and merge into a new dict,
@@ -399,6 +511,11 @@ parser.add_argument('--no-builtin',
                     dest="no_builtin",
                     help='Do not generate builtin types')
 
+parser.add_argument('--compiled-encoding',
+                    action='store_true',
+                    dest="compiled_encoding",
+                    help='Generate type-specific binary encoding functions for the structured types (requires UA_ENABLE_COMPILED_ENCODING)')
+
 parser.add_argument('-t', '--type-bsd',
                     metavar="<typeBsds>",
                     type=argparse.FileType('r'),
@@ -507,6 +624,16 @@ for t in filtered_types:
     printh("#define " + outname.upper() + "_" + t.name.upper() + " " + str(i))
     i += 1
 
+if outname == "ua_types":
+    typeid_index = typeindex(filtered_types, lambda d: d.nodeid)
+    encoding_index = typeindex(filtered_types, lambda d: d.binaryEncodingId)
+    printh('''
+/* Hash indexes into UA_TYPES by the numeric typeId and binaryEncodingId. Used
+ * by UA_findDataType and UA_findDataTypeByBinary. */''')
+    printh("#define UA_TYPES_INDEXSIZE %s" % len(typeid_index))
+    printh("extern const UA_UInt16 UA_TYPES_TYPEIDINDEX[UA_TYPES_INDEXSIZE];")
+    printh("extern const UA_UInt16 UA_TYPES_ENCODINGINDEX[UA_TYPES_INDEXSIZE];")
+
 printh('''
 #ifdef __cplusplus
 } // extern "C"
@@ -561,11 +688,17 @@ printc('''/* Generated from ''' + inname + ''' with script ''' + sys.argv[0] + '
 
 #include "''' + outname + '''_generated.h"
 #include "ua_util.h"''')
+if args.compiled_encoding:
+    printc('#include "ua_types_encoding_binary.h"')
 
 for t in filtered_types:
     printc("")
     printc("/* " + t.name + " */")
     printc(t.members_c())
+    if args.compiled_encoding and isinstance(t, StructType):
+        printc("#ifdef UA_ENABLE_COMPILED_ENCODING")
+        printc(t.encoding_compiled_c())
+        printc("#endif")
 
 printc("const UA_DataType %s[%s_COUNT] = {" % (outname.upper(), outname.upper()))
 for t in filtered_types:
@@ -574,6 +707,16 @@ for t in filtered_types:
     printc(t.datatype_c() + ",")
 printc("};\n")
 
+def print_index(name, index):
+    printc("const UA_UInt16 %s[UA_TYPES_INDEXSIZE] = {" % name)
+    for i in range(0, len(index), 16):
+        printc("    " + ", ".join([str(x) for x in index[i:i+16]]) + ",")
+    printc("};\n")
+
+if outname == "ua_types":
+    print_index("UA_TYPES_TYPEIDINDEX", typeid_index)
+    print_index("UA_TYPES_ENCODINGINDEX", encoding_index)
+
 ##################
 # Print Encoding #
 ##################